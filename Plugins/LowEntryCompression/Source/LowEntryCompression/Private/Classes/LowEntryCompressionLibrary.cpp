@@ -21,7 +21,48 @@ TArray<uint8> ULowEntryCompressionLibrary::CompressLzfThreadSafe(const TArray<ui
 	return ULowEntryCompressionLzfLibrary::Compress(Data, true);
 }
 
+TArray<uint8> ULowEntryCompressionLibrary::CompressLzfBlocks(const TArray<uint8>& Data, int32 BlockSize, FQueuedThreadPool* ThreadPool)
+{
+	return ULowEntryCompressionLzfLibrary::CompressBlocks(Data, BlockSize, ThreadPool);
+}
+
 TArray<uint8> ULowEntryCompressionLibrary::DecompressLzf(const TArray<uint8>& CompressedData)
 {
 	return ULowEntryCompressionLzfLibrary::Decompress(CompressedData);
 }
+
+int32 ULowEntryCompressionLibrary::GetDecompressedSizeLzf(const TArray<uint8>& CompressedData)
+{
+	return ULowEntryCompressionLzfLibrary::GetDecompressedSize(CompressedData.GetData(), CompressedData.Num());
+}
+
+bool ULowEntryCompressionLibrary::DecompressLzfInto(const TArray<uint8>& CompressedData, TArray<uint8>& Data, FQueuedThreadPool* ThreadPool)
+{
+	int32 Size = GetDecompressedSizeLzf(CompressedData);
+	if(Size < 0)
+	{
+		return false;
+	}
+	Data.SetNumUninitialized(Size, false);
+	return ULowEntryCompressionLzfLibrary::DecompressInto(CompressedData.GetData(), CompressedData.Num(), Data.GetData(), Size, ThreadPool);
+}
+
+bool ULowEntryCompressionLibrary::DecompressLzfInto(const TArray<uint8>& CompressedData, uint8* Data, int32 DataLength, FQueuedThreadPool* ThreadPool)
+{
+	return ULowEntryCompressionLzfLibrary::DecompressInto(CompressedData.GetData(), CompressedData.Num(), Data, DataLength, ThreadPool);
+}
+
+int32 ULowEntryCompressionLibrary::GetBlockCountLzf(const TArray<uint8>& CompressedData)
+{
+	return ULowEntryCompressionLzfLibrary::GetBlockCount(CompressedData.GetData(), CompressedData.Num());
+}
+
+bool ULowEntryCompressionLibrary::GetBlockRangeLzf(const TArray<uint8>& CompressedData, int32 BlockIndex, int32& DataOffset, int32& DataLength)
+{
+	return ULowEntryCompressionLzfLibrary::GetBlockRange(CompressedData.GetData(), CompressedData.Num(), BlockIndex, DataOffset, DataLength);
+}
+
+bool ULowEntryCompressionLibrary::DecompressLzfBlockInto(const TArray<uint8>& CompressedData, int32 BlockIndex, uint8* Data, int32 DataLength)
+{
+	return ULowEntryCompressionLzfLibrary::DecompressBlockInto(CompressedData.GetData(), CompressedData.Num(), BlockIndex, Data, DataLength);
+}
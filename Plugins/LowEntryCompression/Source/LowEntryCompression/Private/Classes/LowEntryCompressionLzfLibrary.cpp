@@ -1,10 +1,124 @@
 // Copyright Low Entry. All Rights Reserved.
 
 #include "LowEntryCompressionLzfLibrary.h"
-#include "LowEntryCompressionByteArrayBuffer.h"
+#include "Misc/QueuedThreadPool.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "HAL/ThreadSafeBool.h"
+#include "Templates/UniquePtr.h"
 
 
-int32* ULowEntryCompressionLzfLibrary::cachedHashTab = NULL;
+namespace
+{
+	/**
+	* Hash table of the compressor, one per thread and kept between calls.
+	* Entries store a position plus the base of the call that wrote them, so entries of earlier calls are misses and the table never has to be cleared.
+	*/
+	struct FLowEntryCompressionLzfHashTable
+	{
+		uint32* Entries = nullptr;
+		uint32 Base = 0;
+
+		~FLowEntryCompressionLzfHashTable()
+		{
+			delete[] Entries;
+		}
+	};
+
+	thread_local FLowEntryCompressionLzfHashTable LzfHashTable;
+
+
+	/**
+	* Runs Job for every index in [0, Count). Queued workers and the calling thread take indices until none are left.
+	* Workers that haven't started when the calling thread runs out of indices are taken back from the pool, so this can't deadlock when called from a thread of the same pool.
+	*/
+	class FLowEntryCompressionBlockJobs
+	{
+	private:
+		class FWorker : public IQueuedWork
+		{
+		public:
+			FWorker(FLowEntryCompressionBlockJobs& InJobs) : Jobs(InJobs)
+			{
+			}
+
+			virtual void DoThreadedWork() override
+			{
+				Jobs.RunJobs();
+				Jobs.FinishWorker();
+			}
+
+			virtual void Abandon() override
+			{
+				Jobs.FinishWorker();
+			}
+
+		private:
+			FLowEntryCompressionBlockJobs& Jobs;
+		};
+
+		TFunctionRef<void(int32)> Job;
+		int32 Count;
+		FThreadSafeCounter NextIndex;
+		FThreadSafeCounter RunningWorkers;
+		FEvent* WorkersDone = nullptr;
+
+		void RunJobs()
+		{
+			for(int32 Index = NextIndex.Increment() - 1; Index < Count; Index = NextIndex.Increment() - 1)
+			{
+				Job(Index);
+			}
+		}
+
+		void FinishWorker()
+		{
+			if(RunningWorkers.Decrement() == 0)
+			{
+				WorkersDone->Trigger();
+			}
+		}
+
+		FLowEntryCompressionBlockJobs(int32 InCount, TFunctionRef<void(int32)> InJob) : Job(InJob), Count(InCount)
+		{
+		}
+
+	public:
+		static void Run(int32 Count, FQueuedThreadPool* ThreadPool, TFunctionRef<void(int32)> Job)
+		{
+			int32 WorkerCount = (ThreadPool != nullptr) ? FMath::Min(Count - 1, ThreadPool->GetNumThreads()) : 0;
+			if(WorkerCount <= 0)
+			{
+				for(int32 Index = 0; Index < Count; Index++)
+				{
+					Job(Index);
+				}
+				return;
+			}
+
+			FLowEntryCompressionBlockJobs Jobs(Count, Job);
+			Jobs.WorkersDone = FPlatformProcess::GetSynchEventFromPool(false);
+			Jobs.RunningWorkers.Set(WorkerCount);
+			TArray<TUniquePtr<FWorker>> Workers;
+			Workers.Reserve(WorkerCount);
+			for(int32 i = 0; i < WorkerCount; i++)
+			{
+				Workers.Add(MakeUnique<FWorker>(Jobs));
+				ThreadPool->AddQueuedWork(Workers.Last().Get());
+			}
+
+			Jobs.RunJobs();
+			for(TUniquePtr<FWorker>& Worker : Workers)
+			{
+				if(ThreadPool->RetractQueuedWork(Worker.Get()))
+				{
+					Jobs.FinishWorker();
+				}
+			}
+			Jobs.WorkersDone->Wait();
+			FPlatformProcess::ReturnSynchEventToPool(Jobs.WorkersDone);
+		}
+	};
+}
 
 
 int32 ULowEntryCompressionLzfLibrary::UintByteCount(int32 Value)
@@ -12,24 +126,24 @@ int32 ULowEntryCompressionLzfLibrary::UintByteCount(int32 Value)
 	return ((Value <= 127) ? 1 : 4);
 }
 
-void ULowEntryCompressionLzfLibrary::UintToBytes(ULowEntryCompressionByteArrayBuffer& Array, int32 ArrayOffset, int32 Value)
+void ULowEntryCompressionLzfLibrary::UintToBytes(uint8* Array, int32 Value)
 {
 	if(Value <= 127)
 	{
-		Array.set(ArrayOffset, (uint8) (Value));
+		Array[0] = (uint8) (Value);
 	}
 	else
 	{
-		Array.set(ArrayOffset, (uint8) ((Value >> 24) | (1 << 7)));
-		Array.set(ArrayOffset + 1, (uint8) (Value >> 16));
-		Array.set(ArrayOffset + 2, (uint8) (Value >> 8));
-		Array.set(ArrayOffset + 3, (uint8) (Value));
+		Array[0] = (uint8) ((Value >> 24) | (1 << 7));
+		Array[1] = (uint8) (Value >> 16);
+		Array[2] = (uint8) (Value >> 8);
+		Array[3] = (uint8) (Value);
 	}
 }
 
-int32 ULowEntryCompressionLzfLibrary::BytesToUint(const TArray<uint8>& Array, int32 ArrayOffset)
+int32 ULowEntryCompressionLzfLibrary::BytesToUint(const uint8* Array, int32 ArrayLength, int32 ArrayOffset)
 {
-	if((Array.Num() - 1) < ArrayOffset)
+	if((ArrayLength - 1) < ArrayOffset)
 	{
 		return -1;
 	}
@@ -38,7 +152,7 @@ int32 ULowEntryCompressionLzfLibrary::BytesToUint(const TArray<uint8>& Array, in
 	{
 		return B;
 	}
-	if((Array.Num() - 4) < ArrayOffset)
+	if((ArrayLength - 4) < ArrayOffset)
 	{
 		return -1;
 	}
@@ -53,211 +167,466 @@ int32 ULowEntryCompressionLzfLibrary::BytesToUint(const TArray<uint8>& Array, in
 
 TArray<uint8> ULowEntryCompressionLzfLibrary::Compress(const TArray<uint8>& Bytes, const bool ThreadSafe)
 {
-	int64 inLen = Bytes.Num();
+	return CompressBytes(Bytes.GetData(), Bytes.Num());
+}
+
+TArray<uint8> ULowEntryCompressionLzfLibrary::CompressBytes(const uint8* Bytes, int64 BytesLength)
+{
+	const int64 inLen = BytesLength;
 	if((inLen < SKIP_LENGTH) || (inLen > 0x7fffffff))
 	{
 		TArray<uint8> Result;
 		Result.Reserve(inLen + 1);
 		Result.Add(0);
-		Result.Append(Bytes);
+		Result.Append(Bytes, inLen);
 		return Result;
 	}
 
-	ULowEntryCompressionByteArrayBuffer out(inLen + 20, 512);
-	out.set(0, 1);
-	UintToBytes(out, 1, inLen);
-	int64 outPos = 2 + UintByteCount(inLen);
-	int64 inPos = 0;
-	int32 literals = 0;
-	int32 future = (Bytes[0] << 8) | (Bytes[1] & 255);
-
-	int32 hashSize = 0;
-	int32* hashTab = NULL;
-	if(ThreadSafe)
+	FLowEntryCompressionLzfHashTable& table = LzfHashTable;
+	if(table.Entries == nullptr)
 	{
-		hashSize = NONCACHED_HASH_SIZE;
-		hashTab = new int32[hashSize];
+		table.Entries = new uint32[HASH_SIZE];
+		table.Base = 0;
 	}
-	else
+	if((table.Base == 0) || ((uint64) table.Base + inLen + 1 > MAX_uint32))
+	{
+		FMemory::Memzero(table.Entries, HASH_SIZE * sizeof(uint32));
+		table.Base = 1;
+	}
+	uint32* hashTab = table.Entries;
+	const uint32 base = table.Base;
+	table.Base += (uint32) (inLen + 1);
+
+	// worst case: every byte a literal, one control byte per MAX_LITERAL bytes, plus the header
+	TArray<uint8> Result;
+	Result.SetNumUninitialized(1 + 4 + inLen + (inLen / MAX_LITERAL) + 1);
+	const uint8* in = Bytes;
+	uint8* out = Result.GetData();
+
+	out[0] = 1;
+	UintToBytes(out + 1, inLen);
+	uint8* op = out + 1 + UintByteCount(inLen);
+	int64 literalStart = 0;
+	int64 inPos = 0;
+
+	auto writeLiterals = [&](int64 literalEnd)
 	{
-		hashSize = CACHED_HASH_SIZE;
-		if(cachedHashTab == nullptr)
+		while(literalStart < literalEnd)
 		{
-			cachedHashTab = new int32[hashSize];
+			int32 literals = (int32) FMath::Min<int64>(literalEnd - literalStart, MAX_LITERAL);
+			*op++ = (uint8) (literals - 1);
+			FMemory::Memcpy(op, in + literalStart, literals);
+			op += literals;
+			literalStart += literals;
 		}
-		hashTab = cachedHashTab;
-	}
+	};
+	auto hashAt = [&](int64 pos) -> uint32
+	{
+		uint32 future = ((uint32) in[pos] << 16) | ((uint32) in[pos + 1] << 8) | in[pos + 2];
+		return (future * 2654435761u) >> 16;
+	};
+
 	while(inPos < (inLen - 4))
 	{
-		uint8 p2 = Bytes[inPos + 2];
-		future = (future << 8) + (p2 & 255);
-		int32 off = ((future * 2777) >> 9) & (hashSize - 1);
-		int32 ref = hashTab[off];
-		hashTab[off] = inPos;
-		if((ref < inPos) && (ref > 0) && ((off = inPos - ref - 1) < MAX_OFF) && (Bytes[ref + 2] == p2) && (Bytes[ref + 1] == (uint8) (future >> 8)) && (Bytes[ref] == (uint8) (future >> 16)))
+		uint32 hash = hashAt(inPos);
+		uint32 entry = hashTab[hash];
+		hashTab[hash] = base + (uint32) inPos;
+		if(entry < base)
 		{
-			int32 maxLen = inLen - inPos - 2;
-			if(maxLen > MAX_REF)
-			{
-				maxLen = MAX_REF;
-			}
-			if(literals == 0)
-			{
-				outPos--;
-			}
-			else
-			{
-				out.set(outPos - literals - 1, (uint8) (literals - 1));
-				literals = 0;
-			}
-			int32 len = 3;
-			while((len < maxLen) && (Bytes[ref + len] == Bytes[inPos + len]))
-			{
-				len++;
-			}
-			len -= 2;
-			if(len < 7)
-			{
-				out.set(outPos++, (uint8) ((off >> 8) + (len << 5)));
-			}
-			else
-			{
-				out.set(outPos++, (uint8) ((off >> 8) + (7 << 5)));
-				out.set(outPos++, (uint8) (len - 7));
-			}
-			out.set(outPos++, (uint8) off);
-			outPos++;
-			inPos += len;
-			future = (Bytes[inPos] << 8) | (Bytes[inPos + 1] & 255);
-			future = (future << 8) | (Bytes[inPos + 2] & 255);
-			hashTab[((future * 2777) >> 9) & (hashSize - 1)] = inPos++;
-			future = (future << 8) | (Bytes[inPos + 2] & 255);
-			hashTab[((future * 2777) >> 9) & (hashSize - 1)] = inPos++;
+			inPos++;
+			continue;
+		}
+		int64 ref = entry - base;
+		int64 off = inPos - ref - 1;
+		if((off >= MAX_OFF) || (in[ref] != in[inPos]) || (in[ref + 1] != in[inPos + 1]) || (in[ref + 2] != in[inPos + 2]))
+		{
+			inPos++;
+			continue;
+		}
+
+		int64 maxLen = FMath::Min<int64>(inLen - inPos - 2, MAX_REF);
+		int64 len = 3;
+		while((len < maxLen) && (in[ref + len] == in[inPos + len]))
+		{
+			len++;
+		}
+
+		writeLiterals(inPos);
+		len -= 2;
+		if(len < 7)
+		{
+			*op++ = (uint8) ((off >> 8) + (len << 5));
 		}
 		else
 		{
-			out.set(outPos++, Bytes[inPos++]);
-			literals++;
-			if(literals == MAX_LITERAL)
-			{
-				out.set(outPos - literals - 1, (uint8) (literals - 1));
-				literals = 0;
-				outPos++;
-			}
+			*op++ = (uint8) ((off >> 8) + (7 << 5));
+			*op++ = (uint8) (len - 7);
 		}
+		*op++ = (uint8) off;
+
+		// the last two positions of the match are hashed as well, the ones before are skipped
+		inPos += len;
+		hashTab[hashAt(inPos)] = base + (uint32) inPos;
+		inPos++;
+		hashTab[hashAt(inPos)] = base + (uint32) inPos;
+		inPos++;
+		literalStart = inPos;
 	}
-	if(ThreadSafe)
+	writeLiterals(inLen);
+
+	const int64 outPos = op - out;
+	if(outPos >= inLen)
 	{
-		delete hashTab;
+		out[0] = 0;
+		FMemory::Memcpy(out + 1, in, inLen);
+		Result.SetNum(inLen + 1, false);
+		return Result;
 	}
+	Result.SetNum(outPos, false);
+	return Result;
+}
 
-	while(inPos < inLen)
+
+TArray<uint8> ULowEntryCompressionLzfLibrary::CompressBlocks(const TArray<uint8>& Bytes, int32 BlockSize, FQueuedThreadPool* ThreadPool)
+{
+	BlockSize = FMath::Max(BlockSize, MIN_BLOCK_SIZE);
+	const int32 Length = Bytes.Num();
+	if(Length <= BlockSize)
 	{
-		out.set(outPos++, Bytes[inPos++]);
-		literals++;
-		if(literals == MAX_LITERAL)
-		{
-			out.set(outPos - literals - 1, (uint8) (literals - 1));
-			literals = 0;
-			outPos++;
-		}
+		return CompressBytes(Bytes.GetData(), Length);
+	}
+
+	const int32 BlockCount = (int32) (((int64) Length + BlockSize - 1) / BlockSize);
+	TArray<TArray<uint8>> Blocks;
+	Blocks.SetNum(BlockCount);
+	FLowEntryCompressionBlockJobs::Run(BlockCount, (ThreadPool != nullptr) ? ThreadPool : GThreadPool, [&](int32 BlockIndex)
+	{
+		int32 BlockOffset = BlockIndex * BlockSize;
+		Blocks[BlockIndex] = CompressBytes(Bytes.GetData() + BlockOffset, FMath::Min(BlockSize, Length - BlockOffset));
+	});
+
+	const int64 HeaderLength = 1 + UintByteCount(Length) + UintByteCount(BlockSize) + ((int64) BlockCount * 4);
+	int64 DataLength = 0;
+	for(const TArray<uint8>& Block : Blocks)
+	{
+		DataLength += Block.Num();
 	}
-	out.set(outPos - literals - 1, (uint8) (literals - 1));
-	if(literals == 0)
+	if((HeaderLength + DataLength) > 0x7fffffff)
 	{
-		outPos--;
+		return CompressBytes(Bytes.GetData(), Length);
 	}
 
-	if(outPos >= inLen)
+	TArray<uint8> Result;
+	Result.SetNumUninitialized(HeaderLength + DataLength);
+	uint8* out = Result.GetData();
+	*out++ = 2;
+	UintToBytes(out, Length);
+	out += UintByteCount(Length);
+	UintToBytes(out, BlockSize);
+	out += UintByteCount(BlockSize);
+
+	uint32 BlockEnd = 0;
+	for(const TArray<uint8>& Block : Blocks)
 	{
-		TArray<uint8> Result;
-		Result.Reserve(inLen + 1);
-		Result.Add(0);
-		Result.Append(Bytes);
-		return Result;
+		BlockEnd += Block.Num();
+		*out++ = (uint8) (BlockEnd >> 24);
+		*out++ = (uint8) (BlockEnd >> 16);
+		*out++ = (uint8) (BlockEnd >> 8);
+		*out++ = (uint8) (BlockEnd);
 	}
-	return out.getData(outPos);
+	for(const TArray<uint8>& Block : Blocks)
+	{
+		FMemory::Memcpy(out, Block.GetData(), Block.Num());
+		out += Block.Num();
+	}
+	return Result;
 }
 
 
 TArray<uint8> ULowEntryCompressionLzfLibrary::Decompress(const TArray<uint8>& Bytes)
 {
-	int64 inLen = Bytes.Num();
-	if(inLen < 2) // bool (1 byte), (optional: size (minimum of 1 byte)), data (minimum of 1 byte)
+	int32 outLen = GetDecompressedSize(Bytes.GetData(), Bytes.Num());
+	if(outLen <= 0)
 	{
 		return TArray<uint8>();
 	}
+	TArray<uint8> Result;
+	Result.SetNumUninitialized(outLen);
+	if(!DecompressInto(Bytes.GetData(), Bytes.Num(), Result.GetData(), outLen))
+	{
+		return TArray<uint8>();
+	}
+	return Result;
+}
+
+int32 ULowEntryCompressionLzfLibrary::GetDecompressedSize(const uint8* Bytes, int32 BytesLength)
+{
+	if(BytesLength < 1)
+	{
+		return -1;
+	}
 	if(Bytes[0] == 0)
 	{
-		TArray<uint8> Result;
-		Result.Reserve(inLen - 1);
-		Result.Append((Bytes.GetData() + 1), (inLen - 1));
-		return Result;
+		return BytesLength - 1;
+	}
+	if(Bytes[0] == 2)
+	{
+		FBlockHeader Header;
+		if(!ReadBlockHeader(Bytes, BytesLength, Header))
+		{
+			return -1;
+		}
+		return Header.Length;
 	}
 	if(Bytes[0] != 1)
 	{
-		return TArray<uint8>();
+		return -1;
 	}
-
-	int64 outLen = BytesToUint(Bytes, 1);
+	int32 outLen = BytesToUint(Bytes, BytesLength, 1);
 	if(outLen <= 0)
 	{
-		return TArray<uint8>();
+		return -1;
+	}
+	return outLen;
+}
+
+bool ULowEntryCompressionLzfLibrary::DecompressInto(const uint8* Bytes, int32 BytesLength, uint8* Output, int32 OutputLength, FQueuedThreadPool* ThreadPool)
+{
+	if((BytesLength < 1) || (Bytes[0] != 2))
+	{
+		return DecompressSingleBlockInto(Bytes, BytesLength, Output, OutputLength);
+	}
+
+	FBlockHeader Header;
+	if(!ReadBlockHeader(Bytes, BytesLength, Header) || (Header.Length != OutputLength))
+	{
+		return false;
+	}
+	FThreadSafeBool Failed = false;
+	FLowEntryCompressionBlockJobs::Run(Header.BlockCount, ThreadPool, [&](int32 BlockIndex)
+	{
+		const uint8* BlockBytes = nullptr;
+		int32 BlockBytesLength = 0;
+		int32 BlockOffset = BlockIndex * Header.BlockSize;
+		int32 BlockLength = FMath::Min(Header.BlockSize, Header.Length - BlockOffset);
+		if(Failed || !GetBlockData(Header, BlockIndex, BlockBytes, BlockBytesLength) || !DecompressSingleBlockInto(BlockBytes, BlockBytesLength, Output + BlockOffset, BlockLength))
+		{
+			Failed = true;
+		}
+	});
+	return !Failed;
+}
+
+int32 ULowEntryCompressionLzfLibrary::GetBlockCount(const uint8* Bytes, int32 BytesLength)
+{
+	if((BytesLength >= 1) && (Bytes[0] == 2))
+	{
+		FBlockHeader Header;
+		if(!ReadBlockHeader(Bytes, BytesLength, Header))
+		{
+			return -1;
+		}
+		return Header.BlockCount;
 	}
-	int64 inPos = 1 + UintByteCount(outLen);
-	ULowEntryCompressionByteArrayBuffer out(outLen, 512);
-	int64 outPos = 0;
+	return (GetDecompressedSize(Bytes, BytesLength) >= 0) ? 1 : -1;
+}
 
-	do
+bool ULowEntryCompressionLzfLibrary::GetBlockRange(const uint8* Bytes, int32 BytesLength, int32 BlockIndex, int32& OutputOffset, int32& OutputLength)
+{
+	if((BytesLength >= 1) && (Bytes[0] == 2))
 	{
-		if(inPos >= inLen)
+		FBlockHeader Header;
+		if(!ReadBlockHeader(Bytes, BytesLength, Header) || (BlockIndex < 0) || (BlockIndex >= Header.BlockCount))
 		{
-			return TArray<uint8>();
+			return false;
 		}
-		int32 ctrl = Bytes[inPos++] & 255;
+		OutputOffset = BlockIndex * Header.BlockSize;
+		OutputLength = FMath::Min(Header.BlockSize, Header.Length - OutputOffset);
+		return true;
+	}
+	int32 Length = GetDecompressedSize(Bytes, BytesLength);
+	if((Length < 0) || (BlockIndex != 0))
+	{
+		return false;
+	}
+	OutputOffset = 0;
+	OutputLength = Length;
+	return true;
+}
+
+bool ULowEntryCompressionLzfLibrary::DecompressBlockInto(const uint8* Bytes, int32 BytesLength, int32 BlockIndex, uint8* Output, int32 OutputLength)
+{
+	if((BytesLength < 1) || (Bytes[0] != 2))
+	{
+		return (BlockIndex == 0) && DecompressSingleBlockInto(Bytes, BytesLength, Output, OutputLength);
+	}
+
+	FBlockHeader Header;
+	if(!ReadBlockHeader(Bytes, BytesLength, Header) || (BlockIndex < 0) || (BlockIndex >= Header.BlockCount))
+	{
+		return false;
+	}
+	const uint8* BlockBytes = nullptr;
+	int32 BlockBytesLength = 0;
+	int32 BlockLength = FMath::Min(Header.BlockSize, Header.Length - (BlockIndex * Header.BlockSize));
+	if((BlockLength != OutputLength) || !GetBlockData(Header, BlockIndex, BlockBytes, BlockBytesLength))
+	{
+		return false;
+	}
+	return DecompressSingleBlockInto(BlockBytes, BlockBytesLength, Output, OutputLength);
+}
+
+bool ULowEntryCompressionLzfLibrary::ReadBlockHeader(const uint8* Bytes, int32 BytesLength, FBlockHeader& Header)
+{
+	if((BytesLength < 1) || (Bytes[0] != 2))
+	{
+		return false;
+	}
+	Header.Length = BytesToUint(Bytes, BytesLength, 1);
+	if(Header.Length <= 0)
+	{
+		return false;
+	}
+	int32 Pos = 1 + UintByteCount(Header.Length);
+	Header.BlockSize = BytesToUint(Bytes, BytesLength, Pos);
+	if(Header.BlockSize <= 0)
+	{
+		return false;
+	}
+	Pos += UintByteCount(Header.BlockSize);
+	Header.BlockCount = (int32) (((int64) Header.Length + Header.BlockSize - 1) / Header.BlockSize);
+	if(((int64) BytesLength - Pos) < ((int64) Header.BlockCount * 4))
+	{
+		return false;
+	}
+	Header.Index = Bytes + Pos;
+	Header.Data = Header.Index + (Header.BlockCount * 4);
+	Header.DataLength = BytesLength - Pos - (Header.BlockCount * 4);
+
+	// the last block has to end exactly where the data ends
+	const uint8* LastEnd = Header.Index + ((Header.BlockCount - 1) * 4);
+	int64 DataEnd = ((int64) LastEnd[0] << 24) | (LastEnd[1] << 16) | (LastEnd[2] << 8) | LastEnd[3];
+	return (DataEnd == Header.DataLength);
+}
+
+bool ULowEntryCompressionLzfLibrary::GetBlockData(const FBlockHeader& Header, int32 BlockIndex, const uint8*& BlockBytes, int32& BlockBytesLength)
+{
+	auto ReadEnd = [&](int32 Index) -> int64
+	{
+		const uint8* End = Header.Index + (Index * 4);
+		return ((int64) End[0] << 24) | (End[1] << 16) | (End[2] << 8) | End[3];
+	};
+	int64 Start = (BlockIndex > 0) ? ReadEnd(BlockIndex - 1) : 0;
+	int64 End = ReadEnd(BlockIndex);
+	if((Start > End) || (End > Header.DataLength))
+	{
+		return false;
+	}
+	BlockBytes = Header.Data + Start;
+	BlockBytesLength = (int32) (End - Start);
+	return true;
+}
+
+bool ULowEntryCompressionLzfLibrary::DecompressSingleBlockInto(const uint8* Bytes, int32 BytesLength, uint8* Output, int32 OutputLength)
+{
+	if((BytesLength < 1) || (Bytes[0] > 1) || (OutputLength < 0) || (GetDecompressedSize(Bytes, BytesLength) != OutputLength))
+	{
+		return false;
+	}
+	if(Bytes[0] == 0)
+	{
+		FMemory::Memcpy(Output, Bytes + 1, OutputLength);
+		return true;
+	}
+
+	const uint8* ip = Bytes + 1 + UintByteCount(OutputLength);
+	const uint8* const inEnd = Bytes + BytesLength;
+	uint8* op = Output;
+	uint8* const outEnd = Output + OutputLength;
+
+	while(op < outEnd)
+	{
+		if(ip >= inEnd)
+		{
+			return false;
+		}
+		int32 ctrl = *ip++;
 		if(ctrl < MAX_LITERAL)
 		{
-			ctrl++;
-			if((inLen - inPos) < ctrl)
+			int32 len = ctrl + 1;
+			if(((inEnd - ip) < len) || ((outEnd - op) < len))
 			{
-				return TArray<uint8>();
+				return false;
 			}
-			out.set(outPos, Bytes, inPos, ctrl);
-			outPos += ctrl;
-			inPos += ctrl;
+			if(((inEnd - ip) >= MAX_LITERAL) && ((outEnd - op) >= MAX_LITERAL))
+			{
+				// a run is never longer than 32 bytes, so two fixed 16 byte copies cover it. the bytes past the run are overwritten later
+				FMemory::Memcpy(op, ip, 16);
+				FMemory::Memcpy(op + 16, ip + 16, 16);
+			}
+			else
+			{
+				FMemory::Memcpy(op, ip, len);
+			}
+			op += len;
+			ip += len;
+			continue;
 		}
-		else
+
+		int32 len = ctrl >> 5;
+		if(len == 7)
 		{
-			int32 len = ctrl >> 5;
-			if(len == 7)
+			if(ip >= inEnd)
 			{
-				if(inPos >= inLen)
-				{
-					return TArray<uint8>();
-				}
-				len += Bytes[inPos++] & 255;
+				return false;
 			}
-			len += 2;
-			ctrl = -((ctrl & 0x1f) << 8) - 1;
-			if(inPos >= inLen)
+			len += *ip++;
+		}
+		len += 2;
+		if(ip >= inEnd)
+		{
+			return false;
+		}
+		int32 off = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+		if(((op - Output) < off) || ((outEnd - op) < len))
+		{
+			return false;
+		}
+
+		const uint8* ref = op - off;
+		if(off == 1)
+		{
+			FMemory::Memset(op, *ref, len);
+			op += len;
+			continue;
+		}
+		// short offsets overlap the bytes being written. every copy doubles the distance until 8 byte copies are safe
+		while((len > 0) && ((op - ref) < 8))
+		{
+			int32 chunk = FMath::Min<int32>(op - ref, len);
+			FMemory::Memcpy(op, ref, chunk);
+			op += chunk;
+			len -= chunk;
+		}
+		if((outEnd - op) >= (len + 8))
+		{
+			while(len > 0)
 			{
-				return TArray<uint8>();
+				FMemory::Memcpy(op, ref, 8);
+				op += 8;
+				ref += 8;
+				len -= 8;
 			}
-			ctrl -= Bytes[inPos++] & 255;
-			ctrl += outPos;
-			for(int32 i = 0; i < len; i++)
+			op += len;
+		}
+		else
+		{
+			while(len > 0)
 			{
-				if((outPos < 0) || (outPos >= outLen))
-				{
-					return TArray<uint8>();
-				}
-				if((ctrl < 0) || (ctrl >= outLen))
-				{
-					return TArray<uint8>();
-				}
-				out.set(outPos++, out.get(ctrl++));
+				*op++ = *ref++;
+				len--;
 			}
 		}
-	} while(outPos < outLen);
-	return out.getData();
+	}
+	return (ip == inEnd);
 }
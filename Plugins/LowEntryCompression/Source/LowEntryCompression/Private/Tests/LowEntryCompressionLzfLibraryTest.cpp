@@ -0,0 +1,274 @@
+// Copyright Low Entry. All Rights Reserved.
+
+#include "LowEntryCompressionLzfLibrary.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/QueuedThreadPool.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	/**
+	* Kind 0 is random bytes, 1 is long runs, 2 is a small alphabet that repeats earlier parts, some of them further back than the compressor looks.
+	*/
+	TArray<uint8> MakeLzfTestData(FRandomStream& Random, int32 Kind, int32 Length)
+	{
+		TArray<uint8> Data;
+		Data.SetNumUninitialized(Length);
+		int32 Pos = 0;
+		while(Pos < Length)
+		{
+			if(Kind == 0)
+			{
+				Data[Pos++] = (uint8) Random.RandRange(0, 255);
+			}
+			else if(Kind == 1)
+			{
+				uint8 Value = (uint8) Random.RandRange(0, 255);
+				int32 Run = FMath::Min(Random.RandRange(1, 600), Length - Pos);
+				FMemory::Memset(Data.GetData() + Pos, Value, Run);
+				Pos += Run;
+			}
+			else if((Pos > 0) && (Random.RandRange(0, 2) == 0))
+			{
+				int32 From = FMath::Max(0, Pos - Random.RandRange(1, 10000));
+				int32 Copy = FMath::Min3(Random.RandRange(3, 300), Pos - From, Length - Pos);
+				FMemory::Memcpy(Data.GetData() + Pos, Data.GetData() + From, Copy);
+				Pos += Copy;
+			}
+			else
+			{
+				Data[Pos++] = (uint8) ('a' + Random.RandRange(0, 7));
+			}
+		}
+		return Data;
+	}
+
+	TArray<int32> GetLzfTestLengths(FRandomStream& Random)
+	{
+		TArray<int32> Lengths = {0, 1, 2, 3, 4, 5, 14, 15, 16, 31, 32, 33, 127, 128, 129, 4095, 4096, 4097, 8192, 8193, 65536, 200000};
+		for(int32 i = 0; i < 40; i++)
+		{
+			Lengths.Add(Random.RandRange(0, 100000));
+		}
+		return Lengths;
+	}
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLowEntryCompressionLzfRoundTripTest, "LowEntryCompression.Lzf.RoundTrip",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLowEntryCompressionLzfRoundTripTest::RunTest(const FString& Parameters)
+{
+	FRandomStream Random(48);
+	for(int32 Length : GetLzfTestLengths(Random))
+	{
+		for(int32 Kind = 0; Kind < 3; Kind++)
+		{
+			const TArray<uint8> Data = MakeLzfTestData(Random, Kind, Length);
+			const FString What = FString::Printf(TEXT("Length %i kind %i"), Length, Kind);
+
+			const TArray<uint8> Compressed = ULowEntryCompressionLzfLibrary::Compress(Data);
+			if(!TestEqual(What + TEXT(" decompressed size"), ULowEntryCompressionLzfLibrary::GetDecompressedSize(Compressed.GetData(), Compressed.Num()), Length))
+			{
+				return false;
+			}
+			if(!TestTrue(What + TEXT(" round trip"), ULowEntryCompressionLzfLibrary::Decompress(Compressed) == Data))
+			{
+				return false;
+			}
+
+			// the hash table is kept between calls, earlier calls must not change the result
+			ULowEntryCompressionLzfLibrary::Compress(MakeLzfTestData(Random, 2, 5000));
+			TestTrue(What + TEXT(" same result after another call"), ULowEntryCompressionLzfLibrary::Compress(Data) == Compressed);
+
+			for(int32 BlockSize : {4096, 10000})
+			{
+				const TArray<uint8> Blocks = ULowEntryCompressionLzfLibrary::CompressBlocks(Data, BlockSize);
+				TArray<uint8> Output;
+				Output.SetNumUninitialized(Length);
+				if(!TestTrue(What + FString::Printf(TEXT(" blocks of %i"), BlockSize), ULowEntryCompressionLzfLibrary::DecompressInto(Blocks.GetData(), Blocks.Num(), Output.GetData(), Length, GThreadPool) && (Output == Data)))
+				{
+					return false;
+				}
+				TestTrue(What + FString::Printf(TEXT(" blocks of %i through Decompress"), BlockSize), ULowEntryCompressionLzfLibrary::Decompress(Blocks) == Data);
+			}
+		}
+	}
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLowEntryCompressionLzfCorruptInputTest, "LowEntryCompression.Lzf.CorruptInput",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLowEntryCompressionLzfCorruptInputTest::RunTest(const FString& Parameters)
+{
+	TestEqual(TEXT("Empty input has no size"), ULowEntryCompressionLzfLibrary::GetDecompressedSize(nullptr, 0), -1);
+	TestTrue(TEXT("Empty input decompresses to nothing"), ULowEntryCompressionLzfLibrary::Decompress(TArray<uint8>()).Num() == 0);
+	TestFalse(TEXT("Empty input doesn't decompress"), ULowEntryCompressionLzfLibrary::DecompressInto(nullptr, 0, nullptr, 0));
+	const uint8 UnknownFormat[] = {3, 1, 2, 3};
+	TestEqual(TEXT("Unknown format has no size"), ULowEntryCompressionLzfLibrary::GetDecompressedSize(UnknownFormat, 4), -1);
+
+	FRandomStream Random(49);
+	for(int32 Length : {1, 15, 100, 4096, 9000, 30000})
+	{
+		for(int32 Kind = 0; Kind < 3; Kind++)
+		{
+			const TArray<uint8> Data = MakeLzfTestData(Random, Kind, Length);
+			for(const TArray<uint8>& Compressed : {ULowEntryCompressionLzfLibrary::Compress(Data), ULowEntryCompressionLzfLibrary::CompressBlocks(Data, 4096)})
+			{
+				const FString What = FString::Printf(TEXT("Length %i kind %i format %i"), Length, Kind, Compressed[0]);
+				TArray<uint8> Output;
+				Output.SetNumUninitialized(Length + 1);
+
+				TestFalse(What + TEXT(" into a longer output"), ULowEntryCompressionLzfLibrary::DecompressInto(Compressed.GetData(), Compressed.Num(), Output.GetData(), Length + 1));
+				TestFalse(What + TEXT(" into a shorter output"), ULowEntryCompressionLzfLibrary::DecompressInto(Compressed.GetData(), Compressed.Num(), Output.GetData(), Length - 1));
+
+				// every prefix has to be rejected, the stored format included since its size then no longer matches
+				for(int32 Prefix = 0; Prefix < Compressed.Num(); Prefix += ((Compressed.Num() - Prefix) > 64) ? Random.RandRange(1, 97) : 1)
+				{
+					if(!TestFalse(What + FString::Printf(TEXT(" truncated to %i"), Prefix), ULowEntryCompressionLzfLibrary::DecompressInto(Compressed.GetData(), Prefix, Output.GetData(), Length)))
+					{
+						return false;
+					}
+					TestTrue(What + FString::Printf(TEXT(" truncated to %i through Decompress"), Prefix), ULowEntryCompressionLzfLibrary::Decompress(TArray<uint8>(Compressed.GetData(), Prefix)) != Data);
+				}
+
+				// flipped bits may still decompress, but only into a buffer of the size the data claims
+				for(int32 Round = 0; Round < 200; Round++)
+				{
+					TArray<uint8> Corrupt = Compressed;
+					for(int32 Flips = Random.RandRange(1, 3); Flips > 0; Flips--)
+					{
+						Corrupt[Random.RandRange(0, Corrupt.Num() - 1)] ^= (uint8) (1 << Random.RandRange(0, 7));
+					}
+					const int32 CorruptLength = ULowEntryCompressionLzfLibrary::GetDecompressedSize(Corrupt.GetData(), Corrupt.Num());
+					if((CorruptLength < 0) || (CorruptLength > (Length * 4 + 1024)))
+					{
+						continue;
+					}
+					TArray<uint8> CorruptOutput;
+					CorruptOutput.SetNumUninitialized(CorruptLength);
+					ULowEntryCompressionLzfLibrary::DecompressInto(Corrupt.GetData(), Corrupt.Num(), CorruptOutput.GetData(), CorruptLength, GThreadPool);
+					const int32 Decompressed = ULowEntryCompressionLzfLibrary::Decompress(Corrupt).Num();
+					TestTrue(What + TEXT(" corrupt data decompresses to its size or nothing"), (Decompressed == CorruptLength) || (Decompressed == 0));
+				}
+			}
+		}
+	}
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLowEntryCompressionLzfBlockIndexTest, "LowEntryCompression.Lzf.BlockIndex",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLowEntryCompressionLzfBlockIndexTest::RunTest(const FString& Parameters)
+{
+	FRandomStream Random(50);
+	for(int32 Length : {100, 4096, 4097, 8192, 10000, 100000})
+	{
+		for(int32 BlockSize : {1000, 4096, 5000})
+		{
+			const TArray<uint8> Data = MakeLzfTestData(Random, 2, Length);
+			const TArray<uint8> Compressed = ULowEntryCompressionLzfLibrary::CompressBlocks(Data, BlockSize);
+			const FString What = FString::Printf(TEXT("Length %i block size %i"), Length, BlockSize);
+
+			// block sizes below 4096 are raised to it, input that fits in one block keeps the single-block format
+			const int32 EffectiveBlockSize = FMath::Max(BlockSize, 4096);
+			const int32 ExpectedCount = (Length <= EffectiveBlockSize) ? 1 : ((Length + EffectiveBlockSize - 1) / EffectiveBlockSize);
+			const int32 BlockCount = ULowEntryCompressionLzfLibrary::GetBlockCount(Compressed.GetData(), Compressed.Num());
+			if(!TestEqual(What + TEXT(" block count"), BlockCount, ExpectedCount))
+			{
+				return false;
+			}
+
+			int32 Offset = 0;
+			int32 Size = 0;
+			TArray<uint8> Output;
+			for(int32 BlockIndex = 0; BlockIndex < BlockCount; BlockIndex++)
+			{
+				const FString BlockWhat = What + FString::Printf(TEXT(" block %i"), BlockIndex);
+				const int32 ExpectedOffset = Offset + Size;
+				if(!TestTrue(BlockWhat + TEXT(" range"), ULowEntryCompressionLzfLibrary::GetBlockRange(Compressed.GetData(), Compressed.Num(), BlockIndex, Offset, Size)) || !TestEqual(BlockWhat + TEXT(" offset"), Offset, ExpectedOffset))
+				{
+					return false;
+				}
+				Output.SetNumUninitialized(Size + 1);
+				TestTrue(BlockWhat + TEXT(" decompresses"), ULowEntryCompressionLzfLibrary::DecompressBlockInto(Compressed.GetData(), Compressed.Num(), BlockIndex, Output.GetData(), Size) && (FMemory::Memcmp(Output.GetData(), Data.GetData() + Offset, Size) == 0));
+				TestFalse(BlockWhat + TEXT(" into a longer output"), ULowEntryCompressionLzfLibrary::DecompressBlockInto(Compressed.GetData(), Compressed.Num(), BlockIndex, Output.GetData(), Size + 1));
+			}
+			TestEqual(What + TEXT(" blocks cover the data"), Offset + Size, Length);
+
+			Output.SetNumUninitialized(Length);
+			for(int32 BlockIndex : {-1, BlockCount, BlockCount + 1})
+			{
+				TestFalse(What + FString::Printf(TEXT(" range of block %i"), BlockIndex), ULowEntryCompressionLzfLibrary::GetBlockRange(Compressed.GetData(), Compressed.Num(), BlockIndex, Offset, Size));
+				TestFalse(What + FString::Printf(TEXT(" block %i"), BlockIndex), ULowEntryCompressionLzfLibrary::DecompressBlockInto(Compressed.GetData(), Compressed.Num(), BlockIndex, Output.GetData(), 0));
+			}
+			if(BlockCount < 2)
+			{
+				continue;
+			}
+
+			// framed data starts with 2, the size and the block size (4 bytes each for these sizes), then one 4 byte end offset per block
+			const int32 IndexStart = 1 + 4 + 4;
+			auto ReadEnd = [](const TArray<uint8>& Bytes, int32 Position) -> int32
+			{
+				return (Bytes[Position] << 24) | (Bytes[Position + 1] << 16) | (Bytes[Position + 2] << 8) | Bytes[Position + 3];
+			};
+			auto WriteEnd = [](TArray<uint8>& Bytes, int32 Position, int32 End)
+			{
+				Bytes[Position] = (uint8) (End >> 24);
+				Bytes[Position + 1] = (uint8) (End >> 16);
+				Bytes[Position + 2] = (uint8) (End >> 8);
+				Bytes[Position + 3] = (uint8) (End);
+			};
+
+			// the last end has to match the data exactly
+			const int32 LastEnd = IndexStart + ((BlockCount - 1) * 4);
+			for(int32 Delta : {-1, 1, 1 << 24})
+			{
+				TArray<uint8> Corrupt = Compressed;
+				WriteEnd(Corrupt, LastEnd, ReadEnd(Corrupt, LastEnd) + Delta);
+				TestEqual(What + FString::Printf(TEXT(" last end moved by %i"), Delta), ULowEntryCompressionLzfLibrary::GetBlockCount(Corrupt.GetData(), Corrupt.Num()), -1);
+				TestEqual(What + FString::Printf(TEXT(" size with last end moved by %i"), Delta), ULowEntryCompressionLzfLibrary::GetDecompressedSize(Corrupt.GetData(), Corrupt.Num()), -1);
+			}
+
+			// an index that doesn't fit in the data
+			{
+				TArray<uint8> Corrupt = Compressed;
+				WriteEnd(Corrupt, 1, (int32) (0x80000000u | (uint32) (Length * 64)));
+				TestEqual(What + TEXT(" size larger than the index"), ULowEntryCompressionLzfLibrary::GetBlockCount(Corrupt.GetData(), Corrupt.Num()), -1);
+			}
+
+			// a moved end only breaks the blocks on either side of it, the others still decompress on their own
+			for(int32 Round = 0; Round < 20; Round++)
+			{
+				const int32 Corrupted = Random.RandRange(0, BlockCount - 2);
+				const int32 Position = IndexStart + (Corrupted * 4);
+				const int32 Delta = (Random.RandRange(0, 1) == 0) ? -Random.RandRange(1, 100) : Random.RandRange(1, Compressed.Num());
+				TArray<uint8> Corrupt = Compressed;
+				WriteEnd(Corrupt, Position, FMath::Max(0, ReadEnd(Corrupt, Position) + Delta));
+
+				const FString CorruptWhat = What + FString::Printf(TEXT(" end %i moved by %i"), Corrupted, Delta);
+				ULowEntryCompressionLzfLibrary::GetBlockRange(Corrupt.GetData(), Corrupt.Num(), Corrupted, Offset, Size);
+				TestFalse(CorruptWhat + TEXT(" block"), ULowEntryCompressionLzfLibrary::DecompressBlockInto(Corrupt.GetData(), Corrupt.Num(), Corrupted, Output.GetData(), Size));
+				TestFalse(CorruptWhat + TEXT(" all blocks"), ULowEntryCompressionLzfLibrary::DecompressInto(Corrupt.GetData(), Corrupt.Num(), Output.GetData(), Length, GThreadPool));
+				for(int32 BlockIndex = 0; BlockIndex < BlockCount; BlockIndex++)
+				{
+					if((BlockIndex != Corrupted) && (BlockIndex != (Corrupted + 1)))
+					{
+						ULowEntryCompressionLzfLibrary::GetBlockRange(Corrupt.GetData(), Corrupt.Num(), BlockIndex, Offset, Size);
+						TestTrue(CorruptWhat + FString::Printf(TEXT(" block %i"), BlockIndex), ULowEntryCompressionLzfLibrary::DecompressBlockInto(Corrupt.GetData(), Corrupt.Num(), BlockIndex, Output.GetData(), Size) && (FMemory::Memcmp(Output.GetData(), Data.GetData() + Offset, Size) == 0));
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+#endif
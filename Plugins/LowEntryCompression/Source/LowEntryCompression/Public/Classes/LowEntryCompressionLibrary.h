@@ -12,6 +12,9 @@
 #include "LowEntryCompressionLibrary.generated.h"
 
 
+class FQueuedThreadPool;
+
+
 UCLASS()
 class LOWENTRYCOMPRESSION_API ULowEntryCompressionLibrary : public UBlueprintFunctionLibrary
 {
@@ -27,9 +30,46 @@ public:
 		
 	static TArray<uint8> CompressLzfThreadSafe(const TArray<uint8>& Data);
 
+	/**
+	* Compresses a Byte Array with LZF in blocks of BlockSize bytes, in parallel on ThreadPool (the engine's pool if null, a UMultiTaskThreadPool's Obj works too).
+	* The blocks can be decompressed in parallel or one at a time. Data that fits in one block is compressed like CompressLzf.
+	*/
+	static TArray<uint8> CompressLzfBlocks(const TArray<uint8>& Data, int32 BlockSize = 256 * 1024, FQueuedThreadPool* ThreadPool = nullptr);
+
 	/**
 	* Tries to decompress a Byte Array using the LZF algorithm. Will return an empty Array on failure.
 	*/
 	UFUNCTION(BlueprintPure, Category = "Low Entry|Compression", Meta = (DisplayName = "Decompress (Lzf)"))
 		static TArray<uint8> DecompressLzf(const TArray<uint8>& CompressedData);
+
+	/**
+	* Returns the size LZF data decompresses to, or -1 if it isn't valid LZF data.
+	*/
+	static int32 GetDecompressedSizeLzf(const TArray<uint8>& CompressedData);
+
+	/**
+	* Decompresses LZF data into Data, which is resized to fit but keeps its allocation. Returns false on failure.
+	*/
+	static bool DecompressLzfInto(const TArray<uint8>& CompressedData, TArray<uint8>& Data, FQueuedThreadPool* ThreadPool = nullptr);
+
+	/**
+	* Decompresses LZF data into a caller owned buffer, which has to be exactly GetDecompressedSizeLzf() bytes long. Returns false on failure.
+	* Blocks written by CompressLzfBlocks are decompressed in parallel on ThreadPool if one is given.
+	*/
+	static bool DecompressLzfInto(const TArray<uint8>& CompressedData, uint8* Data, int32 DataLength, FQueuedThreadPool* ThreadPool = nullptr);
+
+	/**
+	* Returns the number of blocks of LZF data that can be decompressed on their own, or -1 if it isn't valid LZF data.
+	*/
+	static int32 GetBlockCountLzf(const TArray<uint8>& CompressedData);
+
+	/**
+	* Returns where a block lands in the decompressed data.
+	*/
+	static bool GetBlockRangeLzf(const TArray<uint8>& CompressedData, int32 BlockIndex, int32& DataOffset, int32& DataLength);
+
+	/**
+	* Decompresses a single block into a caller owned buffer, which has to be exactly as long as GetBlockRangeLzf() returns.
+	*/
+	static bool DecompressLzfBlockInto(const TArray<uint8>& CompressedData, int32 BlockIndex, uint8* Data, int32 DataLength);
 };
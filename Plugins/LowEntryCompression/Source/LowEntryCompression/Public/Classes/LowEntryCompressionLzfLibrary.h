@@ -6,7 +6,7 @@
 #include "CoreMinimal.h"
 
 
-class ULowEntryCompressionByteArrayBuffer;
+class FQueuedThreadPool;
 
 
 class ULowEntryCompressionLzfLibrary
@@ -14,22 +14,76 @@ class ULowEntryCompressionLzfLibrary
 private:
 	const static int32	SKIP_LENGTH = 15;
 
-	const static int32	CACHED_HASH_SIZE = 1 << 16;
-	const static int32	NONCACHED_HASH_SIZE = 1 << 10;
+	const static int32	HASH_SIZE = 1 << 16;
 	const static int32	MAX_LITERAL = 1 << 5;
 	const static int32	MAX_OFF = 1 << 13;
 	const static int32	MAX_REF = (1 << 8) + (1 << 3);
 
-	static int32*		cachedHashTab;
+	const static int32	MIN_BLOCK_SIZE = 1 << 12;
+
+
+	/**
+	* Layout of the framed format: 2, size (uint), block size (uint), one 4 byte end offset per block, the blocks.
+	* Every block is a complete single-block LZF container, so blocks can be decompressed on their own.
+	*/
+	struct FBlockHeader
+	{
+		int32 Length = 0;
+		int32 BlockSize = 0;
+		int32 BlockCount = 0;
+		const uint8* Index = nullptr;
+		const uint8* Data = nullptr;
+		int32 DataLength = 0;
+	};
 
 
 private:
 	FORCEINLINE static int32 UintByteCount(int32 Value);
-	FORCEINLINE static void UintToBytes(ULowEntryCompressionByteArrayBuffer& Array, int32 ArrayOffset, int32 Value);
-	FORCEINLINE static int32 BytesToUint(const TArray<uint8>& Array, int32 ArrayOffset);
+	FORCEINLINE static void UintToBytes(uint8* Array, int32 Value);
+	FORCEINLINE static int32 BytesToUint(const uint8* Array, int32 ArrayLength, int32 ArrayOffset);
+
+	static TArray<uint8> CompressBytes(const uint8* Bytes, int64 BytesLength);
+	static bool DecompressSingleBlockInto(const uint8* Bytes, int32 BytesLength, uint8* Output, int32 OutputLength);
+	static bool ReadBlockHeader(const uint8* Bytes, int32 BytesLength, FBlockHeader& Header);
+	static bool GetBlockData(const FBlockHeader& Header, int32 BlockIndex, const uint8*& BlockBytes, int32& BlockBytesLength);
 
 
 public:
+	/**
+	* Every thread keeps its own hash table between calls, so ThreadSafe is no longer needed and only kept for existing callers.
+	*/
 	static TArray<uint8> Compress(const TArray<uint8>& Bytes, const bool ThreadSafe = false);
 	static TArray<uint8> Decompress(const TArray<uint8>& Bytes);
+
+	/**
+	* Splits Bytes into blocks of BlockSize bytes and compresses them in parallel on ThreadPool (the engine's pool if null).
+	* Input that fits in one block is stored in the single-block format.
+	*/
+	static TArray<uint8> CompressBlocks(const TArray<uint8>& Bytes, int32 BlockSize, FQueuedThreadPool* ThreadPool = nullptr);
+
+	/**
+	* Returns the size the given data decompresses to, or -1 if it isn't valid LZF data.
+	*/
+	static int32 GetDecompressedSize(const uint8* Bytes, int32 BytesLength);
+
+	/**
+	* Decompresses into Output, which has to be exactly GetDecompressedSize() bytes long. Returns false on truncated or corrupt data, Output is undefined then.
+	* Blocks of the framed format are decompressed in parallel on ThreadPool if one is given.
+	*/
+	static bool DecompressInto(const uint8* Bytes, int32 BytesLength, uint8* Output, int32 OutputLength, FQueuedThreadPool* ThreadPool = nullptr);
+
+	/**
+	* Returns the number of blocks that can be decompressed on their own (1 for the single-block format), or -1 if it isn't valid LZF data.
+	*/
+	static int32 GetBlockCount(const uint8* Bytes, int32 BytesLength);
+
+	/**
+	* Returns where the given block lands in the decompressed data.
+	*/
+	static bool GetBlockRange(const uint8* Bytes, int32 BytesLength, int32 BlockIndex, int32& OutputOffset, int32& OutputLength);
+
+	/**
+	* Decompresses a single block into Output, which has to be exactly as long as GetBlockRange() returns.
+	*/
+	static bool DecompressBlockInto(const uint8* Bytes, int32 BytesLength, int32 BlockIndex, uint8* Output, int32 OutputLength);
 };
@@ -392,11 +392,11 @@ FString UFileFunctionsSocketServer::int64ToString(int64 Num) {
 
 
 
-void UFileFunctionsSocketServer::readBytesFromFileInPartsAsync(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath, int32 bufferSize, float delayBetweenReadsInSeconds) {
-	UFileFunctionsSocketServer::getFileFunctionsSocketServerTarget()->readBytesFromFileInPartsAsyncInternal(directoryType, filePath, bufferSize, delayBetweenReadsInSeconds);
+void UFileFunctionsSocketServer::readBytesFromFileInPartsAsync(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath, int32 bufferSize, float delayBetweenReadsInSeconds, int32 readAheadBuffers, bool releaseBuffersManually) {
+	UFileFunctionsSocketServer::getFileFunctionsSocketServerTarget()->readBytesFromFileInPartsAsyncInternal(directoryType, filePath, bufferSize, readAheadBuffers, releaseBuffersManually);
 }
 
-void UFileFunctionsSocketServer::readBytesFromFileInPartsAsyncInternal(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath, int32 bufferSize, float delayBetweenReadsInSeconds) {
+void UFileFunctionsSocketServer::readBytesFromFileInPartsAsyncInternal(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath, int32 bufferSize, int32 readAheadBuffers, bool releaseBuffersManually) {
 
 	FString dir = UFileFunctionsSocketServer::getCleanDirectory(directoryType, filePath);
 
@@ -405,10 +405,23 @@ void UFileFunctionsSocketServer::readBytesFromFileInPartsAsyncInternal(EFileFunc
 		return;
 	}
 
-	FReadFileInPartsSocketServerThread* readThread = new FReadFileInPartsSocketServerThread(dir, bufferSize, delayBetweenReadsInSeconds);
+	FReadFileInPartsSocketServerThread* readThread = new FReadFileInPartsSocketServerThread(dir, bufferSize, readAheadBuffers, releaseBuffersManually);
 	readFileInPartsThreads.Add(dir, readThread);
 }
 
+bool UFileFunctionsSocketServer::releaseBytesFromFileInPartsBuffer(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath) {
+	return UFileFunctionsSocketServer::getFileFunctionsSocketServerTarget()->releaseBytesFromFileInPartsBufferInternal(directoryType, filePath);
+}
+
+bool UFileFunctionsSocketServer::releaseBytesFromFileInPartsBufferInternal(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath) {
+	FString dir = UFileFunctionsSocketServer::getCleanDirectory(directoryType, filePath);
+
+	if (readFileInPartsThreads.Find(*dir) != nullptr) {
+		return (*readFileInPartsThreads.Find(*dir))->releaseBuffer();
+	}
+	return false;
+}
+
 void UFileFunctionsSocketServer::cancelReadBytesFromFileInParts(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath) {
 	UFileFunctionsSocketServer::getFileFunctionsSocketServerTarget()->cancelReadBytesFromFileInPartsInternal(directoryType, filePath);
 }
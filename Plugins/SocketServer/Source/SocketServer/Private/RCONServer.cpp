@@ -1,6 +1,7 @@
 // Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
 
 #include "RCONServer.h"
+#include "SocketServerRCONParser.h"
 
 URCONServer::URCONServer(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer) {
 }
@@ -47,161 +48,89 @@ void URCONServer::startRCONServer(FString serverID, ERCONPasswordType passwordTy
 		passwordOrFile = passwordOrFileP;
 	}
 
+	//packets are parsed and authenticated on the receive threads of the server from now on
+	rconServerID = serverID;
+	FSocketServerRCONEndpoint::add(MakeShareable(new FSocketServerRCONEndpoint(serverID, passwordType, passwordOrFile, this)));
+
 	success = true;
 }
 
-
-void URCONServer::receiveTCPMessageEvent(const FString sessionID, const FString message, const TArray<uint8>& byteArray, const FString serverID) {
-
-	USocketServerPluginTCPServer* tcpServer = *USocketServerBPLibrary::getSocketServerTarget()->getTcpServerMap().Find(serverID);
-	if (tcpServer == nullptr) {
-		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Server not found: %s"), *serverID);
-		return;
-	}
-	
-	//https://developer.valvesoftware.com/wiki/Source_RCON_Protocol
-
-	//packet to small
-	if (byteArray.Num() < 14) {
-		tcpServer->removeClientSession(sessionID);
-		return;
-	}
-
-	//packet to big
-	if (byteArray.Num() > 4096) {
-		tcpServer->removeClientSession(sessionID);
-		return;
-	}
-
-	int32 size = 0;
-	FMemory::Memcpy(&size, byteArray.GetData(), 4);
-
-	//packet to small
-	if (size < 10) {
-		tcpServer->removeClientSession(sessionID);
-		return;
-	}
-
-	int32 id = 0;
-	FMemory::Memcpy(&id, byteArray.GetData() + 4, 4);
-
-	int32 type = 0;
-	FMemory::Memcpy(&type, byteArray.GetData() + 8, 4);
-
-	TArray<uint8> bodyTextArray;
-	bodyTextArray.AddUninitialized(byteArray.Num()-12);
-	FMemory::Memcpy(bodyTextArray.GetData(), byteArray.GetData() + 12, byteArray.Num() - 12);
-
-	FString bodyText = FString(UTF8_TO_TCHAR(bodyTextArray.GetData()));
-	bodyTextArray.Empty();
-
-	UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): size:%i id:%i type:%i body:%s"),size, id,type,*bodyText);
-
-	
-
-	switch (type)
-	{
-	case 0:
-		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Server response sent to the server? Request will be ignored."));
-		break;
-	case 2:
-		USocketServerBPLibrary::getSocketServerTarget()->onreceiveRCONRequestEventDelegate.Broadcast(sessionID,serverID,id, bodyText);
-		break;
-	case 3:
-		authResponse(sessionID, serverID, bodyText, id);
-		break;
-	default:
-		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Unsupported request. Connection is closed."));
-		tcpServer->removeClientSession(sessionID);
-		return;
+void URCONServer::stopRCONServer() {
+	if (rconServerID.IsEmpty() == false) {
+		FSocketServerRCONEndpoint::remove(rconServerID);
+		rconServerID.Empty();
 	}
-
-
 }
 
 
-
-void URCONServer::authResponse(FString sessionID, FString serverID, FString password, int32 rconID){
-
-	//check password
-	if (password.IsEmpty() || passwordOrFile.IsEmpty()) {
-		rconID = -1;
-		sendResponse(sessionID, serverID, -1, 2, FString());
+void URCONServer::dispatchCommand(FString sessionID, FString serverID, int32 requestID, FString request, bool authenticated) {
+	if (request.StartsWith("sessionstats")) {
+		//traffic of every session on every server, nothing for a client that never logged in
+		if (authenticated == false) {
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): sessionstats from a connection that is not authenticated. Request will be ignored."));
+			return;
+		}
+		sessionStatsResponse(sessionID, serverID, requestID, request.RightChop(12).TrimStartAndEnd());
 		return;
 	}
+	USocketServerBPLibrary::getSocketServerTarget()->onreceiveRCONRequestEventDelegate.Broadcast(sessionID, serverID, requestID, request);
+}
 
-	bool found = false;
+void URCONServer::sessionStatsResponse(FString sessionID, FString serverID, int32 rconID, FString arguments) {
+	USocketServerBPLibrary* target = USocketServerBPLibrary::getSocketServerTarget();
 
-	if (passwordType == ERCONPasswordType::E_parameter) {
-		if (password.Equals(passwordOrFile)) {
-			found = true;
-		}
+	TArray<FSocketServerSessionStats> stats;
+	if (arguments.IsEmpty()) {
+		target->serverPluginGetAllSocketSessionStats(FString(), stats);
 	}
 	else {
-		FString passwordData = FString();
-		FFileHelper::LoadFileToString(passwordData, *passwordOrFile);
-
-		TArray<FString> passwords;
-		passwordData.ParseIntoArray(passwords, TEXT("\n"), true);
-
-		for (int32 i = 0; i < passwords.Num(); i++)
-		{
-			if (passwords[i].TrimEnd().Equals(password)) {
-				found = true;
-				break;
-			}
+		bool sessionFound = false;
+		FSocketServerSessionStats sessionStats;
+		target->serverPluginGetSocketSessionStats(arguments, sessionFound, sessionStats);
+		if (sessionFound == false) {
+			sendResponse(sessionID, serverID, rconID, 0, "Session not found: " + arguments);
+			return;
 		}
-	}
-
-
-
-	if (found) {
-		sendResponse(sessionID, serverID, rconID, 2, FString());
-	}
-	else {
-		sendResponse(sessionID, serverID, -1, 2, FString());
-		USocketServerPluginTCPServer* tcpServer = *USocketServerBPLibrary::getSocketServerTarget()->getTcpServerMap().Find(serverID);
-		if (tcpServer != nullptr) {
-			tcpServer->removeClientSession(sessionID);
-			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Wrong password. Connection is closed."));
+		stats.Add(sessionStats);
+	}
+
+	//one line per session. long lists are split into several responses with the same id, like the source engine does
+	FString body;
+	for (const FSocketServerSessionStats& element : stats) {
+		FString line = FString::Printf(TEXT("%s %s in:%lld/%lldB out:%lld/%lldB queue:%i errors:%lld idle:%.1fs rtt:%.1fms\n"),
+			*element.sessionID, *element.serverID, element.packetsIn, element.bytesIn, element.packetsOut, element.bytesOut,
+			element.sendQueueDepth, element.sendErrors, element.secondsSinceLastActivity, element.rttMilliseconds);
+		if (body.Len() + line.Len() > 3800) {
+			sendResponse(sessionID, serverID, rconID, 0, body);
+			body.Empty();
 		}
+		body += line;
 	}
-
+	if (body.IsEmpty()) {
+		body = "No sessions.";
+	}
+	sendResponse(sessionID, serverID, rconID, 0, body);
 }
 
 bool URCONServer::sendResponse(FString sessionID, FString serverID, int32 id, int32 type, FString body){
-	USocketServerPluginTCPServer* tcpServer = *USocketServerBPLibrary::getSocketServerTarget()->getTcpServerMap().Find(serverID);
-	if (tcpServer == nullptr) {
+	TMap<FString, USocketServerPluginTCPServer*> tcpServers = USocketServerBPLibrary::getSocketServerTarget()->getTcpServerMap();
+	USocketServerPluginTCPServer** tcpServer = tcpServers.Find(serverID);
+	if (tcpServer == nullptr || *tcpServer == nullptr) {
 		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Server not found. Can't send response: %s"), *serverID);
 		return false;
 	}
 
-
-
 	FTCHARToUTF8 Convert(*body);
 
-	//4 (id) + 4 (type) + 1 (minimum body) + 1 (null terminator) = 10
-	int32 size = 10;
-
-	TArray<uint8> response;
-	size += Convert.Length();
-
-	response.AddZeroed(size + 4); // 4 =  the size itself as int32
-
-	FMemory::Memcpy(response.GetData(), &size, 4);
-	FMemory::Memcpy(response.GetData() + 4, &id, 4);
-	FMemory::Memcpy(response.GetData() + 8, &type, 4);
-	if (Convert.Length() > 0) {
-		FMemory::Memcpy(response.GetData() + 12, Convert.Get(), Convert.Length());
-	}
-
-	//packet to big
-	if (response.Num() > 4096) {
-		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Answer too big. A data packet may have a maximum size of 4096 bytes. Size is %i"), response.Num());
+	//packet to big. 4 (size) + 4 (id) + 4 (type) + body + 2 (null terminators)
+	if (Convert.Length() + 14 > 4096) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Answer too big. A data packet may have a maximum size of 4096 bytes. Size is %i"), Convert.Length() + 14);
 		return false;
 	}
 
-	tcpServer->sendTCPMessageToClient(sessionID, FString(), response, false);
+	TArray<uint8> response;
+	FSocketServerRCONParser::appendPacket(response, id, type, (const uint8*)Convert.Get(), Convert.Length());
+	(*tcpServer)->sendTCPMessageToClient(sessionID, FString(), response, false);
 
 	return true;
-}
+}
\ No newline at end of file
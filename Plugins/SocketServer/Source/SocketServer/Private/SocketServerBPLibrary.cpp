@@ -1,6 +1,8 @@
 // Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
 
 #include "SocketServerBPLibrary.h"
+#include "DNSClientSocketServer.h"
+#include "SocketServerDNSResolver.h"
 
 USocketServerBPLibrary* USocketServerBPLibrary::socketServerBPLibrary;
 
@@ -25,6 +27,7 @@ void USocketServerBPLibrary::fileTransferOverTCPProgressEventDelegate(const FStr
 void USocketServerBPLibrary::fileTransferOverTCPInfoEventDelegate(const FString message, const FString sessionID, const FString filePathP, const bool success){}
 void USocketServerBPLibrary::socketServerUDPConnectionEventDelegate(const bool success, const FString message, const FString serverID) {}
 void USocketServerBPLibrary::serverReceiveUDPMessageEventDelegate(const FString sessionID, const FString message, const TArray<uint8>& byteArray, const FString serverID) {}
+void USocketServerBPLibrary::serverReceiveUDPMessageBatchEventDelegate(const TArray<FSocketServerUDPDatagram>& datagrams, const FString serverID) {}
 void USocketServerBPLibrary::readBytesFromFileInPartsEventDelegate(const int64 fileSize, const int64 position, const bool end, const TArray<uint8>& byteArray) {}
 void USocketServerBPLibrary::receiveRCONRequestEventDelegate(const FString sessionID, const FString serverID, const int32 requestID, const FString request) {}
 
@@ -87,10 +90,13 @@ void USocketServerBPLibrary::serverPluginGetSocketSessionInfoByServerID(const FS
 		return;
 	}
 
+	//keeps a UDP session alive while it is read, even if another thread removes it
+	FClientSocketSessionPtr udpSession;
 	FClientSocketSession* sessionPointer = nullptr;
 
 	if (udpServers.Find(serverID) != nullptr) {
-		sessionPointer = (*udpServers.Find(serverID))->getClientSession(sessionID);
+		udpSession = (*udpServers.Find(serverID))->getClientSession(sessionID);
+		sessionPointer = udpSession.Get();
 	}
 	else {
 		sessionPointer = (*tcpServers.Find(serverID))->getClientSession(sessionID);
@@ -144,6 +150,77 @@ void USocketServerBPLibrary::serverPluginGetSocketSessionInfo(const FString sess
 	}
 }
 
+void USocketServerBPLibrary::serverPluginGetSocketSessionStats(const FString sessionID, bool& sessionFound, FSocketServerSessionStats& stats) {
+	sessionFound = false;
+	stats = FSocketServerSessionStats();
+
+	FClientSocketSessionPtr udpSession;
+	FClientSocketSession* session = nullptr;
+	for (auto& element : udpServers) {
+		udpSession = element.Value->getClientSession(sessionID);
+		session = udpSession.Get();
+		if (session != nullptr) {
+			break;
+		}
+	}
+	if (session == nullptr) {
+		for (auto& element : tcpServers) {
+			session = element.Value->getClientSession(sessionID);
+			if (session != nullptr) {
+				break;
+			}
+		}
+	}
+
+	if (session != nullptr) {
+		session->fillStats(stats);
+		sessionFound = true;
+	}
+}
+
+void USocketServerBPLibrary::serverPluginGetAllSocketSessionStats(const FString serverID, TArray<FSocketServerSessionStats>& stats) {
+	stats.Empty();
+
+	for (auto& element : udpServers) {
+		if (serverID.IsEmpty() || serverID.Equals(element.Key)) {
+			for (auto& session : element.Value->getClientSessions()) {
+				session.Value.fillStats(stats.AddDefaulted_GetRef());
+			}
+		}
+	}
+	for (auto& element : tcpServers) {
+		if (serverID.IsEmpty() || serverID.Equals(element.Key)) {
+			for (auto& session : element.Value->getClientSessions()) {
+				session.Value.fillStats(stats.AddDefaulted_GetRef());
+			}
+		}
+	}
+}
+
+void USocketServerBPLibrary::serverPluginSetSocketSessionRTT(const FString sessionID, float rttMilliseconds) {
+	FClientSocketSessionPtr udpSession;
+	FClientSocketSession* session = nullptr;
+	for (auto& element : udpServers) {
+		udpSession = element.Value->getClientSession(sessionID);
+		session = udpSession.Get();
+		if (session != nullptr) {
+			break;
+		}
+	}
+	if (session == nullptr) {
+		for (auto& element : tcpServers) {
+			session = element.Value->getClientSession(sessionID);
+			if (session != nullptr) {
+				break;
+			}
+		}
+	}
+
+	if (session != nullptr && session->counters.IsValid()) {
+		session->counters->rttMilliseconds.store(rttMilliseconds, std::memory_order_relaxed);
+	}
+}
+
 void USocketServerBPLibrary::removeSessionAndCloseConnection(FString sessionId, FString serverID) {
 	if (serverID.IsEmpty()) {
 		if (lastUDPServerID.IsEmpty() == false && udpServers.Find(lastUDPServerID) != nullptr) {
@@ -231,7 +308,7 @@ void USocketServerBPLibrary::stopAllUDPServers() {
 	}
 }
 
-void USocketServerBPLibrary::startUDPServer(FString& serverID, FString IP, int32 port ,bool multicast, EReceiveFilterServer receiveFilter, FString optionalServerID, int32 maxPacketSize) {
+void USocketServerBPLibrary::startUDPServer(FString& serverID, FString IP, int32 port ,bool multicast, EReceiveFilterServer receiveFilter, FString optionalServerID, int32 maxPacketSize, int32 receiveThreads, int32 receiveBufferSize, int32 sendBufferSize) {
 
 	serverID = optionalServerID;
 
@@ -271,7 +348,7 @@ void USocketServerBPLibrary::startUDPServer(FString& serverID, FString IP, int32
 
 	USocketServerPluginUDPServer* udpServer = NewObject<USocketServerPluginUDPServer>(USocketServerPluginUDPServer::StaticClass());
 	udpServers.Add(serverID, udpServer);
-	udpServer->startUDPServer(ipStruct,IP, port, multicast, receiveFilter, serverID, maxPacketSize);
+	udpServer->startUDPServer(ipStruct,IP, port, multicast, receiveFilter, serverID, maxPacketSize, receiveThreads, receiveBufferSize, sendBufferSize);
 
 	lastUDPServerID = serverID;
 }
@@ -332,6 +409,76 @@ void USocketServerBPLibrary::socketServerSendUDPMessageToClient(FString clientSe
 	}
 }
 
+void USocketServerBPLibrary::socketServerSendUDPMessageWithPriority(TArray<FString> clientSessionIDs, FString message, TArray<uint8> byteArray, bool addLineBreak, ESocketServerUDPSendPriority priority, ESocketServerUDPSocketType socketType, FString serverID) {
+	if (message.Len() == 0 && byteArray.Num() == 0)
+		return;
+
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	if (message.Len() > 0 && addLineBreak) {
+		message.Append("\r\n");
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		udpServer->sendUDPMessage(clientSessionIDs, message, byteArray, true, socketType, priority);
+	}
+	else {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Server not found or not started: %s"), *serverID);
+		return;
+	}
+}
+
+void USocketServerBPLibrary::socketServerSendUDPMessageToClientWithPriority(FString clientSessionID, FString message, TArray<uint8> byteArray, bool addLineBreak, ESocketServerUDPSendPriority priority, ESocketServerUDPSocketType socketType, FString serverID) {
+	if (message.Len() == 0 && byteArray.Num() == 0)
+		return;
+
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	if (message.Len() > 0 && addLineBreak) {
+		message.Append("\r\n");
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		udpServer->sendUDPMessageToClient(clientSessionID, message, byteArray, true, socketType, priority);
+	}
+	else {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Server not found or not started: %s"), *serverID);
+		return;
+	}
+}
+
+void USocketServerBPLibrary::setUDPSendScheduling(ESocketServerUDPSendScheduling scheduling, float bulkDeadlineMilliseconds, FString serverID) {
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		udpServer->setSendScheduling(scheduling, bulkDeadlineMilliseconds);
+	}
+}
+
 void USocketServerBPLibrary::socketServerSendUDPMessageTo(FString ip, int32 port, FString message, TArray<uint8> byteArray, bool addLineBreak, bool asynchronous, FString serverID) {
 	if (message.Len() == 0 && byteArray.Num() == 0)
 		return;
@@ -359,10 +506,114 @@ void USocketServerBPLibrary::socketServerSendUDPMessageTo(FString ip, int32 port
 	}
 }
 
+void USocketServerBPLibrary::getUDPSendLatency(float& p50Milliseconds, float& p99Milliseconds, FString serverID) {
+	p50Milliseconds = 0.f;
+	p99Milliseconds = 0.f;
+
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		udpServer->getSendLatency(p50Milliseconds, p99Milliseconds);
+	}
+}
+
+void USocketServerBPLibrary::getUDPServerStats(FSocketServerUDPStats& stats, FString serverID) {
+	stats = FSocketServerUDPStats();
+
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		stats = udpServer->getStats();
+	}
+}
+
+void USocketServerBPLibrary::getUDPSendLatencyByPriority(ESocketServerUDPSendPriority priority, float& p50Milliseconds, float& p99Milliseconds, FString serverID) {
+	p50Milliseconds = 0.f;
+	p99Milliseconds = 0.f;
+
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		udpServer->getSendLatency(priority, p50Milliseconds, p99Milliseconds);
+	}
+}
+
+void USocketServerBPLibrary::setUDPBatchedDelivery(bool batchedDelivery, FString serverID) {
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		udpServer->setBatchedDelivery(batchedDelivery);
+	}
+}
+
+void USocketServerBPLibrary::setUDPFragmentation(bool fragmentLargeMessages, FString serverID, float reassemblyTimeoutSeconds, int32 reassemblyMemoryLimitMB) {
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		udpServer->setFragmentation(fragmentLargeMessages, reassemblyTimeoutSeconds, reassemblyMemoryLimitMB);
+	}
+}
+
+void USocketServerBPLibrary::setUDPDatagramHandler(FSocketServerUDPDatagramHandlerWeakPtr handler, FString serverID) {
+	if (serverID.IsEmpty()) {
+		serverID = lastUDPServerID;
+	}
+
+	if (serverID.IsEmpty() || udpServers.Find(serverID) == nullptr) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not found: %s"), *serverID);
+		return;
+	}
+
+	USocketServerPluginUDPServer* udpServer = *udpServers.Find(serverID);
+	if (udpServer != nullptr) {
+		udpServer->setDatagramHandler(handler);
+	}
+}
+
 
 
 //TCP
-void USocketServerBPLibrary::startTCPServerInternal(FString& serverID, FString IP, int32 port, EReceiveFilterServer receiveFilter, FString optionalServerID, bool isFileServer, FString Aes256bitKey, bool resumeFiles) {
+void USocketServerBPLibrary::startTCPServerInternal(FString& serverID, FString IP, int32 port, EReceiveFilterServer receiveFilter, FString optionalServerID, bool isFileServer, FString Aes256bitKey, bool resumeFiles, int32 ioThreads, bool preallocateFiles) {
 
 	serverID = optionalServerID;
 
@@ -406,17 +657,17 @@ void USocketServerBPLibrary::startTCPServerInternal(FString& serverID, FString I
 		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: ServerID not set. Generate automatically one :%s"), *serverID);
 	}
 	tcpServers.Add(serverID, tcpServer);
-	tcpServer->startTCPServer(ipStruct, IP, port, receiveFilter, serverID,isFileServer,Aes256bitKey,resumeFiles);
+	tcpServer->startTCPServer(ipStruct, IP, port, receiveFilter, serverID,isFileServer,Aes256bitKey,resumeFiles,ioThreads,preallocateFiles);
 
 	lastTCPServerID = serverID;
 }
 
-void USocketServerBPLibrary::startTCPServer(FString& serverID, FString IP, int32 port, EReceiveFilterServer receiveFilter, FString optionalServerID) {
-	startTCPServerInternal(serverID, IP, port, receiveFilter, optionalServerID, false, "", false);
+void USocketServerBPLibrary::startTCPServer(FString& serverID, FString IP, int32 port, EReceiveFilterServer receiveFilter, FString optionalServerID, int32 ioThreads) {
+	startTCPServerInternal(serverID, IP, port, receiveFilter, optionalServerID, false, "", false, ioThreads);
 }
 
-void USocketServerBPLibrary::startTCPFileServer(FString& serverID, FString IP, int32 port, FString customServerID, FString Aes256bitKey, bool resumeFiles){
-	startTCPServerInternal(serverID, IP, port, EReceiveFilterServer::E_SAB, customServerID, true, Aes256bitKey, resumeFiles);
+void USocketServerBPLibrary::startTCPFileServer(FString& serverID, FString IP, int32 port, FString customServerID, FString Aes256bitKey, bool resumeFiles, bool preallocateFiles){
+	startTCPServerInternal(serverID, IP, port, EReceiveFilterServer::E_SAB, customServerID, true, Aes256bitKey, resumeFiles, 0, preallocateFiles);
 }
 
 void USocketServerBPLibrary::addFileToken(FString token, bool deleteAfterUse, EFileFunctionsSocketServerDirectoryType directoryType, FString fileDirectory){
@@ -557,6 +808,10 @@ void USocketServerBPLibrary::deactivateTCPWrappingOnServerPlugin() {
 	messageWrapping = ESocketServerTCPMessageWrapping::E_None;
 }
 
+void USocketServerBPLibrary::setTCPMaxMessageSizeOnServerPlugin(int32 maxMessageSizeInBytes) {
+	tcpMaxMessageSize = FMath::Max(maxMessageSizeInBytes, 1);
+}
+
 
 void USocketServerBPLibrary::getTcpWrapping(FString& header, FString& footer, ESocketServerTCPMessageWrapping& wrapping) {
 	header = tcpMessageHeader;
@@ -564,6 +819,10 @@ void USocketServerBPLibrary::getTcpWrapping(FString& header, FString& footer, ES
 	wrapping = messageWrapping;
 }
 
+int32 USocketServerBPLibrary::getTcpMaxMessageSize() {
+	return tcpMaxMessageSize;
+}
+
 TMap<FString, USocketServerPluginTCPServer*> USocketServerBPLibrary::getTcpServerMap(){
 	return tcpServers;
 }
@@ -580,6 +839,14 @@ UDNSClientSocketServer* USocketServerBPLibrary::resolveDomain(FString domain, bo
 	return dnsClient;
 }
 
+void USocketServerBPLibrary::setDNSResolverOptions(float timeoutInSeconds, int32 retries, int32 negativeCacheTimeInSeconds){
+	FSocketServerDNSResolver::get().configure(timeoutInSeconds, retries, negativeCacheTimeInSeconds);
+}
+
+void USocketServerBPLibrary::clearDNSCache(){
+	FSocketServerDNSResolver::get().clearCache();
+}
+
 void USocketServerBPLibrary::changeSocketPlatform(ESocketPlatformServer platform){
 		USocketServerBPLibrary::getSocketServerTarget()->systemSocketPlatform = platform;
 }
@@ -812,7 +1079,6 @@ void USocketServerBPLibrary::registerRCONServer(FString serverID, ERCONPasswordT
 	rconServer->startRCONServer(serverID, passwordType, passwordOrFile, success, errorMessage);
 
 	if (success) {
-		USocketServerBPLibrary::getSocketServerTarget()->onserverReceiveTCPMessageEventDelegate.AddDynamic(rconServer, &URCONServer::receiveTCPMessageEvent);
 		USocketServerBPLibrary::getSocketServerTarget()->rconServers.Add(serverID, rconServer);
 	}
 }
@@ -820,7 +1086,7 @@ void USocketServerBPLibrary::registerRCONServer(FString serverID, ERCONPasswordT
 void USocketServerBPLibrary::unregiserRCONServer(FString serverID){
 	if (USocketServerBPLibrary::getSocketServerTarget()->rconServers.Find(serverID) != nullptr) {
 		URCONServer* rconServer = *USocketServerBPLibrary::getSocketServerTarget()->rconServers.Find(serverID);
-		USocketServerBPLibrary::getSocketServerTarget()->onserverReceiveTCPMessageEventDelegate.RemoveDynamic(rconServer, &URCONServer::receiveTCPMessageEvent);
+		rconServer->stopRCONServer();
 		USocketServerBPLibrary::getSocketServerTarget()->rconServers.Remove(serverID);
 		rconServer->RemoveFromRoot();
 		rconServer = nullptr;
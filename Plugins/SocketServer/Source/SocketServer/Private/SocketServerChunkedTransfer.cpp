@@ -0,0 +1,241 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerChunkedTransfer.h"
+#include "Hash/CityHash.h"
+
+//sidecar: int64 file size | int32 chunk size | one byte per 8 chunks
+static const int64 stateHeaderSize = 12;
+
+FSocketServerChunkedTransfer::FSocketServerChunkedTransfer(FString filePathP, int64 fileSizeP, int32 chunkSizeP) :
+	filePath(filePathP),
+	fileSize(fileSizeP) {
+	statePath = filePath + ".chunks";
+	chunkSize = FMath::Clamp(chunkSizeP, minChunkSize, maxChunkSize);
+	chunkCount = isValidSize(fileSize, chunkSize) ? (int32)((fileSize + chunkSize - 1) / chunkSize) : 0;
+	received.Init(false, chunkCount);
+	lastWrite = FPlatformTime::Seconds();
+}
+
+FSocketServerChunkedTransfer::~FSocketServerChunkedTransfer() {
+	if (fileHandle != nullptr) {
+		//a dropped upload keeps everything that reached the disk for the resume
+		writeState();
+		delete fileHandle;
+		fileHandle = nullptr;
+	}
+	if (stateHandle != nullptr) {
+		stateHandle->Flush();
+		delete stateHandle;
+		stateHandle = nullptr;
+	}
+}
+
+bool FSocketServerChunkedTransfer::isValidSize(int64 fileSizeP, int32 chunkSizeP) {
+	int64 clampedChunkSize = FMath::Clamp(chunkSizeP, minChunkSize, maxChunkSize);
+	return fileSizeP > 0 && (fileSizeP - 1) / clampedChunkSize < maxChunkCount;
+}
+
+bool FSocketServerChunkedTransfer::open() {
+	FScopeLock scopeLock(&lock);
+	if (fileHandle != nullptr) {
+		return true;
+	}
+	if (chunkCount == 0) {
+		return false;
+	}
+
+	IPlatformFile& platformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	TArray<uint8> state;
+	bool resume = false;
+	if (platformFile.FileExists(*filePath) && FFileHelper::LoadFileToArray(state, *statePath, FILEREAD_Silent)) {
+		int32 bitmapSize = (chunkCount + 7) / 8;
+		if (state.Num() == stateHeaderSize + bitmapSize) {
+			int64 stateFileSize = 0;
+			int32 stateChunkSize = 0;
+			FMemory::Memcpy(&stateFileSize, state.GetData(), 8);
+			FMemory::Memcpy(&stateChunkSize, state.GetData() + 8, 4);
+			if (stateFileSize == fileSize && stateChunkSize == chunkSize) {
+				resume = true;
+				for (int32 i = 0; i < chunkCount; i++) {
+					if (state[12 + i / 8] & (1 << (i % 8))) {
+						received[i] = true;
+						receivedCount++;
+					}
+				}
+			}
+		}
+	}
+
+	//without a matching sidecar nothing of an existing file can be trusted
+	fileHandle = platformFile.OpenWrite(*filePath, resume, true);
+	if (fileHandle == nullptr) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't create file %s."), *filePath);
+		return false;
+	}
+	if (!resume) {
+		received.Init(false, chunkCount);
+		receivedCount = 0;
+		return createState();
+	}
+	stateHandle = platformFile.OpenWrite(*statePath, true, true);
+	if (stateHandle == nullptr) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't open file %s."), *statePath);
+		return false;
+	}
+	return true;
+}
+
+int64 FSocketServerChunkedTransfer::getChunkLength(int32 index) const {
+	if (index < 0 || index >= chunkCount) {
+		return 0;
+	}
+	return FMath::Min((int64)chunkSize, fileSize - (int64)index * chunkSize);
+}
+
+FString FSocketServerChunkedTransfer::getMissingChunks() {
+	FScopeLock scopeLock(&lock);
+	FString missing;
+	missing.Reserve((chunkCount + 3) / 4);
+	for (int32 i = 0; i < chunkCount; i += 4) {
+		int32 nibble = 0;
+		for (int32 bit = 0; bit < 4 && i + bit < chunkCount; bit++) {
+			if (!received[i + bit]) {
+				nibble |= 1 << bit;
+			}
+		}
+		missing.AppendChar(TEXT("0123456789abcdef")[nibble]);
+	}
+	return missing;
+}
+
+int64 FSocketServerChunkedTransfer::getReceivedBytes() {
+	FScopeLock scopeLock(&lock);
+	int64 bytes = (int64)receivedCount * chunkSize;
+	//the last chunk is usually shorter
+	if (chunkCount > 0 && received[chunkCount - 1]) {
+		bytes -= chunkSize - getChunkLength(chunkCount - 1);
+	}
+	return bytes;
+}
+
+double FSocketServerChunkedTransfer::getIdleSeconds() {
+	FScopeLock scopeLock(&lock);
+	return FPlatformTime::Seconds() - lastWrite;
+}
+
+bool FSocketServerChunkedTransfer::isComplete() {
+	FScopeLock scopeLock(&lock);
+	return receivedCount == chunkCount;
+}
+
+bool FSocketServerChunkedTransfer::writeChunk(int32 index, const uint8* data, int32 dataSize, uint64 hash) {
+	if (index < 0 || index >= chunkCount || dataSize != getChunkLength(index)) {
+		return false;
+	}
+	//hashing happens outside of the lock, the connections only wait for each other while writing
+	if (hashChunk(data, dataSize) != hash) {
+		return false;
+	}
+
+	FScopeLock scopeLock(&lock);
+	if (fileHandle == nullptr) {
+		return false;
+	}
+	lastWrite = FPlatformTime::Seconds();
+	if (received[index]) {
+		return true;
+	}
+	if (!fileHandle->Seek((int64)index * chunkSize) || !fileHandle->Write(data, dataSize)) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't write chunk %i of %s."), index, *filePath);
+		return false;
+	}
+	received[index] = true;
+	receivedCount++;
+	saveState(index);
+	return true;
+}
+
+void FSocketServerChunkedTransfer::finish() {
+	FScopeLock scopeLock(&lock);
+	if (fileHandle != nullptr) {
+		fileHandle->Flush();
+		delete fileHandle;
+		fileHandle = nullptr;
+	}
+	if (stateHandle != nullptr) {
+		delete stateHandle;
+		stateHandle = nullptr;
+	}
+	IFileManager::Get().Delete(*statePath, false, true, true);
+}
+
+bool FSocketServerChunkedTransfer::createState() {
+	TArray<uint8> state;
+	state.SetNumZeroed(stateHeaderSize + (chunkCount + 7) / 8);
+	FMemory::Memcpy(state.GetData(), &fileSize, 8);
+	FMemory::Memcpy(state.GetData() + 8, &chunkSize, 4);
+
+	stateHandle = FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*statePath, false, true);
+	if (stateHandle == nullptr || !stateHandle->Write(state.GetData(), state.Num())) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't create file %s."), *statePath);
+		return false;
+	}
+	return true;
+}
+
+void FSocketServerChunkedTransfer::saveState(int32 index) {
+	dirtyStateBytes.Add(index / 8);
+	if (lastWrite - lastFlush >= 1.0) {
+		lastFlush = lastWrite;
+		writeState();
+	}
+}
+
+void FSocketServerChunkedTransfer::writeState() {
+	//the chunks have to be on disk before the sidecar says so
+	fileHandle->Flush();
+	if (dirtyStateBytes.Num() == 0) {
+		return;
+	}
+	for (int32 byteIndex : dirtyStateBytes) {
+		//the byte holds 8 chunks, it is rebuilt from the bitmap and not read back from the file
+		uint8 bits = 0;
+		for (int32 i = byteIndex * 8; i < byteIndex * 8 + 8 && i < chunkCount; i++) {
+			if (received[i]) {
+				bits |= 1 << (i % 8);
+			}
+		}
+		if (stateHandle == nullptr || !stateHandle->Seek(stateHeaderSize + byteIndex) || !stateHandle->Write(&bits, 1)) {
+			UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't write file %s."), *statePath);
+			break;
+		}
+	}
+	dirtyStateBytes.Reset();
+	if (stateHandle != nullptr) {
+		stateHandle->Flush();
+	}
+}
+
+uint64 FSocketServerChunkedTransfer::hashChunk(const uint8* data, int32 dataSize) {
+	return CityHash64((const char*)data, (uint32)dataSize);
+}
+
+FString FSocketServerChunkedTransfer::hashToString(uint64 hash) {
+	return FString::Printf(TEXT("%016llx"), hash);
+}
+
+bool FSocketServerChunkedTransfer::hashFromString(const FString& text, uint64& hash) {
+	if (text.Len() != 16) {
+		return false;
+	}
+	hash = 0;
+	for (int32 i = 0; i < 16; i++) {
+		TCHAR c = text[i];
+		if (!FChar::IsHexDigit(c)) {
+			return false;
+		}
+		hash = (hash << 4) | (uint64)FParse::HexDigit(c);
+	}
+	return true;
+}
@@ -0,0 +1,404 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerDNSResolver.h"
+#include "Async/Async.h"
+
+
+/*sends the A and AAAA query of one name and waits for the answers. runs on a thread of its own*/
+class FSocketServerDNSQuery {
+
+public:
+
+	struct FAnswer {
+		bool received = false;
+		//false for server errors, they are not cached
+		bool cacheable = false;
+		TArray<FString> ips;
+		uint32 ttl = MAX_uint32;
+	};
+
+	FSocketServerDNSQuery(ISocketSubsystem* socketSubSystemP, FString keyP, FString domainP, FString dnsServerP, float timeoutInSecondsP, int32 retriesP, uint32 negativeTTLP) :
+		socketSubSystem(socketSubSystemP),
+		key(keyP),
+		domain(domainP),
+		dnsServer(dnsServerP),
+		timeoutInSeconds(timeoutInSecondsP),
+		retries(retriesP),
+		negativeTTL(negativeTTLP) {
+	}
+
+	void run() {
+		TArray<FString> ips;
+		uint32 ttl = query(ips);
+		FSocketServerDNSResolver::get().finishQuery(key, ips, ttl);
+	}
+
+	//query ids and source ports must not be predictable, otherwise forged answers can poison the cache
+	static void randomBytes(uint8* data, int32 size) {
+		int32 filled = 0;
+#if PLATFORM_UNIX
+		IFileHandle* urandom = FPlatformFileManager::Get().GetPlatformFile().OpenRead(TEXT("/dev/urandom"));
+		if (urandom != nullptr) {
+			if (urandom->Read(data, size)) {
+				filled = size;
+			}
+			delete urandom;
+		}
+#endif
+		//version 4 guids come from the system CSPRNG on Windows
+		while (filled < size) {
+			FGuid guid = FGuid::NewGuid();
+			int32 length = FMath::Min(size - filled, (int32)sizeof(FGuid));
+			FMemory::Memcpy(data + filled, &guid, length);
+			filled += length;
+		}
+	}
+
+	//binds to a random port above 1024. if that fails a few times the OS picks one on the first send
+	void bindRandomPort(FSocket* socket, const FInternetAddr& serverAddr) {
+		TSharedRef<FInternetAddr> localAddr = serverAddr.Clone();
+		localAddr->SetAnyAddress();
+		for (int32 attempt = 0; attempt < 8; attempt++) {
+			uint16 port = 0;
+			randomBytes((uint8*)&port, sizeof(port));
+			localAddr->SetPort(1024 + port % (65536 - 1024));
+			if (socket->Bind(*localAddr)) {
+				return;
+			}
+		}
+	}
+
+	uint32 query(TArray<FString>& ips) {
+		TSharedPtr<FInternetAddr> serverAddr = parseServer();
+		if (serverAddr.IsValid() == false) {
+			UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Invalid DNS server %s."), *dnsServer);
+			return 0;
+		}
+		FSocket* socket = socketSubSystem->CreateSocket(NAME_DGram, TEXT("SocketServerDNSClient"), serverAddr->GetProtocolType());
+		if (socket == nullptr) {
+			UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Could not init a UDP socket to resolve %s on %s."), *domain, *dnsServer);
+			return 0;
+		}
+
+		bindRandomPort(socket, *serverAddr);
+
+		const uint16 types[2] = { 1, 28 };
+		uint16 ids[2];
+		TArray<uint8> queries[2];
+		FAnswer answers[2];
+		randomBytes((uint8*)ids, sizeof(ids));
+		for (int32 i = 0; i < 2; i++) {
+			if (!buildQuery(queries[i], ids[i], domain, types[i])) {
+				UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Invalid domain %s."), *domain);
+				socketSubSystem->DestroySocket(socket);
+				return 0;
+			}
+		}
+
+		TSharedRef<FInternetAddr> sender = socketSubSystem->CreateInternetAddr();
+		TArray<uint8> buffer;
+		buffer.SetNumUninitialized(4096);
+
+		for (int32 attempt = 0; attempt <= retries && (!answers[0].received || !answers[1].received); attempt++) {
+			//only the unanswered queries are sent again
+			for (int32 i = 0; i < 2; i++) {
+				if (!answers[i].received) {
+					int32 sent = 0;
+					socket->SendTo(queries[i].GetData(), queries[i].Num(), sent, *serverAddr);
+				}
+			}
+
+			double deadline = FPlatformTime::Seconds() + timeoutInSeconds;
+			while (!answers[0].received || !answers[1].received) {
+				double remaining = deadline - FPlatformTime::Seconds();
+				if (remaining <= 0 || !socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(remaining))) {
+					break;
+				}
+				int32 bytesRead = 0;
+				if (!socket->RecvFrom(buffer.GetData(), buffer.Num(), bytesRead, *sender) || !(*sender == *serverAddr)) {
+					continue;
+				}
+				for (int32 i = 0; i < 2; i++) {
+					if (!answers[i].received && parseResponse(buffer.GetData(), bytesRead, ids[i], answers[i])) {
+						answers[i].received = true;
+						break;
+					}
+				}
+			}
+		}
+		socket->Close();
+		socketSubSystem->DestroySocket(socket);
+
+		//A records first
+		uint32 ttl = MAX_uint32;
+		bool negative = true;
+		for (int32 i = 0; i < 2; i++) {
+			if (answers[i].ips.Num() > 0) {
+				ips.Append(answers[i].ips);
+				ttl = FMath::Min(ttl, answers[i].ttl);
+			}
+			else if (!answers[i].received || !answers[i].cacheable) {
+				negative = false;
+			}
+		}
+		if (ips.Num() > 0) {
+			return ttl;
+		}
+		if (!negative) {
+			return 0;
+		}
+		//no addresses. the zone says how long that may be cached
+		ttl = FMath::Min(answers[0].ttl, answers[1].ttl);
+		return ttl == MAX_uint32 ? negativeTTL : FMath::Min(ttl, negativeTTL);
+	}
+
+	TSharedPtr<FInternetAddr> parseServer() {
+		FString ip = dnsServer;
+		int32 port = 53;
+		int32 portSeparator = INDEX_NONE;
+		if (ip.StartsWith("[")) {
+			//[ipv6]:port
+			int32 end = INDEX_NONE;
+			if (ip.FindChar(']', end)) {
+				if (ip.Len() > end + 1 && ip[end + 1] == ':') {
+					port = FCString::Atoi(*ip.Mid(end + 2));
+				}
+				ip = ip.Mid(1, end - 1);
+			}
+		}
+		else if (ip.FindChar(':', portSeparator) && ip.Find(":", ESearchCase::CaseSensitive, ESearchDir::FromEnd) == portSeparator) {
+			//ipv4:port. plain ipv6 addresses have more than one colon
+			port = FCString::Atoi(*ip.Mid(portSeparator + 1));
+			ip = ip.Left(portSeparator);
+		}
+
+		TSharedPtr<FInternetAddr> addr = socketSubSystem->GetAddressFromString(ip);
+		if (addr.IsValid() == false || port <= 0 || port > 65535) {
+			return nullptr;
+		}
+		addr->SetPort(port);
+		return addr;
+	}
+
+	static bool buildQuery(TArray<uint8>& query, uint16 id, const FString& domain, uint16 type) {
+		//id, recursion desired, one question
+		const uint8 header[12] = { (uint8)(id >> 8), (uint8)id, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+		query.Append(header, 12);
+
+		//every label with its length in bytes
+		TArray<FString> labels;
+		domain.ParseIntoArray(labels, TEXT("."), true);
+		for (int32 i = 0; i < labels.Num(); i++) {
+			FTCHARToUTF8 label(*labels[i]);
+			if (label.Length() > 63) {
+				return false;
+			}
+			query.Add((uint8)label.Length());
+			query.Append((const uint8*)label.Get(), label.Length());
+		}
+		if (labels.Num() == 0 || query.Num() > 12 + 255) {
+			return false;
+		}
+		const uint8 footer[5] = { 0x00, (uint8)(type >> 8), (uint8)type, 0x00, 0x01 };
+		query.Append(footer, 5);
+		return true;
+	}
+
+	static bool skipName(const uint8* data, int32 size, int32& position) {
+		while (position < size) {
+			uint8 length = data[position];
+			if ((length & 0xC0) == 0xC0) {
+				//compression pointer ends the name
+				position += 2;
+				return position <= size;
+			}
+			if (length & 0xC0) {
+				return false;
+			}
+			position += 1 + length;
+			if (length == 0) {
+				return position <= size;
+			}
+		}
+		return false;
+	}
+
+	static uint16 read16(const uint8* data) {
+		return (uint16)((data[0] << 8) | data[1]);
+	}
+
+	static uint32 read32(const uint8* data) {
+		return ((uint32)data[0] << 24) | ((uint32)data[1] << 16) | ((uint32)data[2] << 8) | data[3];
+	}
+
+	//false if the packet is not the answer to the query with this id
+	static bool parseResponse(const uint8* data, int32 size, uint16 id, FAnswer& answer) {
+		if (size < 12 || read16(data) != id || (data[2] & 0x80) == 0) {
+			return false;
+		}
+		//0 = no error, 3 = name does not exist. both may be cached
+		uint8 rcode = data[3] & 0x0F;
+		answer.cacheable = rcode == 0 || rcode == 3;
+		if (!answer.cacheable) {
+			return true;
+		}
+
+		int32 questions = read16(data + 4);
+		int32 answerRecords = read16(data + 6);
+		int32 authorityRecords = read16(data + 8);
+		int32 position = 12;
+		for (int32 i = 0; i < questions; i++) {
+			if (!skipName(data, size, position) || position + 4 > size) {
+				answer.cacheable = false;
+				return true;
+			}
+			position += 4;
+		}
+
+		uint32 negativeTTL = MAX_uint32;
+		for (int32 i = 0; i < answerRecords + authorityRecords; i++) {
+			if (!skipName(data, size, position) || position + 10 > size) {
+				answer.cacheable = answer.ips.Num() > 0;
+				return true;
+			}
+			uint16 type = read16(data + position);
+			uint32 ttl = read32(data + position + 4);
+			int32 dataLength = read16(data + position + 8);
+			position += 10;
+			if (position + dataLength > size) {
+				answer.cacheable = answer.ips.Num() > 0;
+				return true;
+			}
+			const uint8* record = data + position;
+
+			if (i < answerRecords) {
+				if (type == 1 && dataLength == 4) {
+					answer.ips.Add(FString::Printf(TEXT("%u.%u.%u.%u"), record[0], record[1], record[2], record[3]));
+					answer.ttl = FMath::Min(answer.ttl, ttl);
+				}
+				else if (type == 28 && dataLength == 16) {
+					FString ip;
+					for (int32 group = 0; group < 8; group++) {
+						ip += FString::Printf(TEXT("%x:"), read16(record + group * 2));
+					}
+					ip.RemoveFromEnd(":");
+					answer.ips.Add(ip);
+					answer.ttl = FMath::Min(answer.ttl, ttl);
+				}
+			}
+			else if (type == 6) {
+				//SOA: the negative ttl is the smaller one of the record ttl and the MINIMUM field at the end
+				int32 soaPosition = position;
+				if (skipName(data, position + dataLength, soaPosition) && skipName(data, position + dataLength, soaPosition) && soaPosition + 20 <= position + dataLength) {
+					negativeTTL = FMath::Min(ttl, read32(data + soaPosition + 16));
+				}
+			}
+			position += dataLength;
+		}
+
+		if (answer.ips.Num() == 0) {
+			answer.ttl = negativeTTL;
+		}
+		return true;
+	}
+
+private:
+	ISocketSubsystem* socketSubSystem = nullptr;
+	FString key;
+	FString domain;
+	FString dnsServer;
+	float timeoutInSeconds;
+	int32 retries;
+	uint32 negativeTTL;
+};
+
+
+FSocketServerDNSResolver& FSocketServerDNSResolver::get() {
+	static FSocketServerDNSResolver resolver;
+	return resolver;
+}
+
+void FSocketServerDNSResolver::resolve(ISocketSubsystem* socketSubSystem, const FString& domain, const FString& dnsServer, bool useCache, FSocketServerDNSCallback callback) {
+	FString key = domain.ToLower() + "@" + dnsServer;
+	TArray<FString> cachedIPs;
+	bool cached = false;
+	bool startQuery = false;
+	float timeout;
+	int32 retryCount;
+	int32 negativeTTL;
+	{
+		FScopeLock lock(&resolverLock);
+		FCacheEntry* entry = cache.Find(key);
+		if (entry != nullptr) {
+			if (entry->expires > FPlatformTime::Seconds()) {
+				cached = useCache;
+				cachedIPs = entry->ips;
+			}
+			else {
+				cache.Remove(key);
+			}
+		}
+		if (!cached) {
+			TArray<FSocketServerDNSCallback>* waiting = inFlight.Find(key);
+			if (waiting != nullptr) {
+				waiting->Add(callback);
+			}
+			else {
+				inFlight.Add(key).Add(callback);
+				startQuery = true;
+			}
+		}
+		timeout = timeoutInSeconds;
+		retryCount = retries;
+		negativeTTL = negativeCacheTimeInSeconds;
+	}
+
+	if (cached) {
+		callback(cachedIPs);
+	}
+	else if (startQuery) {
+		//the query blocks in Wait for up to timeout * (retries + 1). on the engine thread pool a burst of lookups would
+		//hold workers the engine needs, so every query gets its own thread. the query object lives in the task
+		Async(EAsyncExecution::Thread, [socketSubSystem, key, domain, dnsServer, timeout, retryCount, negativeTTL]() {
+			FSocketServerDNSQuery query(socketSubSystem, key, domain, dnsServer, timeout, retryCount, (uint32)negativeTTL);
+			query.run();
+		});
+	}
+}
+
+void FSocketServerDNSResolver::finishQuery(const FString& key, const TArray<FString>& ips, uint32 ttl) {
+	TArray<FSocketServerDNSCallback> callbacks;
+	{
+		FScopeLock lock(&resolverLock);
+		if (ttl > 0) {
+			double now = FPlatformTime::Seconds();
+			//drop what has expired before the cache grows further
+			if (cache.Num() >= 1024) {
+				for (auto it = cache.CreateIterator(); it; ++it) {
+					if (it.Value().expires <= now) {
+						it.RemoveCurrent();
+					}
+				}
+			}
+			FCacheEntry& entry = cache.Add(key);
+			entry.ips = ips;
+			entry.expires = now + ttl;
+		}
+		inFlight.RemoveAndCopyValue(key, callbacks);
+	}
+	for (int32 i = 0; i < callbacks.Num(); i++) {
+		callbacks[i](ips);
+	}
+}
+
+void FSocketServerDNSResolver::configure(float timeoutInSecondsP, int32 retriesP, int32 negativeCacheTimeInSecondsP) {
+	FScopeLock lock(&resolverLock);
+	timeoutInSeconds = FMath::Max(timeoutInSecondsP, 0.1f);
+	retries = FMath::Clamp(retriesP, 0, 10);
+	negativeCacheTimeInSeconds = FMath::Max(negativeCacheTimeInSecondsP, 0);
+}
+
+void FSocketServerDNSResolver::clearCache() {
+	FScopeLock lock(&resolverLock);
+	cache.Empty();
+}
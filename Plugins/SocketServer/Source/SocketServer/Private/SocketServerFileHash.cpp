@@ -0,0 +1,110 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerFileHash.h"
+
+
+void FSocketServerFileHash::parseClientHash(const FString& clientHash, ESocketServerFileHashAlgorithm& algorithm, FString& hash) {
+	if (clientHash.StartsWith("crc32:")) {
+		algorithm = ESocketServerFileHashAlgorithm::E_CRC32;
+		hash = clientHash.RightChop(6).ToLower();
+	}
+	else {
+		algorithm = ESocketServerFileHashAlgorithm::E_MD5;
+		hash = clientHash;
+	}
+}
+
+void FSocketServerFileHash::reset(ESocketServerFileHashAlgorithm algorithmP) {
+	algorithm = algorithmP;
+	md5 = FMD5();
+	crc = 0;
+	bytes = 0;
+}
+
+void FSocketServerFileHash::update(const uint8* data, int64 dataSize) {
+	while (dataSize > 0) {
+		int32 blockSize = (int32)FMath::Min(dataSize, (int64)MAX_int32);
+		if (algorithm == ESocketServerFileHashAlgorithm::E_CRC32) {
+			crc = FCrc::MemCrc32(data, blockSize, crc);
+		}
+		else {
+			md5.Update(data, blockSize);
+		}
+		data += blockSize;
+		dataSize -= blockSize;
+		bytes += blockSize;
+	}
+}
+
+FString FSocketServerFileHash::finish() {
+	if (algorithm == ESocketServerFileHashAlgorithm::E_CRC32) {
+		return FString::Printf(TEXT("%08x"), crc);
+	}
+	uint8 Digest[16];
+	md5.Final(Digest);
+	FString MD5;
+	for (int32 i = 0; i < 16; i++) {
+		MD5 += FString::Printf(TEXT("%02x"), Digest[i]);
+	}
+	return MD5;
+}
+
+FString FSocketServerFileHash::getStatePath(const FString& filePath) {
+	return filePath + ".hashstate";
+}
+
+bool FSocketServerFileHash::resume(const FString& filePath, int64 fileSize) {
+	ESocketServerFileHashAlgorithm selected = algorithm;
+	reset(selected);
+	if (fileSize <= 0) {
+		return true;
+	}
+
+	//uint8 algorithm | int64 bytes | md5 context or crc
+	TArray<uint8> state;
+	if (FFileHelper::LoadFileToArray(state, *getStatePath(filePath), FILEREAD_Silent) && state.Num() == 9 + (int32)sizeof(FMD5) + 4 && state[0] == (uint8)selected) {
+		int64 stateBytes = 0;
+		FMemory::Memcpy(&stateBytes, state.GetData() + 1, 8);
+		if (stateBytes == fileSize) {
+			FMemory::Memcpy(&md5, state.GetData() + 9, sizeof(FMD5));
+			FMemory::Memcpy(&crc, state.GetData() + 9 + sizeof(FMD5), 4);
+			bytes = stateBytes;
+			return true;
+		}
+	}
+
+	//no usable state, read what is already on disk once
+	IFileHandle* reader = FPlatformFileManager::Get().GetPlatformFile().OpenRead(*filePath);
+	if (reader == nullptr) {
+		return false;
+	}
+	TArray<uint8> buffer;
+	buffer.SetNumUninitialized(1024 * 1024);
+	int64 left = fileSize;
+	bool readOkay = true;
+	while (left > 0 && readOkay) {
+		int32 blockSize = (int32)FMath::Min(left, (int64)buffer.Num());
+		readOkay = reader->Read(buffer.GetData(), blockSize);
+		if (readOkay) {
+			update(buffer.GetData(), blockSize);
+			left -= blockSize;
+		}
+	}
+	delete reader;
+	return readOkay;
+}
+
+void FSocketServerFileHash::saveState(const FString& filePath) {
+	TArray<uint8> state;
+	state.SetNumUninitialized(9 + sizeof(FMD5) + 4);
+	state[0] = (uint8)algorithm;
+	FMemory::Memcpy(state.GetData() + 1, &bytes, 8);
+	//FMD5 only holds its context, a plain copy restores it
+	FMemory::Memcpy(state.GetData() + 9, &md5, sizeof(FMD5));
+	FMemory::Memcpy(state.GetData() + 9 + sizeof(FMD5), &crc, 4);
+	FFileHelper::SaveArrayToFile(state, *getStatePath(filePath));
+}
+
+void FSocketServerFileHash::deleteState(const FString& filePath) {
+	IFileManager::Get().Delete(*getStatePath(filePath), false, true, true);
+}
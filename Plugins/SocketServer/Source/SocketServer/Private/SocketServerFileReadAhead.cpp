@@ -0,0 +1,169 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerFileReadAhead.h"
+
+#if SOCKETSERVER_WITH_NATIVE_FILES
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+FSocketServerFileReadAhead::FSocketServerFileReadAhead(FString filePathP, int32 bufferSizeP, int32 bufferCountP) :
+	filePath(filePathP),
+	bufferSize(FMath::Max(bufferSizeP, 1)) {
+
+	bufferCountP = FMath::Clamp(bufferCountP, 1, 64);
+	buffers.SetNum(bufferCountP);
+	for (int32 i = bufferCountP - 1; i >= 0; i--) {
+		freeBuffers.Add(i);
+	}
+	bufferReleased = FPlatformProcess::GetSynchEventFromPool(false);
+}
+
+FSocketServerFileReadAhead::~FSocketServerFileReadAhead() {
+	close();
+	FPlatformProcess::ReturnSynchEventToPool(bufferReleased);
+	bufferReleased = nullptr;
+}
+
+int32 FSocketServerFileReadAhead::acquire() {
+	while (!canceled) {
+		{
+			FScopeLock lock(&poolLock);
+			if (freeBuffers.Num() > 0) {
+				return freeBuffers.Pop(false);
+			}
+		}
+		bufferReleased->Wait();
+	}
+	return INDEX_NONE;
+}
+
+int32 FSocketServerFileReadAhead::read(int32 index) {
+	int32 bytes = (int32)FMath::Min((int64)bufferSize, size - position);
+	if (bytes <= 0) {
+		return -1;
+	}
+
+	//buffers only grow once to bufferSize, the last part of the file just shortens the view
+	TArray<uint8>& buffer = buffers[index];
+	buffer.SetNumUninitialized(bytes, false);
+	if (readFromFile(buffer.GetData(), bytes) != bytes) {
+		return -1;
+	}
+	position += bytes;
+
+	FScopeLock lock(&poolLock);
+	deliveredBuffers.Add(index);
+	return bytes;
+}
+
+const TArray<uint8>& FSocketServerFileReadAhead::getBuffer(int32 index) const {
+	return buffers[index];
+}
+
+void FSocketServerFileReadAhead::release(int32 index) {
+	{
+		FScopeLock lock(&poolLock);
+		if (deliveredBuffers.Remove(index) == 0) {
+			return;
+		}
+		freeBuffers.Add(index);
+	}
+	bufferReleased->Trigger();
+}
+
+bool FSocketServerFileReadAhead::releaseOldest() {
+	{
+		FScopeLock lock(&poolLock);
+		if (deliveredBuffers.Num() == 0) {
+			return false;
+		}
+		freeBuffers.Add(deliveredBuffers[0]);
+		deliveredBuffers.RemoveAt(0, 1, false);
+	}
+	bufferReleased->Trigger();
+	return true;
+}
+
+void FSocketServerFileReadAhead::cancel() {
+	canceled = true;
+	bufferReleased->Trigger();
+}
+
+#if SOCKETSERVER_WITH_NATIVE_FILES
+
+bool FSocketServerFileReadAhead::open(int64& fileSize) {
+	FString fullPath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*filePath);
+	fileHandle = ::open(TCHAR_TO_UTF8(*fullPath), O_RDONLY | O_CLOEXEC);
+	if (fileHandle < 0) {
+		return false;
+	}
+	size = lseek(fileHandle, 0, SEEK_END);
+	if (size <= 0) {
+		close();
+		return false;
+	}
+	fileSize = size;
+	posix_fadvise(fileHandle, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return true;
+}
+
+int64 FSocketServerFileReadAhead::readFromFile(uint8* data, int64 bytes) {
+	int64 readTotal = 0;
+	while (readTotal < bytes) {
+		ssize_t readBytes = pread(fileHandle, data + readTotal, (size_t)(bytes - readTotal), (off_t)(position + readTotal));
+		if (readBytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (readBytes <= 0) {
+			return -1;
+		}
+		readTotal += readBytes;
+	}
+
+	//the window behind this part is read by the kernel while the consumer works on the delivered buffers
+	int64 windowStart = position + bytes;
+	int64 window = FMath::Min((int64)bufferSize * buffers.Num(), size - windowStart);
+	if (window > 0) {
+		posix_fadvise(fileHandle, (off_t)windowStart, (off_t)window, POSIX_FADV_WILLNEED);
+	}
+	return readTotal;
+}
+
+void FSocketServerFileReadAhead::close() {
+	if (fileHandle >= 0) {
+		::close(fileHandle);
+		fileHandle = -1;
+	}
+}
+
+#else
+
+bool FSocketServerFileReadAhead::open(int64& fileSize) {
+	reader = FPlatformFileManager::Get().GetPlatformFile().OpenRead(*filePath);
+	if (reader == nullptr || reader->Size() <= 0) {
+		close();
+		return false;
+	}
+	size = reader->Size();
+	fileSize = size;
+	return true;
+}
+
+int64 FSocketServerFileReadAhead::readFromFile(uint8* data, int64 bytes) {
+	if (!reader->Read(data, bytes)) {
+		return -1;
+	}
+	return bytes;
+}
+
+void FSocketServerFileReadAhead::close() {
+	if (reader != nullptr) {
+		delete reader;
+		reader = nullptr;
+	}
+}
+
+#endif
@@ -0,0 +1,219 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerFileWriteBehind.h"
+
+#if SOCKETSERVER_WITH_NATIVE_FILES
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/falloc.h>
+#endif
+
+
+FSocketServerFileWriteBehind::FSocketServerFileWriteBehind(FString filePathP) :
+	filePath(filePathP) {
+	blocks.SetNum(blockCount);
+	for (int32 i = blockCount - 1; i >= 0; i--) {
+		freeBlocks.Add(i);
+	}
+	blockQueued = FPlatformProcess::GetSynchEventFromPool(false);
+	blockWritten = FPlatformProcess::GetSynchEventFromPool(false);
+}
+
+FSocketServerFileWriteBehind::~FSocketServerFileWriteBehind() {
+	close();
+	FPlatformProcess::ReturnSynchEventToPool(blockQueued);
+	FPlatformProcess::ReturnSynchEventToPool(blockWritten);
+	blockQueued = nullptr;
+	blockWritten = nullptr;
+}
+
+bool FSocketServerFileWriteBehind::write(const uint8* data, int32 dataSize) {
+	while (dataSize > 0) {
+		if (failed) {
+			return false;
+		}
+		if (currentBlock == INDEX_NONE) {
+			{
+				FScopeLock lock(&blockLock);
+				if (freeBlocks.Num() > 0) {
+					currentBlock = freeBlocks.Pop(false);
+				}
+			}
+			if (currentBlock == INDEX_NONE) {
+				//the disk is slower than the network
+				blockWritten->Wait();
+				continue;
+			}
+		}
+
+		TArray<uint8>& block = blocks[currentBlock];
+		int32 bytes = FMath::Min(dataSize, blockSize - block.Num());
+		block.Append(data, bytes);
+		data += bytes;
+		dataSize -= bytes;
+		if (block.Num() == blockSize) {
+			submitCurrentBlock();
+		}
+	}
+	return failed == false;
+}
+
+void FSocketServerFileWriteBehind::submitCurrentBlock() {
+	if (currentBlock == INDEX_NONE) {
+		return;
+	}
+	if (blocks[currentBlock].Num() == 0) {
+		FScopeLock lock(&blockLock);
+		freeBlocks.Add(currentBlock);
+	}
+	else {
+		FScopeLock lock(&blockLock);
+		queuedBlocks.Add(currentBlock);
+	}
+	currentBlock = INDEX_NONE;
+	blockQueued->Trigger();
+}
+
+bool FSocketServerFileWriteBehind::flush() {
+	submitCurrentBlock();
+	while (failed == false) {
+		{
+			FScopeLock lock(&blockLock);
+			if (freeBlocks.Num() == blockCount) {
+				break;
+			}
+		}
+		blockWritten->Wait();
+	}
+	return failed == false;
+}
+
+bool FSocketServerFileWriteBehind::close() {
+	if (thread != nullptr) {
+		flush();
+		{
+			FScopeLock lock(&blockLock);
+			stopping = true;
+		}
+		blockQueued->Trigger();
+		thread->WaitForCompletion();
+		delete thread;
+		thread = nullptr;
+	}
+	closeFile();
+	return failed == false;
+}
+
+uint32 FSocketServerFileWriteBehind::Run() {
+	while (true) {
+		int32 index = INDEX_NONE;
+		{
+			FScopeLock lock(&blockLock);
+			if (queuedBlocks.Num() > 0) {
+				index = queuedBlocks[0];
+				queuedBlocks.RemoveAt(0, 1, false);
+			}
+			else if (stopping) {
+				break;
+			}
+		}
+		if (index == INDEX_NONE) {
+			blockQueued->Wait();
+			continue;
+		}
+
+		TArray<uint8>& block = blocks[index];
+		if (failed == false && writeToFile(block.GetData(), block.Num()) == false) {
+			UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't write to %s."), *filePath);
+			failed = true;
+		}
+		block.Reset();
+		{
+			FScopeLock lock(&blockLock);
+			freeBlocks.Add(index);
+		}
+		blockWritten->Trigger();
+	}
+	return 0;
+}
+
+#if SOCKETSERVER_WITH_NATIVE_FILES
+
+bool FSocketServerFileWriteBehind::open(bool append, int64 preallocateSize, int64& existingSize) {
+	FString fullPath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForWrite(*filePath);
+	fileHandle = ::open(TCHAR_TO_UTF8(*fullPath), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0644);
+	if (fileHandle < 0) {
+		return false;
+	}
+	existingSize = lseek(fileHandle, 0, SEEK_END);
+	if (existingSize < 0) {
+		closeFile();
+		return false;
+	}
+	writePosition = existingSize;
+
+	//the file keeps its size so a resumed upload still sees how much was received. not every file system supports it
+	if (preallocateSize > existingSize) {
+		fallocate(fileHandle, FALLOC_FL_KEEP_SIZE, (off_t)existingSize, (off_t)(preallocateSize - existingSize));
+	}
+
+	FString threadName = "FSocketServerFileWriteBehind" + FGuid::NewGuid().ToString();
+	thread = FRunnableThread::Create(this, *threadName, 0, EThreadPriority::TPri_Normal);
+	return true;
+}
+
+bool FSocketServerFileWriteBehind::writeToFile(const uint8* data, int32 dataSize) {
+	int32 writtenTotal = 0;
+	while (writtenTotal < dataSize) {
+		ssize_t written = pwrite(fileHandle, data + writtenTotal, (size_t)(dataSize - writtenTotal), (off_t)(writePosition + writtenTotal));
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+		writtenTotal += written;
+	}
+	writePosition += writtenTotal;
+	return true;
+}
+
+void FSocketServerFileWriteBehind::closeFile() {
+	if (fileHandle >= 0) {
+		::close(fileHandle);
+		fileHandle = -1;
+	}
+}
+
+#else
+
+bool FSocketServerFileWriteBehind::open(bool append, int64 preallocateSize, int64& existingSize) {
+	writer = FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*filePath, append, false);
+	if (writer == nullptr) {
+		return false;
+	}
+	existingSize = writer->Size();
+	writePosition = existingSize;
+
+	FString threadName = "FSocketServerFileWriteBehind" + FGuid::NewGuid().ToString();
+	thread = FRunnableThread::Create(this, *threadName, 0, EThreadPriority::TPri_Normal);
+	return true;
+}
+
+bool FSocketServerFileWriteBehind::writeToFile(const uint8* data, int32 dataSize) {
+	if (!writer->Write(data, dataSize)) {
+		return false;
+	}
+	writePosition += dataSize;
+	return true;
+}
+
+void FSocketServerFileWriteBehind::closeFile() {
+	if (writer != nullptr) {
+		delete writer;
+		writer = nullptr;
+	}
+}
+
+#endif
@@ -0,0 +1,71 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Sockets.h"
+#include "SocketServerUDPSessionTable.h"
+
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+#include "BSDSockets/SocketsBSD.h"
+#include "BSDSockets/IPAddressBSD.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <errno.h>
+
+/*
+* Access to the OS socket behind an FSocket for syscalls the engine does not wrap (recvmmsg, ...).
+* Only used on platforms whose socket subsystem is BSD based.
+*/
+class FSocketServerNativeSocket {
+
+public:
+
+	static int getHandle(FSocket* socket) {
+		if (socket == nullptr) {
+			return -1;
+		}
+		return (int)static_cast<FSocketBSD*>(socket)->GetNativeSocket();
+	}
+
+	static void toInternetAddr(const sockaddr_storage& storage, FInternetAddr& addr) {
+		FInternetAddrBSD& addrBSD = static_cast<FInternetAddrBSD&>(addr);
+		addrBSD.SetIp(storage);
+		if (storage.ss_family == AF_INET6) {
+			addrBSD.SetPort(ntohs(((const sockaddr_in6*)&storage)->sin6_port));
+		}
+		else {
+			addrBSD.SetPort(ntohs(((const sockaddr_in*)&storage)->sin_port));
+		}
+	}
+
+	//asks the kernel to attach its drop counter to every received datagram
+	static void enableReceiveQueueOverflow(FSocket* socket) {
+#ifdef SO_RXQ_OVFL
+		int enable = 1;
+		setsockopt(getHandle(socket), SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+#endif
+	}
+
+	static bool getReceiveQueueOverflow(struct msghdr& message, uint32& drops) {
+#ifdef SO_RXQ_OVFL
+		for (struct cmsghdr* control = CMSG_FIRSTHDR(&message); control != nullptr; control = CMSG_NXTHDR(&message, control)) {
+			if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SO_RXQ_OVFL) {
+				FMemory::Memcpy(&drops, CMSG_DATA(control), sizeof(uint32));
+				return true;
+			}
+		}
+#endif
+		return false;
+	}
+
+	static FSocketServerUDPAddressKey toAddressKey(const sockaddr_storage& storage) {
+		if (storage.ss_family == AF_INET6) {
+			const sockaddr_in6* addr6 = (const sockaddr_in6*)&storage;
+			return FSocketServerUDPAddressKey((const uint8*)&addr6->sin6_addr, 16, ntohs(addr6->sin6_port));
+		}
+		const sockaddr_in* addr4 = (const sockaddr_in*)&storage;
+		return FSocketServerUDPAddressKey((const uint8*)&addr4->sin_addr, 4, ntohs(addr4->sin_port));
+	}
+};
+#endif
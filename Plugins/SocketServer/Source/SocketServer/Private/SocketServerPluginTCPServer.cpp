@@ -1,6 +1,7 @@
 // Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
 
 #include "SocketServerPluginTCPServer.h"
+#include "SocketServerTCPEventLoop.h"
 
 
 USocketServerPluginTCPServer::USocketServerPluginTCPServer(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer) {
@@ -8,7 +9,7 @@ USocketServerPluginTCPServer::USocketServerPluginTCPServer(const FObjectInitiali
 }
 
 
-void USocketServerPluginTCPServer::startTCPServer(IpAndPortStruct ipStructP,FString IPPP, int32 portP, EReceiveFilterServer receiveFilterP, FString serverIDP, bool isFileServer, FString Aes256bitKeyP, bool resumeFilesP) {
+void USocketServerPluginTCPServer::startTCPServer(IpAndPortStruct ipStructP,FString IPPP, int32 portP, EReceiveFilterServer receiveFilterP, FString serverIDP, bool isFileServer, FString Aes256bitKeyP, bool resumeFilesP, int32 ioThreadsP, bool preallocateFilesP) {
 	ipAndPortStruct = ipStructP;
 	serverPort = portP;
 	receiveFilter = receiveFilterP;
@@ -16,6 +17,13 @@ void USocketServerPluginTCPServer::startTCPServer(IpAndPortStruct ipStructP,FStr
 	fileServer = isFileServer;
 	aesKey = Aes256bitKeyP;
 	resumeFiles = resumeFilesP;
+	preallocateFiles = preallocateFilesP;
+	//the file server protocol relies on blocking sockets
+	ioThreads = fileServer ? 0 : FMath::Clamp(ioThreadsP, 0, 64);
+	if (FSocketServerTCPEventLoop::isSupported() == false) {
+		ioThreads = 0;
+	}
+	eventLoopStopping = false;
 	serverThread = new FServerTCPThread(this, receiveFilter);
 }
 
@@ -33,6 +41,14 @@ void USocketServerPluginTCPServer::stopTCPServer() {
 	}
 	toRemoveSessionKeys.Empty();
 
+	//closes the files, the sidecars stay so the uploads can resume after a restart
+	{
+		FScopeLock lock(&chunkedTransfersLock);
+		chunkedTransfers.Empty();
+	}
+
+	stopEventLoop();
+
 	if (serverThread != nullptr) {
 		serverThread->stopThread();
 		serverThread = nullptr;
@@ -47,7 +63,11 @@ void USocketServerPluginTCPServer::sendTCPMessage(TArray<FString> clientSessionI
 			FClientSocketSession session = *sessionPointer;
 			if (session.protocol == EServerSocketConnectionProtocol::E_TCP) {
 
-				if (session.sendThread == nullptr) {
+				FScopeLock lock(&eventLoopLock);
+				if (eventLoop != nullptr) {
+					eventLoop->send(sessionID, message, byteArray);
+				}
+				else if (session.sendThread == nullptr) {
 					UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: The thread for sending data has not yet been initialized. Data is not sent."));
 				}
 				else {
@@ -64,7 +84,11 @@ void USocketServerPluginTCPServer::sendTCPMessageToClient(FString clientSessionI
 		FClientSocketSession session = *sessionPointer;
 		if (session.protocol == EServerSocketConnectionProtocol::E_TCP) {
 
-			if (session.sendThread == nullptr) {
+			FScopeLock lock(&eventLoopLock);
+			if (eventLoop != nullptr) {
+				eventLoop->send(clientSessionID, message, byteArray);
+			}
+			else if (session.sendThread == nullptr) {
 				UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: The thread for sending data has not yet been initialized. Data is not sent."));
 			}
 			else {
@@ -98,14 +122,19 @@ bool USocketServerPluginTCPServer::hasResume() {
 	return resumeFiles;
 }
 
+bool USocketServerPluginTCPServer::hasPreallocation() {
+	return preallocateFiles;
+}
+
 
 void USocketServerPluginTCPServer::initTCPClientThreads(FClientSocketSession sessionP, EReceiveFilterServer receiveFilterP){
 	if (fileServer) {
 		TCPFileHandlerThread = new FTCPFileHandlerThread(this, sessionP);
 	}
 	else {
-		sessionP.recieverThread = new FTCPClientReceiveDataFromServerThread(this, sessionP, receiveFilterP);
+		//the receive thread answers RCON packets through the send thread
 		sessionP.sendThread = new FTCPClientSendDataToServerThread(this, sessionP);
+		sessionP.recieverThread = new FTCPClientReceiveDataFromServerThread(this, sessionP, receiveFilterP);
 	}
 	
 	addClientSession(sessionP);
@@ -124,6 +153,12 @@ FClientSocketSession* USocketServerPluginTCPServer::getClientSession(FString key
 
 void USocketServerPluginTCPServer::removeClientSession(FString key) {
 	//close client socket
+	{
+		FScopeLock lock(&eventLoopLock);
+		if (eventLoop != nullptr) {
+			eventLoop->closeConnection(key);
+		}
+	}
 	if (clientSessions.Find(key) != nullptr) {
 		FClientSocketSession session = *clientSessions.Find(key);
 
@@ -189,6 +224,52 @@ void USocketServerPluginTCPServer::getMD5FromFile(FString filePathP, bool& succe
 	UFileFunctionsSocketServer::getMD5FromFileAbsolutePath(filePathP, success, MD5);
 }
 
+FSocketServerChunkedTransferPtr USocketServerPluginTCPServer::openChunkedTransfer(FString token, FString filePath, int64 fileSize, int32 chunkSize) {
+	if (!FSocketServerChunkedTransfer::isValidSize(fileSize, chunkSize)) {
+		return nullptr;
+	}
+	FScopeLock lock(&chunkedTransfersLock);
+	closeIdleChunkedTransfers();
+	FSocketServerChunkedTransferPtr* existing = chunkedTransfers.Find(token);
+	if (existing != nullptr) {
+		//another connection already started this upload
+		if ((*existing)->getFilePath().Equals(filePath) && (*existing)->getFileSize() == fileSize) {
+			return *existing;
+		}
+		return nullptr;
+	}
+	FSocketServerChunkedTransferPtr transfer = MakeShared<FSocketServerChunkedTransfer, ESPMode::ThreadSafe>(filePath, fileSize, chunkSize);
+	if (!transfer->open()) {
+		return nullptr;
+	}
+	chunkedTransfers.Add(token, transfer);
+	return transfer;
+}
+
+FSocketServerChunkedTransferPtr USocketServerPluginTCPServer::getChunkedTransfer(FString token) {
+	FScopeLock lock(&chunkedTransfersLock);
+	FSocketServerChunkedTransferPtr* found = chunkedTransfers.Find(token);
+	FSocketServerChunkedTransferPtr transfer = found != nullptr ? *found : nullptr;
+	//the reference above keeps the requested transfer open
+	closeIdleChunkedTransfers();
+	return transfer;
+}
+
+bool USocketServerPluginTCPServer::removeChunkedTransfer(FString token) {
+	FScopeLock lock(&chunkedTransfersLock);
+	return chunkedTransfers.Remove(token) > 0;
+}
+
+void USocketServerPluginTCPServer::closeIdleChunkedTransfers() {
+	for (auto it = chunkedTransfers.CreateIterator(); it; ++it) {
+		//a connection that still holds the transfer is in the middle of a chunk
+		if (it.Value().IsUnique() && it.Value()->getIdleSeconds() > FSocketServerChunkedTransfer::idleTimeoutInSeconds) {
+			UE_LOG(LogTemp, Display, TEXT("SimpleSocketServer Plugin: Closed the idle upload of %s."), *it.Value()->getFilePath());
+			it.RemoveCurrent();
+		}
+	}
+}
+
 void USocketServerPluginTCPServer::deleteFile(FString filePathP) {
 	UFileFunctionsSocketServer::deleteFileAbsolutePath(filePathP);
 }
@@ -197,6 +278,36 @@ bool USocketServerPluginTCPServer::isRun(){
 	return run;
 }
 
+bool USocketServerPluginTCPServer::startEventLoop(FSocket* listenerSocket) {
+	FScopeLock lock(&eventLoopLock);
+	if (ioThreads < 1 || eventLoop != nullptr || eventLoopStopping) {
+		return false;
+	}
+	FSocketServerTCPEventLoop* loop = new FSocketServerTCPEventLoop(this, receiveFilter, ioThreads);
+	if (loop->start(listenerSocket) == false) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: TCP event loop not started. Using threads per connection."));
+		delete loop;
+		return false;
+	}
+	eventLoop = loop;
+	return true;
+}
+
+void USocketServerPluginTCPServer::stopEventLoop() {
+	FSocketServerTCPEventLoop* loop = nullptr;
+	{
+		FScopeLock lock(&eventLoopLock);
+		eventLoopStopping = true;
+		loop = eventLoop;
+		eventLoop = nullptr;
+	}
+	//the io threads post to the game thread and never take eventLoopLock, stopping them outside of it is safe
+	if (loop != nullptr) {
+		loop->stop();
+		delete loop;
+	}
+}
+
 int64 USocketServerPluginTCPServer::fileSize(FString filePathP) {
 	return UFileFunctionsSocketServer::fileSizeAbsolutePath(filePathP);
 }
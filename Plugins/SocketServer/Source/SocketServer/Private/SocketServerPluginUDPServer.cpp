@@ -1,6 +1,7 @@
 // Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
 
 #include "SocketServerPluginUDPServer.h"
+#include "SocketServerNativeSocket.h"
 
 
 USocketServerPluginUDPServer::USocketServerPluginUDPServer(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer) {
@@ -9,7 +10,8 @@ USocketServerPluginUDPServer::USocketServerPluginUDPServer(const FObjectInitiali
 
 
 void USocketServerPluginUDPServer::startUDPServer(IpAndPortStruct ipStructP,FString IPP, int32 portP, bool multicastP,
-	EReceiveFilterServer receiveFilterP, FString serverIDP, int32 maxPacketSizeP) {
+	EReceiveFilterServer receiveFilterP, FString serverIDP, int32 maxPacketSizeP, int32 receiveThreadsP,
+	int32 receiveBufferSizeP, int32 sendBufferSizeP) {
 
 	ipAndPortStruct = ipStructP;
 	serverIP = IPP;
@@ -19,13 +21,33 @@ void USocketServerPluginUDPServer::startUDPServer(IpAndPortStruct ipStructP,FStr
 	maxPacketSize = maxPacketSizeP;
 	if (maxPacketSize < 1 || maxPacketSize > 65507)
 		maxPacketSize = 65507;
-	serverThread = new FServerUDPThread(this, multicastP);
+
+	receiveBufferSize = FMath::Max(receiveBufferSizeP, 0);
+	sendBufferSize = FMath::Max(sendBufferSizeP, 0);
+
+	receiveThreads = FMath::Clamp(receiveThreadsP, 1, 64);
+#if !SOCKETSERVER_WITH_NATIVE_SOCKETS
+	if (receiveThreads > 1) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Several UDP receive threads need SO_REUSEPORT which is only supported on Linux. Using one thread."));
+		receiveThreads = 1;
+	}
+#endif
+	if (multicastP && receiveThreads > 1) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Multicast servers use one receive thread."));
+		receiveThreads = 1;
+	}
+
+	for (int32 i = 0; i < receiveThreads; i++) {
+		serverThreads.Add(new FServerUDPThread(this, multicastP, i));
+	}
 	sendThread = new  FUDPClientSendDataToServerThread(this);
 
 }
 
 void USocketServerPluginUDPServer::stopUDPServer() {
 
+	setDatagramHandler(nullptr);
+
 	TArray<FString> toRemoveSessionKeys;
 	for (auto& element : getClientSessions()) {
 		toRemoveSessionKeys.Add(element.Key);
@@ -36,14 +58,21 @@ void USocketServerPluginUDPServer::stopUDPServer() {
 	toRemoveSessionKeys.Empty();
 
 	if (sendThread != nullptr) {
-		sendThread->stopThread();
+		//the send thread uses the client sockets that are destroyed below
+		sendThread->stopThreadAndWait();
+		delete sendThread;
 		sendThread = nullptr;
 	}
 
-	if (serverThread != nullptr) {
+	//every shard closes and destroys its own socket when it leaves the receive loop, shard 0 also the one in socket
+	for (FServerUDPThread* serverThread : serverThreads) {
 		serverThread->stopThread();
-		serverThread = nullptr;
 	}
+	for (FServerUDPThread* serverThread : serverThreads) {
+		serverThread->stopThreadAndWait();
+		delete serverThread;
+	}
+	serverThreads.Empty();
 
 	if (socketReceiver != nullptr) {
 		socketReceiver->Stop();
@@ -51,45 +80,47 @@ void USocketServerPluginUDPServer::stopUDPServer() {
 		socketReceiver = nullptr;
 	}
 
-	if (socket && socket != nullptr) {
-		socket->Close();
-		socket = nullptr;
+	socket = nullptr;
+
+	FScopeLock lock(&clientSocketLock);
+	ISocketSubsystem* socketSubsystem = USocketServerBPLibrary::getSocketSubSystem();
+	if (clientSocketIPv4 != nullptr) {
+		clientSocketIPv4->Close();
+		socketSubsystem->DestroySocket(clientSocketIPv4);
+		clientSocketIPv4 = nullptr;
+	}
+	if (clientSocketIPv6 != nullptr) {
+		clientSocketIPv6->Close();
+		socketSubsystem->DestroySocket(clientSocketIPv6);
+		clientSocketIPv6 = nullptr;
 	}
 }
 
-void USocketServerPluginUDPServer::sendUDPMessage(TArray<FString> clientSessionIDs, FString message, TArray<uint8> byteArray, bool asynchronous, ESocketServerUDPSocketType socketType) {
+void USocketServerPluginUDPServer::sendUDPMessage(TArray<FString> clientSessionIDs, FString message, TArray<uint8> byteArray, bool asynchronous, ESocketServerUDPSocketType socketType,
+	ESocketServerUDPSendPriority priority) {
 	for (auto& sessionID : clientSessionIDs) {
-		FClientSocketSession* sessionPointer = clientSessions.Find(sessionID);
-		if (sessionPointer != nullptr) {
-			FClientSocketSession session = *sessionPointer;
+		FClientSocketSessionPtr sessionPointer = clientSessions.findByID(sessionID);
+		if (sessionPointer.IsValid()) {
+			const FClientSocketSession& session = *sessionPointer;
 			if (session.protocol == EServerSocketConnectionProtocol::E_UDP) {
 
 
-				FSocket* socketUDP = socket;
-				if (socketUDP == nullptr || socketType == ESocketServerUDPSocketType::E_SSS_CLIENT)
-					socketUDP = session.socket;
+				FSocketServerRemoteAddressPtr addr = session.addr;
+				if (addr.IsValid() == false) {
+					addr = resolveAddr(session.ip, session.port);
+				}
+
+				FSocket* socketUDP = session.socket;
+				if ((socketUDP == nullptr || socketType == ESocketServerUDPSocketType::E_SSS_CLIENT) && addr.IsValid())
+					socketUDP = getClientSocket(*addr->addr);
 
 				if (asynchronous) {
-					sendThread->sendMessage(session.ip, session.port, message, byteArray, socketUDP);
-					return;
+					sendThread->sendMessage(addr, message, byteArray, socketUDP, session.counters, priority);
+					continue;
 				}
 
-				int32 sent = 0;
-
-				TSharedRef<FInternetAddr> addr = USocketServerBPLibrary::getSocketSubSystem()->CreateInternetAddr();
-				bool bIsValid;
-				addr->SetIp(*session.ip, bIsValid);
-				addr->SetPort(session.port);
-				if (bIsValid) {
-					if (byteArray.Num() > 0) {
-						sendBytes(socketUDP, byteArray, sent, addr);
-					}
-
-					if (message.Len() > 0) {
-						FTCHARToUTF8 Convert(*message);
-						byteArray.Append((uint8*)Convert.Get(), Convert.Length());
-						sendBytes(socketUDP, byteArray, sent, addr);
-					}
+				if (addr.IsValid()) {
+					sendMessageNow(socketUDP, *addr->addr, message, byteArray, session.counters.Get());
 				}
 				else {
 					UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Can't send data. Wrong adress."));
@@ -107,40 +138,30 @@ void USocketServerPluginUDPServer::sendUDPMessage(TArray<FString> clientSessionI
 }
 
 
-void USocketServerPluginUDPServer::sendUDPMessageToClient(FString clientSessionID, FString message, TArray<uint8> byteArray, bool asynchronous, ESocketServerUDPSocketType socketType) {
+void USocketServerPluginUDPServer::sendUDPMessageToClient(FString clientSessionID, FString message, TArray<uint8> byteArray, bool asynchronous, ESocketServerUDPSocketType socketType,
+	ESocketServerUDPSendPriority priority) {
 
-	FClientSocketSession* sessionPointer = clientSessions.Find(clientSessionID);
-	if (sessionPointer != nullptr) {
-		FClientSocketSession session = *sessionPointer;
+	FClientSocketSessionPtr sessionPointer = clientSessions.findByID(clientSessionID);
+	if (sessionPointer.IsValid()) {
+		const FClientSocketSession& session = *sessionPointer;
 		if (session.protocol == EServerSocketConnectionProtocol::E_UDP) {
 			
-			FSocket* socketUDP = socket;
-			if (socketUDP == nullptr || socketType == ESocketServerUDPSocketType::E_SSS_CLIENT)
-				socketUDP = session.socket;
+			FSocketServerRemoteAddressPtr addr = session.addr;
+			if (addr.IsValid() == false) {
+				addr = resolveAddr(session.ip, session.port);
+			}
+
+			FSocket* socketUDP = session.socket;
+			if ((socketUDP == nullptr || socketType == ESocketServerUDPSocketType::E_SSS_CLIENT) && addr.IsValid())
+				socketUDP = getClientSocket(*addr->addr);
 
 			if (asynchronous) {
-				sendThread->sendMessage(session.ip, session.port, message, byteArray, socketUDP);
+				sendThread->sendMessage(addr, message, byteArray, socketUDP, session.counters, priority);
 				return;
 			}
 
-			int32 sent = 0;
-
-			TSharedRef<FInternetAddr> addr = USocketServerBPLibrary::getSocketSubSystem()->CreateInternetAddr();
-			bool bIsValid;
-			addr->SetIp(*session.ip, bIsValid);
-			addr->SetPort(session.port);
-			if (bIsValid) {
-				if (byteArray.Num() > 0) {
-					sendBytes(socketUDP, byteArray, sent, addr);
-				}
-
-				if (message.Len() > 0) {
-					FTCHARToUTF8 Convert(*message);
-					byteArray.Append((uint8*)Convert.Get(), Convert.Length());
-					sendBytes(socketUDP, byteArray, sent, addr);
-				}
-
-				
+			if (addr.IsValid()) {
+				sendMessageNow(socketUDP, *addr->addr, message, byteArray, session.counters.Get());
 			}
 			else {
 				UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Can't send data. Wrong adress."));
@@ -159,7 +180,6 @@ void USocketServerPluginUDPServer::sendUDPMessageToClient(FString clientSessionI
 
 
 void USocketServerPluginUDPServer::sendUDPMessageTo(FString ip, int32 port, FString message, TArray<uint8> byteArray, bool asynchronous) {
-	int32 sent = 0;
 
 	FSocket* socketUDP = socket;
 	if (socketUDP == nullptr) {
@@ -167,67 +187,279 @@ void USocketServerPluginUDPServer::sendUDPMessageTo(FString ip, int32 port, FStr
 		return;
 	}
 
+	FSocketServerRemoteAddressPtr addr = resolveAddr(ip, port);
+
 	if (asynchronous) {
-		sendThread->sendMessage(ip,port,message, byteArray,socketUDP);
+		sendThread->sendMessage(addr, message, byteArray, socketUDP);
 		return;
 	}
 
+	if (addr.IsValid()) {
+		sendMessageNow(socketUDP, *addr->addr, message, byteArray);
+	}
+	else {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Can't send data. Wrong adress."));
+	}
+}
+
+void USocketServerPluginUDPServer::sendMessageNow(FSocket* socketUDP, const FInternetAddr& addr, const FString& message, const TArray<uint8>& byteArray,
+	FSocketServerSessionCounters* counters) {
+	if (byteArray.Num() > 0) {
+		bool sent = sendBytes(socketUDP, byteArray.GetData(), byteArray.Num(), addr);
+		if (counters != nullptr) {
+			sent ? counters->sent(byteArray.Num()) : counters->sendFailed();
+		}
+	}
+
+	if (message.Len() > 0) {
+		FTCHARToUTF8 Convert(*message);
+		bool sent = sendBytes(socketUDP, (const uint8*)Convert.Get(), Convert.Length(), addr);
+		if (counters != nullptr) {
+			sent ? counters->sent(Convert.Length()) : counters->sendFailed();
+		}
+	}
+}
+
+FSocketServerRemoteAddressPtr USocketServerPluginUDPServer::resolveAddr(FString ip, int32 port) {
 	TSharedRef<FInternetAddr> addr = USocketServerBPLibrary::getSocketSubSystem()->CreateInternetAddr();
-	bool bIsValid;
+	bool bIsValid = false;
 	addr->SetIp(*ip, bIsValid);
 	addr->SetPort(port);
-	if (bIsValid) {
+	if (bIsValid == false) {
+		return nullptr;
+	}
+	return MakeShared<const FSocketServerRemoteAddress, ESPMode::ThreadSafe>(addr);
+}
 
-		if (byteArray.Num() > 0) {
-			sendBytes(socketUDP, byteArray, sent, addr);
+void USocketServerPluginUDPServer::getSendLatency(float& p50, float& p99) {
+	p50 = 0.f;
+	p99 = 0.f;
+	if (sendThread != nullptr) {
+		sendThread->getLatency(p50, p99);
+	}
+}
+
+void USocketServerPluginUDPServer::getSendLatency(ESocketServerUDPSendPriority priority, float& p50, float& p99) {
+	p50 = 0.f;
+	p99 = 0.f;
+	if (sendThread != nullptr) {
+		sendThread->getLatency(priority, p50, p99);
+	}
+}
+
+void USocketServerPluginUDPServer::setSendScheduling(ESocketServerUDPSendScheduling scheduling, float bulkDeadlineMilliseconds) {
+	if (sendThread != nullptr) {
+		sendThread->setScheduling(scheduling, bulkDeadlineMilliseconds);
+	}
+}
+
+
+
+void USocketServerPluginUDPServer::receiveDatagrams(FSocket* listenerSocket, int32 shardIndex, const bool& run) {
+	ISocketSubsystem* socketSubsystem = USocketServerBPLibrary::getSocketSubSystem();
+	TSharedRef<FInternetAddr> sender = socketSubsystem->CreateInternetAddr();
+	FTimespan threadWaitTime = FTimespan::FromMilliseconds(100);
+	FSocketServerUDPReceiveContext receiveContext;
+	receiveContext.socket = listenerSocket;
+	receiveContext.shardIndex = shardIndex;
+
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+	//one slab for the whole batch. every datagram gets a slot with the maximum udp payload size so nothing is truncated
+	const int32 slotSize = 65507;
+	TArray<uint8> slab;
+	slab.SetNumUninitialized(receiveBatchSize * slotSize);
+
+	struct mmsghdr messages[receiveBatchSize];
+	struct iovec iovecs[receiveBatchSize];
+	sockaddr_storage addresses[receiveBatchSize];
+	//room for the SO_RXQ_OVFL counter the kernel attaches to every datagram
+	const int32 controlSize = CMSG_SPACE(sizeof(uint32));
+	TArray<uint8, TAlignedHeapAllocator<alignof(cmsghdr)>> controls;
+	controls.SetNumZeroed(receiveBatchSize * controlSize);
+	FMemory::Memzero(messages, sizeof(messages));
+
+	for (int32 i = 0; i < receiveBatchSize; i++) {
+		iovecs[i].iov_base = slab.GetData() + (i * slotSize);
+		iovecs[i].iov_len = slotSize;
+		messages[i].msg_hdr.msg_name = &addresses[i];
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int nativeSocket = FSocketServerNativeSocket::getHandle(listenerSocket);
+
+	while (run) {
+		if (!listenerSocket->Wait(ESocketWaitConditions::WaitForRead, threadWaitTime)) {
+			continue;
 		}
 
-		if (message.Len() > 0) {
-			FTCHARToUTF8 Convert(*message);
-			byteArray.Append((uint8*)Convert.Get(), Convert.Length());
-			sendBytes(socketUDP, byteArray, sent, addr);
+		//drain the socket. a short batch means the kernel queue is empty
+		while (run) {
+			//the kernel overwrites the lengths, they have to be reset before every call
+			for (int32 i = 0; i < receiveBatchSize; i++) {
+				messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+				messages[i].msg_hdr.msg_control = controls.GetData() + (i * controlSize);
+				messages[i].msg_hdr.msg_controllen = controlSize;
+			}
+
+			int received = recvmmsg(nativeSocket, messages, receiveBatchSize, MSG_DONTWAIT, nullptr);
+			if (received <= 0) {
+				if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+					UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: recvmmsg failed with error %i on server %s"), errno, *serverID);
+				}
+				break;
+			}
+
+			int64 batchBytes = 0;
+			for (int32 i = 0; i < received; i++) {
+				batchBytes += messages[i].msg_len;
+				FSocketServerNativeSocket::toInternetAddr(addresses[i], sender.Get());
+				UDPReceiverSocketServerPlugin(slab.GetData() + (i * slotSize), (int32)messages[i].msg_len, sender.Get(),
+					FSocketServerNativeSocket::toAddressKey(addresses[i]), receiveContext);
+			}
+			datagramsReceived.fetch_add(received, std::memory_order_relaxed);
+			bytesReceived.fetch_add(batchBytes, std::memory_order_relaxed);
+
+			//the newest counter of the batch covers everything dropped before it
+			uint32 kernelDrops = 0;
+			if (FSocketServerNativeSocket::getReceiveQueueOverflow(messages[received - 1].msg_hdr, kernelDrops) && kernelDrops != receiveContext.kernelDropCounter) {
+				kernelReceiveDrops.fetch_add((uint32)(kernelDrops - receiveContext.kernelDropCounter), std::memory_order_relaxed);
+				receiveContext.kernelDropCounter = kernelDrops;
+			}
+			int32 droppedMessages = receiveContext.reassembler.getDroppedMessages();
+			if (droppedMessages != receiveContext.reportedReassemblyDrops) {
+				reassemblyDrops.fetch_add(droppedMessages - receiveContext.reportedReassemblyDrops, std::memory_order_relaxed);
+				receiveContext.reportedReassemblyDrops = droppedMessages;
+			}
+
+			if (received < receiveBatchSize) {
+				break;
+			}
 		}
-		
 	}
-	else {
-		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Can't send data. Wrong adress."));
+#else
+	//the socket is non blocking. RecvFrom returns false as soon as the queue is empty so one reused buffer is enough
+	TArray<uint8> buffer;
+	buffer.SetNumUninitialized(65507);
+
+	while (run) {
+		if (!listenerSocket->Wait(ESocketWaitConditions::WaitForRead, threadWaitTime)) {
+			continue;
+		}
+
+		int32 read = 0;
+		while (run && listenerSocket->RecvFrom(buffer.GetData(), buffer.Num(), read, sender.Get())) {
+			datagramsReceived.fetch_add(1, std::memory_order_relaxed);
+			bytesReceived.fetch_add(read, std::memory_order_relaxed);
+			UDPReceiverSocketServerPlugin(buffer.GetData(), read, sender.Get(), FSocketServerUDPAddressKey(sender.Get()), receiveContext);
+		}
+
+		int32 droppedMessages = receiveContext.reassembler.getDroppedMessages();
+		if (droppedMessages != receiveContext.reportedReassemblyDrops) {
+			reassemblyDrops.fetch_add(droppedMessages - receiveContext.reportedReassemblyDrops, std::memory_order_relaxed);
+			receiveContext.reportedReassemblyDrops = droppedMessages;
+		}
 	}
+#endif
 }
 
+void USocketServerPluginUDPServer::UDPReceiverSocketServerPlugin(FArrayReaderPtr& ArrayReaderPtr, TSharedRef<FInternetAddr> remoteAddress) {
+	UDPReceiverSocketServerPlugin(ArrayReaderPtr->GetData(), ArrayReaderPtr->Num(), remoteAddress.Get());
+}
 
+void USocketServerPluginUDPServer::UDPReceiverSocketServerPlugin(const uint8* data, int32 dataSize, const FInternetAddr& remoteAddress) {
+	FScopeLock lock(&legacyReceiveLock);
+	legacyReceiveContext.socket = socket;
+	UDPReceiverSocketServerPlugin(data, dataSize, remoteAddress, FSocketServerUDPAddressKey(remoteAddress), legacyReceiveContext);
 
-void USocketServerPluginUDPServer::UDPReceiverSocketServerPlugin(FArrayReaderPtr& ArrayReaderPtr, TSharedRef<FInternetAddr> remoteAddress) {
+	int32 droppedMessages = legacyReceiveContext.reassembler.getDroppedMessages();
+	if (droppedMessages != legacyReceiveContext.reportedReassemblyDrops) {
+		reassemblyDrops.fetch_add(droppedMessages - legacyReceiveContext.reportedReassemblyDrops, std::memory_order_relaxed);
+		legacyReceiveContext.reportedReassemblyDrops = droppedMessages;
+	}
+}
 
-	FString sessionID = remoteAddress.Get().ToString(true);
-	FClientSocketSession* sessionPointer = clientSessions.Find(sessionID);
+void USocketServerPluginUDPServer::UDPReceiverSocketServerPlugin(const uint8* data, int32 dataSize, const FInternetAddr& remoteAddress,
+	const FSocketServerUDPAddressKey& addressKey, FSocketServerUDPReceiveContext& receiveContext) {
+
+	FString sessionID;
+	FClientSocketSessionPtr addedSession;
+	FClientSocketSession* sessionPointer = clientSessions.find(addressKey, receiveContext.sessionReader);
 	if (sessionPointer == nullptr) {
 
-		//FString socketName;
-		//FSocket* receiverSocket = FUdpSocketBuilder(*socketName);
-		ISocketSubsystem* socketSubsystem = USocketServerBPLibrary::getSocketSubSystem();
-		FSocket* receiverSocket = socketSubsystem->CreateSocket(NAME_DGram, *sessionID, remoteAddress->GetProtocolType());
+		//create and save session. answers go out over the socket of the shard that received it, no socket per client anymore
+		FClientSocketSessionPtr session = MakeShared<FClientSocketSession, ESPMode::ThreadSafe>();
+		session->sessionID = remoteAddress.ToString(true);
+		session->serverID = serverID;
+		session->ip = remoteAddress.ToString(false);
+		session->port = remoteAddress.GetPort();
+		session->addr = MakeShared<const FSocketServerRemoteAddress, ESPMode::ThreadSafe>(remoteAddress.Clone());
+		session->socket = receiveContext.socket;
+		session->shardIndex = receiveContext.shardIndex;
+		session->protocol = EServerSocketConnectionProtocol::E_UDP;
+		session->counters = MakeShared<FSocketServerSessionCounters, ESPMode::ThreadSafe>();
+		addedSession = clientSessions.add(addressKey, session);
+		sessionPointer = addedSession.Get();
+	}
+	sessionID = sessionPointer->sessionID;
+	if (sessionPointer->counters.IsValid()) {
+		sessionPointer->counters->received(dataSize);
+	}
 
+	TArray<uint8> reassembled;
+	FSocketServerUDPFragmentHeader fragmentHeader;
+	if (fragmentation.load(std::memory_order_relaxed) && fragmentHeader.read(data, dataSize)) {
+		if (receiveContext.reassembler.add(addressKey, fragmentHeader, data + FSocketServerUDPFragmentHeader::size, dataSize - FSocketServerUDPFragmentHeader::size,
+			reassemblyTimeout.load(std::memory_order_relaxed), reassemblyMemoryLimit.load(std::memory_order_relaxed), reassembled) == false) {
+			return;
+		}
+		data = reassembled.GetData();
+		dataSize = reassembled.Num();
+	}
 
-		//create and save session
-		FClientSocketSession session;
-		session.sessionID = sessionID;
-		session.serverID = serverID;
-		session.ip = remoteAddress.Get().ToString(false);
-		session.port = remoteAddress.Get().GetPort();
-		session.socket = receiverSocket;
-		session.protocol = EServerSocketConnectionProtocol::E_UDP;
-		addClientSession(session);
+	if (datagramHandlerGeneration.load(std::memory_order_acquire) != receiveContext.handlerGeneration) {
+		FScopeLock lock(&datagramHandlerLock);
+		receiveContext.handler = datagramHandler;
+		receiveContext.handlerGeneration = datagramHandlerGeneration.load(std::memory_order_relaxed);
+	}
+	//keeps the handler alive while it runs, even if its owner releases it meanwhile
+	FSocketServerUDPDatagramHandlerPtr handler = receiveContext.handler.Pin();
+	if (handler.IsValid()) {
+		FSocketServerUDPDatagramView datagram = { data, dataSize, remoteAddress, sessionID, serverID };
+		if (handler->onUDPDatagram(datagram)) {
+			return;
+		}
 	}
+
 	TArray<uint8> byteArray;
 	if (receiveFilter == EReceiveFilterServer::E_SAB || receiveFilter == EReceiveFilterServer::E_B) {
-		byteArray.Append(ArrayReaderPtr->GetData(), ArrayReaderPtr->Num());
+		byteArray.Append(data, dataSize);
 	}
 
 	FString recvMessage;
 	if (receiveFilter == EReceiveFilterServer::E_SAB || receiveFilter == EReceiveFilterServer::E_S) {
-		ArrayReaderPtr->Add(0x00);// null-terminator
-		char* Data = (char*)ArrayReaderPtr->GetData();
-		recvMessage = FString(UTF8_TO_TCHAR(Data));
+		//the receive buffer is reused and not null terminated. convert up to the first null like before
+		int32 length = FCStringAnsi::Strnlen((const ANSICHAR*)data, dataSize);
+		FUTF8ToTCHAR convert((const ANSICHAR*)data, length);
+		recvMessage = FString(convert.Length(), convert.Get());
+	}
+
+	if (batchedDelivery.load(std::memory_order_relaxed)) {
+		{
+			FScopeLock lock(&pendingDatagramsLock);
+			FSocketServerUDPDatagram& datagram = pendingDatagrams.AddDefaulted_GetRef();
+			datagram.sessionID = MoveTemp(sessionID);
+			datagram.message = MoveTemp(recvMessage);
+			datagram.byteArray = MoveTemp(byteArray);
+		}
+
+		//the first datagram after a delivery schedules the next one. everything that arrives until then joins the same batch
+		if (batchDeliveryScheduled.exchange(true) == false) {
+			AsyncTask(ENamedThreads::GameThread, [this]() {
+				deliverPendingDatagrams();
+			});
+		}
+		return;
 	}
 
 	FString serverIDGlobal = serverID;
@@ -242,6 +474,56 @@ void USocketServerPluginUDPServer::UDPReceiverSocketServerPlugin(FArrayReaderPtr
 	recvMessage.Empty();
 }
 
+void USocketServerPluginUDPServer::deliverPendingDatagrams() {
+	TArray<FSocketServerUDPDatagram> datagrams;
+	{
+		FScopeLock lock(&pendingDatagramsLock);
+		Swap(datagrams, pendingDatagrams);
+		batchDeliveryScheduled.store(false);
+	}
+
+	if (datagrams.Num() == 0) {
+		return;
+	}
+
+	USocketServerBPLibrary::socketServerBPLibrary->onserverReceiveUDPMessageBatchEventDelegate.Broadcast(datagrams, serverID);
+	for (FSocketServerUDPDatagram& datagram : datagrams) {
+		UEventBean* clientEvent = USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(datagram.sessionID);
+		if (clientEvent != nullptr) {
+			clientEvent->onregisteredEventDelegate.Broadcast(datagram.message, datagram.byteArray);
+		}
+	}
+}
+
+bool USocketServerPluginUDPServer::enableReusePort(FSocket* listenerSocket) {
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+	int enable = 1;
+	return setsockopt(FSocketServerNativeSocket::getHandle(listenerSocket), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == 0;
+#else
+	return false;
+#endif
+}
+
+int32 USocketServerPluginUDPServer::getReceiveThreadCount() {
+	return receiveThreads;
+}
+
+void USocketServerPluginUDPServer::setDatagramHandler(FSocketServerUDPDatagramHandlerWeakPtr handler) {
+	FScopeLock lock(&datagramHandlerLock);
+	datagramHandler = handler;
+	datagramHandlerGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void USocketServerPluginUDPServer::setBatchedDelivery(bool batchedDeliveryP) {
+	batchedDelivery.store(batchedDeliveryP);
+}
+
+void USocketServerPluginUDPServer::setFragmentation(bool fragmentationP, float reassemblyTimeoutSeconds, int32 reassemblyMemoryLimitMB) {
+	reassemblyTimeout.store(FMath::Max(reassemblyTimeoutSeconds, 0.01f));
+	reassemblyMemoryLimit.store((int64)FMath::Max(reassemblyMemoryLimitMB, 1) * 1024 * 1024);
+	fragmentation.store(fragmentationP);
+}
+
 //do not work with ipv6
 //void USocketServerPluginUDPServer::UDPReceiver(const FArrayReaderPtr& ArrayReaderPtr, const FIPv4Endpoint& EndPt) {
 //
@@ -320,46 +602,158 @@ FString USocketServerPluginUDPServer::getServerID(){
 void USocketServerPluginUDPServer::addClientSession(FClientSocketSession session){
 	if (session.sessionID.IsEmpty() == false) {
 		//UE_LOG(LogTemp, Warning, TEXT("ADD Session:%s"), *session.sessionID);
-		clientSessions.Add(session.sessionID, session);
+		if (session.addr.IsValid() == false) {
+			session.addr = resolveAddr(session.ip, session.port);
+		}
+		if (session.addr.IsValid() == false) {
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Can't add session with invalid address: %s"), *session.sessionID);
+			return;
+		}
+		if (session.counters.IsValid() == false) {
+			session.counters = MakeShared<FSocketServerSessionCounters, ESPMode::ThreadSafe>();
+		}
+		FSocketServerUDPAddressKey addressKey(*session.addr->addr);
+		clientSessions.add(addressKey, MakeShared<FClientSocketSession, ESPMode::ThreadSafe>(session));
 	}
 }
 
-FClientSocketSession* USocketServerPluginUDPServer::getClientSession(FString key){
-	return clientSessions.Find(key);
+FClientSocketSessionPtr USocketServerPluginUDPServer::getClientSession(FString key){
+	return clientSessions.findByID(key);
 }
 
 void USocketServerPluginUDPServer::removeClientSession(FString key){
-	if (clientSessions.Remove(key)) {
+	if (clientSessions.remove(key).IsValid()) {
 		//UE_LOG(LogTemp, Warning, TEXT("Remove Session:%s"), *key);
 		USocketServerBPLibrary::socketServerBPLibrary->unregisterClientEvent(key);
 	}
 }
 
 TMap<FString, FClientSocketSession> USocketServerPluginUDPServer::getClientSessions(){
-	return clientSessions;
+	TMap<FString, FClientSocketSession> sessions;
+	for (FClientSocketSessionPtr& session : clientSessions.getAll()) {
+		sessions.Add(session->sessionID, *session);
+	}
+	return sessions;
+}
+
+FSocket* USocketServerPluginUDPServer::getClientSocket(const FInternetAddr& addr) {
+	bool ipv6 = addr.GetProtocolType() == FNetworkProtocolTypes::IPv6;
+	FScopeLock lock(&clientSocketLock);
+	FSocket*& clientSocket = ipv6 ? clientSocketIPv6 : clientSocketIPv4;
+	if (clientSocket == nullptr) {
+		ISocketSubsystem* socketSubsystem = USocketServerBPLibrary::getSocketSubSystem();
+		clientSocket = socketSubsystem->CreateSocket(NAME_DGram, *("SocketServerUDPClient_" + serverID), addr.GetProtocolType());
+		applySocketOptions(clientSocket);
+	}
+	return clientSocket;
 }
 
 void USocketServerPluginUDPServer::sendBytes(FSocket*& socketP, TArray<uint8>& byteArray, int32& sent, TSharedRef<FInternetAddr>& addr){
-	if (byteArray.Num() > maxPacketSize) {
-		TArray<uint8> byteArrayTemp;
-		for (int32 i = 0; i < byteArray.Num(); i++) {
-			byteArrayTemp.Add(byteArray[i]);
-			if (byteArrayTemp.Num() == maxPacketSize) {
-				sent = 0;
-				socketP->SendTo(byteArrayTemp.GetData(), byteArrayTemp.Num(), sent, *addr);
-				byteArrayTemp.Empty();
-			}
-		}
-		if (byteArrayTemp.Num() > 0) {
-			sent = 0;
-			socketP->SendTo(byteArrayTemp.GetData(), byteArrayTemp.Num(), sent, *addr);
-			byteArrayTemp.Empty();
+	sendBytes(socketP, byteArray.GetData(), byteArray.Num(), *addr);
+	sent = byteArray.Num();
+	byteArray.Empty();
+}
+
+bool USocketServerPluginUDPServer::sendBytes(FSocket* socketP, const uint8* data, int32 dataSize, const FInternetAddr& addr) {
+	if (socketP == nullptr) {
+		return false;
+	}
+	if (dataSize <= maxPacketSize || fragmentation.load(std::memory_order_relaxed) == false) {
+		bool allSent = true;
+		for (int32 offset = 0; offset < dataSize || offset == 0; offset += maxPacketSize) {
+			allSent &= sendDatagram(socketP, data + offset, FMath::Min(maxPacketSize, dataSize - offset), addr);
 		}
+		return allSent;
+	}
+
+	int32 fragmentPayloadSize = maxPacketSize - FSocketServerUDPFragmentHeader::size;
+	int32 count = (dataSize + fragmentPayloadSize - 1) / fragmentPayloadSize;
+	if (fragmentPayloadSize <= 0 || count > MAX_uint16) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: UDP message with %i bytes can't be fragmented with maxPacketSize %i."), dataSize, maxPacketSize);
+		return false;
+	}
+
+	FSocketServerUDPFragmentHeader header;
+	header.messageID = nextFragmentMessageID.fetch_add(1, std::memory_order_relaxed);
+	header.count = (uint16)count;
+
+	TArray<uint8> datagram;
+	datagram.SetNumUninitialized(maxPacketSize);
+	bool allSent = true;
+	for (int32 i = 0; i < count; i++) {
+		int32 offset = i * fragmentPayloadSize;
+		int32 payloadSize = FMath::Min(fragmentPayloadSize, dataSize - offset);
+		header.index = (uint16)i;
+		header.write(datagram.GetData());
+		FMemory::Memcpy(datagram.GetData() + FSocketServerUDPFragmentHeader::size, data + offset, payloadSize);
+		allSent &= sendDatagram(socketP, datagram.GetData(), FSocketServerUDPFragmentHeader::size + payloadSize, addr);
+	}
+	return allSent;
+}
+
+bool USocketServerPluginUDPServer::sendDatagram(FSocket* socketP, const uint8* data, int32 dataSize, const FInternetAddr& addr) {
+	int32 sent = 0;
+	if (socketP->SendTo(data, dataSize, sent, addr)) {
+		datagramsSent.fetch_add(1, std::memory_order_relaxed);
+		bytesSent.fetch_add(sent, std::memory_order_relaxed);
+		return true;
+	}
+
+	ESocketErrors error = USocketServerBPLibrary::getSocketSubSystem()->GetLastErrorCode();
+	if (error == SE_EWOULDBLOCK) {
+		sendWouldBlock.fetch_add(1, std::memory_order_relaxed);
+	}
+	else if (error == SE_ENOBUFS) {
+		sendNoBuffers.fetch_add(1, std::memory_order_relaxed);
 	}
 	else {
-		sent = 0;
-		socketP->SendTo(byteArray.GetData(), byteArray.Num(), sent, *addr);
+		sendOtherErrors.fetch_add(1, std::memory_order_relaxed);
 	}
+	return false;
+}
 
-	byteArray.Empty();
-}
\ No newline at end of file
+void USocketServerPluginUDPServer::applySocketOptions(FSocket* socketP) {
+	if (socketP == nullptr) {
+		return;
+	}
+
+	int32 granted = 0;
+	if (receiveBufferSize > 0) {
+		socketP->SetReceiveBufferSize(receiveBufferSize, granted);
+		if (granted < receiveBufferSize) {
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: UDP receive buffer of %i bytes requested, the OS granted %i. On Linux raise net.core.rmem_max."), receiveBufferSize, granted);
+		}
+		grantedReceiveBufferSize.store(granted);
+	}
+	if (sendBufferSize > 0) {
+		socketP->SetSendBufferSize(sendBufferSize, granted);
+		if (granted < sendBufferSize) {
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: UDP send buffer of %i bytes requested, the OS granted %i. On Linux raise net.core.wmem_max."), sendBufferSize, granted);
+		}
+		grantedSendBufferSize.store(granted);
+	}
+
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+	FSocketServerNativeSocket::enableReceiveQueueOverflow(socketP);
+#endif
+}
+
+FSocketServerUDPStats USocketServerPluginUDPServer::getStats() {
+	FSocketServerUDPStats stats;
+	stats.datagramsReceived = datagramsReceived.load(std::memory_order_relaxed);
+	stats.bytesReceived = bytesReceived.load(std::memory_order_relaxed);
+	stats.datagramsSent = datagramsSent.load(std::memory_order_relaxed);
+	stats.bytesSent = bytesSent.load(std::memory_order_relaxed);
+	stats.kernelReceiveDrops = kernelReceiveDrops.load(std::memory_order_relaxed);
+	stats.sendWouldBlock = sendWouldBlock.load(std::memory_order_relaxed);
+	stats.sendNoBuffers = sendNoBuffers.load(std::memory_order_relaxed);
+	stats.sendOtherErrors = sendOtherErrors.load(std::memory_order_relaxed);
+	stats.reassemblyDrops = reassemblyDrops.load(std::memory_order_relaxed);
+	if (sendThread != nullptr) {
+		stats.bulkDeadlineDrops = sendThread->getDeadlineDrops();
+		stats.sendQueueFullDrops = sendThread->getQueueFullDrops();
+	}
+	stats.receiveBufferSize = grantedReceiveBufferSize.load(std::memory_order_relaxed);
+	stats.sendBufferSize = grantedSendBufferSize.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -0,0 +1,264 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerRCONParser.h"
+#include "RCONServer.h"
+
+
+static int32 readInt32LittleEndian(const uint8* data) {
+	return (int32)((uint32)data[0] | ((uint32)data[1] << 8) | ((uint32)data[2] << 16) | ((uint32)data[3] << 24));
+}
+
+static void appendInt32LittleEndian(TArray<uint8>& out, int32 value) {
+	uint32 bits = (uint32)value;
+	const uint8 bytes[4] = { (uint8)bits, (uint8)(bits >> 8), (uint8)(bits >> 16), (uint8)(bits >> 24) };
+	out.Append(bytes, 4);
+}
+
+static FString bodyToString(const FSocketServerRCONPacket& packet) {
+	if (packet.bodySize == 0) {
+		return FString();
+	}
+	FUTF8ToTCHAR Convert((const ANSICHAR*)packet.body, packet.bodySize);
+	return FString(Convert.Length(), Convert.Get());
+}
+
+
+bool FSocketServerRCONParser::receive(const uint8* data, int32 dataSize, TFunctionRef<void(const FSocketServerRCONPacket&)> onPacket) {
+	FSocketServerRCONPacket packet;
+	while (dataSize > 0) {
+
+		if (pendingSize > 0) {
+			//the size field of a split packet
+			if (pendingSize < 4) {
+				int32 take = FMath::Min(4 - pendingSize, dataSize);
+				FMemory::Memcpy(pending + pendingSize, data, take);
+				pendingSize += take;
+				data += take;
+				dataSize -= take;
+				if (pendingSize < 4) {
+					return true;
+				}
+				pendingPacketSize = readInt32LittleEndian(pending);
+				if (pendingPacketSize < minPacketSize || pendingPacketSize > maxPacketSize) {
+					return false;
+				}
+			}
+
+			int32 packetEnd = 4 + pendingPacketSize;
+			int32 take = FMath::Min(packetEnd - pendingSize, dataSize);
+			FMemory::Memcpy(pending + pendingSize, data, take);
+			pendingSize += take;
+			data += take;
+			dataSize -= take;
+			if (pendingSize < packetEnd) {
+				return true;
+			}
+			pendingSize = 0;
+			pendingPacketSize = -1;
+			readPacket(pending, packetEnd, packet);
+			onPacket(packet);
+			continue;
+		}
+
+		if (dataSize < 4) {
+			FMemory::Memcpy(pending, data, dataSize);
+			pendingSize = dataSize;
+			return true;
+		}
+
+		int32 size = readInt32LittleEndian(data);
+		if (size < minPacketSize || size > maxPacketSize) {
+			return false;
+		}
+		if (dataSize < 4 + size) {
+			//rest of the packet comes with the next read
+			FMemory::Memcpy(pending, data, dataSize);
+			pendingSize = dataSize;
+			pendingPacketSize = size;
+			return true;
+		}
+
+		readPacket(data, 4 + size, packet);
+		onPacket(packet);
+		data += 4 + size;
+		dataSize -= 4 + size;
+	}
+	return true;
+}
+
+void FSocketServerRCONParser::readPacket(const uint8* data, int32 size, FSocketServerRCONPacket& packet) {
+	packet.id = readInt32LittleEndian(data + 4);
+	packet.type = readInt32LittleEndian(data + 8);
+	packet.body = data + 12;
+
+	//the body ends at its null terminator. clients that leave it out get the whole rest
+	int32 maxBodySize = size - 12;
+	packet.bodySize = 0;
+	while (packet.bodySize < maxBodySize && packet.body[packet.bodySize] != 0x00) {
+		packet.bodySize++;
+	}
+}
+
+void FSocketServerRCONParser::appendPacket(TArray<uint8>& out, int32 id, int32 type, const uint8* body, int32 bodySize) {
+	//4 (id) + 4 (type) + body + 2 null terminators
+	out.Reserve(out.Num() + 14 + bodySize);
+	appendInt32LittleEndian(out, 10 + bodySize);
+	appendInt32LittleEndian(out, id);
+	appendInt32LittleEndian(out, type);
+	if (bodySize > 0) {
+		out.Append(body, bodySize);
+	}
+	out.Add(0x00);
+	out.Add(0x00);
+}
+
+
+FCriticalSection FSocketServerRCONEndpoint::registryLock;
+TMap<FString, TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe>> FSocketServerRCONEndpoint::registry;
+std::atomic<uint64> FSocketServerRCONEndpoint::generation{ 0 };
+
+FSocketServerRCONEndpoint::FSocketServerRCONEndpoint(FString serverIDP, ERCONPasswordType passwordTypeP, FString passwordOrFileP, URCONServer* rconServerP) :
+	serverID(serverIDP),
+	passwordType(passwordTypeP),
+	passwordOrFile(passwordOrFileP),
+	rconServer(rconServerP) {
+}
+
+bool FSocketServerRCONEndpoint::receive(const FString& sessionID, FSocketServerRCONParser& parser, const uint8* data, int32 dataSize, const FSocketServerTCPRawWriter& writer) {
+	TArray<uint8> responses;
+	TArray<TPair<int32, FString>> commands;
+	bool supported = true;
+	bool authFailed = false;
+	bool notAuthenticated = false;
+
+	bool valid = parser.receive(data, dataSize, [&](const FSocketServerRCONPacket& packet) {
+		if (!supported || authFailed) {
+			return;
+		}
+		switch (packet.type)
+		{
+		case 0:
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Server response sent to the server? Request will be ignored."));
+			break;
+		case 2:
+			//no command before the right password. answered like a failed login and the connection is closed
+			if (parser.isAuthenticated() == false) {
+				FSocketServerRCONParser::appendPacket(responses, -1, 2, nullptr, 0);
+				authFailed = true;
+				notAuthenticated = true;
+				break;
+			}
+			commands.Emplace(packet.id, bodyToString(packet));
+			break;
+		case 3:
+			if (checkPassword(bodyToString(packet))) {
+				parser.setAuthenticated();
+				FSocketServerRCONParser::appendPacket(responses, packet.id, 2, nullptr, 0);
+			}
+			else {
+				FSocketServerRCONParser::appendPacket(responses, -1, 2, nullptr, 0);
+				authFailed = true;
+			}
+			break;
+		default:
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Unsupported request. Connection is closed."));
+			supported = false;
+			break;
+		}
+	});
+
+	if (responses.Num() > 0 && writer) {
+		writer(MoveTemp(responses));
+	}
+
+	TWeakObjectPtr<URCONServer> rconServerGlobal = rconServer;
+	FString sessionIDGlobal = sessionID;
+	FString serverIDGlobal = serverID;
+	if (commands.Num() > 0 && commandHandler) {
+		for (const TPair<int32, FString>& command : commands) {
+			commandHandler(sessionID, command.Key, command.Value);
+		}
+	}
+	else if (commands.Num() > 0) {
+		//only the commands go to the game thread, all of this read at once. every one of them is authenticated
+		AsyncTask(ENamedThreads::GameThread, [rconServerGlobal, sessionIDGlobal, serverIDGlobal, commands]() {
+			if (rconServerGlobal.IsValid() == false) {
+				return;
+			}
+			for (const TPair<int32, FString>& command : commands) {
+				rconServerGlobal->dispatchCommand(sessionIDGlobal, serverIDGlobal, command.Key, command.Value, true);
+			}
+		});
+	}
+
+	if (authFailed) {
+		//closed on the game thread so the response above is sent first
+		if (notAuthenticated) {
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Command without authentication. Connection is closed."));
+		}
+		else {
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin (RCON): Wrong password. Connection is closed."));
+		}
+		AsyncTask(ENamedThreads::GameThread, [sessionIDGlobal, serverIDGlobal]() {
+			if (USocketServerBPLibrary::getSocketServerTarget() == nullptr) {
+				return;
+			}
+			TMap<FString, USocketServerPluginTCPServer*> tcpServers = USocketServerBPLibrary::getSocketServerTarget()->getTcpServerMap();
+			USocketServerPluginTCPServer** tcpServer = tcpServers.Find(serverIDGlobal);
+			if (tcpServer != nullptr && *tcpServer != nullptr) {
+				(*tcpServer)->removeClientSession(sessionIDGlobal);
+			}
+		});
+	}
+
+	return valid && supported;
+}
+
+void FSocketServerRCONEndpoint::setCommandHandler(TFunction<void(const FString& sessionID, int32 requestID, const FString& request)> handler) {
+	commandHandler = handler;
+}
+
+bool FSocketServerRCONEndpoint::checkPassword(const FString& password) const {
+	if (password.IsEmpty() || passwordOrFile.IsEmpty()) {
+		return false;
+	}
+
+	if (passwordType == ERCONPasswordType::E_parameter) {
+		return password.Equals(passwordOrFile);
+	}
+
+	FString passwordData = FString();
+	FFileHelper::LoadFileToString(passwordData, *passwordOrFile);
+
+	TArray<FString> passwords;
+	passwordData.ParseIntoArray(passwords, TEXT("\n"), true);
+
+	for (int32 i = 0; i < passwords.Num(); i++) {
+		if (passwords[i].TrimEnd().Equals(password)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void FSocketServerRCONEndpoint::add(TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe> endpoint) {
+	FScopeLock lock(&registryLock);
+	registry.Add(endpoint->serverID, endpoint);
+	generation.fetch_add(1, std::memory_order_release);
+}
+
+void FSocketServerRCONEndpoint::remove(const FString& serverID) {
+	FScopeLock lock(&registryLock);
+	if (registry.Remove(serverID) > 0) {
+		generation.fetch_add(1, std::memory_order_release);
+	}
+}
+
+TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe> FSocketServerRCONEndpoint::find(const FString& serverID) {
+	FScopeLock lock(&registryLock);
+	TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe>* endpoint = registry.Find(serverID);
+	if (endpoint != nullptr) {
+		return *endpoint;
+	}
+	return nullptr;
+}
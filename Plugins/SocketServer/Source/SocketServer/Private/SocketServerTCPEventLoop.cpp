@@ -0,0 +1,474 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerTCPEventLoop.h"
+#include "SocketServerNativeSocket.h"
+
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+
+FSocketServerTCPConnection::FSocketServerTCPConnection(FClientSocketSession sessionP, EReceiveFilterServer receiveFilter, int32 ioThreadIndexP) :
+	ioThreadIndex(ioThreadIndexP),
+	session(sessionP),
+	parser(sessionP.sessionID, sessionP.serverID, receiveFilter) {
+}
+
+FSocketServerTCPConnection::~FSocketServerTCPConnection() {
+	//last reference is gone, no io thread uses the socket anymore
+	if (session.socket != nullptr) {
+		session.socket->Close();
+		ISocketSubsystem* sSS = USocketServerBPLibrary::getSocketSubSystem();
+		if (sSS != nullptr) {
+			sSS->DestroySocket(session.socket);
+		}
+		session.socket = nullptr;
+	}
+}
+
+
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+
+/*one epoll instance and the connections it watches*/
+class FSocketServerTCPIOThread : public FRunnable {
+
+public:
+
+	FSocketServerTCPIOThread(FSocketServerTCPEventLoop* loopP, int32 indexP) :
+		loop(loopP),
+		index(indexP) {
+		epollHandle = epoll_create1(EPOLL_CLOEXEC);
+		FString threadName = "FSocketServerTCPIOThread_" + FGuid::NewGuid().ToString();
+		thread = FRunnableThread::Create(this, *threadName, 0, EThreadPriority::TPri_Normal);
+	}
+
+	~FSocketServerTCPIOThread() {
+		if (epollHandle >= 0) {
+			close(epollHandle);
+		}
+	}
+
+	virtual uint32 Run() override {
+		const int32 maxEvents = 64;
+		struct epoll_event events[maxEvents];
+		TArray<uint8> readBuffer;
+
+		while (run) {
+			int32 count = epoll_wait(epollHandle, events, maxEvents, 100);
+			if (count < 0) {
+				if (errno != EINTR) {
+					UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: epoll_wait failed (%i)."), errno);
+					FPlatformProcess::Sleep(0.01);
+				}
+				continue;
+			}
+			if (index == 0) {
+				loop->resumeAccept();
+			}
+			for (int32 i = 0; i < count && run; i++) {
+				if (events[i].data.u64 == 0) {
+					loop->accept();
+					continue;
+				}
+				FSocketServerTCPConnectionPtr connection = find(events[i].data.u64);
+				if (connection.IsValid() == false) {
+					continue;
+				}
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+					loop->onReadable(connection, readBuffer);
+				}
+				if ((events[i].events & EPOLLOUT) && connection->closed == false) {
+					loop->onWritable(connection);
+				}
+			}
+		}
+		return 0;
+	}
+
+	void stopThread() {
+		run = false;
+		if (thread != nullptr) {
+			thread->WaitForCompletion();
+			delete thread;
+			thread = nullptr;
+		}
+	}
+
+	bool isValid() {
+		return epollHandle >= 0 && thread != nullptr;
+	}
+
+	bool control(int operation, int handle, uint64 id, uint32 eventMask) {
+		struct epoll_event event;
+		FMemory::Memzero(event);
+		event.events = eventMask;
+		event.data.u64 = id;
+		return epoll_ctl(epollHandle, operation, handle, &event) == 0;
+	}
+
+	void add(FSocketServerTCPConnectionPtr connection) {
+		FScopeLock lock(&connectionsLock);
+		connections.Add(connection->id, connection);
+	}
+
+	FSocketServerTCPConnectionPtr find(uint64 id) {
+		FScopeLock lock(&connectionsLock);
+		FSocketServerTCPConnectionPtr* connection = connections.Find(id);
+		return connection != nullptr ? *connection : FSocketServerTCPConnectionPtr();
+	}
+
+	void remove(uint64 id) {
+		FScopeLock lock(&connectionsLock);
+		connections.Remove(id);
+	}
+
+	TArray<FSocketServerTCPConnectionPtr> getAll() {
+		TArray<FSocketServerTCPConnectionPtr> all;
+		FScopeLock lock(&connectionsLock);
+		connections.GenerateValueArray(all);
+		return all;
+	}
+
+private:
+	FSocketServerTCPEventLoop* loop = nullptr;
+	int32 index = 0;
+	int epollHandle = -1;
+	FRunnableThread* thread = nullptr;
+	std::atomic<bool> run{ true };
+
+	FCriticalSection connectionsLock;
+	TMap<uint64, FSocketServerTCPConnectionPtr> connections;
+};
+
+
+FSocketServerTCPEventLoop::FSocketServerTCPEventLoop(USocketServerPluginTCPServer* tcpServerP, EReceiveFilterServer receiveFilterP, int32 threadCount) :
+	tcpServer(tcpServerP),
+	receiveFilter(receiveFilterP) {
+
+	FString tcpMessageHeader;
+	FString tcpMessageFooter;
+	USocketServerBPLibrary::socketServerBPLibrary->getTcpWrapping(tcpMessageHeader, tcpMessageFooter, messageWrapping);
+
+	threadCount = FMath::Clamp(threadCount, 1, 64);
+	for (int32 i = 0; i < threadCount; i++) {
+		ioThreads.Add(new FSocketServerTCPIOThread(this, i));
+	}
+}
+
+FSocketServerTCPEventLoop::~FSocketServerTCPEventLoop() {
+	stop();
+}
+
+bool FSocketServerTCPEventLoop::isSupported() {
+	return true;
+}
+
+bool FSocketServerTCPEventLoop::start(FSocket* listenerSocket) {
+	for (FSocketServerTCPIOThread* ioThread : ioThreads) {
+		if (ioThread->isValid() == false) {
+			UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't create epoll instance (%i)."), errno);
+			return false;
+		}
+	}
+	listener = listenerSocket;
+	listener->SetNonBlocking(true);
+	//id 0 is the listener
+	if (ioThreads[0]->control(EPOLL_CTL_ADD, FSocketServerNativeSocket::getHandle(listener), 0, EPOLLIN) == false) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't watch the TCP listener (%i)."), errno);
+		listener->SetNonBlocking(false);
+		listener = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void FSocketServerTCPEventLoop::stop() {
+	for (FSocketServerTCPIOThread* ioThread : ioThreads) {
+		ioThread->stopThread();
+	}
+	//io threads are gone, the connections can be closed from here
+	for (FSocketServerTCPIOThread* ioThread : ioThreads) {
+		for (FSocketServerTCPConnectionPtr& connection : ioThread->getAll()) {
+			disconnect(connection, true);
+		}
+		delete ioThread;
+	}
+	ioThreads.Empty();
+	listener = nullptr;
+}
+
+void FSocketServerTCPEventLoop::accept() {
+	if (listener == nullptr) {
+		return;
+	}
+	FString serverID = tcpServer->getServerID();
+	ISocketSubsystem* socketSubSystem = USocketServerBPLibrary::getSocketSubSystem();
+
+	while (true) {
+		FClientSocketSession session;
+		session.sessionID = FGuid::NewGuid().ToString();
+		session.serverID = serverID;
+
+		TSharedRef<FInternetAddr> remoteAddress = socketSubSystem->CreateInternetAddr();
+		FSocket* clientSocket = listener->Accept(*remoteAddress, session.sessionID);
+		if (clientSocket == nullptr) {
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				//the pending client stays in the backlog and the level triggered listener would wake this thread at once again.
+				//stop watching it for a moment, closing connections free descriptors meanwhile
+				UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Can't accept TCP clients (%i). Trying again in 100 ms."), errno);
+				acceptPausedUntil = FPlatformTime::Seconds() + 0.1;
+				ioThreads[0]->control(EPOLL_CTL_MOD, FSocketServerNativeSocket::getHandle(listener), 0, 0);
+			}
+			break;
+		}
+		clientSocket->SetNonBlocking(true);
+
+		session.ip = remoteAddress.Get().ToString(false);
+		session.port = remoteAddress.Get().GetPort();
+		session.socket = clientSocket;
+		session.protocol = EServerSocketConnectionProtocol::E_TCP;
+		session.counters = MakeShared<FSocketServerSessionCounters, ESPMode::ThreadSafe>();
+
+		int32 ioThreadIndex = nextIOThread;
+		nextIOThread = (nextIOThread + 1) % ioThreads.Num();
+
+		FSocketServerTCPConnectionPtr connection = MakeShared<FSocketServerTCPConnection, ESPMode::ThreadSafe>(session, receiveFilter, ioThreadIndex);
+		connection->id = nextConnectionID.fetch_add(1, std::memory_order_relaxed);
+
+		//RCON responses are queued right from the io thread
+		TWeakPtr<FSocketServerTCPConnection, ESPMode::ThreadSafe> weakConnection = connection;
+		bool byteWrapping = messageWrapping == ESocketServerTCPMessageWrapping::E_Byte;
+		connection->parser.setRawWriter([this, weakConnection, byteWrapping](TArray<uint8>&& bytes) {
+			FSocketServerTCPConnectionPtr pinned = weakConnection.Pin();
+			if (pinned.IsValid()) {
+				enqueue(pinned, FSocketServerTCPSendItem(MoveTemp(bytes), byteWrapping));
+			}
+		});
+
+		tcpServer->addClientSession(session);
+		{
+			FScopeLock lock(&connectionsLock);
+			connectionsBySession.Add(session.sessionID, connection);
+		}
+		ioThreads[ioThreadIndex]->add(connection);
+
+		FString sessionID = session.sessionID;
+		AsyncTask(ENamedThreads::GameThread, [sessionID, serverID]() {
+			USocketServerBPLibrary::socketServerBPLibrary->onsocketServerConnectionEventDelegate.Broadcast(EServerSocketConnectionEventType::E_Client, true, "Client connected", sessionID, serverID);
+		});
+
+		if (ioThreads[ioThreadIndex]->control(EPOLL_CTL_ADD, FSocketServerNativeSocket::getHandle(clientSocket), connection->id, EPOLLIN) == false) {
+			UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't watch TCP client %s:%i (%i)."), *session.ip, session.port, errno);
+			disconnect(connection, true);
+		}
+	}
+}
+
+void FSocketServerTCPEventLoop::resumeAccept() {
+	if (acceptPausedUntil == 0 || listener == nullptr || FPlatformTime::Seconds() < acceptPausedUntil) {
+		return;
+	}
+	acceptPausedUntil = 0;
+	ioThreads[0]->control(EPOLL_CTL_MOD, FSocketServerNativeSocket::getHandle(listener), 0, EPOLLIN);
+}
+
+void FSocketServerTCPEventLoop::onReadable(FSocketServerTCPConnectionPtr connection, TArray<uint8>& readBuffer) {
+	const int32 readSize = 65536;
+	int handle = FSocketServerNativeSocket::getHandle(connection->session.socket);
+	readBuffer.SetNumUninitialized(readSize, false);
+
+	//level triggered, whatever is left after a few reads comes with the next epoll_wait
+	for (int32 reads = 0; reads < 16 && connection->closed == false; reads++) {
+		ssize_t bytesRead = recv(handle, readBuffer.GetData(), readSize, 0);
+		if (bytesRead > 0) {
+			if (connection->session.counters.IsValid())
+				connection->session.counters->received((int32)bytesRead);
+			if (!connection->parser.receive(readBuffer.GetData(), (int32)bytesRead)) {
+				disconnect(connection, true);
+				return;
+			}
+			continue;
+		}
+		if (bytesRead < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		}
+		//0 = orderly shutdown by the client
+		disconnect(connection, true);
+		return;
+	}
+}
+
+void FSocketServerTCPEventLoop::onWritable(FSocketServerTCPConnectionPtr connection) {
+	FSocketServerSessionCounters* counters = connection->session.counters.Get();
+	bool failed = false;
+	{
+		FScopeLock lock(&connection->sendLock);
+		//everything that queued up since the last write goes out in one gathered call
+		while (connection->sendQueue.isEmpty() == false) {
+			int64 written = connection->sendQueue.write(connection->session.socket, counters);
+			if (written == 0) {
+				//socket buffer full, stay armed for EPOLLOUT
+				return;
+			}
+			if (written < 0) {
+				failed = true;
+				break;
+			}
+		}
+		if (failed == false) {
+			connection->writeArmed = false;
+			watch(*connection, false);
+		}
+	}
+	if (failed) {
+		disconnect(connection, true);
+	}
+}
+
+void FSocketServerTCPEventLoop::send(FString sessionID, FString message, TArray<uint8> byteArray) {
+	FSocketServerTCPConnectionPtr connection;
+	{
+		FScopeLock lock(&connectionsLock);
+		FSocketServerTCPConnectionPtr* found = connectionsBySession.Find(sessionID);
+		if (found != nullptr) {
+			connection = *found;
+		}
+	}
+	if (connection.IsValid() == false || connection->closed) {
+		UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Session not found: %s"), *sessionID);
+		return;
+	}
+
+	bool byteWrapping = messageWrapping == ESocketServerTCPMessageWrapping::E_Byte;
+	if (message.Len() > 0) {
+		FTCHARToUTF8 Convert(*message);
+		TArray<uint8> bytes((const uint8*)Convert.Get(), Convert.Length());
+		enqueue(connection, FSocketServerTCPSendItem(MoveTemp(bytes), byteWrapping));
+	}
+	if (byteArray.Num() > 0) {
+		enqueue(connection, FSocketServerTCPSendItem(MoveTemp(byteArray), byteWrapping));
+	}
+}
+
+void FSocketServerTCPEventLoop::enqueue(FSocketServerTCPConnectionPtr connection, FSocketServerTCPSendItem&& item) {
+	{
+		FScopeLock lock(&connection->sendLock);
+		if (connection->closed) {
+			return;
+		}
+		if (connection->sendQueue.bytes() + item.size() <= maxQueuedBytesPerConnection) {
+			connection->sendQueue.add(MoveTemp(item));
+			if (connection->session.counters.IsValid())
+				connection->session.counters->sendQueueDepth.fetch_add(1, std::memory_order_relaxed);
+			//the io thread sends as soon as the socket is writable
+			if (connection->writeArmed == false) {
+				connection->writeArmed = true;
+				watch(*connection, true);
+			}
+			return;
+		}
+	}
+	//disconnect takes the send lock itself
+	UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Client %s:%i does not read fast enough. Disconnected."), *connection->session.ip, connection->session.port);
+	disconnect(connection, true);
+}
+
+void FSocketServerTCPEventLoop::watch(FSocketServerTCPConnection& connection, bool writable) {
+	if (ioThreads.IsValidIndex(connection.ioThreadIndex) == false) {
+		return;
+	}
+	ioThreads[connection.ioThreadIndex]->control(EPOLL_CTL_MOD, FSocketServerNativeSocket::getHandle(connection.session.socket),
+		connection.id, writable ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+}
+
+void FSocketServerTCPEventLoop::closeConnection(FString sessionID) {
+	FSocketServerTCPConnectionPtr connection;
+	{
+		FScopeLock lock(&connectionsLock);
+		FSocketServerTCPConnectionPtr* found = connectionsBySession.Find(sessionID);
+		if (found != nullptr) {
+			connection = *found;
+		}
+	}
+	if (connection.IsValid()) {
+		disconnect(connection, false);
+	}
+}
+
+void FSocketServerTCPEventLoop::disconnect(FSocketServerTCPConnectionPtr connection, bool removeSession) {
+	if (connection->closed.exchange(true)) {
+		return;
+	}
+
+	if (ioThreads.IsValidIndex(connection->ioThreadIndex)) {
+		FSocketServerTCPIOThread* ioThread = ioThreads[connection->ioThreadIndex];
+		ioThread->control(EPOLL_CTL_DEL, FSocketServerNativeSocket::getHandle(connection->session.socket), connection->id, 0);
+		ioThread->remove(connection->id);
+	}
+	{
+		FScopeLock lock(&connectionsLock);
+		connectionsBySession.Remove(connection->session.sessionID);
+	}
+	{
+		FScopeLock lock(&connection->sendLock);
+		connection->sendQueue.empty(connection->session.counters.Get());
+	}
+	//the socket is closed when the last reference (maybe a running io thread) is released
+
+	FString sessionID = connection->session.sessionID;
+	FString serverID = connection->session.serverID;
+	USocketServerPluginTCPServer* tcpServerGlobal = tcpServer;
+	AsyncTask(ENamedThreads::GameThread, [sessionID, serverID, tcpServerGlobal, removeSession]() {
+		USocketServerBPLibrary::socketServerBPLibrary->onsocketServerConnectionEventDelegate.Broadcast(EServerSocketConnectionEventType::E_Client, false, "Client disconnected", sessionID, serverID);
+		if (removeSession) {
+			//clean up session in main thread because race condition
+			tcpServerGlobal->removeClientSession(sessionID);
+		}
+	});
+}
+
+int32 FSocketServerTCPEventLoop::num() {
+	FScopeLock lock(&connectionsLock);
+	return connectionsBySession.Num();
+}
+
+#else
+
+class FSocketServerTCPIOThread {};
+
+FSocketServerTCPEventLoop::FSocketServerTCPEventLoop(USocketServerPluginTCPServer* tcpServerP, EReceiveFilterServer receiveFilterP, int32 threadCount) :
+	tcpServer(tcpServerP),
+	receiveFilter(receiveFilterP) {
+}
+
+FSocketServerTCPEventLoop::~FSocketServerTCPEventLoop() {}
+
+bool FSocketServerTCPEventLoop::isSupported() {
+	return false;
+}
+
+bool FSocketServerTCPEventLoop::start(FSocket* listenerSocket) {
+	return false;
+}
+
+void FSocketServerTCPEventLoop::stop() {}
+void FSocketServerTCPEventLoop::send(FString sessionID, FString message, TArray<uint8> byteArray) {}
+void FSocketServerTCPEventLoop::closeConnection(FString sessionID) {}
+
+int32 FSocketServerTCPEventLoop::num() {
+	return 0;
+}
+
+void FSocketServerTCPEventLoop::accept() {}
+void FSocketServerTCPEventLoop::resumeAccept() {}
+void FSocketServerTCPEventLoop::onReadable(FSocketServerTCPConnectionPtr connection, TArray<uint8>& readBuffer) {}
+void FSocketServerTCPEventLoop::onWritable(FSocketServerTCPConnectionPtr connection) {}
+void FSocketServerTCPEventLoop::enqueue(FSocketServerTCPConnectionPtr connection, FSocketServerTCPSendItem&& item) {}
+void FSocketServerTCPEventLoop::disconnect(FSocketServerTCPConnectionPtr connection, bool removeSession) {}
+void FSocketServerTCPEventLoop::watch(FSocketServerTCPConnection& connection, bool writable) {}
+
+#endif
@@ -0,0 +1,161 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerTCPFileSender.h"
+#include "SocketServerNativeSocket.h"
+
+//sendfile needs the file descriptor of the file and the one behind the FSocket
+#if SOCKETSERVER_WITH_NATIVE_FILES && SOCKETSERVER_WITH_NATIVE_SOCKETS
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+FSocketServerTCPFileSender::FSocketServerTCPFileSender(FSocket* socketP, FString filePathP) :
+	socket(socketP),
+	filePath(filePathP) {
+}
+
+FSocketServerTCPFileSender::~FSocketServerTCPFileSender() {
+	close();
+}
+
+#if SOCKETSERVER_WITH_NATIVE_FILES && SOCKETSERVER_WITH_NATIVE_SOCKETS
+
+bool FSocketServerTCPFileSender::open(int64& fileSize) {
+	FString fullPath = IFileManager::Get().ConvertToAbsolutePathForExternalAppForRead(*filePath);
+	fileHandle = ::open(TCHAR_TO_UTF8(*fullPath), O_RDONLY | O_CLOEXEC);
+	if (fileHandle < 0) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't open %s (%i)."), *filePath, errno);
+		return false;
+	}
+	struct stat fileStat;
+	if (fstat(fileHandle, &fileStat) != 0 || fileStat.st_size <= 0) {
+		close();
+		return false;
+	}
+	size = fileStat.st_size;
+	fileSize = size;
+	posix_fadvise(fileHandle, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return true;
+}
+
+int64 FSocketServerTCPFileSender::send(int64 position, int64 maxBytes) {
+	if (fileHandle < 0 || position >= size) {
+		return -1;
+	}
+	int socketHandle = FSocketServerNativeSocket::getHandle(socket);
+	//sendfile moves at most 0x7ffff000 bytes per call
+	size_t count = (size_t)FMath::Min3(maxBytes, size - position, (int64)0x7ffff000);
+
+	if (useSendfile) {
+		off_t offset = (off_t)position;
+		ssize_t sent;
+		do {
+			sent = sendfile(socketHandle, fileHandle, &offset, count);
+		} while (sent < 0 && errno == EINTR);
+
+		if (sent > 0) {
+			return sent;
+		}
+		if (sent == 0) {
+			//end of file before the size it had when it was opened
+			UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: %s got shorter while it was sent."), *filePath);
+			return -1;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		if (errno != EINVAL && errno != ENOSYS) {
+			return -1;
+		}
+		//file system without sendfile support
+		useSendfile = false;
+	}
+
+	//pread instead of mmap, a mapping would raise SIGBUS if the file is truncated meanwhile.
+	//what the socket does not take is read again by the next call, it is still in the page cache
+	count = FMath::Min(count, (size_t)(1024 * 1024));
+	buffer.SetNumUninitialized((int32)count, false);
+	ssize_t bytesRead;
+	do {
+		bytesRead = pread(fileHandle, buffer.GetData(), count, (off_t)position);
+	} while (bytesRead < 0 && errno == EINTR);
+	if (bytesRead <= 0) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Can't read %s (%i)."), *filePath, bytesRead < 0 ? errno : 0);
+		return -1;
+	}
+
+	ssize_t sent;
+	do {
+		sent = ::send(socketHandle, buffer.GetData(), (size_t)bytesRead, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+
+	if (sent >= 0) {
+		return sent;
+	}
+	return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+}
+
+void FSocketServerTCPFileSender::close() {
+	if (fileHandle >= 0) {
+		::close(fileHandle);
+		fileHandle = -1;
+	}
+}
+
+#else
+
+bool FSocketServerTCPFileSender::open(int64& fileSize) {
+	reader = IFileManager::Get().CreateFileReader(*filePath);
+	if (reader == nullptr || reader->TotalSize() == 0) {
+		close();
+		return false;
+	}
+	size = reader->TotalSize();
+	fileSize = size;
+	return true;
+}
+
+int64 FSocketServerTCPFileSender::send(int64 position, int64 maxBytes) {
+	if (reader == nullptr || position >= size) {
+		return -1;
+	}
+	int32 bufferSize = (int32)FMath::Min3(maxBytes, size - position, (int64)(1024 * 1024));
+	if (position != readerPosition) {
+		reader->Seek(position);
+		readerPosition = position;
+	}
+	buffer.SetNumUninitialized(bufferSize, false);
+	reader->Serialize(buffer.GetData(), bufferSize);
+	if (reader->IsError()) {
+		//the file got shorter while it was sent
+		return -1;
+	}
+	readerPosition += bufferSize;
+
+	//the whole block has to leave, otherwise the next call would read it again
+	int32 sentTotal = 0;
+	while (sentTotal < bufferSize) {
+		int32 sent = 0;
+		if (!socket->Send(buffer.GetData() + sentTotal, bufferSize - sentTotal, sent)) {
+			return -1;
+		}
+		if (sent == 0) {
+			socket->Wait(ESocketWaitConditions::WaitForWrite, FTimespan::FromMilliseconds(100));
+		}
+		sentTotal += sent;
+	}
+	return sentTotal;
+}
+
+void FSocketServerTCPFileSender::close() {
+	if (reader != nullptr) {
+		reader->Close();
+		delete reader;
+		reader = nullptr;
+	}
+}
+
+#endif
@@ -0,0 +1,294 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerTCPMessageParser.h"
+
+
+FSocketServerTCPMessageParser::FSocketServerTCPMessageParser(FString sessionIDP, FString serverIDP, EReceiveFilterServer receiveFilterP) :
+	sessionID(sessionIDP),
+	serverID(serverIDP),
+	receiveFilter(receiveFilterP) {
+
+	USocketServerBPLibrary::socketServerBPLibrary->getTcpWrapping(tcpMessageHeader, tcpMessageFooter, messageWrapping);
+	maxMessageSize = USocketServerBPLibrary::socketServerBPLibrary->getTcpMaxMessageSize();
+
+	headerToken.init(tcpMessageHeader);
+	footerToken.init(tcpMessageFooter);
+}
+
+FSocketServerTCPMessageParser::FSocketServerTCPMessageParser(FString sessionIDP, FString serverIDP, EReceiveFilterServer receiveFilterP,
+	ESocketServerTCPMessageWrapping messageWrappingP, FString tcpMessageHeaderP, FString tcpMessageFooterP, int32 maxMessageSizeP) :
+	sessionID(sessionIDP),
+	serverID(serverIDP),
+	receiveFilter(receiveFilterP),
+	tcpMessageHeader(tcpMessageHeaderP),
+	tcpMessageFooter(tcpMessageFooterP),
+	messageWrapping(messageWrappingP),
+	maxMessageSize(maxMessageSizeP) {
+
+	headerToken.init(tcpMessageHeader);
+	footerToken.init(tcpMessageFooter);
+}
+
+void FSocketServerTCPMessageParser::FToken::init(const FString& text) {
+	FTCHARToUTF8 Convert(*text);
+	bytes.Reset();
+	bytes.Append((const uint8*)Convert.Get(), Convert.Length());
+	int32 length = bytes.Num();
+	for (int32 i = 0; i < 256; i++) {
+		skip[i] = length;
+	}
+	for (int32 i = 0; i < length - 1; i++) {
+		skip[bytes[i]] = length - 1 - i;
+	}
+}
+
+int32 FSocketServerTCPMessageParser::FToken::find(const uint8* data, int32 from, int32 to) const {
+	int32 length = bytes.Num();
+	if (length == 0) {
+		return from;
+	}
+	const uint8* token = bytes.GetData();
+	const uint8 last = token[length - 1];
+	int32 position = from;
+	while (position <= to - length) {
+		uint8 current = data[position + length - 1];
+		if (current == last && FMemory::Memcmp(data + position, token, length - 1) == 0) {
+			return position;
+		}
+		position += skip[current];
+	}
+	return INDEX_NONE;
+}
+
+void FSocketServerTCPMessageParser::setRawWriter(FSocketServerTCPRawWriter writer) {
+	rawWriter = writer;
+}
+
+void FSocketServerTCPMessageParser::setMessageHandler(TFunction<void(const uint8* data, int32 dataSize)> handler) {
+	messageHandler = handler;
+}
+
+bool FSocketServerTCPMessageParser::receive(const uint8* data, int32 dataSize) {
+	if (data == nullptr || dataSize <= 0) {
+		return true;
+	}
+
+	//RCON packets are parsed here on the receive thread. the registry is only asked again after registerRCONServer or unregiserRCONServer
+	uint64 generation = FSocketServerRCONEndpoint::getGeneration();
+	if (generation != rconGeneration) {
+		rconGeneration = generation;
+		rconEndpoint = FSocketServerRCONEndpoint::find(serverID);
+	}
+	if (rconEndpoint.IsValid()) {
+		if (rconParser.IsValid() == false) {
+			rconParser = MakeUnique<FSocketServerRCONParser>();
+		}
+		return rconEndpoint->receive(sessionID, *rconParser, data, dataSize, rawWriter);
+	}
+	switch (messageWrapping)
+	{
+	case ESocketServerTCPMessageWrapping::E_None:
+		triggerMessageEvent(data, dataSize);
+		break;
+	case ESocketServerTCPMessageWrapping::E_String:
+		return receiveString(data, dataSize);
+	case ESocketServerTCPMessageWrapping::E_Byte:
+		return receiveBytes(data, dataSize);
+	}
+	return true;
+}
+
+bool FSocketServerTCPMessageParser::receiveString(const uint8* data, int32 dataSize) {
+	if (receiveFilter == EReceiveFilterServer::E_B) {
+		return true;
+	}
+
+	stringBuffer.Append(data, dataSize);
+	int32 headerSize = headerToken.bytes.Num();
+	int32 footerSize = footerToken.bytes.Num();
+
+	while (true) {
+		int32 end = stringBuffer.Num();
+
+		if (!inStringMessage) {
+			//text outside of header and footer is dropped
+			int32 index = headerToken.find(stringBuffer.GetData(), stringScan, end);
+			if (index == INDEX_NONE) {
+				//keep what could be the beginning of a header that is cut by the end of this read
+				stringHead = FMath::Max(stringHead, end - (headerSize - 1));
+				stringScan = stringHead;
+				break;
+			}
+			inStringMessage = true;
+			stringHead = index + headerSize;
+			stringScan = stringHead;
+			continue;
+		}
+
+		if (footerSize == 0) {
+			//without footer every read is a message
+			if (end > stringHead) {
+				triggerStringEvent(stringBuffer.GetData() + stringHead, end - stringHead);
+			}
+			inStringMessage = false;
+			stringHead = end;
+			stringScan = end;
+			break;
+		}
+
+		int32 index = footerToken.find(stringBuffer.GetData(), stringScan, end);
+		if (index == INDEX_NONE) {
+			stringScan = FMath::Max(stringHead, end - (footerSize - 1));
+			break;
+		}
+
+		//a line break after the footer is text outside of a message and is dropped with it.
+		//it is never part of the message, no matter whether it arrives in the same read or a later one
+		int32 next = index + footerSize;
+		triggerStringEvent(stringBuffer.GetData() + stringHead, index - stringHead);
+
+		inStringMessage = false;
+		stringHead = next;
+		stringScan = next;
+	}
+
+	//drop consumed bytes once per read. an unfinished message stays at the front
+	if (stringHead > 0) {
+		stringBuffer.RemoveAt(0, stringHead, false);
+		stringScan -= stringHead;
+		stringHead = 0;
+	}
+	if (inStringMessage && stringBuffer.Num() > maxMessageSize) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: TCP message without footer after %i bytes. Connection is closed."), stringBuffer.Num());
+		return false;
+	}
+	return true;
+}
+
+bool FSocketServerTCPMessageParser::receiveBytes(const uint8* data, int32 dataSize) {
+	while (dataSize > 0) {
+
+		if (hasPendingMessage) {
+			int32 take = FMath::Min(pendingMessageSize - pendingMessage.Num(), dataSize);
+			pendingMessage.Append(data, take);
+			data += take;
+			dataSize -= take;
+			if (pendingMessage.Num() < pendingMessageSize) {
+				return true;
+			}
+			triggerMessageEvent(pendingMessage.GetData(), pendingMessage.Num());
+			hasPendingMessage = false;
+			pendingMessage.Reset();
+			continue;
+		}
+
+		int32 messageSize = 0;
+		if (pendingHeaderSize > 0 || dataSize < byteHeaderSize) {
+			int32 take = FMath::Min(byteHeaderSize - pendingHeaderSize, dataSize);
+			FMemory::Memcpy(pendingHeader + pendingHeaderSize, data, take);
+			pendingHeaderSize += take;
+			data += take;
+			dataSize -= take;
+			if (pendingHeaderSize < byteHeaderSize) {
+				return true;
+			}
+			pendingHeaderSize = 0;
+			if (!readDataLength(pendingHeader, messageSize)) {
+				return false;
+			}
+		}
+		else {
+			if (!readDataLength(data, messageSize)) {
+				return false;
+			}
+			data += byteHeaderSize;
+			dataSize -= byteHeaderSize;
+		}
+
+		//whole message inside this read
+		if (messageSize <= dataSize) {
+			triggerMessageEvent(data, messageSize);
+			data += messageSize;
+			dataSize -= messageSize;
+			continue;
+		}
+
+		//grows with the data that really arrives, a bogus length does not allocate anything up front
+		hasPendingMessage = true;
+		pendingMessageSize = messageSize;
+		pendingMessage.Reset();
+		pendingMessage.Reserve(FMath::Min(messageSize, 1024 * 1024));
+	}
+	return true;
+}
+
+void FSocketServerTCPMessageParser::triggerMessageEvent(const uint8* data, int32 dataSize) {
+	if (messageHandler) {
+		messageHandler(data, dataSize);
+		return;
+	}
+
+	TArray<uint8> byteDataArray;
+	FString message = FString();
+	if (receiveFilter == EReceiveFilterServer::E_SAB || receiveFilter == EReceiveFilterServer::E_S) {
+		FUTF8ToTCHAR Convert((const ANSICHAR*)data, dataSize);
+		message = FString(Convert.Length(), Convert.Get());
+		if (receiveFilter == EReceiveFilterServer::E_SAB) {
+			//byte arrays always carried the null-terminator of the string conversion
+			byteDataArray.Reserve(dataSize + 1);
+			byteDataArray.Append(data, dataSize);
+			byteDataArray.Add(0x00);
+		}
+	}
+	else {
+		byteDataArray.Append(data, dataSize);
+	}
+
+	//switch to gamethread
+	FString sessionIDGlobal = sessionID;
+	FString serverIDGlobal = serverID;
+	AsyncTask(ENamedThreads::GameThread, [message, sessionIDGlobal, byteDataArray, serverIDGlobal]() {
+		USocketServerBPLibrary::socketServerBPLibrary->onserverReceiveTCPMessageEventDelegate.Broadcast(sessionIDGlobal, message, byteDataArray, serverIDGlobal);
+		if (USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(sessionIDGlobal) != nullptr) {
+			USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(sessionIDGlobal)->onregisteredEventDelegate.Broadcast(message, byteDataArray);
+		}
+	});
+}
+
+void FSocketServerTCPMessageParser::triggerStringEvent(const uint8* data, int32 dataSize) {
+	if (messageHandler) {
+		messageHandler(data, dataSize);
+		return;
+	}
+	FUTF8ToTCHAR Convert((const ANSICHAR*)data, dataSize);
+	FString message = FString(Convert.Length(), Convert.Get());
+
+	//switch to gamethread
+	FString sessionIDGlobal = sessionID;
+	FString serverIDGlobal = serverID;
+	AsyncTask(ENamedThreads::GameThread, [message, sessionIDGlobal, serverIDGlobal]() {
+		TArray<uint8> byteDataArray;
+		USocketServerBPLibrary::socketServerBPLibrary->onserverReceiveTCPMessageEventDelegate.Broadcast(sessionIDGlobal, message, byteDataArray, serverIDGlobal);
+		if (USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(sessionIDGlobal) != nullptr) {
+			USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(sessionIDGlobal)->onregisteredEventDelegate.Broadcast(message, byteDataArray);
+		}
+	});
+}
+
+bool FSocketServerTCPMessageParser::readDataLength(const uint8* header, int32& byteLenght) const {
+	if (header[0] == 0x00) {
+		byteLenght = (int32)((uint32)header[1] | ((uint32)header[2] << 8) | ((uint32)header[3] << 16) | ((uint32)header[4] << 24));
+	}
+	else if (header[0] == 0x01) {
+		byteLenght = (int32)((uint32)header[4] | ((uint32)header[3] << 8) | ((uint32)header[2] << 16) | ((uint32)header[1] << 24));
+	}
+	else {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Invalid TCP byte header (0x%02x). Connection is closed."), header[0]);
+		return false;
+	}
+	if (byteLenght < 0 || byteLenght > maxMessageSize) {
+		UE_LOG(LogTemp, Error, TEXT("SimpleSocketServer Plugin: Invalid TCP message length (%i, limit %i). Connection is closed."), byteLenght, maxMessageSize);
+		return false;
+	}
+	return true;
+}
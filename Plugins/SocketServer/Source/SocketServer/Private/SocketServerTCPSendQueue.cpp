@@ -0,0 +1,160 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerTCPSendQueue.h"
+#include "SocketServerNativeSocket.h"
+
+
+FSocketServerTCPSendItem::FSocketServerTCPSendItem(TArray<uint8>&& payloadP, bool byteWrapping) :
+	payload(MoveTemp(payloadP)) {
+	if (byteWrapping) {
+		header[0] = FGenericPlatformProperties::IsLittleEndian() ? 0x00 : 0x01;
+		int32 dataLength = payload.Num();
+		FMemory::Memcpy(header + 1, &dataLength, 4);
+		headerSize = 5;
+	}
+}
+
+void FSocketServerTCPSendQueue::add(FSocketServerTCPSendItem&& item) {
+	queuedBytes += item.size();
+	items.Add(MoveTemp(item));
+}
+
+void FSocketServerTCPSendQueue::advance(int64 bytes, FSocketServerSessionCounters* counters) {
+	while (bytes > 0 && head < items.Num()) {
+		FSocketServerTCPSendItem& item = items[head];
+		int32 left = item.size() - offset;
+		if (bytes < left) {
+			offset += (int32)bytes;
+			return;
+		}
+		bytes -= left;
+		queuedBytes -= item.size();
+		if (counters != nullptr) {
+			counters->sent(item.size());
+			counters->sendQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+		}
+		item.payload.Empty();
+		head++;
+		offset = 0;
+	}
+	//everything sent. reuse the allocation
+	if (head >= items.Num()) {
+		items.Reset();
+		head = 0;
+	}
+	//a queue that never drains completely would grow forever. drop the sent items once they are the larger part
+	else if (head > items.Num() / 2) {
+		items.RemoveAt(0, head, false);
+		head = 0;
+	}
+}
+
+void FSocketServerTCPSendQueue::empty(FSocketServerSessionCounters* counters) {
+	if (counters != nullptr)
+		counters->sendQueueDepth.fetch_sub(num(), std::memory_order_relaxed);
+	items.Empty();
+	head = 0;
+	offset = 0;
+	queuedBytes = 0;
+}
+
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+
+int64 FSocketServerTCPSendQueue::write(FSocket* socket, FSocketServerSessionCounters* counters) {
+	if (isEmpty()) {
+		return 0;
+	}
+
+	const int32 maxVectors = 64;
+	struct iovec vectors[maxVectors];
+	int32 vectorCount = 0;
+	int32 skip = offset;
+
+	for (int32 i = head; i < items.Num() && vectorCount < maxVectors - 1; i++) {
+		FSocketServerTCPSendItem& item = items[i];
+		if (skip < item.headerSize) {
+			vectors[vectorCount].iov_base = item.header + skip;
+			vectors[vectorCount].iov_len = item.headerSize - skip;
+			vectorCount++;
+			skip = 0;
+		}
+		else {
+			skip -= item.headerSize;
+		}
+		if (skip < item.payload.Num()) {
+			vectors[vectorCount].iov_base = item.payload.GetData() + skip;
+			vectors[vectorCount].iov_len = item.payload.Num() - skip;
+			vectorCount++;
+		}
+		skip = 0;
+	}
+
+	struct msghdr message;
+	FMemory::Memzero(message);
+	message.msg_iov = vectors;
+	message.msg_iovlen = vectorCount;
+
+	ssize_t written;
+	do {
+		written = sendmsg(FSocketServerNativeSocket::getHandle(socket), &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (written < 0 && errno == EINTR);
+
+	if (written < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		if (counters != nullptr)
+			counters->sendFailed();
+		return -1;
+	}
+	advance(written, counters);
+	return written;
+}
+
+#else
+
+int64 FSocketServerTCPSendQueue::write(FSocket* socket, FSocketServerSessionCounters* counters) {
+	if (isEmpty()) {
+		return 0;
+	}
+
+	//no gathered send in FSocket. small messages are copied into one buffer, large ones are sent from their own memory
+	const int32 coalesceLimit = 64 * 1024;
+	const uint8* data = nullptr;
+	int32 dataSize = 0;
+	FSocketServerTCPSendItem& first = items[head];
+	if (offset >= first.headerSize && first.size() - offset >= coalesceLimit) {
+		data = first.payload.GetData() + offset - first.headerSize;
+		dataSize = first.size() - offset;
+	}
+	else {
+		coalesceBuffer.Reset();
+		int32 skip = offset;
+		for (int32 i = head; i < items.Num() && coalesceBuffer.Num() < coalesceLimit; i++) {
+			FSocketServerTCPSendItem& item = items[i];
+			if (skip < item.headerSize) {
+				coalesceBuffer.Append(item.header + skip, item.headerSize - skip);
+				skip = 0;
+			}
+			else {
+				skip -= item.headerSize;
+			}
+			int32 take = FMath::Min(item.payload.Num() - skip, coalesceLimit - coalesceBuffer.Num());
+			coalesceBuffer.Append(item.payload.GetData() + skip, FMath::Max(take, 0));
+			skip = 0;
+		}
+		data = coalesceBuffer.GetData();
+		dataSize = coalesceBuffer.Num();
+	}
+
+	int32 sent = 0;
+	if (!socket->Send(data, dataSize, sent)) {
+		if (counters != nullptr)
+			counters->sendFailed();
+		return -1;
+	}
+	advance(sent, counters);
+	return sent;
+}
+
+#endif
@@ -0,0 +1,132 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerUDPReassembler.h"
+
+
+void FSocketServerUDPFragmentHeader::write(uint8* out) const {
+	out[0] = (uint8)(magic & 0xFF);
+	out[1] = (uint8)(magic >> 8);
+	out[2] = version;
+	out[3] = 0;
+	out[4] = (uint8)(messageID & 0xFF);
+	out[5] = (uint8)((messageID >> 8) & 0xFF);
+	out[6] = (uint8)((messageID >> 16) & 0xFF);
+	out[7] = (uint8)(messageID >> 24);
+	out[8] = (uint8)(index & 0xFF);
+	out[9] = (uint8)(index >> 8);
+	out[10] = (uint8)(count & 0xFF);
+	out[11] = (uint8)(count >> 8);
+}
+
+bool FSocketServerUDPFragmentHeader::read(const uint8* data, int32 dataSize) {
+	if (dataSize < size || data[0] != (uint8)(magic & 0xFF) || data[1] != (uint8)(magic >> 8) || data[2] != version) {
+		return false;
+	}
+	messageID = (uint32)data[4] | ((uint32)data[5] << 8) | ((uint32)data[6] << 16) | ((uint32)data[7] << 24);
+	index = (uint16)(data[8] | (data[9] << 8));
+	count = (uint16)(data[10] | (data[11] << 8));
+	return count > 1 && index < count;
+}
+
+
+bool FSocketServerUDPReassembler::add(const FSocketServerUDPAddressKey& sender, const FSocketServerUDPFragmentHeader& header, const uint8* payload, int32 payloadSize,
+	double timeoutSeconds, int64 memoryLimit, TArray<uint8>& message) {
+
+	if (payloadSize <= 0) {
+		return false;
+	}
+
+	double now = FPlatformTime::Seconds();
+	if (now - lastPurge > 0.25) {
+		purge(now, timeoutSeconds);
+		lastPurge = now;
+	}
+
+	FMessageKey key;
+	key.sender = sender;
+	key.messageID = header.messageID;
+
+	FPendingMessage* entry = pending.Find(key);
+	if (entry != nullptr && entry->fragments.Num() != header.count) {
+		//message id was reused by a new message, the old one can not complete anymore
+		remove(key, true);
+		entry = nullptr;
+	}
+	if (entry == nullptr) {
+		int64 overhead = overheadBytes(header.count);
+		if (overhead + payloadSize > memoryLimit) {
+			//could never be buffered completely
+			droppedMessages++;
+			return false;
+		}
+		entry = &pending.Add(key);
+		entry->fragments.SetNum(header.count);
+		entry->firstSeen = now;
+		entry->bytes = overhead;
+		order.AddTail(key);
+		entry->orderNode = order.GetTail();
+		bufferedBytes += overhead;
+	}
+
+	TArray<uint8>& fragment = entry->fragments[header.index];
+	if (fragment.Num() > 0) {
+		//duplicate
+		return false;
+	}
+	fragment.Append(payload, payloadSize);
+	entry->received++;
+	entry->bytes += payloadSize;
+	bufferedBytes += payloadSize;
+
+	if (entry->received == header.count) {
+		message.Reset(entry->bytes);
+		for (const TArray<uint8>& part : entry->fragments) {
+			message.Append(part);
+		}
+		remove(key, false);
+		return true;
+	}
+
+	//make room, oldest first. a message that alone is larger than the limit is dropped as well
+	while (bufferedBytes > memoryLimit && evictOldest()) {
+	}
+	return false;
+}
+
+void FSocketServerUDPReassembler::remove(const FMessageKey& key, bool dropped) {
+	FPendingMessage* entry = pending.Find(key);
+	if (entry == nullptr) {
+		return;
+	}
+	bufferedBytes -= entry->bytes;
+	order.RemoveNode(entry->orderNode);
+	pending.Remove(key);
+	if (dropped) {
+		droppedMessages++;
+	}
+}
+
+void FSocketServerUDPReassembler::purge(double now, double timeoutSeconds) {
+	//the list is ordered by firstSeen, so only the expired head has to be looked at
+	while (order.GetHead() != nullptr) {
+		FMessageKey key = order.GetHead()->GetValue();
+		const FPendingMessage* entry = pending.Find(key);
+		if (entry == nullptr) {
+			order.RemoveNode(order.GetHead());
+			continue;
+		}
+		if (now - entry->firstSeen <= timeoutSeconds) {
+			break;
+		}
+		remove(key, true);
+	}
+}
+
+bool FSocketServerUDPReassembler::evictOldest() {
+	if (order.GetHead() == nullptr) {
+		return false;
+	}
+	FMessageKey key = order.GetHead()->GetValue();
+	remove(key, true);
+	return true;
+}
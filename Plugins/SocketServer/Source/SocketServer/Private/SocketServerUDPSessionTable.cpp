@@ -0,0 +1,123 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerUDPSessionTable.h"
+#include "SocketServer.h"
+
+
+FSocketServerUDPAddressKey::FSocketServerUDPAddressKey(const FInternetAddr& addr) {
+	if (addr.GetProtocolType() == FNetworkProtocolTypes::IPv6) {
+		TArray<uint8> raw = addr.GetRawIp();
+		*this = FSocketServerUDPAddressKey(raw.GetData(), raw.Num(), (uint16)addr.GetPort());
+	}
+	else {
+		uint32 ip = 0;
+		addr.GetIp(ip);
+		low = ip;
+		portAndFamily = (4u << 16) | (uint16)addr.GetPort();
+	}
+}
+
+FSocketServerUDPAddressKey::FSocketServerUDPAddressKey(const uint8* ipBytes, int32 ipSize, uint16 port) {
+	if (ipSize == 16) {
+		FMemory::Memcpy(&high, ipBytes, 8);
+		FMemory::Memcpy(&low, ipBytes + 8, 8);
+		portAndFamily = (6u << 16) | port;
+	}
+	else if (ipSize == 4) {
+		//same layout as FInternetAddr::GetIp (host byte order)
+		low = ((uint32)ipBytes[0] << 24) | ((uint32)ipBytes[1] << 16) | ((uint32)ipBytes[2] << 8) | (uint32)ipBytes[3];
+		portAndFamily = (4u << 16) | port;
+	}
+}
+
+
+FSocketServerUDPSessionTable::FSocketServerUDPSessionTable() {
+	for (int32 i = 0; i < shardCount; i++) {
+		shards[i] = MakeShared<FShardMap, ESPMode::ThreadSafe>();
+	}
+}
+
+FClientSocketSession* FSocketServerUDPSessionTable::find(const FSocketServerUDPAddressKey& key, FReader& reader) const {
+	if (generation.load(std::memory_order_acquire) != reader.generation) {
+		FScopeLock lock(&writeLock);
+		for (int32 i = 0; i < shardCount; i++) {
+			reader.shards[i] = shards[i];
+		}
+		reader.generation = generation.load(std::memory_order_relaxed);
+	}
+
+	const FClientSocketSessionPtr* session = reader.shards[shardIndex(key)]->Find(key);
+	if (session == nullptr) {
+		return nullptr;
+	}
+	return session->Get();
+}
+
+FClientSocketSessionPtr FSocketServerUDPSessionTable::findByID(const FString& sessionID) const {
+	FScopeLock lock(&writeLock);
+	const FClientSocketSessionPtr* session = sessionsByID.Find(sessionID);
+	if (session == nullptr) {
+		return nullptr;
+	}
+	return *session;
+}
+
+FClientSocketSessionPtr FSocketServerUDPSessionTable::add(const FSocketServerUDPAddressKey& key, FClientSocketSessionPtr session) {
+	FScopeLock lock(&writeLock);
+
+	int32 index = shardIndex(key);
+	const FClientSocketSessionPtr* existing = shards[index]->Find(key);
+	if (existing != nullptr) {
+		return *existing;
+	}
+
+	//a session added again under the same ID but another address replaces the old entry
+	FSocketServerUDPAddressKey* oldKey = keysByID.Find(session->sessionID);
+	if (oldKey != nullptr) {
+		int32 oldIndex = shardIndex(*oldKey);
+		TSharedPtr<FShardMap, ESPMode::ThreadSafe> oldShardCopy = MakeShared<FShardMap, ESPMode::ThreadSafe>(*shards[oldIndex]);
+		oldShardCopy->Remove(*oldKey);
+		shards[oldIndex] = oldShardCopy;
+	}
+
+	TSharedPtr<FShardMap, ESPMode::ThreadSafe> shardCopy = MakeShared<FShardMap, ESPMode::ThreadSafe>(*shards[index]);
+	shardCopy->Add(key, session);
+	shards[index] = shardCopy;
+
+	keysByID.Add(session->sessionID, key);
+	sessionsByID.Add(session->sessionID, session);
+	generation.fetch_add(1, std::memory_order_release);
+	return session;
+}
+
+FClientSocketSessionPtr FSocketServerUDPSessionTable::remove(const FString& sessionID) {
+	FScopeLock lock(&writeLock);
+
+	FSocketServerUDPAddressKey key;
+	if (keysByID.RemoveAndCopyValue(sessionID, key) == false) {
+		return nullptr;
+	}
+
+	FClientSocketSessionPtr session;
+	sessionsByID.RemoveAndCopyValue(sessionID, session);
+
+	int32 index = shardIndex(key);
+	TSharedPtr<FShardMap, ESPMode::ThreadSafe> shardCopy = MakeShared<FShardMap, ESPMode::ThreadSafe>(*shards[index]);
+	shardCopy->Remove(key);
+	shards[index] = shardCopy;
+
+	generation.fetch_add(1, std::memory_order_release);
+	return session;
+}
+
+TArray<FClientSocketSessionPtr> FSocketServerUDPSessionTable::getAll() const {
+	FScopeLock lock(&writeLock);
+	TArray<FClientSocketSessionPtr> sessions;
+	sessionsByID.GenerateValueArray(sessions);
+	return sessions;
+}
+
+int32 FSocketServerUDPSessionTable::num() const {
+	FScopeLock lock(&writeLock);
+	return sessionsByID.Num();
+}
@@ -0,0 +1,328 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerChunkedTransfer.h"
+#include "Misc/AutomationTest.h"
+#include "Async/Async.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+static bool writeTestChunk(FSocketServerChunkedTransfer& transfer, const TArray<uint8>& data, int32 index) {
+	int64 offset = (int64)index * transfer.getChunkSize();
+	int32 length = (int32)transfer.getChunkLength(index);
+	return transfer.writeChunk(index, data.GetData() + offset, length, FSocketServerChunkedTransfer::hashChunk(data.GetData() + offset, length));
+}
+
+static bool sendLoopbackBytes(FSocket* socket, const uint8* data, int32 dataSize) {
+	while (dataSize > 0) {
+		int32 bytesSent = 0;
+		if (!socket->Send(data, dataSize, bytesSent)) {
+			return false;
+		}
+		data += bytesSent;
+		dataSize -= bytesSent;
+	}
+	return true;
+}
+
+//false once the other side is gone
+static bool recvLoopbackBytes(FSocket* socket, uint8* data, int32 dataSize) {
+	while (dataSize > 0) {
+		int32 bytesRead = 0;
+		if (!socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(5)) || !socket->Recv(data, dataSize, bytesRead) || bytesRead <= 0) {
+			return false;
+		}
+		data += bytesRead;
+		dataSize -= bytesRead;
+	}
+	return true;
+}
+
+struct FSocketServerChunkedLoopbackResult {
+	bool connected = false;
+	int32 chunksWritten = 0;
+	double seconds = 0.0;
+};
+
+//every connection is a loopback pair. the client side sends int32 index | uint64 hash | chunk, the server side writes into the shared transfer
+//like the file handler threads do. chunks are spread round robin over the connections. with drop set every connection dies in the middle of its last chunk
+static FSocketServerChunkedLoopbackResult uploadOverLoopback(ISocketSubsystem* socketSubsystem, FSocketServerChunkedTransfer& transfer, const TArray<uint8>& data,
+	const TArray<int32>& chunks, int32 connections, bool drop) {
+	FSocketServerChunkedLoopbackResult result;
+	TSharedRef<FInternetAddr> addr = socketSubsystem->CreateInternetAddr();
+	bool validIP = false;
+	addr->SetIp(TEXT("127.0.0.1"), validIP);
+	addr->SetPort(0);
+	FSocket* listener = socketSubsystem->CreateSocket(NAME_Stream, TEXT("SocketServerChunkedTransferTestListener"), addr->GetProtocolType());
+	if (listener == nullptr) {
+		return result;
+	}
+	TArray<FSocket*> clients;
+	TArray<FSocket*> servers;
+	if (listener->Bind(*addr) && listener->Listen(connections)) {
+		addr->SetPort(listener->GetPortNo());
+		for (int32 i = 0; i < connections; i++) {
+			FSocket* client = socketSubsystem->CreateSocket(NAME_Stream, TEXT("SocketServerChunkedTransferTestClient"), addr->GetProtocolType());
+			if (client == nullptr) {
+				break;
+			}
+			clients.Add(client);
+			if (!client->Connect(*addr) || !listener->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(5))) {
+				break;
+			}
+			FSocket* server = listener->Accept(TEXT("SocketServerChunkedTransferTestServer"));
+			if (server == nullptr) {
+				break;
+			}
+			servers.Add(server);
+		}
+	}
+	result.connected = servers.Num() == connections;
+
+	if (result.connected) {
+		std::atomic<int32> chunksWritten{ 0 };
+		TArray<TFuture<void>> threads;
+		double start = FPlatformTime::Seconds();
+		for (int32 c = 0; c < connections; c++) {
+			FSocket* server = servers[c];
+			threads.Add(Async(EAsyncExecution::Thread, [server, &transfer, &chunksWritten]() {
+				TArray<uint8> chunk;
+				chunk.SetNumUninitialized(transfer.getChunkSize());
+				uint8 header[12];
+				while (recvLoopbackBytes(server, header, sizeof(header))) {
+					int32 index = 0;
+					uint64 hash = 0;
+					FMemory::Memcpy(&index, header, 4);
+					FMemory::Memcpy(&hash, header + 4, 8);
+					int32 length = (int32)transfer.getChunkLength(index);
+					if (length == 0 || !recvLoopbackBytes(server, chunk.GetData(), length)) {
+						return;
+					}
+					if (transfer.writeChunk(index, chunk.GetData(), length, hash)) {
+						chunksWritten++;
+					}
+				}
+			}));
+
+			FSocket* client = clients[c];
+			TArray<int32> share;
+			for (int32 i = c; i < chunks.Num(); i += connections) {
+				share.Add(chunks[i]);
+			}
+			threads.Add(Async(EAsyncExecution::Thread, [socketSubsystem, client, &transfer, &data, share, drop]() {
+				for (int32 i = 0; i < share.Num(); i++) {
+					int32 index = share[i];
+					int64 offset = (int64)index * transfer.getChunkSize();
+					int32 length = (int32)transfer.getChunkLength(index);
+					uint64 hash = FSocketServerChunkedTransfer::hashChunk(data.GetData() + offset, length);
+					uint8 header[12];
+					FMemory::Memcpy(header, &index, 4);
+					FMemory::Memcpy(header + 4, &hash, 8);
+					if (drop && i == share.Num() - 1) {
+						length /= 2;
+					}
+					if (!sendLoopbackBytes(client, header, sizeof(header)) || !sendLoopbackBytes(client, data.GetData() + offset, length)) {
+						break;
+					}
+				}
+				//the server side runs into the end of the stream and stops
+				socketSubsystem->DestroySocket(client);
+			}));
+		}
+		for (TFuture<void>& thread : threads) {
+			thread.Wait();
+		}
+		result.seconds = FPlatformTime::Seconds() - start;
+		result.chunksWritten = chunksWritten.load();
+		clients.Empty();
+	}
+
+	for (FSocket* client : clients) {
+		socketSubsystem->DestroySocket(client);
+	}
+	for (FSocket* server : servers) {
+		socketSubsystem->DestroySocket(server);
+	}
+	socketSubsystem->DestroySocket(listener);
+	return result;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerChunkedTransferResumeTest, "SocketServer.ChunkedTransfer.DropAndResume",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerChunkedTransferResumeTest::RunTest(const FString& Parameters) {
+	const int32 chunkSize = FSocketServerChunkedTransfer::minChunkSize;
+	//the last chunk is shorter
+	const int64 fileSize = (int64)chunkSize * 10 + 1234;
+	const FString filePath = FPaths::CreateTempFilename(*FPaths::AutomationTransientDir(), TEXT("ChunkedTransfer"), TEXT(".bin"));
+	const FString statePath = filePath + ".chunks";
+	FRandomStream random(42);
+	IFileManager::Get().MakeDirectory(*FPaths::AutomationTransientDir(), true);
+
+	TArray<uint8> data;
+	data.SetNumUninitialized((int32)fileSize);
+	for (uint8& byte : data) {
+		byte = (uint8)random.RandRange(0, 255);
+	}
+
+	TestFalse(TEXT("Empty file"), FSocketServerChunkedTransfer::isValidSize(0, chunkSize));
+	TestFalse(TEXT("Too many chunks"), FSocketServerChunkedTransfer::isValidSize((int64)FSocketServerChunkedTransfer::maxChunkCount * chunkSize + 1, chunkSize));
+	TestFalse(TEXT("Open with an invalid size"), FSocketServerChunkedTransfer(filePath, 0, chunkSize).open());
+
+	//first connection set: some chunks out of order, then the upload is dropped
+	const TArray<int32> firstChunks = { 7, 2, 10, 0, 5, 3 };
+	{
+		FSocketServerChunkedTransfer transfer(filePath, fileSize, chunkSize);
+		if (!TestTrue(TEXT("Open"), transfer.open())) {
+			return false;
+		}
+		TestEqual(TEXT("Chunk count"), transfer.getChunkCount(), 11);
+		TestEqual(TEXT("Nothing received"), transfer.getMissingChunks(), FString(TEXT("ff7")));
+
+		for (int32 index : firstChunks) {
+			TestTrue(FString::Printf(TEXT("Chunk %i written"), index), writeTestChunk(transfer, data, index));
+		}
+		//a repeated chunk is fine, broken ones are refused
+		TestTrue(TEXT("Repeated chunk"), writeTestChunk(transfer, data, 7));
+		int32 broken = 9;
+		int64 offset = (int64)broken * chunkSize;
+		int32 length = (int32)transfer.getChunkLength(broken);
+		uint64 hash = FSocketServerChunkedTransfer::hashChunk(data.GetData() + offset, length);
+		TestFalse(TEXT("Wrong hash"), transfer.writeChunk(broken, data.GetData() + offset, length, hash ^ 1));
+		TestFalse(TEXT("Wrong size"), transfer.writeChunk(broken, data.GetData() + offset, length - 1, hash));
+		TestFalse(TEXT("Index past the end"), transfer.writeChunk(11, data.GetData(), length, hash));
+		TestFalse(TEXT("Not complete"), transfer.isComplete());
+		//missing 1 | 4, 6 | 8, 9
+		TestEqual(TEXT("Missing chunks before the drop"), transfer.getMissingChunks(), FString(TEXT("253")));
+	}
+
+	//the upload comes back: only the missing chunks are asked for
+	{
+		FSocketServerChunkedTransfer transfer(filePath, fileSize, chunkSize);
+		if (!TestTrue(TEXT("Reopen"), transfer.open())) {
+			return false;
+		}
+		TestEqual(TEXT("Missing chunks after the drop"), transfer.getMissingChunks(), FString(TEXT("253")));
+		//five full chunks and the short last one
+		TestEqual(TEXT("Received bytes after the drop"), transfer.getReceivedBytes(), (int64)chunkSize * 5 + 1234);
+
+		for (int32 index : { 1, 4, 6, 8, 9 }) {
+			TestTrue(FString::Printf(TEXT("Missing chunk %i written"), index), writeTestChunk(transfer, data, index));
+		}
+		TestTrue(TEXT("Complete"), transfer.isComplete());
+		TestEqual(TEXT("Nothing missing"), transfer.getMissingChunks(), FString(TEXT("000")));
+		TestEqual(TEXT("Received bytes"), transfer.getReceivedBytes(), fileSize);
+		transfer.finish();
+	}
+
+	TArray<uint8> result;
+	TestTrue(TEXT("File read back"), FFileHelper::LoadFileToArray(result, *filePath));
+	TestTrue(TEXT("File content"), result == data);
+	TestFalse(TEXT("Sidecar deleted"), FPaths::FileExists(statePath));
+
+	//a sidecar of a different upload to the same path is not trusted
+	{
+		FSocketServerChunkedTransfer transfer(filePath, fileSize, chunkSize);
+		TestTrue(TEXT("Open again"), transfer.open());
+		TestTrue(TEXT("Chunk written again"), writeTestChunk(transfer, data, 0));
+	}
+	{
+		FSocketServerChunkedTransfer transfer(filePath, fileSize - 1, chunkSize);
+		TestTrue(TEXT("Open with another size"), transfer.open());
+		TestEqual(TEXT("Received bytes with another size"), transfer.getReceivedBytes(), (int64)0);
+		transfer.finish();
+	}
+
+	IFileManager::Get().Delete(*filePath, false, true, true);
+	IFileManager::Get().Delete(*statePath, false, true, true);
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerChunkedTransferLoopbackTest, "SocketServer.ChunkedTransfer.LoopbackConnections",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerChunkedTransferLoopbackTest::RunTest(const FString& Parameters) {
+	const int32 chunkSize = FSocketServerChunkedTransfer::minChunkSize;
+	//256 full chunks and a short one
+	const int64 fileSize = (int64)chunkSize * 256 + 777;
+	ISocketSubsystem* socketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	IFileManager::Get().MakeDirectory(*FPaths::AutomationTransientDir(), true);
+	FRandomStream random(42);
+
+	TArray<uint8> data;
+	data.SetNumUninitialized((int32)fileSize);
+	for (uint8& byte : data) {
+		byte = (uint8)random.RandRange(0, 255);
+	}
+	TArray<int32> allChunks;
+	for (int32 i = 0; i < 257; i++) {
+		allChunks.Add(i);
+	}
+
+	//four connections send chunks 0 - 131 and die in the middle of 128 - 131
+	const FString filePath = FPaths::CreateTempFilename(*FPaths::AutomationTransientDir(), TEXT("ChunkedTransfer"), TEXT(".bin"));
+	const FString statePath = filePath + ".chunks";
+	{
+		FSocketServerChunkedTransfer transfer(filePath, fileSize, chunkSize);
+		if (!TestTrue(TEXT("Open"), transfer.open())) {
+			return false;
+		}
+		TArray<int32> firstChunks(allChunks.GetData(), 132);
+		FSocketServerChunkedLoopbackResult dropped = uploadOverLoopback(socketSubsystem, transfer, data, firstChunks, 4, true);
+		if (!TestTrue(TEXT("Four connections before the drop"), dropped.connected)) {
+			return false;
+		}
+		TestEqual(TEXT("Chunks written before the drop"), dropped.chunksWritten, 128);
+		TestFalse(TEXT("Not complete"), transfer.isComplete());
+	}
+
+	//new connections pick up the sidecar and send only what is missing
+	{
+		FSocketServerChunkedTransfer transfer(filePath, fileSize, chunkSize);
+		if (!TestTrue(TEXT("Reopen"), transfer.open())) {
+			return false;
+		}
+		//32 digits for chunks 0 - 127, 32 for 128 - 255, chunk 256 alone in the last digit
+		TestEqual(TEXT("Missing chunks after the drop"), transfer.getMissingChunks(), FString::ChrN(32, TEXT('0')) + FString::ChrN(32, TEXT('f')) + TEXT("1"));
+		TestEqual(TEXT("Received bytes after the drop"), transfer.getReceivedBytes(), (int64)chunkSize * 128);
+
+		TArray<int32> missingChunks(allChunks.GetData() + 128, 129);
+		FSocketServerChunkedLoopbackResult resumed = uploadOverLoopback(socketSubsystem, transfer, data, missingChunks, 4, false);
+		TestTrue(TEXT("Four connections after the drop"), resumed.connected);
+		TestEqual(TEXT("Chunks written after the drop"), resumed.chunksWritten, 129);
+		TestTrue(TEXT("Complete"), transfer.isComplete());
+		TestEqual(TEXT("Nothing missing"), transfer.getMissingChunks(), FString::ChrN(65, TEXT('0')));
+		transfer.finish();
+	}
+	TArray<uint8> result;
+	TestTrue(TEXT("File read back"), FFileHelper::LoadFileToArray(result, *filePath));
+	TestTrue(TEXT("File content"), result == data);
+	TestFalse(TEXT("Sidecar deleted"), FPaths::FileExists(statePath));
+	IFileManager::Get().Delete(*filePath, false, true, true);
+
+	//the same file over one and over four connections. hashing runs outside of the transfer lock, so more connections must not be slower
+	double bytesPerSecond[2] = { 0.0, 0.0 };
+	const int32 connectionCounts[2] = { 1, 4 };
+	for (int32 run = 0; run < 2; run++) {
+		//best of two, a single run of a few hundred milliseconds is easily disturbed
+		for (int32 attempt = 0; attempt < 2; attempt++) {
+			const FString scalingPath = FPaths::CreateTempFilename(*FPaths::AutomationTransientDir(), TEXT("ChunkedTransfer"), TEXT(".bin"));
+			FSocketServerChunkedTransfer transfer(scalingPath, fileSize, chunkSize);
+			if (transfer.open()) {
+				FSocketServerChunkedLoopbackResult upload = uploadOverLoopback(socketSubsystem, transfer, data, allChunks, connectionCounts[run], false);
+				TestTrue(FString::Printf(TEXT("%i connections complete"), connectionCounts[run]), upload.connected && transfer.isComplete());
+				if (upload.seconds > 0.0) {
+					bytesPerSecond[run] = FMath::Max(bytesPerSecond[run], fileSize / upload.seconds);
+				}
+				transfer.finish();
+			}
+			IFileManager::Get().Delete(*scalingPath, false, true, true);
+		}
+	}
+	AddInfo(FString::Printf(TEXT("Chunked upload over loopback: %.1f MB/s with one connection, %.1f MB/s with four"), bytesPerSecond[0] / (1024 * 1024), bytesPerSecond[1] / (1024 * 1024)));
+	TestTrue(TEXT("Four connections keep up with one"), bytesPerSecond[0] > 0.0 && bytesPerSecond[1] >= bytesPerSecond[0] * 0.9);
+	return true;
+}
+
+#endif
@@ -0,0 +1,343 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerDNSResolver.h"
+#include "Misc/AutomationTest.h"
+#include "Async/Async.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/*how the stub server answers one name*/
+struct FSocketServerStubDNSName {
+	//A record. empty means NOERROR without addresses
+	TArray<uint8> ipv4;
+	uint32 ttl = 60;
+	bool nxdomain = false;
+	//MINIMUM of an SOA record in the authority section. 0 means no SOA
+	uint32 soaMinimum = 0;
+	//queries per record type that get no answer at all
+	int32 dropFirst = 0;
+	//every answer is held back this long
+	float delaySeconds = 0.f;
+};
+
+/*minimal DNS server on a loopback port. answers A and AAAA questions of the names it knows and counts every query*/
+class FSocketServerStubDNS {
+
+public:
+
+	bool start(ISocketSubsystem* socketSubsystemP) {
+		socketSubsystem = socketSubsystemP;
+		TSharedRef<FInternetAddr> addr = socketSubsystem->CreateInternetAddr();
+		bool validIP = false;
+		addr->SetIp(TEXT("127.0.0.1"), validIP);
+		addr->SetPort(0);
+		socket = socketSubsystem->CreateSocket(NAME_DGram, TEXT("SocketServerStubDNS"), addr->GetProtocolType());
+		if (socket == nullptr || !socket->Bind(*addr)) {
+			return false;
+		}
+		address = FString::Printf(TEXT("127.0.0.1:%i"), socket->GetPortNo());
+		thread = Async(EAsyncExecution::Thread, [this]() {
+			run();
+		});
+		return true;
+	}
+
+	void stop() {
+		running = false;
+		if (thread.IsValid()) {
+			thread.Wait();
+		}
+		if (socket != nullptr) {
+			socketSubsystem->DestroySocket(socket);
+			socket = nullptr;
+		}
+	}
+
+	const FString& getAddress() const {
+		return address;
+	}
+
+	void setName(const FString& name, const FSocketServerStubDNSName& config) {
+		FScopeLock lock(&stubLock);
+		names.Add(name, config);
+	}
+
+	int32 getQueries(const FString& name, uint16 type) {
+		FScopeLock lock(&stubLock);
+		int32* count = queries.Find(FString::Printf(TEXT("%s/%u"), *name, type));
+		return count != nullptr ? *count : 0;
+	}
+
+private:
+
+	static void append16(TArray<uint8>& out, uint16 value) {
+		out.Add((uint8)(value >> 8));
+		out.Add((uint8)value);
+	}
+
+	static void append32(TArray<uint8>& out, uint32 value) {
+		append16(out, (uint16)(value >> 16));
+		append16(out, (uint16)value);
+	}
+
+	void run() {
+		TSharedRef<FInternetAddr> sender = socketSubsystem->CreateInternetAddr();
+		uint8 buffer[512];
+		while (running) {
+			if (!socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromMilliseconds(20))) {
+				continue;
+			}
+			int32 bytesRead = 0;
+			if (!socket->RecvFrom(buffer, sizeof(buffer), bytesRead, *sender) || bytesRead < 17) {
+				continue;
+			}
+
+			//question: labels, type, class
+			FString name;
+			int32 position = 12;
+			while (position < bytesRead && buffer[position] != 0) {
+				int32 length = buffer[position];
+				if (position + 1 + length > bytesRead) {
+					break;
+				}
+				if (!name.IsEmpty()) {
+					name += TEXT(".");
+				}
+				name += FString(length, (const ANSICHAR*)buffer + position + 1).ToLower();
+				position += 1 + length;
+			}
+			int32 questionEnd = position + 5;
+			if (questionEnd > bytesRead) {
+				continue;
+			}
+			uint16 type = (uint16)((buffer[position + 1] << 8) | buffer[position + 2]);
+
+			FSocketServerStubDNSName config;
+			int32 count = 0;
+			{
+				FScopeLock lock(&stubLock);
+				count = ++queries.FindOrAdd(FString::Printf(TEXT("%s/%u"), *name, type));
+				FSocketServerStubDNSName* known = names.Find(name);
+				if (known == nullptr) {
+					continue;
+				}
+				config = *known;
+			}
+			if (count <= config.dropFirst) {
+				continue;
+			}
+			if (config.delaySeconds > 0.f) {
+				FPlatformProcess::Sleep(config.delaySeconds);
+			}
+
+			TArray<uint8> response;
+			response.Append(buffer, questionEnd);
+			response[2] = 0x81;
+			response[3] = config.nxdomain ? 0x83 : 0x80;
+			bool answer = type == 1 && config.ipv4.Num() == 4 && !config.nxdomain;
+			bool soa = !answer && config.soaMinimum > 0;
+			response[6] = 0;
+			response[7] = answer ? 1 : 0;
+			response[8] = 0;
+			response[9] = soa ? 1 : 0;
+			response[10] = 0;
+			response[11] = 0;
+			if (answer) {
+				//name as pointer to the question, type A, class IN
+				append16(response, 0xC00C);
+				append16(response, 1);
+				append16(response, 1);
+				append32(response, config.ttl);
+				append16(response, 4);
+				response.Append(config.ipv4);
+			}
+			if (soa) {
+				//root as mname and rname, serial, refresh, retry, expire, minimum. the record itself has a long ttl
+				append16(response, 0xC00C);
+				append16(response, 6);
+				append16(response, 1);
+				append32(response, 3600);
+				append16(response, 22);
+				response.Add(0);
+				response.Add(0);
+				for (int32 i = 0; i < 4; i++) {
+					append32(response, 1);
+				}
+				append32(response, config.soaMinimum);
+			}
+			int32 bytesSent = 0;
+			socket->SendTo(response.GetData(), response.Num(), bytesSent, *sender);
+		}
+	}
+
+	ISocketSubsystem* socketSubsystem = nullptr;
+	FSocket* socket = nullptr;
+	FString address;
+	TFuture<void> thread;
+	std::atomic<bool> running{ true };
+	FCriticalSection stubLock;
+	TMap<FString, FSocketServerStubDNSName> names;
+	TMap<FString, int32> queries;
+};
+
+/*answers of resolve() calls. the callbacks run on the query threads*/
+struct FSocketServerDNSTestAnswers {
+	FCriticalSection lock;
+	TArray<TArray<FString>> answers;
+
+	int32 num() {
+		FScopeLock scopeLock(&lock);
+		return answers.Num();
+	}
+
+	TArray<FString> get(int32 index) {
+		FScopeLock scopeLock(&lock);
+		return answers.IsValidIndex(index) ? answers[index] : TArray<FString>();
+	}
+};
+
+typedef TSharedPtr<FSocketServerDNSTestAnswers, ESPMode::ThreadSafe> FSocketServerDNSTestAnswersPtr;
+
+static void resolveInto(ISocketSubsystem* socketSubsystem, const FString& domain, const FString& dnsServer, FSocketServerDNSTestAnswersPtr answers) {
+	FSocketServerDNSResolver::get().resolve(socketSubsystem, domain, dnsServer, true, [answers](const TArray<FString>& ips) {
+		FScopeLock lock(&answers->lock);
+		answers->answers.Add(ips);
+	});
+}
+
+static bool waitForAnswers(FSocketServerDNSTestAnswersPtr answers, int32 count, double seconds) {
+	double giveUp = FPlatformTime::Seconds() + seconds;
+	while (answers->num() < count && FPlatformTime::Seconds() < giveUp) {
+		FPlatformProcess::Sleep(0.005f);
+	}
+	return answers->num() >= count;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerDNSResolverStubTest, "SocketServer.DNS.Resolver.LoopbackStub",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerDNSResolverStubTest::RunTest(const FString& Parameters) {
+	ISocketSubsystem* socketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	FSocketServerDNSResolver& resolver = FSocketServerDNSResolver::get();
+	FSocketServerStubDNS stub;
+	if (!TestTrue(TEXT("Stub server started"), stub.start(socketSubsystem))) {
+		stub.stop();
+		return false;
+	}
+	const FString& server = stub.getAddress();
+	resolver.clearCache();
+	//the timeout is per attempt and has to leave room for the delayed answers below
+	resolver.configure(0.5f, 2, 30);
+
+	//TTL: the answer is served from the cache until its ttl of one second is over
+	{
+		FSocketServerStubDNSName name;
+		name.ipv4 = { 10, 1, 2, 3 };
+		name.ttl = 1;
+		stub.setName(TEXT("ttl.test"), name);
+		FSocketServerDNSTestAnswersPtr answers = MakeShared<FSocketServerDNSTestAnswers, ESPMode::ThreadSafe>();
+		resolveInto(socketSubsystem, TEXT("ttl.test"), server, answers);
+		TestTrue(TEXT("TTL: resolved"), waitForAnswers(answers, 1, 5.0) && answers->get(0) == TArray<FString>({ TEXT("10.1.2.3") }));
+		resolveInto(socketSubsystem, TEXT("TTL.test"), server, answers);
+		TestTrue(TEXT("TTL: cached answer, names are case insensitive"), answers->num() == 2 && answers->get(1) == answers->get(0));
+		TestEqual(TEXT("TTL: one A query while cached"), stub.getQueries(TEXT("ttl.test"), 1), 1);
+
+		FPlatformProcess::Sleep(1.2f);
+		resolveInto(socketSubsystem, TEXT("ttl.test"), server, answers);
+		TestTrue(TEXT("TTL: resolved again after expiry"), waitForAnswers(answers, 3, 5.0) && answers->get(2) == answers->get(0));
+		TestEqual(TEXT("TTL: expired answer asked again"), stub.getQueries(TEXT("ttl.test"), 1), 2);
+	}
+
+	//NXDOMAIN: cached for the SOA MINIMUM, capped by the configured negative cache time
+	{
+		FSocketServerStubDNSName name;
+		name.nxdomain = true;
+		name.soaMinimum = 1;
+		stub.setName(TEXT("missing.test"), name);
+		FSocketServerDNSTestAnswersPtr answers = MakeShared<FSocketServerDNSTestAnswers, ESPMode::ThreadSafe>();
+		resolveInto(socketSubsystem, TEXT("missing.test"), server, answers);
+		TestTrue(TEXT("NXDOMAIN: no addresses"), waitForAnswers(answers, 1, 5.0) && answers->get(0).Num() == 0);
+		resolveInto(socketSubsystem, TEXT("missing.test"), server, answers);
+		TestTrue(TEXT("NXDOMAIN: negative answer cached"), answers->num() == 2 && stub.getQueries(TEXT("missing.test"), 1) == 1);
+		FPlatformProcess::Sleep(1.2f);
+		resolveInto(socketSubsystem, TEXT("missing.test"), server, answers);
+		TestTrue(TEXT("NXDOMAIN: asked again after the SOA minimum"), waitForAnswers(answers, 3, 5.0) && stub.getQueries(TEXT("missing.test"), 1) == 2);
+
+		//a negative cache time of 0 turns negative caching off, whatever the zone says
+		resolver.clearCache();
+		resolver.configure(0.5f, 2, 0);
+		name.soaMinimum = 300;
+		stub.setName(TEXT("missing.test"), name);
+		resolveInto(socketSubsystem, TEXT("missing.test"), server, answers);
+		waitForAnswers(answers, 4, 5.0);
+		resolveInto(socketSubsystem, TEXT("missing.test"), server, answers);
+		TestTrue(TEXT("NXDOMAIN: not cached without a negative cache time"), waitForAnswers(answers, 5, 5.0) && stub.getQueries(TEXT("missing.test"), 1) == 4);
+		resolver.configure(0.5f, 2, 30);
+	}
+
+	//NOERROR without addresses: the SOA MINIMUM decides as well
+	{
+		FSocketServerStubDNSName name;
+		name.soaMinimum = 60;
+		stub.setName(TEXT("empty.test"), name);
+		FSocketServerDNSTestAnswersPtr answers = MakeShared<FSocketServerDNSTestAnswers, ESPMode::ThreadSafe>();
+		resolveInto(socketSubsystem, TEXT("empty.test"), server, answers);
+		waitForAnswers(answers, 1, 5.0);
+		resolveInto(socketSubsystem, TEXT("empty.test"), server, answers);
+		TestTrue(TEXT("NODATA: negative answer cached"), answers->num() == 2 && answers->get(1).Num() == 0 && stub.getQueries(TEXT("empty.test"), 28) == 1);
+	}
+
+	//coalescing: lookups for a name that is already being resolved wait for that query
+	{
+		FSocketServerStubDNSName name;
+		name.ipv4 = { 10, 4, 5, 6 };
+		name.delaySeconds = 0.1f;
+		stub.setName(TEXT("slow.test"), name);
+		FSocketServerDNSTestAnswersPtr answers = MakeShared<FSocketServerDNSTestAnswers, ESPMode::ThreadSafe>();
+		for (int32 i = 0; i < 8; i++) {
+			resolveInto(socketSubsystem, TEXT("slow.test"), server, answers);
+		}
+		TestTrue(TEXT("Coalescing: every lookup answered"), waitForAnswers(answers, 8, 5.0));
+		for (int32 i = 0; i < answers->num(); i++) {
+			TestTrue(FString::Printf(TEXT("Coalescing: answer %i"), i), answers->get(i) == TArray<FString>({ TEXT("10.4.5.6") }));
+		}
+		TestEqual(TEXT("Coalescing: one A query"), stub.getQueries(TEXT("slow.test"), 1), 1);
+		TestEqual(TEXT("Coalescing: one AAAA query"), stub.getQueries(TEXT("slow.test"), 28), 1);
+	}
+
+	//retry: the first query of each type gets no answer, the resend after the timeout does
+	{
+		FSocketServerStubDNSName name;
+		name.ipv4 = { 10, 7, 8, 9 };
+		name.dropFirst = 1;
+		stub.setName(TEXT("lossy.test"), name);
+		FSocketServerDNSTestAnswersPtr answers = MakeShared<FSocketServerDNSTestAnswers, ESPMode::ThreadSafe>();
+		resolveInto(socketSubsystem, TEXT("lossy.test"), server, answers);
+		TestTrue(TEXT("Retry: resolved"), waitForAnswers(answers, 1, 5.0) && answers->get(0) == TArray<FString>({ TEXT("10.7.8.9") }));
+		TestEqual(TEXT("Retry: A sent twice"), stub.getQueries(TEXT("lossy.test"), 1), 2);
+		TestEqual(TEXT("Retry: AAAA sent twice"), stub.getQueries(TEXT("lossy.test"), 28), 2);
+	}
+
+	//no answer at all: retries + 1 attempts, nothing cached
+	{
+		FSocketServerStubDNSName name;
+		name.ipv4 = { 10, 0, 0, 1 };
+		name.dropFirst = 1000;
+		stub.setName(TEXT("silent.test"), name);
+		FSocketServerDNSTestAnswersPtr answers = MakeShared<FSocketServerDNSTestAnswers, ESPMode::ThreadSafe>();
+		resolveInto(socketSubsystem, TEXT("silent.test"), server, answers);
+		TestTrue(TEXT("No answer: gives up"), waitForAnswers(answers, 1, 5.0) && answers->get(0).Num() == 0);
+		TestEqual(TEXT("No answer: three attempts"), stub.getQueries(TEXT("silent.test"), 1), 3);
+		resolveInto(socketSubsystem, TEXT("silent.test"), server, answers);
+		waitForAnswers(answers, 2, 5.0);
+		TestEqual(TEXT("No answer: not cached"), stub.getQueries(TEXT("silent.test"), 1), 6);
+	}
+
+	stub.stop();
+	resolver.clearCache();
+	resolver.configure(2, 2, 30);
+	return true;
+}
+
+#endif
@@ -0,0 +1,104 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerFileHash.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+static void updateInPieces(FSocketServerFileHash& hash, const TArray<uint8>& data, int64 from, int64 to, FRandomStream& random) {
+	while (from < to) {
+		int64 take = FMath::Min((int64)random.RandRange(1, 300000), to - from);
+		hash.update(data.GetData() + from, take);
+		from += take;
+	}
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerFileHashResumeTest, "SocketServer.FileHash.Resume",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerFileHashResumeTest::RunTest(const FString& Parameters) {
+	IFileManager::Get().MakeDirectory(*FPaths::AutomationTransientDir(), true);
+	const FString filePath = FPaths::CreateTempFilename(*FPaths::AutomationTransientDir(), TEXT("FileHash"), TEXT(".bin"));
+	FRandomStream random(43);
+
+	//more than the 1 MB read buffer of the fallback, and not a multiple of it
+	TArray<uint8> data;
+	data.SetNumUninitialized(3 * 1024 * 1024 + 123);
+	for (uint8& byte : data) {
+		byte = (uint8)random.RandRange(0, 255);
+	}
+	const int64 savedBytes = 1024 * 1024 + 77;
+	const int64 extendedBytes = 2 * 1024 * 1024 + 5;
+
+	const ESocketServerFileHashAlgorithm algorithms[] = { ESocketServerFileHashAlgorithm::E_MD5, ESocketServerFileHashAlgorithm::E_CRC32 };
+	for (ESocketServerFileHashAlgorithm algorithm : algorithms) {
+		const FString name = algorithm == ESocketServerFileHashAlgorithm::E_MD5 ? TEXT("MD5") : TEXT("CRC32");
+		const FString expected = algorithm == ESocketServerFileHashAlgorithm::E_MD5 ? FMD5::HashBytes(data.GetData(), data.Num())
+			: FString::Printf(TEXT("%08x"), FCrc::MemCrc32(data.GetData(), data.Num()));
+
+		FSocketServerFileHash singlePass;
+		singlePass.reset(algorithm);
+		singlePass.update(data.GetData(), data.Num());
+		TestEqual(name + TEXT(" single pass"), singlePass.finish(), expected);
+
+		//the upload is interrupted after savedBytes: the received part is on disk and the state is saved next to it
+		TArray<uint8> received(data.GetData(), (int32)savedBytes);
+		FFileHelper::SaveArrayToFile(received, *filePath);
+		{
+			FSocketServerFileHash hash;
+			hash.reset(algorithm);
+			updateInPieces(hash, data, 0, savedBytes, random);
+			hash.saveState(filePath);
+		}
+
+		//a new object continues from the state and never reads the file
+		{
+			FSocketServerFileHash hash;
+			hash.reset(algorithm);
+			TestTrue(name + TEXT(" resumed"), hash.resume(filePath, savedBytes));
+			TestEqual(name + TEXT(" bytes after the resume"), hash.getBytes(), savedBytes);
+			updateInPieces(hash, data, savedBytes, data.Num(), random);
+			TestEqual(name + TEXT(" resumed hash"), hash.finish(), expected);
+		}
+
+		//more of the file reached the disk after the state was saved: the state does not match the size and the file is hashed again
+		TArray<uint8> extended(data.GetData(), (int32)extendedBytes);
+		FFileHelper::SaveArrayToFile(extended, *filePath);
+		{
+			FSocketServerFileHash hash;
+			hash.reset(algorithm);
+			TestTrue(name + TEXT(" resumed with another size"), hash.resume(filePath, extendedBytes));
+			TestEqual(name + TEXT(" bytes after the re-hash"), hash.getBytes(), extendedBytes);
+			updateInPieces(hash, data, extendedBytes, data.Num(), random);
+			TestEqual(name + TEXT(" re-hashed"), hash.finish(), expected);
+		}
+
+		//a state of the other algorithm is not used either
+		{
+			FSocketServerFileHash other;
+			other.reset(algorithm == ESocketServerFileHashAlgorithm::E_MD5 ? ESocketServerFileHashAlgorithm::E_CRC32 : ESocketServerFileHashAlgorithm::E_MD5);
+			other.update(data.GetData(), extendedBytes);
+			other.saveState(filePath);
+
+			FSocketServerFileHash hash;
+			hash.reset(algorithm);
+			TestTrue(name + TEXT(" resumed after a state of the other algorithm"), hash.resume(filePath, extendedBytes));
+			updateInPieces(hash, data, extendedBytes, data.Num(), random);
+			TestEqual(name + TEXT(" re-hashed after a state of the other algorithm"), hash.finish(), expected);
+		}
+
+		//without state and without file there is nothing to continue
+		FSocketServerFileHash::deleteState(filePath);
+		IFileManager::Get().Delete(*filePath, false, true, true);
+		{
+			FSocketServerFileHash hash;
+			hash.reset(algorithm);
+			TestFalse(name + TEXT(" resumed without file"), hash.resume(filePath, savedBytes));
+			TestTrue(name + TEXT(" fresh start"), hash.resume(filePath, 0) && hash.getBytes() == 0);
+		}
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,329 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerRCONParser.h"
+#include "SocketServerTCPMessageParser.h"
+#include "Misc/AutomationTest.h"
+#include "Async/Async.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+struct FSocketServerRCONTestPacket {
+	int32 id = 0;
+	int32 type = 0;
+	TArray<uint8> body;
+
+	bool operator==(const FSocketServerRCONTestPacket& other) const {
+		return id == other.id && type == other.type && body == other.body;
+	}
+};
+
+//feeds the stream in pieces that end at the given cuts. false as soon as the parser wants the connection closed
+static bool feedRCON(FSocketServerRCONParser& parser, const TArray<uint8>& stream, const TArray<int32>& cuts, TArray<FSocketServerRCONTestPacket>& received) {
+	int32 position = 0;
+	for (int32 i = 0; i <= cuts.Num(); i++) {
+		int32 end = i < cuts.Num() ? cuts[i] : stream.Num();
+		bool valid = parser.receive(stream.GetData() + position, end - position, [&received](const FSocketServerRCONPacket& packet) {
+			FSocketServerRCONTestPacket& copy = received.AddDefaulted_GetRef();
+			copy.id = packet.id;
+			copy.type = packet.type;
+			copy.body.Append(packet.body, packet.bodySize);
+		});
+		if (!valid) {
+			return false;
+		}
+		position = end;
+	}
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerRCONParserSplitTest, "SocketServer.RCON.Parser.SplitPackets",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerRCONParserSplitTest::RunTest(const FString& Parameters) {
+	FRandomStream random(47);
+
+	//a batch the way the endpoint writes its responses: empty, short, random and the largest body
+	TArray<FSocketServerRCONTestPacket> sent;
+	TArray<uint8> stream;
+	const int32 bodySizes[] = { 0, 6, random.RandRange(1, 300), FSocketServerRCONParser::maxPacketSize - 10, 0, random.RandRange(1, 300) };
+	for (int32 bodySize : bodySizes) {
+		FSocketServerRCONTestPacket& packet = sent.AddDefaulted_GetRef();
+		packet.id = random.RandRange(-1, 1 << 30);
+		packet.type = random.RandRange(0, 3);
+		packet.body.SetNumUninitialized(bodySize);
+		for (uint8& byte : packet.body) {
+			byte = (uint8)random.RandRange(1, 255);
+		}
+		FSocketServerRCONParser::appendPacket(stream, packet.id, packet.type, packet.body.GetData(), packet.body.Num());
+	}
+
+	//one cut at every offset, then two cuts next to each other at every offset
+	for (int32 cut = 0; cut <= stream.Num(); cut++) {
+		for (int32 pieces = 2; pieces <= 3; pieces++) {
+			TArray<int32> cuts;
+			cuts.Add(cut);
+			if (pieces == 3) {
+				if (cut == stream.Num()) {
+					continue;
+				}
+				cuts.Add(cut + 1);
+			}
+			FSocketServerRCONParser parser;
+			TArray<FSocketServerRCONTestPacket> received;
+			if (!TestTrue(FString::Printf(TEXT("Cut at %i in %i pieces accepted"), cut, pieces), feedRCON(parser, stream, cuts, received))
+				|| !TestTrue(FString::Printf(TEXT("Cut at %i in %i pieces"), cut, pieces), received == sent)) {
+				return false;
+			}
+		}
+	}
+
+	//byte by byte and random pieces
+	for (int32 round = 0; round < 50; round++) {
+		TArray<int32> cuts;
+		for (int32 cut = round == 0 ? 1 : random.RandRange(1, 64); cut < stream.Num(); cut += round == 0 ? 1 : random.RandRange(1, 64)) {
+			cuts.Add(cut);
+		}
+		FSocketServerRCONParser parser;
+		TArray<FSocketServerRCONTestPacket> received;
+		TestTrue(FString::Printf(TEXT("Random pieces %i"), round), feedRCON(parser, stream, cuts, received) && received == sent);
+	}
+
+	//a body without terminators gets the whole rest of the packet
+	{
+		TArray<uint8> unterminated;
+		FSocketServerRCONParser::appendPacket(unterminated, 7, 2, (const uint8*)"abc", 3);
+		unterminated[unterminated.Num() - 2] = 'd';
+		unterminated[unterminated.Num() - 1] = 'e';
+		FSocketServerRCONParser parser;
+		TArray<FSocketServerRCONTestPacket> received;
+		TestTrue(TEXT("Unterminated body"), feedRCON(parser, unterminated, TArray<int32>(), received)
+			&& received.Num() == 1 && received[0].body == TArray<uint8>((const uint8*)"abcde", 5));
+	}
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerRCONParserInvalidSizeTest, "SocketServer.RCON.Parser.InvalidSize",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerRCONParserInvalidSizeTest::RunTest(const FString& Parameters) {
+	//a valid packet, then a size field out of range. split anywhere, the valid packet is delivered and the stream is refused
+	TArray<uint8> valid;
+	FSocketServerRCONParser::appendPacket(valid, 1, 3, (const uint8*)"secret", 6);
+
+	const int32 invalidSizes[] = { FSocketServerRCONParser::minPacketSize - 1, FSocketServerRCONParser::maxPacketSize + 1, -1, 0, MAX_int32 };
+	for (int32 invalidSize : invalidSizes) {
+		TArray<uint8> stream = valid;
+		for (int32 i = 0; i < 4; i++) {
+			stream.Add((uint8)((uint32)invalidSize >> (i * 8)));
+		}
+		stream.AddZeroed(16);
+
+		for (int32 cut = 0; cut <= stream.Num(); cut++) {
+			FSocketServerRCONParser parser;
+			TArray<FSocketServerRCONTestPacket> received;
+			TArray<int32> cuts;
+			cuts.Add(cut);
+			if (!TestFalse(FString::Printf(TEXT("Size %i cut at %i refused"), invalidSize, cut), feedRCON(parser, stream, cuts, received))
+				|| !TestEqual(FString::Printf(TEXT("Size %i cut at %i valid packet delivered"), invalidSize, cut), received.Num(), 1)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+static TArray<uint8> rconPacket(int32 id, int32 type, const FString& body) {
+	FTCHARToUTF8 Convert(*body);
+	TArray<uint8> packet;
+	FSocketServerRCONParser::appendPacket(packet, id, type, (const uint8*)Convert.Get(), Convert.Length());
+	return packet;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerRCONEndpointAuthTest, "SocketServer.RCON.Endpoint.Auth",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerRCONEndpointAuthTest::RunTest(const FString& Parameters) {
+	FSocketServerRCONEndpoint endpoint(TEXT("SocketServerRCONEndpointAuthTest"), ERCONPasswordType::E_parameter, TEXT("secret"), nullptr);
+	TArray<int32> commandIDs;
+	endpoint.setCommandHandler([&commandIDs](const FString& sessionID, int32 requestID, const FString& request) {
+		commandIDs.Add(requestID);
+	});
+	TArray<FSocketServerRCONTestPacket> responses;
+	FSocketServerRCONParser responseParser;
+	FSocketServerTCPRawWriter writer = [&responses, &responseParser](TArray<uint8>&& bytes) {
+		TArray<int32> noCuts;
+		feedRCON(responseParser, bytes, noCuts, responses);
+	};
+
+	//a command before the login is refused like a wrong password and never reaches the handler
+	{
+		FSocketServerRCONParser parser;
+		TArray<uint8> stream = rconPacket(1, 2, TEXT("sessionstats"));
+		stream.Append(rconPacket(2, 3, TEXT("secret")));
+		stream.Append(rconPacket(3, 2, TEXT("sessionstats")));
+		TestTrue(TEXT("Stream accepted"), endpoint.receive(TEXT("a"), parser, stream.GetData(), stream.Num(), writer));
+		TestEqual(TEXT("No command without login"), commandIDs.Num(), 0);
+		TestTrue(TEXT("Refused with id -1"), responses.Num() == 1 && responses[0].id == -1 && responses[0].type == 2);
+		TestFalse(TEXT("Not authenticated"), parser.isAuthenticated());
+		stream = rconPacket(4, 2, TEXT("status"));
+		endpoint.receive(TEXT("a"), parser, stream.GetData(), stream.Num(), writer);
+		TestTrue(TEXT("Still refused in the next read"), commandIDs.Num() == 0 && responses.Num() == 2 && responses[1].id == -1);
+	}
+
+	//a wrong password does not authenticate
+	responses.Reset();
+	{
+		FSocketServerRCONParser parser;
+		TArray<uint8> stream = rconPacket(5, 3, TEXT("wrong"));
+		stream.Append(rconPacket(6, 2, TEXT("status")));
+		endpoint.receive(TEXT("b"), parser, stream.GetData(), stream.Num(), writer);
+		TestTrue(TEXT("Wrong password refused"), responses.Num() == 1 && responses[0].id == -1);
+		TestFalse(TEXT("Wrong password not authenticated"), parser.isAuthenticated());
+		TestEqual(TEXT("No command after a wrong password"), commandIDs.Num(), 0);
+	}
+
+	//after the login the commands go through, also in later reads
+	responses.Reset();
+	{
+		FSocketServerRCONParser parser;
+		TArray<uint8> stream = rconPacket(7, 3, TEXT("secret"));
+		stream.Append(rconPacket(8, 2, TEXT("status")));
+		TestTrue(TEXT("Login accepted"), endpoint.receive(TEXT("c"), parser, stream.GetData(), stream.Num(), writer));
+		TestTrue(TEXT("Login answered with its id"), responses.Num() == 1 && responses[0].id == 7 && responses[0].type == 2);
+		TestTrue(TEXT("Authenticated"), parser.isAuthenticated());
+		stream = rconPacket(9, 2, TEXT("status"));
+		endpoint.receive(TEXT("c"), parser, stream.GetData(), stream.Num(), writer);
+		TestTrue(TEXT("Commands after the login"), commandIDs == TArray<int32>({ 8, 9 }));
+	}
+	return true;
+}
+
+
+static bool sendAll(FSocket* socket, const uint8* data, int32 dataSize) {
+	while (dataSize > 0) {
+		int32 bytesSent = 0;
+		if (!socket->Send(data, dataSize, bytesSent)) {
+			return false;
+		}
+		data += bytesSent;
+		dataSize -= bytesSent;
+	}
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerRCONEndpointLoopbackTest, "SocketServer.RCON.Endpoint.Loopback",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerRCONEndpointLoopbackTest::RunTest(const FString& Parameters) {
+	const FString serverID = TEXT("SocketServerRCONLoopbackTest");
+	const int32 commandCount = 10000;
+	ISocketSubsystem* socketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+
+	TSharedRef<FInternetAddr> addr = socketSubsystem->CreateInternetAddr();
+	bool validIP = false;
+	addr->SetIp(TEXT("127.0.0.1"), validIP);
+	addr->SetPort(0);
+	FSocket* listener = socketSubsystem->CreateSocket(NAME_Stream, TEXT("SocketServerRCONLoopbackTestListener"), addr->GetProtocolType());
+	FSocket* client = socketSubsystem->CreateSocket(NAME_Stream, TEXT("SocketServerRCONLoopbackTestClient"), addr->GetProtocolType());
+	FSocket* server = nullptr;
+	if (listener != nullptr && client != nullptr && listener->Bind(*addr) && listener->Listen(1)) {
+		addr->SetPort(listener->GetPortNo());
+		if (client->Connect(*addr) && listener->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(5))) {
+			server = listener->Accept(TEXT("SocketServerRCONLoopbackTestServer"));
+		}
+	}
+	if (!TestTrue(TEXT("Loopback connection"), server != nullptr)) {
+		if (listener != nullptr) {
+			socketSubsystem->DestroySocket(listener);
+		}
+		if (client != nullptr) {
+			socketSubsystem->DestroySocket(client);
+		}
+		return false;
+	}
+
+	//the same path a TCP receive thread takes: message parser, registry lookup, endpoint, responses written back right away
+	TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe> endpoint = MakeShareable(new FSocketServerRCONEndpoint(serverID, ERCONPasswordType::E_parameter, TEXT("secret"), nullptr));
+	std::atomic<int32> received{ 0 };
+	std::atomic<int32> outOfOrder{ 0 };
+	endpoint->setCommandHandler([&received, &outOfOrder](const FString& sessionID, int32 requestID, const FString& request) {
+		if (requestID != received.load() || request != FString::Printf(TEXT("command %i"), requestID)) {
+			outOfOrder++;
+		}
+		received++;
+	});
+	FSocketServerRCONEndpoint::add(endpoint);
+
+	std::atomic<bool> run{ true };
+	TFuture<void> receiveThread = Async(EAsyncExecution::Thread, [server, serverID, &run]() {
+		FSocketServerTCPMessageParser parser(TEXT("loopback"), serverID, EReceiveFilterServer::E_SAB, ESocketServerTCPMessageWrapping::E_None,
+			FString(), FString(), FSocketServerTCPMessageParser::defaultMaxMessageSize);
+		parser.setRawWriter([server](TArray<uint8>&& bytes) {
+			sendAll(server, bytes.GetData(), bytes.Num());
+		});
+		TArray<uint8> buffer;
+		buffer.SetNumUninitialized(64 * 1024);
+		while (run) {
+			if (!server->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromMilliseconds(50))) {
+				continue;
+			}
+			int32 bytesRead = 0;
+			if (!server->Recv(buffer.GetData(), buffer.Num(), bytesRead) || bytesRead <= 0 || !parser.receive(buffer.GetData(), bytesRead)) {
+				return;
+			}
+		}
+	});
+
+	//login, wait for the answer
+	TArray<uint8> login = rconPacket(42, 3, TEXT("secret"));
+	sendAll(client, login.GetData(), login.Num());
+	FSocketServerRCONParser responseParser;
+	TArray<FSocketServerRCONTestPacket> responses;
+	uint8 responseBuffer[256];
+	while (responses.Num() == 0 && client->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(5))) {
+		int32 bytesRead = 0;
+		if (!client->Recv(responseBuffer, sizeof(responseBuffer), bytesRead) || bytesRead <= 0) {
+			break;
+		}
+		TArray<uint8> bytes(responseBuffer, bytesRead);
+		feedRCON(responseParser, bytes, TArray<int32>(), responses);
+	}
+	TestTrue(TEXT("Logged in"), responses.Num() == 1 && responses[0].id == 42);
+
+	//10000 commands in batches of 100 like a busy admin tool. all of them have to be parsed within a second
+	double start = FPlatformTime::Seconds();
+	for (int32 batch = 0; batch < commandCount; batch += 100) {
+		TArray<uint8> stream;
+		for (int32 i = batch; i < batch + 100; i++) {
+			stream.Append(rconPacket(i, 2, FString::Printf(TEXT("command %i"), i)));
+		}
+		if (!sendAll(client, stream.GetData(), stream.Num())) {
+			break;
+		}
+	}
+	double giveUp = start + 10.0;
+	while (received < commandCount && FPlatformTime::Seconds() < giveUp) {
+		FPlatformProcess::Sleep(0.001f);
+	}
+	double seconds = FPlatformTime::Seconds() - start;
+
+	run = false;
+	receiveThread.Wait();
+	FSocketServerRCONEndpoint::remove(serverID);
+
+	TestEqual(TEXT("Every command received"), received.load(), commandCount);
+	TestEqual(TEXT("Commands in order"), outOfOrder.load(), 0);
+	TestTrue(FString::Printf(TEXT("%i commands in %f seconds, at least %i per second"), commandCount, seconds, commandCount), seconds <= 1.0);
+
+	socketSubsystem->DestroySocket(client);
+	socketSubsystem->DestroySocket(server);
+	socketSubsystem->DestroySocket(listener);
+	return true;
+}
+
+#endif
@@ -0,0 +1,234 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerTCPMessageParser.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+static void appendByteMessage(TArray<uint8>& stream, const TArray<uint8>& payload, bool bigEndian) {
+	int32 length = payload.Num();
+	stream.Add(bigEndian ? 0x01 : 0x00);
+	for (int32 i = 0; i < 4; i++) {
+		stream.Add((uint8)(length >> (bigEndian ? 24 - i * 8 : i * 8)));
+	}
+	stream.Append(payload);
+}
+
+//feeds the stream in random pieces. false as soon as the parser wants the connection closed
+static bool feedInPieces(FSocketServerTCPMessageParser& parser, const TArray<uint8>& stream, FRandomStream& random) {
+	int32 position = 0;
+	while (position < stream.Num()) {
+		int32 take = FMath::Min(random.RandRange(1, 64), stream.Num() - position);
+		if (!parser.receive(stream.GetData() + position, take)) {
+			return false;
+		}
+		position += take;
+	}
+	return true;
+}
+
+static int32 findBytes(const TArray<uint8>& data, const TArray<uint8>& token) {
+	for (int32 i = 0; i + token.Num() <= data.Num(); i++) {
+		if (FMemory::Memcmp(data.GetData() + i, token.GetData(), token.Num()) == 0) {
+			return i;
+		}
+	}
+	return INDEX_NONE;
+}
+
+//random text that is only followed by token where token is appended, not earlier
+static TArray<uint8> textBefore(const TArray<uint8>& token, FRandomStream& random) {
+	static const uint8 alphabet[] = { 'a', 'b', '#', '<', '>', 'h', 'f', 'x', ' ', 0xC2, 0xAB, 0xBB };
+	while (true) {
+		TArray<uint8> text;
+		text.SetNumUninitialized(random.RandRange(0, 30));
+		for (uint8& byte : text) {
+			byte = alphabet[random.RandRange(0, UE_ARRAY_COUNT(alphabet) - 1)];
+		}
+		TArray<uint8> withToken = text;
+		withToken.Append(token);
+		if (findBytes(withToken, token) == text.Num()) {
+			return text;
+		}
+	}
+}
+
+static TArray<uint8> utf8Bytes(const FString& text) {
+	FTCHARToUTF8 convert(*text);
+	return TArray<uint8>((const uint8*)convert.Get(), convert.Length());
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerTCPMessageParserMalformedLengthTest, "SocketServer.TCP.MessageParser.MalformedLength",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerTCPMessageParserMalformedLengthTest::RunTest(const FString& Parameters) {
+	const int32 maxMessageSize = 4096;
+	FRandomStream random(38);
+
+	for (int32 round = 0; round < 2000; round++) {
+		FSocketServerTCPMessageParser parser("test", "test", EReceiveFilterServer::E_B, ESocketServerTCPMessageWrapping::E_Byte, FString(), FString(), maxMessageSize);
+		TArray<TArray<uint8>> received;
+		parser.setMessageHandler([&received](const uint8* data, int32 dataSize) {
+			received.Add(TArray<uint8>(data, dataSize));
+		});
+
+		//a few valid messages, then a random header
+		TArray<TArray<uint8>> sent;
+		TArray<uint8> stream;
+		int32 validCount = random.RandRange(0, 4);
+		for (int32 i = 0; i < validCount; i++) {
+			TArray<uint8> payload;
+			payload.SetNumUninitialized(random.RandRange(0, 300));
+			for (uint8& byte : payload) {
+				byte = (uint8)random.RandRange(0, 255);
+			}
+			appendByteMessage(stream, payload, random.RandRange(0, 1) == 1);
+			sent.Add(payload);
+		}
+
+		uint8 header[5];
+		for (int32 i = 0; i < 5; i++) {
+			header[i] = (uint8)random.RandRange(0, 255);
+		}
+		//most rounds use a known endian byte, so the length check is what decides
+		if (random.RandRange(0, 3) != 0) {
+			header[0] = (uint8)random.RandRange(0, 1);
+		}
+		stream.Append(header, 5);
+
+		int32 length = 0;
+		bool headerValid = header[0] <= 0x01;
+		if (headerValid) {
+			uint32 raw = header[0] == 0x00 ?
+				((uint32)header[1] | ((uint32)header[2] << 8) | ((uint32)header[3] << 16) | ((uint32)header[4] << 24)) :
+				((uint32)header[4] | ((uint32)header[3] << 8) | ((uint32)header[2] << 16) | ((uint32)header[1] << 24));
+			length = (int32)raw;
+			headerValid = length >= 0 && length <= maxMessageSize;
+		}
+
+		bool accepted = feedInPieces(parser, stream, random);
+		if (!TestTrue(FString::Printf(TEXT("Round %i accepted"), round), accepted == headerValid)) {
+			return false;
+		}
+		if (!TestEqual(FString::Printf(TEXT("Round %i messages"), round), received.Num(), validCount + (headerValid && length == 0 ? 1 : 0))) {
+			return false;
+		}
+		for (int32 i = 0; i < validCount; i++) {
+			if (!TestTrue(FString::Printf(TEXT("Round %i message %i"), round, i), received[i] == sent[i])) {
+				return false;
+			}
+		}
+	}
+
+	//pure garbage: whatever comes out has to respect the limit
+	for (int32 round = 0; round < 200; round++) {
+		FSocketServerTCPMessageParser parser("test", "test", EReceiveFilterServer::E_B, ESocketServerTCPMessageWrapping::E_Byte, FString(), FString(), maxMessageSize);
+		int32 largest = 0;
+		parser.setMessageHandler([&largest](const uint8* data, int32 dataSize) {
+			largest = FMath::Max(largest, dataSize);
+		});
+		TArray<uint8> stream;
+		stream.SetNumUninitialized(random.RandRange(1, 20000));
+		for (uint8& byte : stream) {
+			//mostly small endian bytes and lengths, otherwise every stream dies at its first header
+			byte = (uint8)(random.RandRange(0, 3) == 0 ? random.RandRange(0, 255) : random.RandRange(0, 1));
+		}
+		feedInPieces(parser, stream, random);
+		TestTrue(TEXT("Message size within the limit"), largest <= maxMessageSize);
+	}
+
+	//string wrapping without footer
+	FSocketServerTCPMessageParser parser("test", "test", EReceiveFilterServer::E_S, ESocketServerTCPMessageWrapping::E_String, "<h>", "<f>", maxMessageSize);
+	parser.setMessageHandler([](const uint8* data, int32 dataSize) {});
+	TArray<uint8> stream;
+	stream.Append((const uint8*)"<h>", 3);
+	stream.AddZeroed(maxMessageSize + 1);
+	TestFalse(TEXT("Unterminated string message closes the connection"), feedInPieces(parser, stream, random));
+
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerTCPMessageParserSplitDelimiterTest, "SocketServer.TCP.MessageParser.SplitDelimiter",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerTCPMessageParserSplitDelimiterTest::RunTest(const FString& Parameters) {
+	//multi byte utf-8 tokens and tokens that overlap with themselves or with each other
+	const FString pairs[][2] = {
+		{ TEXT("<h>"), TEXT("<f>") },
+		{ TEXT("HEADER"), TEXT("FOOTER") },
+		{ TEXT("aab"), TEXT("abab") },
+		{ TEXT("##"), TEXT("#") },
+		{ TEXT("\u00BB"), TEXT("\u00AB") },
+	};
+	FRandomStream random(39);
+
+	for (const FString* pair : pairs) {
+		TArray<uint8> header = utf8Bytes(pair[0]);
+		TArray<uint8> footer = utf8Bytes(pair[1]);
+
+		for (int32 round = 0; round < 20; round++) {
+			//text outside of the messages is dropped, the stream ends with text that could be the start of a header.
+			//every other message is followed by a line break, which is dropped as well wherever the cuts fall
+			TArray<TArray<uint8>> sent;
+			TArray<uint8> stream;
+			int32 messageCount = random.RandRange(1, 5);
+			for (int32 i = 0; i < messageCount; i++) {
+				stream.Append(textBefore(header, random));
+				stream.Append(header);
+				TArray<uint8> message = textBefore(footer, random);
+				stream.Append(message);
+				stream.Append(footer);
+				if ((round + i) % 2 == 0) {
+					stream.Add('\r');
+					stream.Add('\n');
+				}
+				sent.Add(message);
+			}
+			stream.Append(textBefore(header, random));
+			stream.Append(header.GetData(), random.RandRange(0, header.Num() - 1));
+
+			//one cut at every offset, two cuts next to each other at every offset, byte by byte, random pieces
+			TArray<TArray<int32>> cutLists;
+			for (int32 cut = 1; cut < stream.Num(); cut++) {
+				cutLists.Add(TArray<int32>{ cut });
+				if (cut + 1 < stream.Num()) {
+					cutLists.Add(TArray<int32>{ cut, cut + 1 });
+				}
+			}
+			TArray<int32> everyByte;
+			for (int32 cut = 1; cut < stream.Num(); cut++) {
+				everyByte.Add(cut);
+			}
+			cutLists.Add(everyByte);
+			for (int32 i = 0; i < 20; i++) {
+				TArray<int32> cuts;
+				for (int32 cut = random.RandRange(1, 8); cut < stream.Num(); cut += random.RandRange(1, 8)) {
+					cuts.Add(cut);
+				}
+				cutLists.Add(cuts);
+			}
+
+			for (const TArray<int32>& cuts : cutLists) {
+				FSocketServerTCPMessageParser parser("test", "test", EReceiveFilterServer::E_S, ESocketServerTCPMessageWrapping::E_String, pair[0], pair[1], 4096);
+				TArray<TArray<uint8>> received;
+				parser.setMessageHandler([&received](const uint8* data, int32 dataSize) {
+					received.Add(TArray<uint8>(data, dataSize));
+				});
+				int32 position = 0;
+				for (int32 i = 0; i <= cuts.Num(); i++) {
+					int32 end = i < cuts.Num() ? cuts[i] : stream.Num();
+					parser.receive(stream.GetData() + position, end - position);
+					position = end;
+				}
+				if (!TestTrue(FString::Printf(TEXT("%s%s round %i split at %i first"), *pair[0], *pair[1], round, cuts.Num() > 0 ? cuts[0] : 0), received == sent)) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+#endif
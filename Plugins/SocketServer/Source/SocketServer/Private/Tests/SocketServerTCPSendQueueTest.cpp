@@ -0,0 +1,145 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerTCPSendQueue.h"
+#include "Misc/AutomationTest.h"
+#include "Async/Async.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerTCPSendQueuePartialWriteTest, "SocketServer.TCP.SendQueue.PartialWrites",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerTCPSendQueuePartialWriteTest::RunTest(const FString& Parameters) {
+	ISocketSubsystem* socketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+
+	//a loopback pair with the smallest buffers the OS allows, so writes stop in the middle of messages
+	TSharedRef<FInternetAddr> addr = socketSubsystem->CreateInternetAddr();
+	bool validIP = false;
+	addr->SetIp(TEXT("127.0.0.1"), validIP);
+	addr->SetPort(0);
+	FSocket* listener = socketSubsystem->CreateSocket(NAME_Stream, TEXT("SocketServerTCPSendQueueTestListener"), addr->GetProtocolType());
+	FSocket* client = socketSubsystem->CreateSocket(NAME_Stream, TEXT("SocketServerTCPSendQueueTestClient"), addr->GetProtocolType());
+	FSocket* server = nullptr;
+	int32 actualSize = 0;
+	if (listener != nullptr && client != nullptr) {
+		listener->SetReceiveBufferSize(4096, actualSize);
+		client->SetSendBufferSize(4096, actualSize);
+		if (listener->Bind(*addr) && listener->Listen(1)) {
+			addr->SetPort(listener->GetPortNo());
+			if (client->Connect(*addr) && listener->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(5))) {
+				server = listener->Accept(TEXT("SocketServerTCPSendQueueTestServer"));
+			}
+		}
+	}
+	if (!TestTrue(TEXT("Loopback connection"), server != nullptr)) {
+		if (listener != nullptr) {
+			socketSubsystem->DestroySocket(listener);
+		}
+		if (client != nullptr) {
+			socketSubsystem->DestroySocket(client);
+		}
+		return false;
+	}
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+	//the event loop writes to non blocking sockets, elsewhere the send threads block and only the 64 KB coalescing splits messages
+	client->SetNonBlocking(true);
+#endif
+
+	//messages with and without byte wrapping header, small ones and ones larger than the coalescing limit.
+	//every payload is filled with its own index so the message at the head of the queue can be identified
+	FRandomStream random(40);
+	const int32 messageCount = 40;
+	FSocketServerSessionCounters counters;
+	FSocketServerTCPSendQueue queue;
+	TArray<int32> sizes;
+	TArray<uint8> expected;
+	for (int32 i = 0; i < messageCount; i++) {
+		TArray<uint8> payload;
+		payload.Init((uint8)i, i % 8 == 0 ? random.RandRange(70000, 150000) : random.RandRange(1, 20000));
+		FSocketServerTCPSendItem item(MoveTemp(payload), i % 2 == 0);
+		expected.Append(item.header, item.headerSize);
+		expected.Append(item.payload);
+		sizes.Add(item.size());
+		queue.add(MoveTemp(item));
+		counters.sendQueueDepth++;
+	}
+	TestEqual(TEXT("Bytes queued"), queue.bytes(), (int64)expected.Num());
+
+	//a slow reader on the other side
+	TArray<uint8> received;
+	TFuture<void> reader = Async(EAsyncExecution::Thread, [server, &received, &expected]() {
+		uint8 buffer[1024];
+		while (received.Num() < expected.Num() && server->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(5))) {
+			int32 bytesRead = 0;
+			if (!server->Recv(buffer, sizeof(buffer), bytesRead) || bytesRead <= 0) {
+				return;
+			}
+			received.Append(buffer, bytesRead);
+			FPlatformProcess::Sleep(0.0001f);
+		}
+	});
+
+	int64 written = 0;
+	int32 writes = 0;
+	int32 partialWrites = 0;
+	int32 compactions = 0;
+	bool consistent = true;
+	double giveUp = FPlatformTime::Seconds() + 30.0;
+	while (!queue.isEmpty() && consistent && FPlatformTime::Seconds() < giveUp) {
+		int32 itemsBefore = queue.items.Num();
+		int64 result = queue.write(client, &counters);
+		if (!TestTrue(TEXT("Write without error"), result >= 0)) {
+			break;
+		}
+		if (result == 0) {
+			client->Wait(ESocketWaitConditions::WaitForWrite, FTimespan::FromMilliseconds(100));
+			continue;
+		}
+		written += result;
+		writes++;
+
+		//which message the written bytes end in, and how far into it
+		int32 completed = 0;
+		int64 left = written;
+		while (completed < messageCount && left >= sizes[completed]) {
+			left -= sizes[completed];
+			completed++;
+		}
+		int64 remainingBytes = 0;
+		for (int32 i = completed; i < messageCount; i++) {
+			remainingBytes += sizes[i];
+		}
+		if (left > 0) {
+			partialWrites++;
+		}
+		if (queue.items.Num() < itemsBefore && !queue.isEmpty()) {
+			compactions++;
+		}
+
+		FString after = FString::Printf(TEXT("after %lld bytes"), written);
+		consistent = TestEqual(TEXT("Offset ") + after, (int64)queue.offset, left)
+			&& TestEqual(TEXT("Messages left ") + after, queue.num(), messageCount - completed)
+			&& TestEqual(TEXT("Bytes left ") + after, queue.bytes(), remainingBytes)
+			&& TestTrue(TEXT("Sent messages are at most half of the queue ") + after, queue.head <= queue.items.Num() / 2)
+			&& TestEqual(TEXT("Messages counted as sent ") + after, counters.packetsOut.load(), (int64)completed)
+			&& TestEqual(TEXT("Queue depth ") + after, counters.sendQueueDepth.load(), messageCount - completed);
+		if (consistent && !queue.isEmpty()) {
+			consistent = TestEqual(TEXT("Message at the head ") + after, (int32)queue.items[queue.head].payload[0], completed);
+		}
+	}
+
+	reader.Wait();
+	AddInfo(FString::Printf(TEXT("%i writes, %i ended inside a message, %i compactions"), writes, partialWrites, compactions));
+	TestTrue(TEXT("Everything written"), queue.isEmpty() && written == expected.Num());
+	TestTrue(TEXT("Empty queue reuses its allocation"), queue.items.Num() == 0 && queue.head == 0 && queue.offset == 0 && queue.bytes() == 0);
+	TestTrue(TEXT("Writes ended inside a message"), partialWrites > 0);
+	TestTrue(TEXT("Sent messages were compacted"), compactions > 0);
+	TestTrue(TEXT("Byte stream"), received == expected);
+
+	socketSubsystem->DestroySocket(client);
+	socketSubsystem->DestroySocket(server);
+	socketSubsystem->DestroySocket(listener);
+	return true;
+}
+
+#endif
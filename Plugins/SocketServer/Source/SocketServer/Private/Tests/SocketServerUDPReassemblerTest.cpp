@@ -0,0 +1,208 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerUDPReassembler.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+struct FSocketServerUDPTestDatagram {
+	FSocketServerUDPAddressKey sender;
+	TArray<uint8> bytes;
+};
+
+static TArray<uint8> randomMessage(FRandomStream& random, int32 minSize, int32 maxSize) {
+	TArray<uint8> message;
+	message.SetNumUninitialized(random.RandRange(minSize, maxSize));
+	for (uint8& byte : message) {
+		byte = (uint8)random.RandRange(0, 255);
+	}
+	return message;
+}
+
+//splits the message into datagrams with a fragment header in front, the way sendBytes does
+static void appendFragments(TArray<FSocketServerUDPTestDatagram>& datagrams, const FSocketServerUDPAddressKey& sender, uint32 messageID,
+	const TArray<uint8>& message, int32 payloadSize) {
+	FSocketServerUDPFragmentHeader header;
+	header.messageID = messageID;
+	header.count = (uint16)((message.Num() + payloadSize - 1) / payloadSize);
+	for (int32 i = 0; i < header.count; i++) {
+		header.index = (uint16)i;
+		int32 offset = i * payloadSize;
+		int32 size = FMath::Min(payloadSize, message.Num() - offset);
+		FSocketServerUDPTestDatagram& datagram = datagrams.AddDefaulted_GetRef();
+		datagram.sender = sender;
+		datagram.bytes.SetNumUninitialized(FSocketServerUDPFragmentHeader::size + size);
+		header.write(datagram.bytes.GetData());
+		FMemory::Memcpy(datagram.bytes.GetData() + FSocketServerUDPFragmentHeader::size, message.GetData() + offset, size);
+	}
+}
+
+static void shuffle(TArray<FSocketServerUDPTestDatagram>& datagrams, FRandomStream& random) {
+	for (int32 i = datagrams.Num() - 1; i > 0; i--) {
+		datagrams.Swap(i, random.RandRange(0, i));
+	}
+}
+
+static bool addDatagram(FSocketServerUDPReassembler& reassembler, const FSocketServerUDPTestDatagram& datagram, double timeoutSeconds,
+	int64 memoryLimit, TArray<uint8>& message) {
+	FSocketServerUDPFragmentHeader header;
+	if (!header.read(datagram.bytes.GetData(), datagram.bytes.Num())) {
+		return false;
+	}
+	return reassembler.add(datagram.sender, header, datagram.bytes.GetData() + FSocketServerUDPFragmentHeader::size,
+		datagram.bytes.Num() - FSocketServerUDPFragmentHeader::size, timeoutSeconds, memoryLimit, message);
+}
+
+static FSocketServerUDPAddressKey testSender(int32 i) {
+	uint8 ip[4] = { 10, 0, 0, (uint8)(1 + i) };
+	return FSocketServerUDPAddressKey(ip, 4, (uint16)(40000 + i));
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerUDPReassemblerHeaderTest, "SocketServer.UDP.Reassembler.Header",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerUDPReassemblerHeaderTest::RunTest(const FString& Parameters) {
+	FSocketServerUDPFragmentHeader header;
+	header.messageID = 0xDEADBEEF;
+	header.index = 513;
+	header.count = 1027;
+	uint8 bytes[FSocketServerUDPFragmentHeader::size];
+	header.write(bytes);
+
+	FSocketServerUDPFragmentHeader read;
+	TestTrue(TEXT("Header reads back"), read.read(bytes, FSocketServerUDPFragmentHeader::size));
+	TestTrue(TEXT("Header fields survive"), read.messageID == header.messageID && read.index == header.index && read.count == header.count);
+	TestFalse(TEXT("Short datagram"), read.read(bytes, FSocketServerUDPFragmentHeader::size - 1));
+
+	uint8 broken[FSocketServerUDPFragmentHeader::size];
+	FMemory::Memcpy(broken, bytes, sizeof(bytes));
+	broken[0] ^= 1;
+	TestFalse(TEXT("Wrong magic"), read.read(broken, sizeof(broken)));
+	FMemory::Memcpy(broken, bytes, sizeof(bytes));
+	broken[2]++;
+	TestFalse(TEXT("Wrong version"), read.read(broken, sizeof(broken)));
+
+	header.index = 5;
+	header.count = 5;
+	header.write(broken);
+	TestFalse(TEXT("Index past the count"), read.read(broken, sizeof(broken)));
+	header.index = 0;
+	header.count = 1;
+	header.write(broken);
+	TestFalse(TEXT("Single fragment"), read.read(broken, sizeof(broken)));
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerUDPReassemblerReorderTest, "SocketServer.UDP.Reassembler.Reorder",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerUDPReassemblerReorderTest::RunTest(const FString& Parameters) {
+	const int32 payloadSize = 200;
+	FRandomStream random(33);
+	FSocketServerUDPReassembler reassembler;
+
+	for (int32 round = 0; round < 20; round++) {
+		//several senders use the same message ids, fragments of all of them arrive shuffled and some twice
+		TArray<TArray<uint8>> expected;
+		TArray<int32> completions;
+		TArray<FSocketServerUDPTestDatagram> datagrams;
+		TArray<FSocketServerUDPTestDatagram> duplicates;
+		for (int32 sender = 0; sender < 4; sender++) {
+			for (uint32 messageID = 0; messageID < 8; messageID++) {
+				TArray<uint8> message = randomMessage(random, payloadSize + 1, 5000);
+				int32 first = datagrams.Num();
+				appendFragments(datagrams, testSender(sender), round * 8 + messageID, message, payloadSize);
+				expected.Add(message);
+				completions.Add(0);
+				//at most one duplicate per message, a late duplicate starts a new message that can never complete
+				if (random.RandRange(0, 1) == 0) {
+					duplicates.Add(datagrams[random.RandRange(first, datagrams.Num() - 1)]);
+				}
+			}
+		}
+		datagrams.Append(duplicates);
+		shuffle(datagrams, random);
+
+		for (const FSocketServerUDPTestDatagram& datagram : datagrams) {
+			TArray<uint8> message;
+			if (addDatagram(reassembler, datagram, 60.0, 64 * 1024 * 1024, message)) {
+				int32 index = expected.Find(message);
+				if (!TestTrue(FString::Printf(TEXT("Round %i completed a message that was sent"), round), index != INDEX_NONE)) {
+					return false;
+				}
+				completions[index]++;
+			}
+		}
+		for (int32 count : completions) {
+			TestEqual(FString::Printf(TEXT("Round %i every message completed once"), round), count, 1);
+		}
+	}
+	TestEqual(TEXT("Nothing dropped"), reassembler.getDroppedMessages(), 0);
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerUDPReassemblerLossTest, "SocketServer.UDP.Reassembler.Loss",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerUDPReassemblerLossTest::RunTest(const FString& Parameters) {
+	const int32 payloadSize = 200;
+	const int64 memoryLimit = 32 * 1024;
+	FRandomStream random(34);
+	FSocketServerUDPReassembler reassembler;
+	FSocketServerUDPAddressKey sender = testSender(0);
+
+	//every third message loses a fragment. the rest has to complete while the incomplete ones are evicted
+	int32 completed = 0;
+	int32 lost = 0;
+	int64 receivedBytes = 0;
+	for (uint32 messageID = 0; messageID < 300; messageID++) {
+		TArray<uint8> message = randomMessage(random, payloadSize + 1, 4000);
+		TArray<FSocketServerUDPTestDatagram> datagrams;
+		appendFragments(datagrams, sender, messageID, message, payloadSize);
+		shuffle(datagrams, random);
+		if (messageID % 3 == 0) {
+			datagrams.RemoveAt(random.RandRange(0, datagrams.Num() - 1));
+			lost++;
+		}
+
+		bool done = false;
+		for (const FSocketServerUDPTestDatagram& datagram : datagrams) {
+			TArray<uint8> received;
+			if (addDatagram(reassembler, datagram, 60.0, memoryLimit, received)) {
+				if (!TestTrue(FString::Printf(TEXT("Message %u reassembled"), messageID), !done && received == message)) {
+					return false;
+				}
+				done = true;
+				completed++;
+			}
+			receivedBytes += datagram.bytes.Num();
+		}
+		if (!TestTrue(FString::Printf(TEXT("Message %u completed unless it lost a fragment"), messageID), done == (messageID % 3 != 0))) {
+			return false;
+		}
+	}
+	TestEqual(TEXT("Completed messages"), completed, 300 - lost);
+	TestTrue(TEXT("Incomplete messages evicted to stay under the limit"), reassembler.getDroppedMessages() > 0 && reassembler.getDroppedMessages() <= lost);
+	TestTrue(TEXT("More was received than the limit holds"), receivedBytes > memoryLimit);
+
+	//whatever is still buffered times out. the purge runs at most every 0.25 seconds
+	FPlatformProcess::Sleep(0.3f);
+	TArray<FSocketServerUDPTestDatagram> datagrams;
+	appendFragments(datagrams, sender, 1000, randomMessage(random, payloadSize + 1, 4000), payloadSize);
+	TArray<uint8> received;
+	addDatagram(reassembler, datagrams[0], 0.1, memoryLimit, received);
+	TestEqual(TEXT("Every incomplete message dropped exactly once"), reassembler.getDroppedMessages(), lost);
+
+	//a message that could never fit is dropped right away
+	FSocketServerUDPReassembler small;
+	datagrams.Reset();
+	appendFragments(datagrams, sender, 0, randomMessage(random, 2000, 2000), payloadSize);
+	TestFalse(TEXT("Oversized message"), addDatagram(small, datagrams[0], 60.0, 100, received));
+	TestEqual(TEXT("Oversized message dropped"), small.getDroppedMessages(), 1);
+	return true;
+}
+
+#endif
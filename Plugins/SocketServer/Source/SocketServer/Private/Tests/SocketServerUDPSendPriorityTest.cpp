@@ -0,0 +1,124 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerPluginUDPServer.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+static uint64 microsecondsToCycles(double microseconds) {
+	return (uint64)(microseconds / 1000000.0 / FPlatformTime::GetSecondsPerCycle64());
+}
+
+struct FSocketServerUDPSaturationResult {
+	int32 deepestQueue = 0;
+	float controlP99 = 0.f;
+	float bulkP50 = 0.f;
+	float bulkP99 = 0.f;
+	int64 deadlineDrops = 0;
+};
+
+//floods the bulk lane of a fresh send thread and puts a control message in after every 50 bulk messages
+static FSocketServerUDPSaturationResult saturate(USocketServerPluginUDPServer* udpServer, FSocket* socket, const FSocketServerRemoteAddressPtr& addr,
+	ESocketServerUDPSendScheduling scheduling, float bulkDeadlineMilliseconds) {
+	FSocketServerUDPSaturationResult result;
+	FUDPClientSendDataToServerThread* sendThread = new FUDPClientSendDataToServerThread(udpServer);
+	sendThread->setScheduling(scheduling, bulkDeadlineMilliseconds);
+
+	TArray<uint8> bulk;
+	bulk.SetNumZeroed(1200);
+	TArray<uint8> control;
+	control.SetNumZeroed(16);
+	for (int32 i = 0; i < 40000; i++) {
+		sendThread->sendMessage(addr, FString(), bulk, socket, nullptr, ESocketServerUDPSendPriority::E_Bulk);
+		if (i % 50 == 0) {
+			sendThread->sendMessage(addr, FString(), control, socket, nullptr, ESocketServerUDPSendPriority::E_Control);
+			result.deepestQueue = FMath::Max(result.deepestQueue, sendThread->getQueueDepth());
+		}
+	}
+
+	double giveUp = FPlatformTime::Seconds() + 30.0;
+	while (sendThread->getQueueDepth() > 0 && FPlatformTime::Seconds() < giveUp) {
+		FPlatformProcess::Sleep(0.001f);
+	}
+	sendThread->stopThreadAndWait();
+
+	float p50 = 0.f;
+	sendThread->getLatency(ESocketServerUDPSendPriority::E_Control, p50, result.controlP99);
+	sendThread->getLatency(ESocketServerUDPSendPriority::E_Bulk, result.bulkP50, result.bulkP99);
+	result.deadlineDrops = sendThread->getDeadlineDrops();
+	delete sendThread;
+	return result;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerUDPLatencyHistogramTest, "SocketServer.UDP.SendPriority.Histogram",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerUDPLatencyHistogramTest::RunTest(const FString& Parameters) {
+	FSocketServerLatencyHistogram histogram;
+	TestEqual(TEXT("Empty"), histogram.percentile(0.99f), 0.f);
+
+	//980 sends around 10 us, 20 around 10 ms. buckets report their upper bound
+	for (int32 i = 0; i < 980; i++) {
+		histogram.add(microsecondsToCycles(10.0));
+	}
+	for (int32 i = 0; i < 20; i++) {
+		histogram.add(microsecondsToCycles(10000.0));
+	}
+	TestEqual(TEXT("p50"), histogram.percentile(0.5f), 0.016f);
+	TestEqual(TEXT("p97"), histogram.percentile(0.97f), 0.016f);
+	TestEqual(TEXT("p99"), histogram.percentile(0.99f), 16.384f);
+
+	histogram.reset();
+	TestEqual(TEXT("Reset"), histogram.percentile(0.5f), 0.f);
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerUDPSendPrioritySaturationTest, "SocketServer.UDP.SendPriority.Saturation",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerUDPSendPrioritySaturationTest::RunTest(const FString& Parameters) {
+	ISocketSubsystem* socketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+
+	//everything goes to a local socket nobody reads, the kernel drops what doesn't fit
+	TSharedRef<FInternetAddr> sinkAddr = socketSubsystem->CreateInternetAddr();
+	bool validIP = false;
+	sinkAddr->SetIp(TEXT("127.0.0.1"), validIP);
+	sinkAddr->SetPort(0);
+	FSocket* sink = socketSubsystem->CreateSocket(NAME_DGram, TEXT("SocketServerUDPSendPriorityTestSink"), sinkAddr->GetProtocolType());
+	FSocket* socket = socketSubsystem->CreateSocket(NAME_DGram, TEXT("SocketServerUDPSendPriorityTest"), sinkAddr->GetProtocolType());
+	if (!TestTrue(TEXT("Sockets"), sink != nullptr && socket != nullptr && sink->Bind(*sinkAddr))) {
+		if (sink != nullptr) {
+			socketSubsystem->DestroySocket(sink);
+		}
+		if (socket != nullptr) {
+			socketSubsystem->DestroySocket(socket);
+		}
+		return false;
+	}
+	sinkAddr->SetPort(sink->GetPortNo());
+	FSocketServerRemoteAddressPtr addr = MakeShared<const FSocketServerRemoteAddress, ESPMode::ThreadSafe>(sinkAddr);
+	USocketServerPluginUDPServer* udpServer = NewObject<USocketServerPluginUDPServer>();
+
+	//bulk waits behind thousands of queued datagrams, control may only wait for the datagram on the wire
+	FSocketServerUDPSaturationResult strict = saturate(udpServer, socket, addr, ESocketServerUDPSendScheduling::E_Strict, 0.f);
+	TestTrue(TEXT("Strict: bulk lane saturated"), strict.deepestQueue >= 1000);
+	TestTrue(FString::Printf(TEXT("Strict: control p99 %f ms below bulk p50 %f ms"), strict.controlP99, strict.bulkP50), strict.controlP99 > 0.f && strict.controlP99 < strict.bulkP50);
+
+	//with weights 8:4:1 control still overtakes the bulk backlog
+	FSocketServerUDPSaturationResult weighted = saturate(udpServer, socket, addr, ESocketServerUDPSendScheduling::E_Weighted, 0.f);
+	TestTrue(TEXT("Weighted: bulk lane saturated"), weighted.deepestQueue >= 1000);
+	TestTrue(FString::Printf(TEXT("Weighted: control p99 %f ms below bulk p50 %f ms"), weighted.controlP99, weighted.bulkP50), weighted.controlP99 > 0.f && weighted.controlP99 < weighted.bulkP50);
+
+	//a deadline drops stale bulk data instead of letting its latency grow with the backlog
+	FSocketServerUDPSaturationResult deadline = saturate(udpServer, socket, addr, ESocketServerUDPSendScheduling::E_Strict, 1.f);
+	TestTrue(TEXT("Deadline: stale bulk messages dropped"), deadline.deadlineDrops > 0);
+	TestTrue(FString::Printf(TEXT("Deadline: bulk p99 %f ms below %f ms without deadline"), deadline.bulkP99, strict.bulkP99), deadline.bulkP99 < strict.bulkP99);
+
+	socketSubsystem->DestroySocket(socket);
+	socketSubsystem->DestroySocket(sink);
+	return true;
+}
+
+#endif
@@ -0,0 +1,197 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerUDPSessionTable.h"
+#include "SocketServer.h"
+#include "Misc/AutomationTest.h"
+#include "Async/Async.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+static FClientSocketSessionPtr tableTestSession(const FString& sessionID) {
+	FClientSocketSessionPtr session = MakeShared<FClientSocketSession, ESPMode::ThreadSafe>();
+	session->sessionID = sessionID;
+	return session;
+}
+
+static FSocketServerUDPAddressKey tableTestKey(int32 peer) {
+	//10.x.y.z with a port per peer
+	uint8 ip[4] = { 10, (uint8)(peer >> 16), (uint8)(peer >> 8), (uint8)peer };
+	return FSocketServerUDPAddressKey(ip, 4, (uint16)(1024 + peer % 50000));
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerUDPSessionTableGenerationsTest, "SocketServer.UDP.SessionTable.Generations",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerUDPSessionTableGenerationsTest::RunTest(const FString& Parameters) {
+	ISocketSubsystem* socketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	TSharedRef<FInternetAddr> addr = socketSubsystem->CreateInternetAddr();
+	bool validIP = false;
+	addr->SetIp(TEXT("127.0.0.1"), validIP);
+	addr->SetPort(7777);
+	const uint8 loopback[4] = { 127, 0, 0, 1 };
+	const uint8 loopback6[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+	const FSocketServerUDPAddressKey first(loopback, 4, 7777);
+	const FSocketServerUDPAddressKey second(loopback, 4, 7778);
+	const FSocketServerUDPAddressKey third(loopback6, 16, 7777);
+	const FSocketServerUDPAddressKey moved(loopback, 4, 9999);
+
+	TestTrue(TEXT("Key from an address equals the key from raw bytes"), FSocketServerUDPAddressKey(*addr) == first);
+	TestFalse(TEXT("Ports are part of the key"), first == second);
+	TestFalse(TEXT("IPv4 and IPv6 keys differ"), first == third);
+
+	FSocketServerUDPSessionTable table;
+	FSocketServerUDPSessionTable::FReader reader;
+	TestTrue(TEXT("Empty table"), table.find(first, reader) == nullptr && table.num() == 0);
+	uint64 emptyGeneration = reader.generation;
+
+	FClientSocketSessionPtr sessionA = tableTestSession(TEXT("A"));
+	FClientSocketSessionPtr sessionB = tableTestSession(TEXT("B"));
+	FClientSocketSessionPtr sessionC = tableTestSession(TEXT("C"));
+	TestTrue(TEXT("Add A"), table.add(first, sessionA) == sessionA);
+	TestTrue(TEXT("Add B"), table.add(second, sessionB) == sessionB);
+	TestTrue(TEXT("Add C"), table.add(third, sessionC) == sessionC);
+	//the address is taken, the first session wins
+	TestTrue(TEXT("Add under a taken address"), table.add(first, tableTestSession(TEXT("D"))) == sessionA);
+	TestEqual(TEXT("Sessions"), table.num(), 3);
+
+	//the reader still has the empty generation and refreshes on the next lookup
+	TestEqual(TEXT("Reader not refreshed before the lookup"), reader.generation, emptyGeneration);
+	FClientSocketSession* foundA = table.find(first, reader);
+	TestTrue(TEXT("Find A"), foundA == sessionA.Get());
+	uint64 generation = reader.generation;
+	TestTrue(TEXT("Reader refreshed"), generation != emptyGeneration);
+	TestTrue(TEXT("Find B"), table.find(second, reader) == sessionB.Get());
+	TestTrue(TEXT("Find C"), table.find(third, reader) == sessionC.Get());
+	TestEqual(TEXT("Lookups without writes keep the generation"), reader.generation, generation);
+	TestTrue(TEXT("Find by ID"), table.findByID(TEXT("B")) == sessionB);
+
+	//removing A publishes a new shard. the reader keeps the old one, so its last result stays valid until its next lookup
+	TestTrue(TEXT("Remove A"), table.remove(TEXT("A")) == sessionA);
+	TestTrue(TEXT("Remove unknown"), table.remove(TEXT("A")) == nullptr);
+	sessionA.Reset();
+	TestEqual(TEXT("Old shard still alive for the reader"), foundA->sessionID, FString(TEXT("A")));
+	TestTrue(TEXT("A gone after the refresh"), table.find(first, reader) == nullptr);
+	TestTrue(TEXT("New generation"), reader.generation != generation);
+	TestTrue(TEXT("A gone by ID"), table.findByID(TEXT("A")) == nullptr);
+
+	//B comes back from another address: the old address no longer finds it
+	FClientSocketSessionPtr movedB = tableTestSession(TEXT("B"));
+	TestTrue(TEXT("Add B under another address"), table.add(moved, movedB) == movedB);
+	TestTrue(TEXT("Old address of B"), table.find(second, reader) == nullptr);
+	TestTrue(TEXT("New address of B"), table.find(moved, reader) == movedB.Get());
+	TestTrue(TEXT("B by ID"), table.findByID(TEXT("B")) == movedB);
+	TestEqual(TEXT("Sessions after the move"), table.num(), 2);
+	TestEqual(TEXT("All sessions"), table.getAll().Num(), 2);
+
+	//a reader that starts late sees the current state right away
+	FSocketServerUDPSessionTable::FReader lateReader;
+	TestTrue(TEXT("Late reader finds C"), table.find(third, lateReader) == sessionC.Get());
+	TestTrue(TEXT("Late reader misses A"), table.find(first, lateReader) == nullptr);
+	TestEqual(TEXT("Readers agree on the generation"), lateReader.generation, reader.generation);
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerUDPSessionTableLookupTest, "SocketServer.UDP.SessionTable.Lookup10k",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerUDPSessionTableLookupTest::RunTest(const FString& Parameters) {
+	const int32 peerCount = 10000;
+	const int32 lookupCount = 1000000;
+
+	FSocketServerUDPSessionTable table;
+	//what the table replaced: "ip:port" strings in one map behind a lock
+	FCriticalSection stringLock;
+	TMap<FString, FClientSocketSessionPtr> stringSessions;
+	TArray<FSocketServerUDPAddressKey> keys;
+	TArray<FString> strings;
+	for (int32 peer = 0; peer < peerCount; peer++) {
+		FClientSocketSessionPtr session = tableTestSession(FString::Printf(TEXT("peer%i"), peer));
+		FSocketServerUDPAddressKey key = tableTestKey(peer);
+		FString string = FString::Printf(TEXT("10.%i.%i.%i:%i"), (peer >> 16) & 0xFF, (peer >> 8) & 0xFF, peer & 0xFF, 1024 + peer % 50000);
+		table.add(key, session);
+		stringSessions.Add(string, session);
+		keys.Add(key);
+		strings.Add(string);
+	}
+	TestEqual(TEXT("Sessions"), table.num(), peerCount);
+
+	//datagrams arrive from random peers
+	FRandomStream random(30);
+	TArray<int32> order;
+	order.SetNumUninitialized(lookupCount);
+	for (int32& peer : order) {
+		peer = random.RandRange(0, peerCount - 1);
+	}
+
+	FSocketServerUDPSessionTable::FReader reader;
+	int32 found = 0;
+	double start = FPlatformTime::Seconds();
+	for (int32 peer : order) {
+		if (table.find(keys[peer], reader) != nullptr) {
+			found++;
+		}
+	}
+	double tableSeconds = FPlatformTime::Seconds() - start;
+	TestEqual(TEXT("Every peer found in the table"), found, lookupCount);
+
+	found = 0;
+	start = FPlatformTime::Seconds();
+	for (int32 peer : order) {
+		FScopeLock lock(&stringLock);
+		if (stringSessions.Find(strings[peer]) != nullptr) {
+			found++;
+		}
+	}
+	double stringSeconds = FPlatformTime::Seconds() - start;
+	TestEqual(TEXT("Every peer found in the string map"), found, lookupCount);
+
+	AddInfo(FString::Printf(TEXT("%i peers: %.1f M lookups/s through a reader, %.1f M lookups/s in the locked string map"), peerCount,
+		lookupCount / tableSeconds / 1000000.0, lookupCount / stringSeconds / 1000000.0));
+	TestTrue(TEXT("Reader lookups at least as fast as the locked string map"), tableSeconds <= stringSeconds);
+
+	//four receive threads look up the known peers while sessions of other peers come and go
+	std::atomic<bool> run{ true };
+	std::atomic<int64> lookups{ 0 };
+	std::atomic<int64> misses{ 0 };
+	TArray<TFuture<void>> readers;
+	for (int32 thread = 0; thread < 4; thread++) {
+		readers.Add(Async(EAsyncExecution::Thread, [&table, &keys, &run, &lookups, &misses, thread]() {
+			FSocketServerUDPSessionTable::FReader threadReader;
+			FRandomStream threadRandom(thread);
+			int64 threadLookups = 0;
+			while (run.load(std::memory_order_relaxed)) {
+				int32 peer = threadRandom.RandRange(0, keys.Num() - 1);
+				FClientSocketSession* session = table.find(keys[peer], threadReader);
+				if (session == nullptr || session->sessionID != FString::Printf(TEXT("peer%i"), peer)) {
+					misses++;
+				}
+				threadLookups++;
+			}
+			lookups += threadLookups;
+		}));
+	}
+	int32 churn = 0;
+	double stop = FPlatformTime::Seconds() + 0.5;
+	while (FPlatformTime::Seconds() < stop) {
+		FString sessionID = FString::Printf(TEXT("churn%i"), churn % 1000);
+		if (churn / 1000 % 2 == 0) {
+			table.add(tableTestKey(peerCount + churn % 1000), tableTestSession(sessionID));
+		}
+		else {
+			table.remove(sessionID);
+		}
+		churn++;
+	}
+	run = false;
+	for (TFuture<void>& threadReader : readers) {
+		threadReader.Wait();
+	}
+	AddInfo(FString::Printf(TEXT("%lld lookups on four threads during %i adds and removes"), lookups.load(), churn));
+	TestEqual(TEXT("No lookup missed a known peer during the churn"), misses.load(), (int64)0);
+	TestTrue(TEXT("Lookups during the churn"), lookups.load() > 0);
+	return true;
+}
+
+#endif
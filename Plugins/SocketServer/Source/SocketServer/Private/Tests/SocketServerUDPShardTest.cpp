@@ -0,0 +1,158 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+
+#include "SocketServerPluginUDPServer.h"
+#include "Misc/AutomationTest.h"
+#include "Async/Async.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+//counts on the receive threads and keeps the datagrams away from the game thread
+class FSocketServerUDPCountingHandler : public ISocketServerUDPDatagramHandler {
+public:
+	std::atomic<int64> datagrams{ 0 };
+
+	virtual bool onUDPDatagram(const FSocketServerUDPDatagramView& datagram) override {
+		datagrams.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+};
+
+struct FSocketServerUDPFloodResult {
+	bool started = false;
+	double datagramsPerSecond = 0.0;
+	TSet<int32> shards;
+	bool socketReleased = false;
+};
+
+static int32 freeUDPPort(ISocketSubsystem* socketSubsystem) {
+	TSharedRef<FInternetAddr> addr = socketSubsystem->CreateInternetAddr();
+	bool validIP = false;
+	addr->SetIp(TEXT("127.0.0.1"), validIP);
+	addr->SetPort(0);
+	FSocket* probe = socketSubsystem->CreateSocket(NAME_DGram, TEXT("SocketServerUDPShardTestProbe"), addr->GetProtocolType());
+	int32 port = 0;
+	if (probe != nullptr) {
+		if (probe->Bind(*addr)) {
+			port = probe->GetPortNo();
+		}
+		socketSubsystem->DestroySocket(probe);
+	}
+	return port;
+}
+
+//starts the server with the given number of receive threads, floods it from 16 client sockets on 4 threads and stops it again
+static FSocketServerUDPFloodResult flood(ISocketSubsystem* socketSubsystem, USocketServerPluginUDPServer* udpServer, int32 receiveThreads, double seconds) {
+	FSocketServerUDPFloodResult result;
+	int32 port = freeUDPPort(socketSubsystem);
+	if (port == 0) {
+		return result;
+	}
+
+	TSharedPtr<FSocketServerUDPCountingHandler, ESPMode::ThreadSafe> handler = MakeShared<FSocketServerUDPCountingHandler, ESPMode::ThreadSafe>();
+	IpAndPortStruct ipAndPort;
+	ipAndPort.success = true;
+	ipAndPort.ip = TEXT("127.0.0.1");
+	ipAndPort.port = port;
+	udpServer->startUDPServer(ipAndPort, ipAndPort.ip, port, false, EReceiveFilterServer::E_B, TEXT("SocketServerUDPShardTest"), 65507, receiveThreads);
+	udpServer->setDatagramHandler(handler);
+
+	//shard 0 publishes its socket once it is bound, the other shards bind at the same time
+	double giveUp = FPlatformTime::Seconds() + 5.0;
+	while (udpServer->getSocket() == nullptr && FPlatformTime::Seconds() < giveUp) {
+		FPlatformProcess::Sleep(0.01f);
+	}
+	result.started = udpServer->getSocket() != nullptr;
+	FPlatformProcess::Sleep(0.2f);
+
+	if (result.started) {
+		TSharedRef<FInternetAddr> serverAddrRef = socketSubsystem->CreateInternetAddr();
+		bool validIP = false;
+		serverAddrRef->SetIp(TEXT("127.0.0.1"), validIP);
+		serverAddrRef->SetPort(port);
+		const FInternetAddr* serverAddr = &serverAddrRef.Get();
+
+		std::atomic<bool> sending{ true };
+		TArray<TFuture<void>> senders;
+		for (int32 i = 0; i < 4; i++) {
+			senders.Add(Async(EAsyncExecution::Thread, [socketSubsystem, serverAddr, &sending]() {
+				//several source ports per thread so SO_REUSEPORT has something to spread
+				TArray<FSocket*> sockets;
+				for (int32 s = 0; s < 4; s++) {
+					FSocket* socket = socketSubsystem->CreateSocket(NAME_DGram, TEXT("SocketServerUDPShardTestSender"), serverAddr->GetProtocolType());
+					if (socket != nullptr) {
+						sockets.Add(socket);
+					}
+				}
+				uint8 payload[64] = { 0 };
+				int32 bytesSent = 0;
+				while (sending.load(std::memory_order_relaxed)) {
+					for (FSocket* socket : sockets) {
+						socket->SendTo(payload, sizeof(payload), bytesSent, *serverAddr);
+					}
+				}
+				for (FSocket* socket : sockets) {
+					socketSubsystem->DestroySocket(socket);
+				}
+			}));
+		}
+
+		//let the sessions settle, then count what the shards take in during the measured window
+		FPlatformProcess::Sleep(0.2f);
+		int64 startCount = handler->datagrams.load();
+		double start = FPlatformTime::Seconds();
+		FPlatformProcess::Sleep((float)seconds);
+		result.datagramsPerSecond = (handler->datagrams.load() - startCount) / (FPlatformTime::Seconds() - start);
+		sending = false;
+		for (TFuture<void>& sender : senders) {
+			sender.Wait();
+		}
+
+		for (auto& element : udpServer->getClientSessions()) {
+			result.shards.Add(element.Value.shardIndex);
+		}
+	}
+
+	//the shard threads are joined and have destroyed their sockets when this returns
+	udpServer->stopUDPServer();
+	result.socketReleased = udpServer->getSocket() == nullptr;
+	return result;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSocketServerUDPShardFloodTest, "SocketServer.UDP.Shards.LoopbackFlood",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FSocketServerUDPShardFloodTest::RunTest(const FString& Parameters) {
+	ISocketSubsystem* socketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	USocketServerPluginUDPServer* udpServer = NewObject<USocketServerPluginUDPServer>();
+
+	FSocketServerUDPFloodResult single = flood(socketSubsystem, udpServer, 1, 1.0);
+	if (!TestTrue(TEXT("One receive thread started"), single.started)) {
+		udpServer->RemoveFromRoot();
+		return false;
+	}
+	TestTrue(TEXT("One receive thread received"), single.datagramsPerSecond > 0.0);
+	TestTrue(TEXT("One receive thread stopped"), single.socketReleased);
+	TestEqual(TEXT("One receive thread is one shard"), single.shards.Num(), 1);
+
+#if SOCKETSERVER_WITH_NATIVE_SOCKETS
+	FSocketServerUDPFloodResult sharded = flood(socketSubsystem, udpServer, 4, 1.0);
+	if (!TestTrue(TEXT("Four receive threads started"), sharded.started)) {
+		udpServer->RemoveFromRoot();
+		return false;
+	}
+	TestTrue(TEXT("Four receive threads stopped"), sharded.socketReleased);
+	TestTrue(FString::Printf(TEXT("16 senders spread over %i shards"), sharded.shards.Num()), sharded.shards.Num() > 1);
+	AddInfo(FString::Printf(TEXT("Loopback flood: %.0f datagrams/s with one receive thread, %.0f with four"), single.datagramsPerSecond, sharded.datagramsPerSecond));
+	//the senders share the machine with the receivers, so only a drop below the single thread counts as a failure
+	TestTrue(TEXT("Four receive threads keep up with one"), sharded.datagramsPerSecond >= single.datagramsPerSecond * 0.9);
+
+	//the same server once more after its shards were joined
+	FSocketServerUDPFloodResult restarted = flood(socketSubsystem, udpServer, 4, 0.2);
+	TestTrue(TEXT("Restarted"), restarted.started && restarted.datagramsPerSecond > 0.0 && restarted.socketReleased);
+#endif
+	udpServer->RemoveFromRoot();
+	return true;
+}
+
+#endif
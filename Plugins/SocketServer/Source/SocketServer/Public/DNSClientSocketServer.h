@@ -4,6 +4,7 @@
 
 #include "SocketServer.h"
 #include "SocketServerBPLibrary.h"
+#include "SocketServerDNSResolver.h"
 #include "DNSClientSocketServer.generated.h"
 
 UCLASS()
@@ -20,17 +21,17 @@ public:
 		FresolveDomainEventDelegate onresolveDomainEventDelegate;
 
 	void resolveDomain(ISocketSubsystem * socketSubSystem, FString domain, bool useDNSCache = true, FString dnsIP = FString("8.8.8.8"));
-	
-	void UDPReceiver(const FArrayReaderPtr& ArrayReaderPtr, const FIPv4Endpoint& EndPt);
-
-	FSocket* socket = nullptr;
 
 	bool isResloving();
+	//first address of the answer, IPv4 before IPv6
 	FString getIP();
+	/** All IPv4 and IPv6 addresses of the domain. IPv4 addresses come first. Empty if the domain could not be resolved. */
+	UFUNCTION(BlueprintCallable, BlueprintPure, Category = "SocketServer|ResolveDomain")
+		TArray<FString> getIPs();
 
 private:
 	bool resolving;
 	FString ip;
+	TArray<FString> ips;
 	FString domain;
-	TMap<FString, FString> dnsCache;
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "SocketServer.h"
 #include "SocketServerBPLibrary.h"
+#include "SocketServerFileReadAhead.h"
 
 #include "FileFunctionsSocketServer.generated.h"
 
@@ -124,12 +125,21 @@ public:
 
 	/**
 	* With this function you can read a file piece by piece. This reduces the RAM consumption to almost zero and files can be read in infinite size.
+	* The file is read ahead into readAheadBuffers buffers. Reading pauses as soon as all of them are waiting in the game thread, so it never reads faster than the parts are processed.
 	*@param bufferSize In bytes. This is the size of the file pieces that are being read.
-	*@param delayBetweenReadsInSeconds Specified in seconds. The higher the value, the slower the file is read (0.0001 minimum). When sending data over the network/internet, please make sure not to send data too fast. SSDs can read data much faster than you can send it over a network. This means that the data ends up in some buffers (RAM) and can also cause them to overflow.
+	*@param delayBetweenReadsInSeconds Deprecated and ignored. The read speed is controlled by the free buffers.
+	*@param readAheadBuffers Number of file pieces that can be read ahead (1-64). RAM consumption is at most bufferSize * readAheadBuffers.
+	*@param releaseBuffersManually If false a piece is released right after the event. If true the byte array stays valid after the event and every piece must be given back with releaseBytesFromFileInPartsBuffer, for example after it has been sent over the network.
 	*/
 	UFUNCTION(BlueprintCallable, Category = "SocketServer|SpecialFunctions|File", meta = (AdvancedDisplay = 2))
-		static void readBytesFromFileInPartsAsync(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath, int32 bufferSize = 65536, float delayBetweenReadsInSeconds = 0.01f);
-	void readBytesFromFileInPartsAsyncInternal(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath, int32 bufferSize = 65536, float delayBetweenReadsInSeconds = 0.01f);
+		static void readBytesFromFileInPartsAsync(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath, int32 bufferSize = 65536, float delayBetweenReadsInSeconds = 0.01f, int32 readAheadBuffers = 4, bool releaseBuffersManually = false);
+	void readBytesFromFileInPartsAsyncInternal(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath, int32 bufferSize = 65536, int32 readAheadBuffers = 4, bool releaseBuffersManually = false);
+	/**
+	* Gives the oldest file piece back to readBytesFromFileInPartsAsync. Only needed if releaseBuffersManually is true. Returns false if no piece is waiting.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|SpecialFunctions|File")
+		static bool releaseBytesFromFileInPartsBuffer(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath);
+	bool releaseBytesFromFileInPartsBufferInternal(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath);
 	UFUNCTION(BlueprintCallable, Category = "SocketServer|SpecialFunctions|File")
 		static void cancelReadBytesFromFileInParts(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath);
 	void cancelReadBytesFromFileInPartsInternal(EFileFunctionsSocketServerDirectoryType directoryType, FString filePath);
@@ -147,96 +157,73 @@ class  SOCKETSERVER_API FReadFileInPartsSocketServerThread : public FRunnable {
 
 public:
 
-	FReadFileInPartsSocketServerThread(FString cleanDirP, int32 bufferSizeP, float delayBetweenReadsInSecondsP) :
+	FReadFileInPartsSocketServerThread(FString cleanDirP, int32 bufferSizeP, int32 readAheadBuffersP, bool releaseBuffersManuallyP) :
 		cleanDir(cleanDirP),
-		bufferSize(bufferSizeP),
-		delayBetweenReadsInSeconds(delayBetweenReadsInSecondsP)
+		releaseBuffersManually(releaseBuffersManuallyP)
 	{
+		readAhead = MakeShareable(new FSocketServerFileReadAhead(cleanDir, bufferSizeP, readAheadBuffersP));
 		FString threadName = "FReadFileInPartsSocketServerThread" + FGuid::NewGuid().ToString();
 		thread = FRunnableThread::Create(this, *threadName, 0, EThreadPriority::TPri_Normal);
 	}
 
 	virtual uint32 Run() override {
 
-		FArchive* reader = IFileManager::Get().CreateFileReader(*cleanDir);
-		if (reader == nullptr || reader->TotalSize() == 0) {
-			AsyncTask(ENamedThreads::GameThread, []() {
-				USocketServerBPLibrary::getSocketServerTarget()->onreadBytesFromFileInPartsEventDelegate.Broadcast(0, 0, true, TArray<uint8>());
-				});
-			if (reader != nullptr) {
-				reader->Close();
-			}
-			delete reader;
-			return 0;
-		}
-
-		if (delayBetweenReadsInSeconds <= 0) {
-			delayBetweenReadsInSeconds = 0.0001f;
-		}
-
-		int64 fileSize = reader->TotalSize();
-		int64 readSize = 0;
+		int64 fileSize = 0;
 		int64 lastPosition = 0;
-		TArray<uint8> buffer;
-
-		if (bufferSize > fileSize) {
-			bufferSize = fileSize;
-		}
-
-		while (run && lastPosition < fileSize) {
-			if ((lastPosition + bufferSize) > fileSize) {
-				bufferSize = fileSize - lastPosition;
+		FString cleanDirGameThread = cleanDir;
+
+		if (readAhead->open(fileSize)) {
+			TSharedPtr<FSocketServerFileReadAhead, ESPMode::ThreadSafe> readAheadGameThread = readAhead;
+			bool autoRelease = !releaseBuffersManually;
+
+			//no sleep here. the loop waits in acquire() until the game thread gives a buffer back
+			while (run && lastPosition < fileSize) {
+				int32 index = readAhead->acquire();
+				if (index == INDEX_NONE) {
+					break;
+				}
+				int32 bytes = readAhead->read(index);
+				if (bytes <= 0) {
+					UE_LOG(LogTemp, Error, TEXT("ReadBytesFromFileInPartsAsync: Can't read %s."), *cleanDir);
+					break;
+				}
+				lastPosition += bytes;
+
+				AsyncTask(ENamedThreads::GameThread, [readAheadGameThread, index, fileSize, lastPosition, autoRelease]() {
+					USocketServerBPLibrary::getSocketServerTarget()->onreadBytesFromFileInPartsEventDelegate.Broadcast(fileSize, lastPosition, false, readAheadGameThread->getBuffer(index));
+					if (autoRelease) {
+						readAheadGameThread->release(index);
+					}
+					});
 			}
-
-			//buffer.Reset(bufferSize);
-			buffer.Empty();
-			buffer.AddUninitialized(bufferSize);
-
-			reader->Serialize(buffer.GetData(), buffer.Num());
-			lastPosition += buffer.Num();
-
-			//UE_LOG(LogTemp, Warning, TEXT("xxxxx READ: %i"), buffer.Num());
-
-
-			AsyncTask(ENamedThreads::GameThread, [fileSize, lastPosition, buffer]() {
-				USocketServerBPLibrary::getSocketServerTarget()->onreadBytesFromFileInPartsEventDelegate.Broadcast(fileSize, lastPosition, false, buffer);
-				});
-
-			FPlatformProcess::Sleep(delayBetweenReadsInSeconds);
-
+			readAhead->close();
 		}
 
-		AsyncTask(ENamedThreads::GameThread, [fileSize, lastPosition]() {
+		AsyncTask(ENamedThreads::GameThread, [fileSize, lastPosition, cleanDirGameThread]() {
 			USocketServerBPLibrary::getSocketServerTarget()->onreadBytesFromFileInPartsEventDelegate.Broadcast(fileSize, lastPosition, true, TArray<uint8>());
+			UFileFunctionsSocketServer::getFileFunctionsSocketServerTarget()->cleanReadBytesFromFileInParts(cleanDirGameThread);
 			});
 
-		UFileFunctionsSocketServer::getFileFunctionsSocketServerTarget()->cleanReadBytesFromFileInParts(cleanDir);
-		//buffer.Empty();
-		if (reader != nullptr) {
-			reader->Close();
-		}
-		delete reader;
 		thread = nullptr;
 		return 0;
 	}
 
 	void stopThread() {
 		run = false;
+		readAhead->cancel();
 	}
 
-	void setDelayBetweenReadsInSeconds(float d) {
-		delayBetweenReadsInSeconds = d;
-		if (delayBetweenReadsInSeconds <= 0) {
-			delayBetweenReadsInSeconds = 0.001f;
-		}
+	//gives the oldest delivered part back to the reader
+	bool releaseBuffer() {
+		return readAhead->releaseOldest();
 	}
 
 
 protected:
-	bool run = true;
+	std::atomic<bool> run{ true };
 	FString cleanDir;
-	int32 bufferSize;
-	float delayBetweenReadsInSeconds;
+	bool releaseBuffersManually = false;
+	TSharedPtr<FSocketServerFileReadAhead, ESPMode::ThreadSafe> readAhead;
 	//USocketServerBPLibrary* mainLib = USocketServerBPLibrary::getSocketServerTarget();
 
 	FRunnableThread* thread = nullptr;
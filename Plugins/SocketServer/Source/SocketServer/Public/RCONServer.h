@@ -14,11 +14,12 @@ class SOCKETSERVER_API URCONServer : public UObject
 
 public:
 
-	UFUNCTION()
-		void receiveTCPMessageEvent(const FString sessionID, const FString message, const TArray<uint8>& byteArray, const FString serverID);
+	//game thread. called with the commands the receive thread has parsed. authenticated if the connection sent the right password before
+	void dispatchCommand(FString sessionID, FString serverID, int32 requestID, FString request, bool authenticated);
 
 	void startRCONServer(FString serverID, ERCONPasswordType passwordType, FString passwordOrFile,
 		bool& success, FString& errorMessage);
+	void stopRCONServer();
 
 	bool sendResponse(FString sessionID, FString serverID, int32 id, int32 type, FString body);
 
@@ -26,7 +27,8 @@ private:
 	FString passwordOrFile = FString();
 	ERCONPasswordType passwordType = ERCONPasswordType::E_parameter;
 	TArray<FString> commandList;
-
-	void authResponse(FString sessionID, FString serverID, FString password, int32 rconID);
+	FString rconServerID = FString();
+	//built in "sessionstats [sessionID]" command. only answered for authenticated connections
+	void sessionStatsResponse(FString sessionID, FString serverID, int32 rconID, FString arguments);
 	
 };
\ No newline at end of file
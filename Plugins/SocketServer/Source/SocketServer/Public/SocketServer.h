@@ -16,6 +16,7 @@
 #include "Misc/Base64.h"
 #include "Misc/SecureHash.h"
 #include "Modules/ModuleManager.h"
+#include <atomic>
 #include "SocketServer.generated.h"
 
 class FTCPClientSendDataToServerThread;
@@ -99,6 +100,24 @@ enum class ESocketServerUDPSocketType : uint8
 
 };
 
+//lanes of the asynchronous UDP send queue, highest priority first
+UENUM(BlueprintType)
+enum class ESocketServerUDPSendPriority : uint8
+{
+	E_Control 		UMETA(DisplayName = "Control"),
+	E_Interactive	UMETA(DisplayName = "Interactive"),
+	E_Bulk			UMETA(DisplayName = "Bulk")
+
+};
+
+UENUM(BlueprintType)
+enum class ESocketServerUDPSendScheduling : uint8
+{
+	E_Strict 	UMETA(DisplayName = "Strict"),
+	E_Weighted	UMETA(DisplayName = "Weighted")
+
+};
+
 UENUM(BlueprintType)
 enum class ESocketServerTCPMessageWrapping : uint8
 {
@@ -133,6 +152,98 @@ struct IpAndPortStruct {
 	int32			port = 0;
 };
 
+/*traffic counters of one session at the time of the call*/
+USTRUCT(BlueprintType)
+struct FSocketServerSessionStats
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	FString sessionID = FString();
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	FString serverID = FString();
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	EServerSocketConnectionProtocol protocol = EServerSocketConnectionProtocol::E_NotSet;
+	//UDP: datagrams. TCP: reads and writes on the socket
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	int64 packetsIn = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	int64 bytesIn = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	int64 packetsOut = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	int64 bytesOut = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	int64 sendErrors = 0;
+	//messages queued for asynchronous sending
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	int32 sendQueueDepth = 0;
+	//-1 if nothing was sent or received yet
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	float secondsSinceLastActivity = -1.f;
+	//-1 until the application reports a round trip time
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer")
+	float rttMilliseconds = -1.f;
+};
+
+/*counters of one session. shared between all copies of the session and written with relaxed atomics from the socket threads*/
+struct FSocketServerSessionCounters {
+
+	std::atomic<int64> packetsIn{ 0 };
+	std::atomic<int64> bytesIn{ 0 };
+	std::atomic<int64> packetsOut{ 0 };
+	std::atomic<int64> bytesOut{ 0 };
+	std::atomic<int64> sendErrors{ 0 };
+	std::atomic<int32> sendQueueDepth{ 0 };
+	std::atomic<uint64> lastActivityCycles{ 0 };
+	std::atomic<float> rttMilliseconds{ -1.f };
+
+	void received(int64 bytes) {
+		packetsIn.fetch_add(1, std::memory_order_relaxed);
+		bytesIn.fetch_add(bytes, std::memory_order_relaxed);
+		lastActivityCycles.store(FPlatformTime::Cycles64(), std::memory_order_relaxed);
+	}
+
+	void sent(int64 bytes) {
+		packetsOut.fetch_add(1, std::memory_order_relaxed);
+		bytesOut.fetch_add(bytes, std::memory_order_relaxed);
+		lastActivityCycles.store(FPlatformTime::Cycles64(), std::memory_order_relaxed);
+	}
+
+	void sendFailed() {
+		sendErrors.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void fillStats(FSocketServerSessionStats& stats) const {
+		stats.packetsIn = packetsIn.load(std::memory_order_relaxed);
+		stats.bytesIn = bytesIn.load(std::memory_order_relaxed);
+		stats.packetsOut = packetsOut.load(std::memory_order_relaxed);
+		stats.bytesOut = bytesOut.load(std::memory_order_relaxed);
+		stats.sendErrors = sendErrors.load(std::memory_order_relaxed);
+		stats.sendQueueDepth = sendQueueDepth.load(std::memory_order_relaxed);
+		stats.rttMilliseconds = rttMilliseconds.load(std::memory_order_relaxed);
+		uint64 lastActivity = lastActivityCycles.load(std::memory_order_relaxed);
+		stats.secondsSinceLastActivity = lastActivity == 0 ? -1.f : (float)FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - lastActivity);
+	}
+};
+
+typedef TSharedPtr<FSocketServerSessionCounters, ESPMode::ThreadSafe> FSocketServerSessionCountersPtr;
+
+/*
+* Remote address that is shared between the receive, game and send threads. Sockets only hand out FInternetAddr with
+* the not thread safe ESPMode::Fast, so the address is wrapped once on the creating thread and only the thread safe
+* wrapper is copied around.
+*/
+struct FSocketServerRemoteAddress {
+	TSharedRef<FInternetAddr> addr;
+
+	explicit FSocketServerRemoteAddress(const TSharedRef<FInternetAddr>& addrP) :
+		addr(addrP) {
+	}
+};
+
+typedef TSharedPtr<const FSocketServerRemoteAddress, ESPMode::ThreadSafe> FSocketServerRemoteAddressPtr;
+
 USTRUCT(BlueprintType)
 struct FClientSocketSession
 {
@@ -140,17 +251,88 @@ struct FClientSocketSession
 
 	FString ip = FString();;
 	int32	port = 0;
+	//resolved once when the session is created so senders do not parse the ip string again
+	FSocketServerRemoteAddressPtr addr;
 	FString sessionID = FString();;
 	FString serverID = FString();;
 	FSocket* socket = nullptr;
+	//UDP receive thread the session is pinned to
+	int32 shardIndex = 0;
+	//created with the session, copies of the session share it
+	FSocketServerSessionCountersPtr counters;
 
 	FTCPClientSendDataToServerThread* sendThread = nullptr;
 	FTCPClientReceiveDataFromServerThread* recieverThread = nullptr;
 
 	EServerSocketConnectionProtocol protocol;
+
+	void fillStats(FSocketServerSessionStats& stats) const {
+		stats.sessionID = sessionID;
+		stats.serverID = serverID;
+		stats.protocol = protocol;
+		if (counters.IsValid()) {
+			counters->fillStats(stats);
+		}
+	}
+};
+
+
+/*one received datagram, used when UDP messages are delivered in batches*/
+USTRUCT(BlueprintType)
+struct FSocketServerUDPDatagram
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	FString sessionID = FString();
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	FString message = FString();
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	TArray<uint8> byteArray;
 };
 
 
+/*counters of a UDP server since it was started. kernel drops are only available on Linux*/
+USTRUCT(BlueprintType)
+struct FSocketServerUDPStats
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 datagramsReceived = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 bytesReceived = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 datagramsSent = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 bytesSent = 0;
+	//datagrams the kernel dropped because the receive buffer was full (SO_RXQ_OVFL)
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 kernelReceiveDrops = 0;
+	//sends rejected with EAGAIN/EWOULDBLOCK
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 sendWouldBlock = 0;
+	//sends rejected with ENOBUFS
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 sendNoBuffers = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 sendOtherErrors = 0;
+	//fragmented messages that timed out or were evicted before they were complete
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 reassemblyDrops = 0;
+	//bulk messages dropped because they waited longer than the bulk deadline
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 bulkDeadlineDrops = 0;
+	//asynchronous sends dropped because their lane of the send queue was full
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int64 sendQueueFullDrops = 0;
+	//buffer sizes the OS actually granted
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int32 receiveBufferSize = 0;
+	UPROPERTY(BlueprintReadOnly, Category = "SocketServer|UDP")
+	int32 sendBufferSize = 0;
+};
+
 USTRUCT(BlueprintType)
 struct FSocketServerDownloadFileInfo
 {
@@ -28,6 +28,7 @@ public:
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_FourParams(FreadBytesFromFileInPartsEventDelegate, int64, fileSize, int64, position, bool, end, const TArray<uint8>&, byteArray);
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FsocketServerUDPConnectionEventDelegate, bool, success, FString, message, FString, serverID);
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_FourParams(FserverReceiveUDPMessageEventDelegate, FString, sessionID, FString, message, const TArray<uint8>&, byteArray,FString, serverID);
+	DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FserverReceiveUDPMessageBatchEventDelegate, const TArray<FSocketServerUDPDatagram>&, datagrams, FString, serverID);
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_SixParams(FfileTransferOverTCPProgressEventDelegate, FString, sessionID, FString, filePath, float, percent, float, mbit, int64, bytesTransferred, int64, fileSize);
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_FourParams(FfileTransferOverTCPInfoEventDelegate, FString, message, FString, sessionID, FString, filePath, bool, success);
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_FourParams(FreceiveRCONRequestEventDelegate, FString, sessionID, FString, serverID, int32, requestID, FString, request);
@@ -49,6 +50,10 @@ public:
 		void serverReceiveUDPMessageEventDelegate(const FString sessionID, const FString message, const TArray<uint8>& byteArray, const FString serverID);
 	UPROPERTY(BlueprintAssignable, Category = "SocketServer|UDP|Events|ReceiveMessage")
 		FserverReceiveUDPMessageEventDelegate onserverReceiveUDPMessageEventDelegate;
+	UFUNCTION()
+		void serverReceiveUDPMessageBatchEventDelegate(const TArray<FSocketServerUDPDatagram>& datagrams, const FString serverID);
+	UPROPERTY(BlueprintAssignable, Category = "SocketServer|UDP|Events|ReceiveMessage")
+		FserverReceiveUDPMessageBatchEventDelegate onserverReceiveUDPMessageBatchEventDelegate;
 	UFUNCTION()
 		void fileTransferOverTCPProgressEventDelegate(const FString sessionID, const FString filePath, const float percent, const float mbit, const int64 bytesTransferred, const int64 fileSize);
 	UPROPERTY(BlueprintAssignable, Category = "SocketServer|TCP|Events|File|FileTransferOverTCPProgress")
@@ -76,6 +81,22 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "SocketServer")
 		void serverPluginGetSocketSessionInfoByServerID(const FString serverID, const FString sessionID, bool& sessionFound, FString& IP, int32& port, EServerSocketConnectionProtocol& connectionProtocol);
 	/**
+	*Traffic counters of a session: packets and bytes in both directions, queued messages, send errors, time since the last activity and the round trip time if one was reported.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer")
+		void serverPluginGetSocketSessionStats(const FString sessionID, bool& sessionFound, FSocketServerSessionStats& stats);
+	/**
+	*Traffic counters of all sessions.
+	*@param optionalServerID If empty, the sessions of all servers are returned.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer")
+		void serverPluginGetAllSocketSessionStats(const FString optionalServerID, TArray<FSocketServerSessionStats>& stats);
+	/**
+	*The plugin does not measure round trip times itself. If your protocol has feedback (pings, acks) report the measured value here and it shows up in the session stats.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer")
+		void serverPluginSetSocketSessionRTT(const FString sessionID, float rttMilliseconds);
+	/**
 	*Close a connection and remove the session
 	*@param optionalServerID With one server the field can remain empty. If there are several servers, the ServerID should be entered here or the newest server is automatically taken.
 	*/
@@ -94,9 +115,12 @@ public:
 	*@param receiveFilter This allows you to decide which data type you want to receive. If you receive files it makes no sense to convert them into a string.
 	*@param customServerID Optionally you can assign your own ServerID like "myAuthentificationServer" or "fileServer"
 	*@param maxPacketSize sets the maximum UDP packet size. More than 65507 is not possible.
+	*@param receiveBufferSize SO_RCVBUF in bytes. 0 keeps the OS default. On Linux the kernel caps it at net.core.rmem_max.
+	*@param sendBufferSize SO_SNDBUF in bytes. 0 keeps the OS default. On Linux the kernel caps it at net.core.wmem_max.
+	*@param receiveThreads Linux only. Opens this many sockets on the same port (SO_REUSEPORT), each with its own receive thread. Clients stay on the thread that received their first datagram.
 	*/
 	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP", meta = (AdvancedDisplay = 7))
-		void startUDPServer(FString& serverID, FString IP = FString("0.0.0.0"), int32 port = 8888, bool multicast = false, EReceiveFilterServer receiveFilter = EReceiveFilterServer::E_SAB, FString customServerID = FString(""), int32 maxPacketSize = 65507);
+		void startUDPServer(FString& serverID, FString IP = FString("0.0.0.0"), int32 port = 8888, bool multicast = false, EReceiveFilterServer receiveFilter = EReceiveFilterServer::E_SAB, FString customServerID = FString(""), int32 maxPacketSize = 65507, int32 receiveThreads = 1, int32 receiveBufferSize = 0, int32 sendBufferSize = 0);
 
 	/**
 	*Stop UDP Server
@@ -131,6 +155,26 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP", meta = (AutoCreateRefTerm = "byteArray"))
 		void socketServerSendUDPMessageToClient(FString clientSessionID, FString message, TArray<uint8> byteArray, bool addLineBreak, bool asynchronous, ESocketServerUDPSocketType socketType, FString optionalServerID);
 
+	/**
+	*Sends data asynchronously through one of the priority lanes of the send queue. Control and Interactive messages overtake queued Bulk data.
+	*Messages sent without priority use the Interactive lane.
+	*@param priority Control for small latency critical messages, Bulk for frame data that may be dropped when it is too old.
+	*@param optionalServerID With one server the field can remain empty. If there are several servers, the ServerID should be entered here or the newest server is automatically taken.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP", meta = (AutoCreateRefTerm = "byteArray"))
+		void socketServerSendUDPMessageWithPriority(TArray<FString> clientSessionIDs, FString message, TArray<uint8> byteArray, bool addLineBreak, ESocketServerUDPSendPriority priority, ESocketServerUDPSocketType socketType, FString optionalServerID);
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP", meta = (AutoCreateRefTerm = "byteArray"))
+		void socketServerSendUDPMessageToClientWithPriority(FString clientSessionID, FString message, TArray<uint8> byteArray, bool addLineBreak, ESocketServerUDPSendPriority priority, ESocketServerUDPSocketType socketType, FString optionalServerID);
+
+	/**
+	*How the asynchronous send thread picks between the priority lanes.
+	*@param scheduling Strict always serves the highest non empty lane. Weighted serves Control, Interactive and Bulk 8:4:1 so Bulk keeps moving under load.
+	*@param bulkDeadlineMilliseconds Bulk messages that waited longer are dropped instead of sent. 0 disables the deadline.
+	*@param optionalServerID With one server the field can remain empty. If there are several servers, the ServerID should be entered here or the newest server is automatically taken.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP")
+		void setUDPSendScheduling(ESocketServerUDPSendScheduling scheduling, float bulkDeadlineMilliseconds, FString optionalServerID);
+
 	/**
 	*If you want to send data directly to a specific destination without getting data back.
 	*@param ip
@@ -143,11 +187,57 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP", meta = (AutoCreateRefTerm = "byteArray"))
 		void socketServerSendUDPMessageTo(FString ip, int32 port, FString message, TArray<uint8> byteArray, bool addLineBreak, bool asynchronous, FString optionalServerID);
 
+	/**
+	*Time between queuing an asynchronous UDP message and handing it to the socket.
+	*@param p50Milliseconds median latency
+	*@param p99Milliseconds 99th percentile latency
+	*@param optionalServerID With one server the field can remain empty. If there are several servers, the ServerID should be entered here or the newest server is automatically taken.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP")
+		void getUDPSendLatency(float& p50Milliseconds, float& p99Milliseconds, FString optionalServerID);
+
+	/**
+	*Like getUDPSendLatency, for a single priority lane.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP")
+		void getUDPSendLatencyByPriority(ESocketServerUDPSendPriority priority, float& p50Milliseconds, float& p99Milliseconds, FString optionalServerID);
+
+	/**
+	*Traffic and drop counters of a UDP server. kernelReceiveDrops counts datagrams the OS threw away because the receive buffer was full (Linux only).
+	*Send errors count datagrams the OS rejected before they reached the network.
+	*@param optionalServerID With one server the field can remain empty. If there are several servers, the ServerID should be entered here or the newest server is automatically taken.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP")
+		void getUDPServerStats(FSocketServerUDPStats& stats, FString optionalServerID);
+
+	/**
+	*With batched delivery all datagrams received since the last game thread tick arrive in one onserverReceiveUDPMessageBatchEvent
+	*instead of one onserverReceiveUDPMessageEvent per datagram. Registered client events still fire per datagram.
+	*@param optionalServerID With one server the field can remain empty. If there are several servers, the ServerID should be entered here or the newest server is automatically taken.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP")
+		void setUDPBatchedDelivery(bool batchedDelivery, FString optionalServerID);
+
+	/**
+	*Messages larger than maxPacketSize are split into datagrams with a small header (message id, index, count) and put back together
+	*on the receiving side, in any order. Both sides need this enabled. Unfinished messages are dropped after the timeout or when the memory limit is reached.
+	*@param reassemblyMemoryLimitMB Limit for unfinished messages per receive thread.
+	*@param optionalServerID With one server the field can remain empty. If there are several servers, the ServerID should be entered here or the newest server is automatically taken.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|UDP")
+		void setUDPFragmentation(bool fragmentLargeMessages, FString optionalServerID, float reassemblyTimeoutSeconds = 5.f, int32 reassemblyMemoryLimitMB = 64);
+
+	/**
+	*C++ only. The handler is called on the receive thread for every datagram before anything is copied.
+	*Pass nullptr to remove it. The server only holds a weak reference: once the last shared pointer of the caller is gone the handler is no longer called.
+	*/
+	void setUDPDatagramHandler(TWeakPtr<class ISocketServerUDPDatagramHandler, ESPMode::ThreadSafe> handler, FString optionalServerID);
+
 	
 
 	//TCP
 
-	void startTCPServerInternal(FString& serverID, FString IP, int32 port, EReceiveFilterServer receiveFilter, FString customServerID, bool isFileServer, FString Aes256bitKey, bool resumeFiles);
+	void startTCPServerInternal(FString& serverID, FString IP, int32 port, EReceiveFilterServer receiveFilter, FString customServerID, bool isFileServer, FString Aes256bitKey, bool resumeFiles, int32 ioThreads = 0, bool preallocateFiles = false);
 
 	/**
 	* Start TCP Server
@@ -155,9 +245,10 @@ public:
 	* @param port port to listen
 	* @param receiveFilter This allows you to decide which data type you want to receive. If you receive files it makes no sense to convert them into a string.
 	* @param customServerID Optionally you can assign your own ServerID like "myAuthentificationServer" or "fileServer"
+	* @param ioThreads Linux only. All clients are served by this many epoll threads instead of two threads per client. 0 = two threads per client.
 	*/
 	UFUNCTION(BlueprintCallable, Category = "SocketServer|TCP")
-		void startTCPServer(FString& serverID, FString IP = FString("0.0.0.0"), int32 port = 8888, EReceiveFilterServer receiveFilter = EReceiveFilterServer::E_SAB, FString customServerID = FString(""));
+		void startTCPServer(FString& serverID, FString IP = FString("0.0.0.0"), int32 port = 8888, EReceiveFilterServer receiveFilter = EReceiveFilterServer::E_SAB, FString customServerID = FString(""), int32 ioThreads = 0);
 
 
 	/**
@@ -167,9 +258,10 @@ public:
 	* @param receiveFilter This allows you to decide which data type you want to receive. If you receive files it makes no sense to convert them into a string.
 	* @param customServerID Optionally you can assign your own ServerID like "myAuthentificationServer" or "fileServer"
 	* @param Aes256bitKey The AES key must consist of 32 ASCII characters. The communication between client and server is encrypted via AES in 256bit. Therefore a key must be entered.
+	* @param preallocateFiles Reserves the disk space for the announced file size when an upload starts. Avoids fragmentation and fails early if the disk is full (Linux only).
 	*/
 	UFUNCTION(BlueprintCallable, Category = "SocketServer|TCP")
-		void startTCPFileServer(FString& serverID, FString IP = FString("0.0.0.0"), int32 port = 8899, FString customServerID = FString(""), FString Aes256bitKey = FString(""), bool resumeFiles = false);
+		void startTCPFileServer(FString& serverID, FString IP = FString("0.0.0.0"), int32 port = 8899, FString customServerID = FString(""), FString Aes256bitKey = FString(""), bool resumeFiles = false, bool preallocateFiles = false);
 
 	/**
 	* Tokens are used to determine what can be uploaded or downloaded and how. It can be used to specify a directory in which a file is stored or to specify a file that can be sent to a client.
@@ -241,6 +333,14 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "SocketServer|TCP")
 		void activateTCPMessageAndBytesWrappingOnServerPlugin();
 
+	/**
+	* Use before a connection has been established. With message wrapping a client could announce a message of up to 2 GB and the server would buffer it.
+	* A larger declared length (byte wrapping) or a longer message without footer (string wrapping) closes the connection.
+	*@param maxMessageSizeInBytes Largest message the server accepts. Default 64 MB.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer|TCP")
+		void setTCPMaxMessageSizeOnServerPlugin(int32 maxMessageSizeInBytes = 67108864);
+
 	/**
 	* Use before a connection has been established!
 	*/
@@ -264,14 +364,26 @@ public:
 		static FString generateUniqueID();
 
 	/**
-	*Resolve Domain. Only Domains. Hostnames do not work.
+	*Resolve Domain. Only Domains. Hostnames do not work. All addresses (IPv4 and IPv6) can be read with getIPs.
 	*@param domain
-	*@param useDNSCache Domain and IP are stored in RAM. Starting from the second time the IP is taken from the RAM.
-	*@param dnsIP
+	*@param useDNSCache Domain and IPs are stored in RAM as long as the DNS server allows (TTL). Domains that do not exist are stored as well.
+	*@param dnsIP IP of the DNS server with an optional port like 127.0.0.1:5353 or [::1]:5353
 	*/
 	UFUNCTION(BlueprintCallable, Category = "SocketServer")
 		UDNSClientSocketServer* resolveDomain(FString domain, bool useDNSCache = true, FString dnsIP = FString("8.8.8.8"));
 
+	/**
+	*Settings for resolveDomain.
+	*@param timeoutInSeconds How long to wait for the DNS server before the query is sent again.
+	*@param retries How often a query is sent again.
+	*@param negativeCacheTimeInSeconds Maximum time a domain that does not exist is stored in the DNS cache.
+	*/
+	UFUNCTION(BlueprintCallable, Category = "SocketServer")
+		static void setDNSResolverOptions(float timeoutInSeconds = 2, int32 retries = 2, int32 negativeCacheTimeInSeconds = 30);
+
+	UFUNCTION(BlueprintCallable, Category = "SocketServer")
+		static void clearDNSCache();
+
 
 	/**
 	*UE4 uses different socket connections. When Steam is active, Steam Sockets are used for all connections. This leads to problems if you want to use Steam but not Steam Sockets. Therefore you can change the sockets.
@@ -397,6 +509,7 @@ public:
 	//void setTCPServerRun(bool run);
 
 	void getTcpWrapping(FString& header, FString& footer, ESocketServerTCPMessageWrapping& wrapping);
+	int32 getTcpMaxMessageSize();
 
 	TMap<FString, USocketServerPluginTCPServer*> getTcpServerMap();
 
@@ -418,6 +531,7 @@ private:
 	FString tcpMessageHeader = "([{UE4-Head}])";
 	FString tcpMessageFooter = "([{UE4-Foot}])";
 	ESocketServerTCPMessageWrapping messageWrapping = ESocketServerTCPMessageWrapping::E_None;
+	int32 tcpMaxMessageSize = 64 * 1024 * 1024;
 
 
 	
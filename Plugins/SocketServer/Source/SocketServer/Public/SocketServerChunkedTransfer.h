@@ -0,0 +1,88 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+#include "HAL/CriticalSection.h"
+
+/*
+* A file that is uploaded in fixed size chunks over several connections at the same time.
+* Every chunk comes with a CityHash64 of its data and is only written if the hash matches, so the client
+* repeats just the broken chunk. Which chunks are complete is kept in a sidecar file (<file>.chunks)
+* and an interrupted upload continues with the missing chunks. Thread safe, shared by all connections of the upload.
+*/
+class SOCKETSERVER_API FSocketServerChunkedTransfer {
+
+public:
+
+	static const int32 minChunkSize = 64 * 1024;
+	static const int32 maxChunkSize = 64 * 1024 * 1024;
+	//keeps the bitmap at 2 MB, 1 TB with the smallest chunks
+	static const int32 maxChunkCount = 16 * 1024 * 1024;
+	//unfinished uploads nobody wrote to for this long are closed, the sidecar stays for a later resume
+	static constexpr double idleTimeoutInSeconds = 300.0;
+
+	//false for file sizes the client can't mean, checked before a transfer is created
+	static bool isValidSize(int64 fileSizeP, int32 chunkSizeP);
+
+	FSocketServerChunkedTransfer(FString filePathP, int64 fileSizeP, int32 chunkSizeP);
+	~FSocketServerChunkedTransfer();
+
+	//creates or reopens the file and loads the sidecar if it belongs to the same file size and chunk size
+	bool open();
+
+	int32 getChunkCount() const {
+		return chunkCount;
+	}
+	int32 getChunkSize() const {
+		return chunkSize;
+	}
+	int64 getChunkLength(int32 index) const;
+	int64 getFileSize() const {
+		return fileSize;
+	}
+	int64 getReceivedBytes();
+
+	//one hex digit per 4 chunks, bit set = chunk still missing. lowest bit of the first digit is chunk 0
+	FString getMissingChunks();
+	bool isComplete();
+	//false if the index, size or hash is wrong or the file can't be written
+	bool writeChunk(int32 index, const uint8* data, int32 dataSize, uint64 hash);
+	//closes the file and deletes the sidecar
+	void finish();
+
+	FString getFilePath() const {
+		return filePath;
+	}
+	double getIdleSeconds();
+
+	static uint64 hashChunk(const uint8* data, int32 dataSize);
+	static FString hashToString(uint64 hash);
+	static bool hashFromString(const FString& text, uint64& hash);
+
+private:
+
+	//writes the whole sidecar, only when the upload starts
+	bool createState();
+	//marks the bitmap byte of one chunk, the sidecar is written at most once per second
+	void saveState(int32 index);
+	//flushes the file first and then writes the marked bitmap bytes, so the sidecar never names a chunk that is not on disk
+	void writeState();
+
+	FString filePath;
+	FString statePath;
+	int64 fileSize = 0;
+	int32 chunkSize = 0;
+	int32 chunkCount = 0;
+
+	FCriticalSection lock;
+	IFileHandle* fileHandle = nullptr;
+	IFileHandle* stateHandle = nullptr;
+	double lastWrite = 0;
+	double lastFlush = 0;
+	TBitArray<> received;
+	int32 receivedCount = 0;
+	//bitmap bytes that changed since the last writeState
+	TSet<int32> dirtyStateBytes;
+};
+
+typedef TSharedPtr<FSocketServerChunkedTransfer, ESPMode::ThreadSafe> FSocketServerChunkedTransferPtr;
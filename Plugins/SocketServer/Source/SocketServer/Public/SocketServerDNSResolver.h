@@ -0,0 +1,43 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+
+//an empty array means the domain could not be resolved
+typedef TFunction<void(const TArray<FString>& ips)> FSocketServerDNSCallback;
+
+/*
+* Resolver shared by all UDNSClientSocketServer objects. Every lookup asks for A and AAAA records at once.
+* Answers stay in the cache as long as their TTL allows. Names without addresses are cached for the negative TTL of their zone.
+* A lookup for a name that is already being resolved waits for that query instead of sending another one.
+*/
+class SOCKETSERVER_API FSocketServerDNSResolver {
+
+public:
+
+	static FSocketServerDNSResolver& get();
+
+	//dnsServer is an ip with an optional port: "8.8.8.8", "127.0.0.1:5353" or "[::1]:5353"
+	//the callback runs in the caller for cached names, otherwise on the thread of the query
+	void resolve(ISocketSubsystem* socketSubSystem, const FString& domain, const FString& dnsServer, bool useCache, FSocketServerDNSCallback callback);
+	void configure(float timeoutInSecondsP, int32 retriesP, int32 negativeCacheTimeInSecondsP);
+	void clearCache();
+
+	//called by the query task. ttl 0 means the answer is not cached
+	void finishQuery(const FString& key, const TArray<FString>& ips, uint32 ttl);
+
+private:
+
+	struct FCacheEntry {
+		TArray<FString> ips;
+		double expires = 0;
+	};
+
+	FCriticalSection resolverLock;
+	TMap<FString, FCacheEntry> cache;
+	TMap<FString, TArray<FSocketServerDNSCallback>> inFlight;
+
+	float timeoutInSeconds = 2;
+	int32 retries = 2;
+	int32 negativeCacheTimeInSeconds = 30;
+};
@@ -0,0 +1,45 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+
+enum class ESocketServerFileHashAlgorithm : uint8 {
+	E_MD5 = 0,
+	E_CRC32 = 1
+};
+
+/*
+* Hash of a file that is updated block by block while the file is received, so the finished file does not have
+* to be read again. The state can be saved next to the file to continue the hash when the upload is resumed.
+*/
+class SOCKETSERVER_API FSocketServerFileHash {
+
+public:
+
+	//the client selects the algorithm with a prefix. "crc32:1a2b3c4d" is CRC32, a plain hex string is MD5 like before
+	static void parseClientHash(const FString& clientHash, ESocketServerFileHashAlgorithm& algorithm, FString& hash);
+
+	void reset(ESocketServerFileHashAlgorithm algorithmP);
+	void update(const uint8* data, int64 dataSize);
+	//lower case hex, same format as getMD5FromFile
+	FString finish();
+
+	int64 getBytes() const {
+		return bytes;
+	}
+
+	//continues with the saved state if it belongs to exactly the first fileSize bytes, otherwise hashes that part of the file again
+	bool resume(const FString& filePath, int64 fileSize);
+	//call after the written data was flushed
+	void saveState(const FString& filePath);
+	static void deleteState(const FString& filePath);
+
+private:
+
+	static FString getStatePath(const FString& filePath);
+
+	ESocketServerFileHashAlgorithm algorithm = ESocketServerFileHashAlgorithm::E_MD5;
+	FMD5 md5;
+	uint32 crc = 0;
+	int64 bytes = 0;
+};
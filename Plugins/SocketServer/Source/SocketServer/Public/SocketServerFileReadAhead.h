@@ -0,0 +1,55 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+#include <atomic>
+
+/*
+* Reads a file ahead into a fixed ring of pooled buffers. Every buffer is a credit: the reader only continues
+* while a buffer is free and the consumer gives it back with release() when it is done with the bytes.
+* This way reading follows the speed of the consumer without sleeping and memory never grows beyond bufferCount * bufferSize.
+* On Linux the file is read with pread() and the kernel is asked to fetch the next window ahead.
+*/
+class SOCKETSERVER_API FSocketServerFileReadAhead {
+
+public:
+
+	FSocketServerFileReadAhead(FString filePathP, int32 bufferSizeP, int32 bufferCountP);
+	~FSocketServerFileReadAhead();
+
+	//false if the file can't be opened or is empty
+	bool open(int64& fileSize);
+	void close();
+
+	//waits until a buffer is free. returns INDEX_NONE after cancel()
+	int32 acquire();
+	//reads the next part of the file into an acquired buffer and hands it to the consumer. returns the read bytes or -1
+	int32 read(int32 index);
+	//the buffer belongs to the consumer until it is released
+	const TArray<uint8>& getBuffer(int32 index) const;
+	void release(int32 index);
+	//releases the oldest buffer the consumer still holds. false if it holds none
+	bool releaseOldest();
+	//wakes up a waiting acquire()
+	void cancel();
+
+private:
+
+	int64 readFromFile(uint8* data, int64 bytes);
+
+	FString filePath;
+	int32 bufferSize = 0;
+	int64 size = 0;
+	int64 position = 0;
+
+	TArray<TArray<uint8>> buffers;
+	TArray<int32> freeBuffers;
+	//in the order in which they were handed to the consumer
+	TArray<int32> deliveredBuffers;
+	FCriticalSection poolLock;
+	FEvent* bufferReleased = nullptr;
+	std::atomic<bool> canceled{ false };
+
+	int fileHandle = -1;
+	IFileHandle* reader = nullptr;
+};
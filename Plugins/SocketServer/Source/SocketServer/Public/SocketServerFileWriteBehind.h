@@ -0,0 +1,56 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+#include <atomic>
+
+/*
+* Write-behind for received files. The receive thread copies the data into 1 MB blocks, full blocks are written
+* by an own thread. A slow disk only slows down the socket when all blocks are waiting to be written.
+* On Linux the blocks are written with pwrite() and the file can be preallocated with fallocate().
+*/
+class SOCKETSERVER_API FSocketServerFileWriteBehind : public FRunnable {
+
+public:
+
+	static const int32 blockSize = 1024 * 1024;
+	static const int32 blockCount = 8;
+
+	FSocketServerFileWriteBehind(FString filePathP);
+	~FSocketServerFileWriteBehind();
+
+	//append continues an existing file. preallocateSize > 0 reserves the disk space of the whole file without changing its size
+	bool open(bool append, int64 preallocateSize, int64& existingSize);
+	//waits only if all blocks are queued. false after a write error
+	bool write(const uint8* data, int32 dataSize);
+	//hands over the current block and waits until everything is written
+	bool flush();
+	//flush and close the file. false if something could not be written
+	bool close();
+
+	virtual uint32 Run() override;
+
+private:
+
+	void submitCurrentBlock();
+	bool writeToFile(const uint8* data, int32 dataSize);
+	void closeFile();
+
+	FString filePath;
+	int64 writePosition = 0;
+
+	TArray<TArray<uint8>> blocks;
+	TArray<int32> freeBlocks;
+	TArray<int32> queuedBlocks;
+	int32 currentBlock = INDEX_NONE;
+	FCriticalSection blockLock;
+	FEvent* blockQueued = nullptr;
+	FEvent* blockWritten = nullptr;
+	std::atomic<bool> failed{ false };
+	bool stopping = false;
+
+	FRunnableThread* thread = nullptr;
+
+	int fileHandle = -1;
+	IFileHandle* writer = nullptr;
+};
@@ -2,12 +2,19 @@
 #pragma once
 
 #include "SocketServer.h"
+#include "SocketServerTCPMessageParser.h"
+#include "SocketServerTCPSendQueue.h"
+#include "SocketServerTCPFileSender.h"
+#include "SocketServerChunkedTransfer.h"
+#include "SocketServerFileHash.h"
+#include "SocketServerFileWriteBehind.h"
 #include "SocketServerPluginTCPServer.generated.h"
 
 
 class USocketServerBPLibrary;
 class FServerTCPThread;
 class FTCPFileHandlerThread;
+class FSocketServerTCPEventLoop;
 
 UCLASS(Blueprintable, BlueprintType)
 class SOCKETSERVER_API USocketServerPluginTCPServer : public UObject
@@ -16,7 +23,7 @@ class SOCKETSERVER_API USocketServerPluginTCPServer : public UObject
 
 public:
 
-	void startTCPServer(IpAndPortStruct ipStructP,FString IP, int32 port, EReceiveFilterServer receiveFilter, FString serverID, bool isFileServer, FString Aes256bitKey, bool resumeFiles);
+	void startTCPServer(IpAndPortStruct ipStructP,FString IP, int32 port, EReceiveFilterServer receiveFilter, FString serverID, bool isFileServer, FString Aes256bitKey, bool resumeFiles, int32 ioThreads = 0, bool preallocateFiles = false);
 	void stopTCPServer();
 	void sendTCPMessage(TArray<FString> clientSessionIDs, FString message, TArray<uint8> byteArray, bool addLineBreak);
 	void sendTCPMessageToClient(FString clientSessionID, FString message, TArray<uint8> byteArray, bool addLineBreak);
@@ -26,6 +33,7 @@ public:
 	int32 getPort();
 	FString getServerID();
 	bool hasResume();
+	bool hasPreallocation();
 
 	void initTCPClientThreads(FClientSocketSession session, EReceiveFilterServer receiveFilter);
 
@@ -43,12 +51,22 @@ public:
 	void removeTokenFromStruct(FString token);
 	FString getCleanDir(EFileFunctionsSocketServerDirectoryType directoryType, FString fileDirectory);
 	void getMD5FromFile(FString filePathP, bool& success, FString& MD5);
+
+	//chunked uploads are shared by all connections that send parts of the same file
+	FSocketServerChunkedTransferPtr openChunkedTransfer(FString token, FString filePath, int64 fileSize, int32 chunkSize);
+	FSocketServerChunkedTransferPtr getChunkedTransfer(FString token);
+	//true if this call removed it
+	bool removeChunkedTransfer(FString token);
 	void deleteFile(FString filePathP);
 	int64 fileSize(FString filePathP);
 	FString int64ToString(int64 num);
 
 	bool isRun();
 
+	//hands the listener to the epoll backend. false = accept and serve clients with threads per connection
+	bool startEventLoop(FSocket* listenerSocket);
+	void stopEventLoop();
+
 private:
 	bool run = true;
 	FString serverID = FString();
@@ -59,12 +77,25 @@ private:
 	bool fileServer = false;
 	FString aesKey = FString();
 	bool resumeFiles = false;
+	bool preallocateFiles = false;
 	//FString downloadDir;
 
 	FServerTCPThread* serverThread = nullptr;
 	FTCPFileHandlerThread* TCPFileHandlerThread = nullptr;
+	//number of io threads of the event loop, 0 = two threads per connection
+	int32 ioThreads = 0;
+	//written by the server thread, read on the game thread. stopping keeps a late startEventLoop from creating a loop nobody stops
+	FCriticalSection eventLoopLock;
+	FSocketServerTCPEventLoop* eventLoop = nullptr;
+	bool eventLoopStopping = false;
 
 	TMap<FString, FClientSocketSession> clientSessions;
+
+	//called with chunkedTransfersLock held
+	void closeIdleChunkedTransfers();
+
+	FCriticalSection chunkedTransfersLock;
+	TMap<FString, FSocketServerChunkedTransferPtr> chunkedTransfers;
 };
 
 
@@ -145,6 +176,13 @@ public:
 				USocketServerBPLibrary::socketServerBPLibrary->onsocketServerConnectionEventDelegate.Broadcast(EServerSocketConnectionEventType::E_Server, true, "TCP Server started.", TEXT(""), serverID);
 			});
 
+			//clients are accepted and served by the io threads of the event loop. stopTCPServer stops it before this thread
+			if (tcpServer->startEventLoop(listenerSocket)) {
+				while (run) {
+					FPlatformProcess::Sleep(0.1);
+				}
+			}
+
 			while (run) {
 				bool pending;
 				listenerSocket->WaitForPendingConnection(pending, FTimespan::FromSeconds(1));
@@ -162,6 +200,7 @@ public:
 					session.port = remoteAddress.Get().GetPort();
 					session.socket = clientSocket;
 					session.protocol = EServerSocketConnectionProtocol::E_TCP;
+					session.counters = MakeShared<FSocketServerSessionCounters, ESPMode::ThreadSafe>();
 					tcpServer->addClientSession(session);
 					tcpServer->initTCPClientThreads(session, receiveFilter);
 				}
@@ -253,62 +292,35 @@ public:
 			}
 
 
-			int32 sent = 0;
 			if (socket != nullptr && socket->GetConnectionState() == ESocketConnectionState::SCS_Connected) {
 
-				
+				bool byteWrapping = messageWrapping == ESocketServerTCPMessageWrapping::E_Byte;
 
 				while (messageQueue.IsEmpty() == false) {
 					FString m;
 					messageQueue.Dequeue(m);
 					FTCHARToUTF8 Convert(*m);
-					sent = 0;
-
-					if (messageWrapping == ESocketServerTCPMessageWrapping::E_Byte) {
-						TArray<uint8> byteCache;
-						if (FGenericPlatformProperties::IsLittleEndian()) {
-							byteCache.Add(0x00);
-						}
-						else {
-							byteCache.Add(0x01);
-						}
-						byteCache.SetNum(5);
-						int32 dataLength = Convert.Length();
-						FMemory::Memcpy(byteCache.GetData()+1,&dataLength,4);
-						byteCache.Append((uint8*)Convert.Get(), Convert.Length());
-						socket->Send(byteCache.GetData(), byteCache.Num(), sent);
-						byteCache.Empty();
-					}
-					else {
-						socket->Send((uint8*)Convert.Get(), Convert.Length(), sent);
-					}
+					TArray<uint8> bytes((const uint8*)Convert.Get(), Convert.Length());
+					sendQueue.add(FSocketServerTCPSendItem(MoveTemp(bytes), byteWrapping));
 				}
 
 				while (byteArrayQueue.IsEmpty() == false) {
 					TArray<uint8> ba;
 					byteArrayQueue.Dequeue(ba);
-					sent = 0;
-					if (messageWrapping == ESocketServerTCPMessageWrapping::E_Byte) {
-						TArray<uint8> byteCache;
-						if (FGenericPlatformProperties::IsLittleEndian()) {
-							byteCache.Add(0x00);
-						}
-						else {
-							byteCache.Add(0x01);
-						}
-						byteCache.SetNum(5);
-						int32 dataLength = ba.Num();
-						FMemory::Memcpy(byteCache.GetData() + 1, &dataLength, 4);
-						byteCache.Append(ba.GetData(), ba.Num());
-						socket->Send(byteCache.GetData(), byteCache.Num(), sent);
+					sendQueue.add(FSocketServerTCPSendItem(MoveTemp(ba), byteWrapping));
+				}
+
+				//all queued messages in as few writes as possible. wait for the socket if its buffer is full
+				while (run && sendQueue.isEmpty() == false) {
+					int64 written = sendQueue.write(socket, session.counters.Get());
+					if (written < 0) {
+						sendQueue.empty(session.counters.Get());
+						break;
 					}
-					else {
-						socket->Send(ba.GetData(), ba.Num(), sent);
+					if (written == 0) {
+						socket->Wait(ESocketWaitConditions::WaitForWrite, FTimespan::FromMilliseconds(100));
 					}
-					ba.Empty();
 				}
-		
-
 			}
 			else {
 				//UE_LOG(LogTemp, Error, TEXT("Connection lost"));
@@ -326,6 +338,7 @@ public:
 			}
 		}
 
+		sendQueue.empty(session.counters.Get());
 		run = false;
 		thread = nullptr;
 
@@ -354,20 +367,26 @@ public:
 
 
 	void setMessage(FString messageP, TArray<uint8> byteArrayP) {
-		if (messageP.Len() > 0)
+		if (messageP.Len() > 0) {
 			messageQueue.Enqueue(messageP);
-		if (byteArrayP.Num() > 0)
+			enqueued();
+		}
+		if (byteArrayP.Num() > 0) {
 			byteArrayQueue.Enqueue(byteArrayP);
+			enqueued();
+		}
 	}
 
 	void sendMessage(FString messageP, TArray<uint8> byteArrayP) {
-		if (messageP.Len() > 0)
-			messageQueue.Enqueue(messageP);
-		if (byteArrayP.Num() > 0)
-			byteArrayQueue.Enqueue(byteArrayP);
+		setMessage(messageP, byteArrayP);
 		pauseThread(false);
 	}
 
+	void enqueued() {
+		if (session.counters.IsValid())
+			session.counters->sendQueueDepth.fetch_add(1, std::memory_order_relaxed);
+	}
+
 
 
 	void pauseThread(bool pause) {
@@ -383,8 +402,10 @@ protected:
 	bool					run = true;
 	bool					paused;
 	bool waitForInit = true;
-	TQueue<FString> messageQueue;
-	TQueue<TArray<uint8>> byteArrayQueue;
+	//filled by the game thread and by the receive thread (RCON responses)
+	TQueue<FString, EQueueMode::Mpsc> messageQueue;
+	TQueue<TArray<uint8>, EQueueMode::Mpsc> byteArrayQueue;
+	FSocketServerTCPSendQueue sendQueue;
 };
 
 
@@ -406,17 +427,13 @@ public:
 		FSocket* clientSocket = session.socket;
 		FString sessionID = session.sessionID;
 
-		//message wrapping
-		FString tcpMessageHeader = FString();
-		FString tcpMessageFooter = FString();
-		ESocketServerTCPMessageWrapping messageWrapping = ESocketServerTCPMessageWrapping::E_None;
-
-		USocketServerBPLibrary::socketServerBPLibrary->getTcpWrapping(tcpMessageHeader, tcpMessageFooter, messageWrapping);
-
-
-		FString tcpMessageFooterLineBreak = tcpMessageFooter + "\r\n";
-		FString tcpMessageFooterLineBreak2 = tcpMessageFooter + "\r";;
-				
+		FSocketServerTCPMessageParser parser(sessionID, serverID, receiveFilter);
+		FTCPClientSendDataToServerThread* sendThread = session.sendThread;
+		parser.setRawWriter([sendThread](TArray<uint8>&& bytes) {
+			if (sendThread != nullptr) {
+				sendThread->sendMessage(FString(), MoveTemp(bytes));
+			}
+		});
 
 		//switch to gamethread
 		AsyncTask(ENamedThreads::GameThread, [sessionID, serverID]() {
@@ -424,17 +441,11 @@ public:
 		});
 
 		uint32 DataSize = 0;
-		//FArrayReaderPtr Datagram = MakeShareable(new FArrayReader(true));
 		TArray<uint8> dataFromSocket;
 		int64 ticks1;
 		int64 ticks2;
-		TArray<uint8> byteDataArray;
-		TArray<uint8> byteDataArrayCache;
-		FString mainMessage;
-		bool inCollectMessageStatus = false;
 		bool deathConnection = false;
 		bool hasData = false;
-		int32 lastDataLengthFromHeader = 0;
 
 		while (run && clientSocket != nullptr && tcpServer->isRun()) {
 			//ESocketConnectionState::SCS_Connected does not work https://issues.unrealengine.com/issue/UE-27542
@@ -463,132 +474,13 @@ public:
 				dataFromSocket.SetNumUninitialized(DataSize);
 				int32 BytesRead = 0;
 				if (clientSocket->Recv(dataFromSocket.GetData(), dataFromSocket.Num(), BytesRead)) {
-					switch (messageWrapping)
-					{
-					case ESocketServerTCPMessageWrapping::E_None:
-						triggerMessageEvent(dataFromSocket, sessionID, serverID);
-						break;
-					case ESocketServerTCPMessageWrapping::E_String:
-						if (receiveFilter == EReceiveFilterServer::E_SAB || receiveFilter == EReceiveFilterServer::E_S) {
-							dataFromSocket.Add(0x00);// null-terminator
-							char* Data = (char*)dataFromSocket.GetData();
-
-
-							FString recvMessage = FString(UTF8_TO_TCHAR(Data));
-							if (recvMessage.StartsWith(tcpMessageHeader)) {
-								inCollectMessageStatus = true;
-								recvMessage.RemoveFromStart(tcpMessageHeader);
-							}
-							if (recvMessage.EndsWith(tcpMessageFooter) || recvMessage.EndsWith(tcpMessageFooterLineBreak) || recvMessage.EndsWith(tcpMessageFooterLineBreak2)) {
-								inCollectMessageStatus = false;
-								if (!recvMessage.RemoveFromEnd(tcpMessageFooter)) {
-									if (!recvMessage.RemoveFromEnd(tcpMessageFooterLineBreak)) {
-										if (recvMessage.RemoveFromEnd(tcpMessageFooterLineBreak2)) {
-											recvMessage.Append("\r");
-										}
-									}
-									else {
-										recvMessage.Append("\r\n");
-									}
-								}
-
-								//splitt merged messages
-								if (recvMessage.Contains(tcpMessageHeader)) {
-									TArray<FString> lines;
-									int32 lineCount = recvMessage.ParseIntoArray(lines, *tcpMessageHeader, true);
-									for (int32 i = 0; i < lineCount; i++) {
-										mainMessage = lines[i];
-										if (mainMessage.EndsWith(tcpMessageFooter) || mainMessage.EndsWith(tcpMessageFooterLineBreak) || mainMessage.EndsWith(tcpMessageFooterLineBreak2)) {
-											if (!mainMessage.RemoveFromEnd(tcpMessageFooter)) {
-												if (!mainMessage.RemoveFromEnd(tcpMessageFooterLineBreak)) {
-													if (mainMessage.RemoveFromEnd(tcpMessageFooterLineBreak2)) {
-														mainMessage.Append("\r");
-													}
-												}
-												else {
-													mainMessage.Append("\r\n");
-												}
-											}
-										}
-
-										//switch to gamethread
-										AsyncTask(ENamedThreads::GameThread, [mainMessage, sessionID, byteDataArray, serverID]() {
-											//UE_LOG(LogTemp, Display, TEXT("TCP:%s"), *recvMessage);
-											USocketServerBPLibrary::socketServerBPLibrary->onserverReceiveTCPMessageEventDelegate.Broadcast(sessionID, mainMessage, byteDataArray, serverID);
-											if (USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(sessionID) != nullptr) {
-												USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(sessionID)->onregisteredEventDelegate.Broadcast(mainMessage, byteDataArray);
-											}
-											});
-
-										dataFromSocket.Empty();
-										mainMessage.Empty();
-									}
-									continue;
-								}
-								else {
-									mainMessage.Append(recvMessage);
-								}
-
-
-							}
-							if (inCollectMessageStatus) {
-								mainMessage.Append(recvMessage);
-								continue;
-							}
-							if (mainMessage.IsEmpty()) {
-								continue;
-							}
-
-						}
-						break;
-					case ESocketServerTCPMessageWrapping::E_Byte:
-	
-
-						if (lastDataLengthFromHeader == 0 && dataFromSocket.Num() >= 5) {
-
-							readDataLength(dataFromSocket, lastDataLengthFromHeader);
-
-							if (dataFromSocket.Num() == 5) {
-								dataFromSocket.Empty();
-								continue;
-							}
-
-							byteDataArrayCache.Append(dataFromSocket.GetData() + 5, dataFromSocket.Num() - 5);
-							dataFromSocket.Empty();
-						}
-						else {
-							byteDataArrayCache.Append(dataFromSocket.GetData(), dataFromSocket.Num());
-						}
-
-						int32 maxLoops = 1000;//to prevent endless loop
-
-						while (byteDataArrayCache.Num() > 0 && byteDataArrayCache.Num() >= lastDataLengthFromHeader && maxLoops > 0) {
-							maxLoops--;
-
-							byteDataArray.Append(byteDataArrayCache.GetData(), lastDataLengthFromHeader);
-							byteDataArrayCache.RemoveAt(0, lastDataLengthFromHeader, true);
-
-
-							triggerMessageEvent(byteDataArray, sessionID, serverID);
-							//UE_LOG(LogTemp, Display, TEXT("%s"), *mainMessage);
-							byteDataArray.Empty();
-
-							if (byteDataArrayCache.Num() == 0) {
-								lastDataLengthFromHeader = 0;
-								break;
-							}
-
-							if (byteDataArrayCache.Num() > 5) {
-								readDataLength(byteDataArrayCache, lastDataLengthFromHeader);
-								byteDataArrayCache.RemoveAt(0, 5, true);
-							}
-
-						}
+					if (session.counters.IsValid())
+						session.counters->received(BytesRead);
+					if (!parser.receive(dataFromSocket.GetData(), BytesRead)) {
 						break;
 					}
 				}
-				dataFromSocket.Empty();
-				mainMessage.Empty();
+				dataFromSocket.Reset();
 			}
 		}
 			
@@ -624,46 +516,6 @@ public:
 		return 0;
 	}
 
-	void triggerMessageEvent(TArray<uint8>& byteDataArray, FString& sessionID, FString& serverID) {
-		//if (receiveFilter == EReceiveFilterServer::E_SAB || receiveFilter == EReceiveFilterServer::E_B) {
-		//	byteDataArray.Append(dataFromSocket.GetData(), dataFromSocket.Num());
-		//}
-
-		FString mainMessage = FString();
-		if (receiveFilter == EReceiveFilterServer::E_SAB || receiveFilter == EReceiveFilterServer::E_S) {
-			byteDataArray.Add(0x00);// null-terminator
-			char* Data = (char*)byteDataArray.GetData();
-			mainMessage = FString(UTF8_TO_TCHAR(Data));
-			if (receiveFilter == EReceiveFilterServer::E_S) {
-				byteDataArray.Empty();
-			}
-		}
-
-
-
-		//switch to gamethread
-		AsyncTask(ENamedThreads::GameThread, [mainMessage, sessionID, byteDataArray, serverID]() {
-			//UE_LOG(LogTemp, Display, TEXT("TCP:%s"), *recvMessage);
-			USocketServerBPLibrary::socketServerBPLibrary->onserverReceiveTCPMessageEventDelegate.Broadcast(sessionID, mainMessage, byteDataArray, serverID);
-			if (USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(sessionID) != nullptr) {
-				USocketServerBPLibrary::socketServerBPLibrary->getResiteredClientEvent(sessionID)->onregisteredEventDelegate.Broadcast(mainMessage, byteDataArray);
-			}
-		});
-		mainMessage.Empty();
-	}
-
-	void readDataLength(TArray<uint8>& byteDataArray, int32& byteLenght) {
-		if (FGenericPlatformProperties::IsLittleEndian() && byteDataArray[0] == 0x00) {
-			FMemory::Memcpy(&byteLenght, byteDataArray.GetData() + 1, 4);
-		}
-		else {
-			//endian fits not. swap bytes that contains the length
-			byteDataArray.SwapMemory(1, 4);
-			byteDataArray.SwapMemory(2, 3);
-			FMemory::Memcpy(&byteLenght, byteDataArray.GetData() + 1, 4);
-		}
-	}
-
 	void stopThread() {
 		run = false;
 	}
@@ -702,55 +554,40 @@ public:
 			return 0;
 		}
 
-		FArchive* reader = IFileManager::Get().CreateFileReader(*filePath);
-		if (reader == nullptr || reader->TotalSize() == 0) {
-			if (reader != nullptr) {
-				reader->Close();
-			}
-			delete reader;
-			return false;
-		}
+		FString sessionID = session.sessionID;
 
+		//the client was told the size in REQUEST_FILE_FROM_SERVER_ACCEPTED and expects exactly that many bytes
+		FSocketServerTCPFileSender sender(socket, filePath);
+		int64 openedFileSize = 0;
+		if (!sender.open(openedFileSize) || openedFileSize != fileSize) {
+			triggerFileTransferOverTCPInfoEvent(openedFileSize > 0 ? "File has changed since its size was sent to the client." : "Error while sending the file.", sessionID, filePath, false);
+			run = false;
+			thread = nullptr;
+			return 0;
+		}
 
-		FString sessionID = session.sessionID;
-		fileSize = reader->TotalSize();
-		int64 readSize = 0;
 		int64 lastPosition = startPosition;
 		int64 bytesSentSinceLastTick = 0;
 
-		int32 bufferSize = 1024 * 64;
-		int32 dataSendBySocket = 0;
+		//upper limit per send call, keeps the progress events and stopThread responsive
+		int64 blockSize = 1024 * 1024 * 16;
 
 		float percent = 0.f;
 		float mbit = 0.f;
 
-		TArray<uint8> buffer;
-
 		int64 lastTimeTicks = FDateTime::Now().GetTicks();
 
-		if (bufferSize > fileSize) {
-			bufferSize = fileSize;
-		}
-
-		if (lastPosition > 0) {
-			reader->Seek(lastPosition);
-		}
-
 		while (run && lastPosition < fileSize) {
 
-			if ((lastPosition + bufferSize) > fileSize) {
-				bufferSize = fileSize - lastPosition;
+			int64 sent = sender.send(lastPosition, blockSize);
+			if (sent < 0) {
+				break;
 			}
-
-			//buffer.Reset(bufferSize);
-			buffer.Empty();
-			buffer.AddUninitialized(bufferSize);
-
-			reader->Serialize(buffer.GetData(), buffer.Num());
-			lastPosition += buffer.Num();
-
-			//socket->Send((uint8*)((ANSICHAR*)Convert.Get()), Convert.Length(), dataSendBySocket);
-			socket->Send(buffer.GetData(), buffer.Num(), dataSendBySocket);
+			if (sent == 0) {
+				socket->Wait(ESocketWaitConditions::WaitForWrite, FTimespan::FromMilliseconds(100));
+				continue;
+			}
+			lastPosition += sent;
 
 			//slowdown for tests
 			//FPlatformProcess::Sleep(0.01f);
@@ -779,12 +616,6 @@ public:
 			triggerFileTransferOverTCPInfoEvent("Error while sending the file.", sessionID, filePath, false);
 		}
 
-		buffer.Empty();
-		if (reader != nullptr) {
-			reader->Close();
-			reader = nullptr;
-		}
-
 		run = false;
 		thread = nullptr;
 
@@ -850,7 +681,7 @@ public:
 		int64 ticksDownload = FDateTime::Now().GetTicks();
 		int64 lastByte = 0;
 		int64 bytesDownloaded = 0;
-		FArchive* writer = nullptr;
+		FSocketServerFileWriteBehind* writer = nullptr;
 		uint32 DataSize;
 		FArrayReaderPtr Datagram = MakeShareable(new FArrayReader(true));
 		int64 ticks1;
@@ -897,12 +728,19 @@ public:
 						TArray<FString> lines;
 						recvMessage.ParseIntoArray(lines, TEXT("_|_"), true);
 
+						//chunked transfers over several connections
+						if (lines.Num() > 0 && lines[0].Contains("CHUNK")) {
+							if (!handleChunkCommand(lines, clientSocket, sessionID, fullFilePath)) {
+								run = false;
+							}
+							break;
+						}
 
 						if (lines.Num() == 5) {
 							//client send data to this server
 							if (lines[0].Equals("SEND_FILE_TO_SERVER") && lines[1].Len() > 0 && lines[2].Len() > 0 && lines[3].Len() > 0 && lines[4].Len() > 0) {
 								
-								md5Client = lines[2];
+								FSocketServerFileHash::parseClientHash(lines[2], hashAlgorithm, md5Client);
 
 								token = lines[1];
 								struct FSocketServerToken tokenStruct = tcpServer->getTokenStruct(token);
@@ -961,27 +799,14 @@ public:
 									}
 								}*/
 
-								if (tcpServer->hasResume()) {
-									writer = IFileManager::Get().CreateFileWriter(*fullFilePath, EFileWrite::FILEWRITE_Append);
-								}
-								else {
-									writer = IFileManager::Get().CreateFileWriter(*fullFilePath);
-								}
-								
-								
-							
-								
-
-								if (!writer) {
+								//blocks are written by an own thread, a slow disk does not hold up the socket
+								writer = new FSocketServerFileWriteBehind(fullFilePath);
+								if (!writer->open(tcpServer->hasResume(), tcpServer->hasPreallocation() ? fileSize : 0, bytesDownloaded)) {
 									triggerFileTransferOverTCPInfoEvent("Can't create file.", sessionID, fullFilePath, false);
 									run = false;
 									break;
 								}
 
-								
-								
-								bytesDownloaded = writer->TotalSize();
-
 
 								if (bytesDownloaded > fileSize) {
 									triggerFileTransferOverTCPInfoEvent("File on server bigger than on client. Cancel.", sessionID, fullFilePath, false);
@@ -989,9 +814,16 @@ public:
 									break;
 								}
 
+								//the hash follows the received blocks. a resumed upload continues with the saved state
+								uploadHash.reset(hashAlgorithm);
+								if (!uploadHash.resume(fullFilePath, bytesDownloaded)) {
+									triggerFileTransferOverTCPInfoEvent("Can't read the already received part of the file.", sessionID, fullFilePath, false);
+									run = false;
+									break;
+								}
+
 								if (bytesDownloaded == fileSize) {
-									writer->Close();
-									FPlatformProcess::Sleep(1);
+									writer->close();
 									sendEndMessage(fullFilePath, token, md5Client, sessionID, clientSocket);
 									run = false;
 									break;
@@ -1044,7 +876,9 @@ public:
 									FString md5Server = FString();
 									tcpServer->getMD5FromFile(fullFilePath, md5okay, md5Server);
 
-									FString response = "REQUEST_FILE_FROM_SERVER_ACCEPTED_|_" + token + "_|_" + md5Server + "_|_" + tcpServer->int64ToString(tcpServer->fileSize(fullFilePath)) + "_|_" + FPaths::GetCleanFilename(fullFilePath) +"\r\n";
+									//the send thread checks that it streams the size announced here
+									fileSize = tcpServer->fileSize(fullFilePath);
+									FString response = "REQUEST_FILE_FROM_SERVER_ACCEPTED_|_" + token + "_|_" + md5Server + "_|_" + tcpServer->int64ToString(fileSize) + "_|_" + FPaths::GetCleanFilename(fullFilePath) +"\r\n";
 									response = tcpServer->encryptMessage(response);
 
 									FTCHARToUTF8 Convert(*response);
@@ -1125,14 +959,21 @@ public:
 				case 1:
 					//downlnoad
 					bytesRead = 0;
-					Datagram->Empty();
-					Datagram->SetNumUninitialized(DataSize);
+					Datagram->SetNumUninitialized(DataSize, false);
 					if (clientSocket->Recv(Datagram->GetData(), Datagram->Num(), bytesRead)) {
-						writer->Serialize(const_cast<uint8*>(Datagram->GetData()), Datagram->Num());
+						if (!writer->write(Datagram->GetData(), bytesRead)) {
+							triggerFileTransferOverTCPInfoEvent("Can't write file.", sessionID, fullFilePath, false);
+							run = false;
+							break;
+						}
+						uploadHash.update(Datagram->GetData(), bytesRead);
 
 						//show progress each second
 						if ((ticksDownload + 10000000) <= FDateTime::Now().GetTicks()) {
-							writer->Flush();
+							//the saved hash state has to match the bytes on disk
+							if (tcpServer->hasResume() && writer->flush()) {
+								uploadHash.saveState(fullFilePath);
+							}
 							int64 bytesSendLastSecond = bytesDownloaded - lastByte;
 							//float speed = ((float)bytesSendLastSecond) / 125000;
 							float mbit = ((float)bytesSendLastSecond) / 1024 / 1024 * 8;
@@ -1156,17 +997,31 @@ public:
 						//receive file finish
 						triggerFileOverTCPProgress(sessionID, fullFilePath, 100, 0, bytesDownloaded, fileSize);
 
-						if (writer != nullptr) {
-							writer->Close();
+						if (writer != nullptr && !writer->close()) {
+							triggerFileTransferOverTCPInfoEvent("Can't write file.", sessionID, fullFilePath, false);
+							run = false;
+							break;
 						}
 
-						FPlatformProcess::Sleep(1);
 						sendEndMessage(fullFilePath, token, md5Client, sessionID, clientSocket);
 
 						run = false;
 					}
 
 				break;
+				case 2:
+					//one chunk of a chunked upload
+					bytesRead = 0;
+					if (clientSocket->Recv(chunkBuffer.GetData() + chunkReceived, FMath::Min((int32)DataSize, chunkBuffer.Num() - chunkReceived), bytesRead)) {
+						chunkReceived += bytesRead;
+					}
+					if (chunkReceived >= chunkBuffer.Num()) {
+						commandProgress = 0;
+						if (!finishChunk(clientSocket, sessionID)) {
+							run = false;
+						}
+					}
+				break;
 
 				}
 			}
@@ -1191,12 +1046,14 @@ public:
 		}
 
 		if (writer != nullptr) {
-			writer->Close();
+			writer->close();
 			delete writer;
 		}
 
-		FPlatformProcess::Sleep(3);
 		if (clientSocket != nullptr) {
+			//let the last response reach the client. returns as soon as the client closes its side
+			clientSocket->Shutdown(ESocketShutdownMode::Write);
+			clientSocket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(3));
 			clientSocket->Close();
 		
 			ISocketSubsystem* sSS = USocketServerBPLibrary::socketServerBPLibrary->getSocketSubSystem();
@@ -1229,9 +1086,10 @@ public:
 	}
 
 	void sendEndMessage(FString fullFilePathP, FString tokenP, FString md5ClientP, FString sessionIDP, FSocket* clientSocketP) {
-		bool md5okay = false;
-		FString md5Server = FString();
-		tcpServer->getMD5FromFile(fullFilePathP, md5okay, md5Server);
+		//hashed while receiving, the file is not read again
+		bool md5okay = uploadHash.getBytes() == fileSize;
+		FString md5Server = uploadHash.finish();
+		FSocketServerFileHash::deleteState(fullFilePathP);
 
 		FString response = "SEND_FILE_TO_SERVER_END_|_" + tokenP + "_|_";
 
@@ -1256,6 +1114,174 @@ public:
 	}
 
 
+	/*
+	* Chunked transfer commands. Upload:
+	* SEND_FILE_CHUNKED_TO_SERVER_|_token_|_fileName_|_fileSize_|_chunkSize -> _ACCEPTED_|_token_|_chunkSize_|_chunkCount_|_missing chunks (hex bitmap)
+	* SEND_CHUNK_TO_SERVER_|_token_|_index_|_cityHash64_|_size -> _ACCEPTED_|_token_|_index, then the raw chunk -> SEND_CHUNK_TO_SERVER_END_|_token_|_index_|_OKAY or HASHERROR
+	* Any number of connections can send chunks of the same upload at the same time.
+	* Download:
+	* REQUEST_FILE_CHUNKED_FROM_SERVER_|_token_|_chunkSize -> _ACCEPTED_|_token_|_fileSize_|_chunkSize_|_chunkCount_|_fileName
+	* REQUEST_CHUNK_FROM_SERVER_|_token_|_index_|_chunkSize -> _ACCEPTED_|_token_|_index_|_cityHash64_|_size followed by the raw chunk
+	* REQUEST_FILE_CHUNKED_FROM_SERVER_END_|_token_|_OKAY when the client has everything
+	* returns false if the connection should be closed
+	*/
+	bool handleChunkCommand(TArray<FString>& lines, FSocket* clientSocket, FString sessionID, FString& fullFilePath) {
+
+		FString command = lines[0];
+		chunkToken = lines.Num() > 1 ? lines[1] : FString();
+		struct FSocketServerToken tokenStruct = tcpServer->getTokenStruct(chunkToken);
+		if (chunkToken.IsEmpty() || tokenStruct.token.Equals(chunkToken) == false) {
+			triggerFileTransferOverTCPInfoEvent("Token not found.", sessionID, fullFilePath, false);
+			return false;
+		}
+
+		if (command.Equals("SEND_FILE_CHUNKED_TO_SERVER") && lines.Num() == 5) {
+			FString downloadDir = tcpServer->getCleanDir(tokenStruct.directoryType, tokenStruct.fileDirectory);
+			FString fileName = FPaths::GetCleanFilename(lines[2]);
+			fullFilePath = downloadDir.EndsWith("/") ? downloadDir + fileName : downloadDir + "/" + fileName;
+
+			if (FPaths::DirectoryExists(downloadDir) == false) {
+				triggerFileTransferOverTCPInfoEvent("Directory not found.", sessionID, fullFilePath, false);
+				return false;
+			}
+			int64 chunkedFileSize = FCString::Atoi64(*lines[3]);
+			if (chunkedFileSize <= 0) {
+				triggerFileTransferOverTCPInfoEvent("Client has reported a file size of 0 or lower.", sessionID, fullFilePath, false);
+				return false;
+			}
+			if (!FSocketServerChunkedTransfer::isValidSize(chunkedFileSize, FCString::Atoi(*lines[4]))) {
+				triggerFileTransferOverTCPInfoEvent("Client has reported a file size that is too large.", sessionID, fullFilePath, false);
+				return false;
+			}
+
+			FSocketServerChunkedTransferPtr transfer = tcpServer->openChunkedTransfer(chunkToken, fullFilePath, chunkedFileSize, FCString::Atoi(*lines[4]));
+			if (transfer.IsValid() == false) {
+				triggerFileTransferOverTCPInfoEvent("Can't create file.", sessionID, fullFilePath, false);
+				return false;
+			}
+			sendCommand("SEND_FILE_CHUNKED_TO_SERVER_ACCEPTED_|_" + chunkToken + "_|_" + FString::FromInt(transfer->getChunkSize()) + "_|_" +
+				FString::FromInt(transfer->getChunkCount()) + "_|_" + transfer->getMissingChunks() + "\r\n", clientSocket);
+			return true;
+		}
+
+		if (command.Equals("SEND_CHUNK_TO_SERVER") && lines.Num() == 5) {
+			chunkedTransfer = tcpServer->getChunkedTransfer(chunkToken);
+			if (chunkedTransfer.IsValid() == false) {
+				triggerFileTransferOverTCPInfoEvent("Chunked transfer not found.", sessionID, fullFilePath, false);
+				return false;
+			}
+			fullFilePath = chunkedTransfer->getFilePath();
+			chunkIndex = FCString::Atoi(*lines[2]);
+			int64 chunkSize = FCString::Atoi64(*lines[4]);
+			if (!FSocketServerChunkedTransfer::hashFromString(lines[3], chunkHash) || chunkSize <= 0 || chunkSize != chunkedTransfer->getChunkLength(chunkIndex)) {
+				triggerFileTransferOverTCPInfoEvent("Chunk request incorrect.", sessionID, fullFilePath, false);
+				return false;
+			}
+			chunkBuffer.SetNumUninitialized((int32)chunkSize, false);
+			chunkReceived = 0;
+			commandProgress = 2;
+			sendCommand("SEND_CHUNK_TO_SERVER_ACCEPTED_|_" + chunkToken + "_|_" + FString::FromInt(chunkIndex) + "\r\n", clientSocket);
+			return true;
+		}
+
+		fullFilePath = tcpServer->getCleanDir(tokenStruct.directoryType, tokenStruct.fileDirectory);
+
+		if (command.Equals("REQUEST_FILE_CHUNKED_FROM_SERVER") && lines.Num() == 3) {
+			int64 downloadSize = tcpServer->fileSize(fullFilePath);
+			if (downloadSize <= 0) {
+				triggerFileTransferOverTCPInfoEvent("File not found,", sessionID, fullFilePath, false);
+				return false;
+			}
+			int32 chunkSize = FMath::Clamp(FCString::Atoi(*lines[2]), FSocketServerChunkedTransfer::minChunkSize, FSocketServerChunkedTransfer::maxChunkSize);
+			int64 chunkCount = (downloadSize + chunkSize - 1) / chunkSize;
+			sendCommand("REQUEST_FILE_CHUNKED_FROM_SERVER_ACCEPTED_|_" + chunkToken + "_|_" + tcpServer->int64ToString(downloadSize) + "_|_" +
+				FString::FromInt(chunkSize) + "_|_" + tcpServer->int64ToString(chunkCount) + "_|_" + FPaths::GetCleanFilename(fullFilePath) + "\r\n", clientSocket);
+			return true;
+		}
+
+		if (command.Equals("REQUEST_CHUNK_FROM_SERVER") && lines.Num() == 4) {
+			int64 downloadSize = tcpServer->fileSize(fullFilePath);
+			int32 chunkSize = FMath::Clamp(FCString::Atoi(*lines[3]), FSocketServerChunkedTransfer::minChunkSize, FSocketServerChunkedTransfer::maxChunkSize);
+			int64 offset = FCString::Atoi64(*lines[2]) * chunkSize;
+			if (downloadSize <= 0 || offset < 0 || offset >= downloadSize) {
+				triggerFileTransferOverTCPInfoEvent("Chunk request incorrect.", sessionID, fullFilePath, false);
+				return false;
+			}
+			int32 length = (int32)FMath::Min((int64)chunkSize, downloadSize - offset);
+
+			IFileHandle* reader = FPlatformFileManager::Get().GetPlatformFile().OpenRead(*fullFilePath);
+			chunkBuffer.SetNumUninitialized(length, false);
+			bool readOkay = reader != nullptr && reader->Seek(offset) && reader->Read(chunkBuffer.GetData(), length);
+			delete reader;
+			if (!readOkay) {
+				triggerFileTransferOverTCPInfoEvent("Can't read file.", sessionID, fullFilePath, false);
+				return false;
+			}
+
+			uint64 hash = FSocketServerChunkedTransfer::hashChunk(chunkBuffer.GetData(), length);
+			sendCommand("REQUEST_CHUNK_FROM_SERVER_ACCEPTED_|_" + chunkToken + "_|_" + lines[2] + "_|_" + FSocketServerChunkedTransfer::hashToString(hash) +
+				"_|_" + FString::FromInt(length) + "\r\n", clientSocket);
+			return sendAll(chunkBuffer.GetData(), length, clientSocket);
+		}
+
+		if (command.Equals("REQUEST_FILE_CHUNKED_FROM_SERVER_END") && lines.Num() == 3 && lines[2].Equals("OKAY")) {
+			if (tokenStruct.deleteAfterUse) {
+				tcpServer->removeTokenFromStruct(chunkToken);
+			}
+			triggerFileTransferOverTCPInfoEvent("File transfer successful.", sessionID, fullFilePath, true);
+			return false;
+		}
+
+		triggerFileTransferOverTCPInfoEvent("File request incorrect (4).", sessionID, fullFilePath, false);
+		return false;
+	}
+
+	bool finishChunk(FSocket* clientSocket, FString sessionID) {
+		FString filePath = chunkedTransfer->getFilePath();
+
+		bool okay = chunkedTransfer->writeChunk(chunkIndex, chunkBuffer.GetData(), chunkBuffer.Num(), chunkHash);
+		sendCommand("SEND_CHUNK_TO_SERVER_END_|_" + chunkToken + "_|_" + FString::FromInt(chunkIndex) + (okay ? "_|_OKAY\r\n" : "_|_HASHERROR\r\n"), clientSocket);
+
+		//progress of the whole upload, at most once per second and connection
+		if (okay && (ticksChunkProgress + 10000000) <= FDateTime::Now().GetTicks()) {
+			ticksChunkProgress = FDateTime::Now().GetTicks();
+			int64 receivedBytes = chunkedTransfer->getReceivedBytes();
+			int64 totalBytes = chunkedTransfer->getFileSize();
+			triggerFileOverTCPProgress(sessionID, filePath, (float)receivedBytes / totalBytes * 100, 0, receivedBytes, totalBytes);
+		}
+
+		//the connection that wrote the last chunk completes the upload
+		if (chunkedTransfer->isComplete() && tcpServer->removeChunkedTransfer(chunkToken)) {
+			chunkedTransfer->finish();
+			if (tcpServer->getTokenStruct(chunkToken).deleteAfterUse) {
+				tcpServer->removeTokenFromStruct(chunkToken);
+			}
+			triggerFileTransferOverTCPInfoEvent("File successfully received.", sessionID, filePath, true);
+			sendCommand("SEND_FILE_CHUNKED_TO_SERVER_END_|_" + chunkToken + "_|_OKAY\r\n", clientSocket);
+		}
+		chunkBuffer.Reset();
+		chunkedTransfer.Reset();
+		return true;
+	}
+
+	void sendCommand(FString command, FSocket* clientSocketP) {
+		command = tcpServer->encryptMessage(command);
+		FTCHARToUTF8 Convert(*command);
+		sendAll((const uint8*)Convert.Get(), Convert.Length(), clientSocketP);
+	}
+
+	bool sendAll(const uint8* data, int32 dataSize, FSocket* clientSocketP) {
+		int32 sentTotal = 0;
+		while (run && sentTotal < dataSize) {
+			int32 sent = 0;
+			if (!clientSocketP->Send(data + sentTotal, dataSize - sentTotal, sent)) {
+				return false;
+			}
+			sentTotal += sent;
+		}
+		return sentTotal == dataSize;
+	}
+
 	void stopThread() {
 		run = false;
 	}
@@ -1270,6 +1296,17 @@ protected:
 	int32 commandProgress = 0;
 	int64 fileSize;
 	FTCPClientSendFileToClientThread* sendFileThread = nullptr;
+	ESocketServerFileHashAlgorithm hashAlgorithm = ESocketServerFileHashAlgorithm::E_MD5;
+	FSocketServerFileHash uploadHash;
+
+	//chunk upload in progress on this connection
+	FString chunkToken = FString();
+	FSocketServerChunkedTransferPtr chunkedTransfer;
+	int32 chunkIndex = 0;
+	uint64 chunkHash = 0;
+	TArray<uint8> chunkBuffer;
+	int32 chunkReceived = 0;
+	int64 ticksChunkProgress = 0;
 };
 
 
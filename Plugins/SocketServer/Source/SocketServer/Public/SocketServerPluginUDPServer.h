@@ -2,6 +2,10 @@
 #pragma once
 
 #include "SocketServer.h"
+#include "SocketServerUDPSessionTable.h"
+#include "SocketServerUDPReassembler.h"
+#include "Containers/LockFreeList.h"
+#include <atomic>
 #include "SocketServerPluginUDPServer.generated.h"
 
 
@@ -9,15 +13,57 @@ class USocketServerBPLibrary;
 class FServerUDPThread;
 class FUDPClientSendDataToServerThread;
 
+/*pooled buffer for one queued payload. the address is shared with the session and never parsed again*/
 struct FSendUDPMessageStruct {
-	FString			ip;
-	int32			port;
-	FString			message;
-	TArray<uint8>	bytes;
-	FSocket* socketUDP = nullptr;
+	TArray<uint8>				bytes;
+	FSocketServerRemoteAddressPtr	addr;
+	FSocket*					socketUDP = nullptr;
+	uint64						enqueueCycles = 0;
+	FSocketServerSessionCountersPtr	counters;
+	//ESocketServerUDPSendPriority
+	uint8						lane = 0;
 };
 
 
+/*non owning view of a received datagram. only valid during ISocketServerUDPDatagramHandler::onUDPDatagram*/
+struct FSocketServerUDPDatagramView {
+	const uint8*			data;
+	int32					dataSize;
+	const FInternetAddr&	remoteAddress;
+	const FString&			sessionID;
+	const FString&			serverID;
+};
+
+/*
+* C++ receive hook. Called on the receive thread of the server for every datagram, before it is copied for the game thread.
+* Return true if the datagram is handled and no Blueprint events should be fired for it.
+*/
+class SOCKETSERVER_API ISocketServerUDPDatagramHandler {
+public:
+	virtual ~ISocketServerUDPDatagramHandler() {}
+	virtual bool onUDPDatagram(const FSocketServerUDPDatagramView& datagram) = 0;
+};
+
+//the caller owns the handler, the server only keeps a weak reference and pins it per datagram
+typedef TSharedPtr<ISocketServerUDPDatagramHandler, ESPMode::ThreadSafe> FSocketServerUDPDatagramHandlerPtr;
+typedef TWeakPtr<ISocketServerUDPDatagramHandler, ESPMode::ThreadSafe> FSocketServerUDPDatagramHandlerWeakPtr;
+
+
+/*state of one receive thread (shard)*/
+struct FSocketServerUDPReceiveContext {
+	FSocket*								socket = nullptr;
+	int32									shardIndex = 0;
+	FSocketServerUDPSessionTable::FReader	sessionReader;
+	//a client always lands on the same shard, so fragments of one message meet in the same reassembler
+	FSocketServerUDPReassembler				reassembler;
+	int32									reportedReassemblyDrops = 0;
+	//last SO_RXQ_OVFL value of this shard's socket. the kernel counter is cumulative per socket
+	uint32									kernelDropCounter = 0;
+	//copy of the server's handler, refreshed when setDatagramHandler changed it
+	uint64									handlerGeneration = 0;
+	FSocketServerUDPDatagramHandlerWeakPtr	handler;
+};
+
 UCLASS(Blueprintable, BlueprintType)
 class SOCKETSERVER_API USocketServerPluginUDPServer : public UObject
 {
@@ -25,14 +71,28 @@ class SOCKETSERVER_API USocketServerPluginUDPServer : public UObject
 
 public:
 
-	void startUDPServer(IpAndPortStruct ipStruct,FString IP, int32 port, bool multicast, EReceiveFilterServer receiveFilter, FString serverID, int32 maxPacketSize);
+	void startUDPServer(IpAndPortStruct ipStruct,FString IP, int32 port, bool multicast, EReceiveFilterServer receiveFilter, FString serverID, int32 maxPacketSize, int32 receiveThreads = 1,
+		int32 receiveBufferSize = 0, int32 sendBufferSize = 0);
 	void stopUDPServer();
-	void sendUDPMessage(TArray<FString> clientSessionIDs, FString message, TArray<uint8> byteArray, bool asynchronous, ESocketServerUDPSocketType socketType);
-	void sendUDPMessageToClient(FString clientSessionID, FString message, TArray<uint8> byteArray, bool asynchronous, ESocketServerUDPSocketType socketType);
+	void sendUDPMessage(TArray<FString> clientSessionIDs, FString message, TArray<uint8> byteArray, bool asynchronous, ESocketServerUDPSocketType socketType,
+		ESocketServerUDPSendPriority priority = ESocketServerUDPSendPriority::E_Interactive);
+	void sendUDPMessageToClient(FString clientSessionID, FString message, TArray<uint8> byteArray, bool asynchronous, ESocketServerUDPSocketType socketType,
+		ESocketServerUDPSendPriority priority = ESocketServerUDPSendPriority::E_Interactive);
 	void sendUDPMessageTo(FString ip, int32 port, FString message, TArray<uint8> byteArray, bool asynchronous);
 	//do not work with ipv6
 	//void UDPReceiver(const FArrayReaderPtr& ArrayReaderPtr, const FIPv4Endpoint& EndPt);
 	void UDPReceiverSocketServerPlugin(FArrayReaderPtr& ArrayReaderPtr, TSharedRef<FInternetAddr> remoteAddress);
+	//for FUdpSocketReceiver and other callers without a receive thread of their own. they share one receive context
+	void UDPReceiverSocketServerPlugin(const uint8* data, int32 dataSize, const FInternetAddr& remoteAddress);
+	void UDPReceiverSocketServerPlugin(const uint8* data, int32 dataSize, const FInternetAddr& remoteAddress, const FSocketServerUDPAddressKey& addressKey, FSocketServerUDPReceiveContext& receiveContext);
+	//receive loop of the server thread. reads datagrams in batches where the platform allows it
+	void receiveDatagrams(FSocket* listenerSocket, int32 shardIndex, const bool& run);
+	//lets several sockets bind the same port. the kernel hashes remote addresses across them
+	bool enableReusePort(FSocket* listenerSocket);
+	int32 getReceiveThreadCount();
+	//buffer sizes and drop reporting, called for every socket the server opens
+	void applySocketOptions(FSocket* socket);
+	FSocketServerUDPStats getStats();
 
 	IpAndPortStruct getServerIpAndPortStruct();
 	FString getIP();
@@ -43,10 +103,23 @@ public:
 	FString getServerID();
 
 	void addClientSession(FClientSocketSession session);
-	FClientSocketSession* getClientSession(FString key);
+	FClientSocketSessionPtr getClientSession(FString key);
 	void removeClientSession(FString key);
 	TMap<FString, FClientSocketSession> getClientSessions();
+	//one unbound socket per ip version for ESocketServerUDPSocketType::E_SSS_CLIENT, shared by all sessions
+	FSocket* getClientSocket(const FInternetAddr& addr);
 	void sendBytes(FSocket*& socket, TArray<uint8>& bytes, int32& sent, TSharedRef<FInternetAddr>& addr);
+	//false if the OS rejected at least one datagram
+	bool sendBytes(FSocket* socket, const uint8* data, int32 dataSize, const FInternetAddr& addr);
+	void sendMessageNow(FSocket* socket, const FInternetAddr& addr, const FString& message, const TArray<uint8>& byteArray, FSocketServerSessionCounters* counters = nullptr);
+	FSocketServerRemoteAddressPtr resolveAddr(FString ip, int32 port);
+	//enqueue to wire latency of asynchronous sends in milliseconds
+	void getSendLatency(float& p50, float& p99);
+	void getSendLatency(ESocketServerUDPSendPriority priority, float& p50, float& p99);
+	void setSendScheduling(ESocketServerUDPSendScheduling scheduling, float bulkDeadlineMilliseconds);
+	void setDatagramHandler(FSocketServerUDPDatagramHandlerWeakPtr handler);
+	void setBatchedDelivery(bool batchedDeliveryP);
+	void setFragmentation(bool fragmentationP, float reassemblyTimeoutSeconds, int32 reassemblyMemoryLimitMB);
 
 private:
 
@@ -55,13 +128,55 @@ private:
 	FString serverIP;
 	int32  serverPort = -1;
 	int32 maxPacketSize = 65507;
+	//datagrams per recvmmsg call
+	static const int32 receiveBatchSize = 32;
+	int32 receiveThreads = 1;
+	//0 keeps the OS default
+	int32 receiveBufferSize = 0;
+	int32 sendBufferSize = 0;
 	FSocket* socket= nullptr;
 	FUdpSocketReceiver* socketReceiver = nullptr;
 	EReceiveFilterServer receiveFilter;
-	FServerUDPThread* serverThread = nullptr;
+	TArray<FServerUDPThread*> serverThreads;
 	FUDPClientSendDataToServerThread* sendThread = nullptr;
 
-	TMap<FString, FClientSocketSession> clientSessions;
+	FSocketServerUDPSessionTable clientSessions;
+
+	FCriticalSection datagramHandlerLock;
+	FSocketServerUDPDatagramHandlerWeakPtr datagramHandler;
+	//bumped by setDatagramHandler, the receive contexts only take the lock when it changed
+	std::atomic<uint64> datagramHandlerGeneration{ 0 };
+	//receive context of the three argument UDPReceiverSocketServerPlugin, fragments of several calls meet here
+	FCriticalSection legacyReceiveLock;
+	FSocketServerUDPReceiveContext legacyReceiveContext;
+	std::atomic<bool> batchedDelivery{ false };
+	//messages larger than maxPacketSize are sent with a FSocketServerUDPFragmentHeader per datagram
+	std::atomic<bool> fragmentation{ false };
+	std::atomic<uint32> nextFragmentMessageID{ 0 };
+	std::atomic<double> reassemblyTimeout{ 5.0 };
+	//per receive thread
+	std::atomic<int64> reassemblyMemoryLimit{ 64 * 1024 * 1024 };
+	//datagrams waiting for the game thread in batched mode. only one delivery task is in flight at a time
+	FCriticalSection pendingDatagramsLock;
+	TArray<FSocketServerUDPDatagram> pendingDatagrams;
+	std::atomic<bool> batchDeliveryScheduled{ false };
+	void deliverPendingDatagrams();
+	//sends one datagram and counts the result
+	bool sendDatagram(FSocket* socketP, const uint8* data, int32 dataSize, const FInternetAddr& addr);
+	std::atomic<int64> datagramsReceived{ 0 };
+	std::atomic<int64> bytesReceived{ 0 };
+	std::atomic<int64> datagramsSent{ 0 };
+	std::atomic<int64> bytesSent{ 0 };
+	std::atomic<int64> kernelReceiveDrops{ 0 };
+	std::atomic<int64> sendWouldBlock{ 0 };
+	std::atomic<int64> sendNoBuffers{ 0 };
+	std::atomic<int64> sendOtherErrors{ 0 };
+	std::atomic<int64> reassemblyDrops{ 0 };
+	std::atomic<int32> grantedReceiveBufferSize{ 0 };
+	std::atomic<int32> grantedSendBufferSize{ 0 };
+	FCriticalSection clientSocketLock;
+	FSocket* clientSocketIPv4 = nullptr;
+	FSocket* clientSocketIPv6 = nullptr;
 };
 
 
@@ -69,13 +184,21 @@ class SOCKETSERVER_API FServerUDPThread : public FRunnable {
 
 public:
 
-	FServerUDPThread(USocketServerPluginUDPServer* udpServerP, bool multicastP) :
+	FServerUDPThread(USocketServerPluginUDPServer* udpServerP, bool multicastP, int32 shardIndexP = 0) :
 		udpServer(udpServerP),
-		multicast(multicastP) {
+		multicast(multicastP),
+		shardIndex(shardIndexP) {
 		FString threadName = "FServerUDPThread_" + FGuid::NewGuid().ToString();
 		thread = FRunnableThread::Create(this, *threadName, 0, EThreadPriority::TPri_Normal);
 	}
 
+	~FServerUDPThread() {
+		if (thread != nullptr) {
+			delete thread;
+			thread = nullptr;
+		}
+	}
+
 	virtual uint32 Run() override {
 
 		IpAndPortStruct ipAndPortStruct = udpServer->getServerIpAndPortStruct();
@@ -104,18 +227,18 @@ public:
 				AsyncTask(ENamedThreads::GameThread, [adress, SocketErr, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to open UDP Server: " + adress + " | " + SocketErr, serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 
 
+			listenerSocket->SetNonBlocking();
+			udpServer->applySocketOptions(listenerSocket);
 			if (!listenerSocket->Bind(*addr)) {
 				UE_LOG(LogTemp, Error, TEXT("Unable to open UDP Server"));
 				const TCHAR* SocketErr = socketSubsystem->GetSocketError(SE_GET_LAST_ERROR_CODE);
 				AsyncTask(ENamedThreads::GameThread, [adress, SocketErr, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to open UDP Server: " + adress + " | " + SocketErr, serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 
@@ -125,7 +248,6 @@ public:
 				AsyncTask(ENamedThreads::GameThread, [adress, SocketErr, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to set Broadcast: " + adress + " | " + SocketErr, serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 
@@ -135,7 +257,6 @@ public:
 				AsyncTask(ENamedThreads::GameThread, [adress, SocketErr, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to set Multicast Loopback: " + adress + " | " + SocketErr, serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 			bool validIP = true;
@@ -146,7 +267,6 @@ public:
 				AsyncTask(ENamedThreads::GameThread, [adress, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to open UDP Server: " + adress + " | Can't set ip.", serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 
@@ -157,7 +277,6 @@ public:
 				AsyncTask(ENamedThreads::GameThread, [adress, SocketErr, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to join Multicast Group: " + adress + " | " + SocketErr, serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 		}
@@ -175,7 +294,6 @@ public:
 				AsyncTask(ENamedThreads::GameThread, [adress, SocketErr, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to open UDP Server: " + adress + " | " + SocketErr, serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 
@@ -184,63 +302,49 @@ public:
 				AsyncTask(ENamedThreads::GameThread, [adress, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to open UDP Server: " + adress + " | Can't set ip.", serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 
 			listenerSocket->SetReuseAddr();
 			listenerSocket->SetNonBlocking();
+			udpServer->applySocketOptions(listenerSocket);
+			if (udpServer->getReceiveThreadCount() > 1 && !udpServer->enableReusePort(listenerSocket)) {
+				UE_LOG(LogTemp, Error, TEXT("SocketServer UDP. Can't set SO_REUSEPORT"));
+				AsyncTask(ENamedThreads::GameThread, [adress, serverID]() {
+					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to open UDP Server: " + adress + " | Can't share the port between receive threads.", serverID);
+					});
+				return 0;
+			}
 			if (!listenerSocket->Bind(*addr)) {
 				UE_LOG(LogTemp, Error, TEXT("Unable to open UDP Server"));
 				const TCHAR* SocketErr = socketSubsystem->GetSocketError(SE_GET_LAST_ERROR_CODE);
 				AsyncTask(ENamedThreads::GameThread, [adress, SocketErr, serverID]() {
 					USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "Unable to open UDP Server: " + adress + " | " + SocketErr, serverID);
 					});
-				thread = nullptr;
 				return 0;
 			}
 		}
 
 		//do not work with ipv6
-		FTimespan ThreadWaitTime = FTimespan::FromMilliseconds(100);
 		//FString threadName = "SocketServerBPLibUDPReceiverThread_" + FString::FromInt(FDateTime::Now().GetTicks());
 
 		//udpSocketReceiver = new FUdpSocketReceiver(listenerSocket, ThreadWaitTime, *threadName);
 		//udpSocketReceiver->OnDataReceived().BindUObject(udpServer, &USocketServerPluginUDPServer::UDPReceiver);
 		//udpSocketReceiver->Start();
-		udpServer->setSocketReceiver(udpSocketReceiver, listenerSocket);
+		//the first shard owns the socket that is used for sending and for sessions that were added by hand
+		if (shardIndex == 0) {
+			udpServer->setSocketReceiver(udpSocketReceiver, listenerSocket);
 
-		//udpServer->initUDPClientThreads(listenerSocket);
+			//udpServer->initUDPClientThreads(listenerSocket);
 
-		AsyncTask(ENamedThreads::GameThread, [adress, serverID]() {
-			USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "UDP Server started: " + adress, serverID);
-		});
+			AsyncTask(ENamedThreads::GameThread, [adress, serverID]() {
+				USocketServerBPLibrary::socketServerBPLibrary->onsocketServerUDPConnectionEventDelegate.Broadcast(true, "UDP Server started: " + adress, serverID);
+			});
+		}
 
 
 		//copy of FUdpSocketReceiver.h to get IPv6 working
-		while (run) {
-			if (!listenerSocket->Wait(ESocketWaitConditions::WaitForRead, ThreadWaitTime)){
-				continue;
-			}
-
-			TSharedRef<FInternetAddr> Sender = socketSubsystem->CreateInternetAddr();
-			uint32 Size;
-
-			while (listenerSocket->HasPendingData(Size)){
-				FArrayReaderPtr Reader = MakeShared<FArrayReader, ESPMode::ThreadSafe>(true);
-				Reader->SetNumUninitialized(FMath::Min(Size, 65507u));
-
-				int32 Read = 0;
-
-				if (listenerSocket->RecvFrom(Reader->GetData(), Reader->Num(), Read, *Sender))
-				{
-					Reader->RemoveAt(Read, Reader->Num() - Read, false);
-					udpServer->UDPReceiverSocketServerPlugin(Reader, Sender);
-				//	UE_LOG(LogTemp, Error, TEXT("%s_%s"), *Sender.Get().ToString(true), *Sender->GetProtocolType().ToString());
-
-				}
-			}
-		}
+		udpServer->receiveDatagrams(listenerSocket, shardIndex, run);
 
 		if (listenerSocket != nullptr) {
 			listenerSocket->Close();
@@ -248,9 +352,6 @@ public:
 			listenerSocket = nullptr;
 		}
 
-		if (thread != nullptr)
-			thread = nullptr;
-
 		return 0;
 	}
 
@@ -258,11 +359,20 @@ public:
 		run = false;
 	}
 
+	//returns when the thread has closed and destroyed its socket
+	void stopThreadAndWait() {
+		stopThread();
+		if (thread != nullptr) {
+			thread->WaitForCompletion();
+		}
+	}
+
 
 protected:
 	FString message;
 	USocketServerPluginUDPServer* udpServer;
 	bool multicast;
+	int32 shardIndex = 0;
 	FRunnableThread* thread = nullptr;
 	bool run = true;
 
@@ -270,71 +380,236 @@ protected:
 
 
 
-/*Send data asynchronous Thread*/
+/*
+* Bounded multi producer / single consumer ring (Dmitry Vyukov). Any thread can push without a lock,
+* only the send thread pops.
+*/
+class SOCKETSERVER_API FSocketServerUDPSendRing {
+
+public:
+
+	FSocketServerUDPSendRing(uint32 capacityP) {
+		capacity = FMath::RoundUpToPowerOfTwo(FMath::Max(capacityP, 2u));
+		cells = new FCell[capacity];
+		for (uint32 i = 0; i < capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~FSocketServerUDPSendRing() {
+		delete[] cells;
+	}
+
+	bool enqueue(FSendUDPMessageStruct* item) {
+		uint64 pos = enqueuePos.load(std::memory_order_relaxed);
+		FCell* cell = nullptr;
+		while (true) {
+			cell = &cells[pos & (capacity - 1)];
+			uint64 sequence = cell->sequence.load(std::memory_order_acquire);
+			int64 diff = (int64)sequence - (int64)pos;
+			if (diff == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				//full
+				return false;
+			}
+			else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->item = item;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	FSendUDPMessageStruct* dequeue() {
+		uint64 pos = dequeuePos.load(std::memory_order_relaxed);
+		FCell* cell = &cells[pos & (capacity - 1)];
+		if (cell->sequence.load(std::memory_order_acquire) != pos + 1) {
+			return nullptr;
+		}
+		FSendUDPMessageStruct* item = cell->item;
+		cell->sequence.store(pos + capacity, std::memory_order_release);
+		dequeuePos.store(pos + 1, std::memory_order_relaxed);
+		return item;
+	}
+
+	//only called from the send thread. sees every item whose enqueue() returned before
+	bool isEmpty() const {
+		uint64 pos = dequeuePos.load(std::memory_order_relaxed);
+		return cells[pos & (capacity - 1)].sequence.load(std::memory_order_acquire) != pos + 1;
+	}
+
+	//approximate when called while producers are active
+	int32 num() const {
+		return (int32)(enqueuePos.load(std::memory_order_relaxed) - dequeuePos.load(std::memory_order_relaxed));
+	}
+
+private:
+	struct FCell {
+		std::atomic<uint64>		sequence;
+		FSendUDPMessageStruct*	item = nullptr;
+	};
+
+	FCell* cells = nullptr;
+	uint32 capacity = 0;
+	alignas(PLATFORM_CACHE_LINE_SIZE) std::atomic<uint64> enqueuePos{ 0 };
+	alignas(PLATFORM_CACHE_LINE_SIZE) std::atomic<uint64> dequeuePos{ 0 };
+};
+
+
+/*log2 histogram in microseconds. cheap enough to update for every datagram*/
+class SOCKETSERVER_API FSocketServerLatencyHistogram {
+
+public:
+
+	FSocketServerLatencyHistogram() {
+		reset();
+	}
+
+	void add(uint64 cycles) {
+		double microseconds = FPlatformTime::ToSeconds64(cycles) * 1000000.0;
+		int32 bucket = 0;
+		if (microseconds >= 1.0) {
+			bucket = FMath::Min((int32)FMath::FloorLog2((uint32)FMath::Min(microseconds, (double)MAX_uint32)) + 1, bucketCount - 1);
+		}
+		buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	//upper bound of the bucket that holds the percentile, in milliseconds
+	float percentile(float fraction) const {
+		uint64 total = 0;
+		for (int32 i = 0; i < bucketCount; i++) {
+			total += buckets[i].load(std::memory_order_relaxed);
+		}
+		if (total == 0) {
+			return 0.f;
+		}
+		uint64 target = FMath::Max<uint64>((uint64)FMath::CeilToDouble(total * (double)fraction), 1);
+		uint64 count = 0;
+		for (int32 i = 0; i < bucketCount; i++) {
+			count += buckets[i].load(std::memory_order_relaxed);
+			if (count >= target) {
+				return (float)((uint64)1 << i) / 1000.f;
+			}
+		}
+		return (float)((uint64)1 << (bucketCount - 1)) / 1000.f;
+	}
+
+	void reset() {
+		for (int32 i = 0; i < bucketCount; i++) {
+			buckets[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	static const int32 bucketCount = 32;
+	std::atomic<uint64> buckets[bucketCount];
+};
+
+
+/*
+* Send data asynchronous Thread. One ring per ESocketServerUDPSendPriority. With strict scheduling a lane is only served when
+* all higher lanes are empty, with weighted scheduling the lanes take turns (8:4:1) so bulk data can't starve completely.
+*/
 class SOCKETSERVER_API FUDPClientSendDataToServerThread : public FRunnable {
 
 public:
 
+	static const int32 laneCount = 3;
+
 	FUDPClientSendDataToServerThread(USocketServerPluginUDPServer* udpServerP) :
 		udpServer(udpServerP) {
+		for (int32 i = 0; i < laneCount; i++) {
+			sendRings[i] = new FSocketServerUDPSendRing(4096);
+		}
+		wakeEvent = FPlatformProcess::GetSynchEventFromPool(false);
 		FString threadName = "FUDPClientSendDataToServerThread_" + FGuid::NewGuid().ToString();
 		thread = FRunnableThread::Create(this, *threadName, 0, EThreadPriority::TPri_Normal);
 	}
 
+	~FUDPClientSendDataToServerThread() {
+		if (thread != nullptr) {
+			delete thread;
+			thread = nullptr;
+		}
+		FPlatformProcess::ReturnSynchEventToPool(wakeEvent);
+		wakeEvent = nullptr;
+		for (int32 i = 0; i < laneCount; i++) {
+			delete sendRings[i];
+			sendRings[i] = nullptr;
+		}
+	}
+
 	virtual uint32 Run() override {
-		//FString serverID = tcpServer->getServerID();
-		//socket = session.socket;
-		//FString sessionID = session.sessionID;
 
 		while (run && thread == nullptr) {
 				FPlatformProcess::Sleep(0.1);
 		}
 
-		TSharedRef<FInternetAddr> addr = USocketServerBPLibrary::getSocketSubSystem()->CreateInternetAddr();
-		int32 sent = 0;
-		bool bIsValid = false;
-
-		while (run) {	
-
-			while (messageQueue.IsEmpty() == false) {
-				FSendUDPMessageStruct messageStuct;
-				messageQueue.Dequeue(messageStuct);
-
-
-				addr->SetIp(*messageStuct.ip, bIsValid);
-				addr->SetPort(messageStuct.port);
-
-				if (bIsValid && messageStuct.socketUDP != nullptr) {
-
-					if (messageStuct.bytes.Num() > 0) {
-						udpServer->sendBytes(messageStuct.socketUDP, messageStuct.bytes, sent, addr);
-					}
+		while (run) {
 
-					if (messageStuct.message.Len() > 0) {
-						FTCHARToUTF8 Convert(*messageStuct.message);
-						messageStuct.bytes.Append((uint8*)Convert.Get(), Convert.Length());
-						udpServer->sendBytes(messageStuct.socketUDP, messageStuct.bytes, sent, addr);
+			FSendUDPMessageStruct* messageStruct = next();
+			while (messageStruct != nullptr) {
+				uint64 now = FPlatformTime::Cycles64();
+				uint64 deadline = bulkDeadlineCycles.load(std::memory_order_relaxed);
+				if (messageStruct->lane == (uint8)ESocketServerUDPSendPriority::E_Bulk && deadline > 0 && now - messageStruct->enqueueCycles > deadline) {
+					//stale frame data. sending it would only delay what comes after it
+					deadlineDrops.fetch_add(1, std::memory_order_relaxed);
+					if (messageStruct->counters.IsValid()) {
+						messageStruct->counters->sendQueueDepth.fetch_sub(1, std::memory_order_relaxed);
 					}
-
 				}
 				else {
-					UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Can't send data. Wrong adress."));
+					bool sent = udpServer->sendBytes(messageStruct->socketUDP, messageStruct->bytes.GetData(), messageStruct->bytes.Num(), *messageStruct->addr->addr);
+					if (messageStruct->counters.IsValid()) {
+						messageStruct->counters->sendQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+						if (sent) {
+							messageStruct->counters->sent(messageStruct->bytes.Num());
+						}
+						else {
+							messageStruct->counters->sendFailed();
+						}
+					}
+					uint64 cycles = FPlatformTime::Cycles64() - messageStruct->enqueueCycles;
+					latency.add(cycles);
+					laneLatency[messageStruct->lane].add(cycles);
 				}
-					
+				releaseBuffer(messageStruct);
+				messageStruct = next();
 			}
-			
 
-			if (run) {
-				pauseThread(true);
-				//workaround. suspend do not work on all platforms. lets sleep
-				while (paused && run) {
-					FPlatformProcess::Sleep(0.01);
+			//producers only trigger the event while we are waiting. the fence pairs with the one in enqueue(): either the
+			//producer sees waiting or the check below sees its item, so no wakeup is lost. the timeout is just a safety net
+			waiting.store(true, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (run && hasQueuedMessages() == false) {
+				wakeEvent->Wait(100);
+			}
+			waiting.store(false, std::memory_order_relaxed);
+		}
+
+		//drop what is left and free the pool. the sessions may outlive this thread, so their queue depth has to go down as well
+		for (int32 i = 0; i < laneCount; i++) {
+			FSendUDPMessageStruct* messageStruct = sendRings[i]->dequeue();
+			while (messageStruct != nullptr) {
+				if (messageStruct->counters.IsValid()) {
+					messageStruct->counters->sendQueueDepth.fetch_sub(1, std::memory_order_relaxed);
 				}
+				delete messageStruct;
+				messageStruct = sendRings[i]->dequeue();
 			}
 		}
+		FSendUDPMessageStruct* messageStruct = freeBuffers.Pop();
+		while (messageStruct != nullptr) {
+			delete messageStruct;
+			messageStruct = freeBuffers.Pop();
+		}
 
 		run = false;
-		thread = nullptr;
 
 
 		return 0;
@@ -350,8 +625,14 @@ public:
 
 	void stopThread() {
 		run = false;
+		wakeEvent->Trigger();
+	}
+
+	//what is still queued after stopThread() is dropped, not sent. returns when the thread no longer touches the sockets
+	void stopThreadAndWait() {
+		stopThread();
 		if (thread != nullptr) {
-			pauseThread(false);
+			thread->WaitForCompletion();
 		}
 	}
 
@@ -360,27 +641,174 @@ public:
 	}
 
 
-	void sendMessage(FString ip, int32	port, FString message,TArray<uint8>	bytes, FSocket* socketUDP) {
-		FSendUDPMessageStruct messageStuct;
-		messageStuct.ip = ip;
-		messageStuct.port = port;
-		messageStuct.message = message;
-		messageStuct.bytes = bytes;
-		messageStuct.socketUDP = socketUDP;
-		messageQueue.Enqueue(messageStuct);
-		pauseThread(false);
+	//never blocks the caller. false if a datagram was dropped because its lane is full
+	bool sendMessage(FSocketServerRemoteAddressPtr addr, const FString& message, const TArray<uint8>& bytes, FSocket* socketUDP,
+		const FSocketServerSessionCountersPtr& counters = nullptr, ESocketServerUDPSendPriority priority = ESocketServerUDPSendPriority::E_Interactive) {
+		if (addr.IsValid() == false || socketUDP == nullptr) {
+			UE_LOG(LogTemp, Warning, TEXT("SimpleSocketServer Plugin: Can't send data. Wrong adress."));
+			return false;
+		}
+
+		//bytes and message go out as separate datagrams like in the synchronous path
+		bool queued = true;
+		if (bytes.Num() > 0) {
+			FSendUDPMessageStruct* messageStruct = acquireBuffer();
+			messageStruct->bytes.Append(bytes);
+			messageStruct->counters = counters;
+			queued = enqueue(messageStruct, addr, socketUDP, priority);
+		}
+
+		if (message.Len() > 0) {
+			FTCHARToUTF8 Convert(*message);
+			FSendUDPMessageStruct* messageStruct = acquireBuffer();
+			messageStruct->bytes.Append((uint8*)Convert.Get(), Convert.Length());
+			messageStruct->counters = counters;
+			queued = enqueue(messageStruct, addr, socketUDP, priority) && queued;
+		}
+		return queued;
+	}
+
+	void setScheduling(ESocketServerUDPSendScheduling scheduling, float bulkDeadlineMilliseconds) {
+		weighted.store(scheduling == ESocketServerUDPSendScheduling::E_Weighted);
+		bulkDeadlineCycles.store(bulkDeadlineMilliseconds > 0.f ? (uint64)(bulkDeadlineMilliseconds / 1000.0 / FPlatformTime::GetSecondsPerCycle64()) : 0);
+	}
+
+	void getLatency(float& p50, float& p99) {
+		p50 = latency.percentile(0.5f);
+		p99 = latency.percentile(0.99f);
+	}
+
+	void getLatency(ESocketServerUDPSendPriority priority, float& p50, float& p99) {
+		p50 = laneLatency[(uint8)priority].percentile(0.5f);
+		p99 = laneLatency[(uint8)priority].percentile(0.99f);
+	}
+
+	int32 getQueueDepth() {
+		int32 depth = 0;
+		for (int32 i = 0; i < laneCount; i++) {
+			depth += sendRings[i]->num();
+		}
+		return depth;
+	}
+
+	int64 getDeadlineDrops() {
+		return deadlineDrops.load(std::memory_order_relaxed);
+	}
+
+	int64 getQueueFullDrops() {
+		return queueFullDrops.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	//only called from the send thread
+	bool hasQueuedMessages() const {
+		for (int32 i = 0; i < laneCount; i++) {
+			if (sendRings[i]->isEmpty() == false) {
+				return true;
+			}
+		}
+		return false;
 	}
-	
 
-	void pauseThread(bool pause) {
-		paused = pause;
-		thread->Suspend(pause);
+	//only called from the send thread
+	FSendUDPMessageStruct* next() {
+		if (weighted.load(std::memory_order_relaxed) == false) {
+			for (int32 i = 0; i < laneCount; i++) {
+				FSendUDPMessageStruct* messageStruct = sendRings[i]->dequeue();
+				if (messageStruct != nullptr) {
+					return messageStruct;
+				}
+			}
+			return nullptr;
+		}
+
+		//weighted round robin. a lane keeps the turn until its credits are used up or it runs empty
+		static const int32 weights[laneCount] = { 8, 4, 1 };
+		for (int32 attempts = 0; attempts <= laneCount; attempts++) {
+			if (credits > 0) {
+				FSendUDPMessageStruct* messageStruct = sendRings[currentLane]->dequeue();
+				if (messageStruct != nullptr) {
+					credits--;
+					return messageStruct;
+				}
+			}
+			currentLane = (currentLane + 1) % laneCount;
+			credits = weights[currentLane];
+		}
+		return nullptr;
+	}
+
+	FSendUDPMessageStruct* acquireBuffer() {
+		FSendUDPMessageStruct* messageStruct = freeBuffers.Pop();
+		if (messageStruct == nullptr) {
+			messageStruct = new FSendUDPMessageStruct();
+		}
+		return messageStruct;
+	}
+
+	void releaseBuffer(FSendUDPMessageStruct* messageStruct) {
+		//keep the allocation for typical datagrams, give back what a single huge payload grabbed
+		if (messageStruct->bytes.Max() > 65536) {
+			messageStruct->bytes.Empty();
+		}
+		else {
+			messageStruct->bytes.Reset();
+		}
+		messageStruct->addr.Reset();
+		messageStruct->socketUDP = nullptr;
+		messageStruct->counters.Reset();
+		freeBuffers.Push(messageStruct);
+	}
+
+	//called from the game thread, so a full lane drops the datagram like a full socket buffer would instead of waiting for the send thread
+	bool enqueue(FSendUDPMessageStruct* messageStruct, const FSocketServerRemoteAddressPtr& addr, FSocket* socketUDP, ESocketServerUDPSendPriority priority) {
+		messageStruct->addr = addr;
+		messageStruct->socketUDP = socketUDP;
+		messageStruct->lane = FMath::Min((uint8)priority, (uint8)(laneCount - 1));
+		messageStruct->enqueueCycles = FPlatformTime::Cycles64();
+		if (messageStruct->counters.IsValid()) {
+			messageStruct->counters->sendQueueDepth.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if (!run || sendRings[messageStruct->lane]->enqueue(messageStruct) == false) {
+			queueFullDrops.fetch_add(1, std::memory_order_relaxed);
+			if (messageStruct->counters.IsValid()) {
+				messageStruct->counters->sendQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+				messageStruct->counters->sendFailed();
+			}
+			//the pool is freed when the loop ends
+			if (run) {
+				releaseBuffer(messageStruct);
+				wakeEvent->Trigger();
+			}
+			else {
+				delete messageStruct;
+			}
+			return false;
+		}
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed)) {
+			wakeEvent->Trigger();
+		}
+		return true;
 	}
 
 protected:
 	USocketServerPluginUDPServer* udpServer;
 	FRunnableThread* thread = nullptr;
 	bool					run = true;
-	bool					paused;
-	TQueue<FSendUDPMessageStruct> messageQueue;
-};
\ No newline at end of file
+	FEvent*					wakeEvent = nullptr;
+	std::atomic<bool>		waiting{ false };
+	FSocketServerUDPSendRing* sendRings[laneCount];
+	TLockFreePointerListUnordered<FSendUDPMessageStruct, PLATFORM_CACHE_LINE_SIZE> freeBuffers;
+	FSocketServerLatencyHistogram latency;
+	FSocketServerLatencyHistogram laneLatency[laneCount];
+	std::atomic<bool>		weighted{ false };
+	std::atomic<uint64>		bulkDeadlineCycles{ 0 };
+	std::atomic<int64>		deadlineDrops{ 0 };
+	std::atomic<int64>		queueFullDrops{ 0 };
+	int32					currentLane = 0;
+	int32					credits = 0;
+};
@@ -0,0 +1,97 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+#include <atomic>
+
+class URCONServer;
+
+typedef TFunction<void(TArray<uint8>&&)> FSocketServerTCPRawWriter;
+
+/*one Source RCON packet. body points into the received data and is only valid inside the packet callback*/
+struct FSocketServerRCONPacket {
+	int32 id = 0;
+	int32 type = 0;
+	const uint8* body = nullptr;
+	//without the null terminators
+	int32 bodySize = 0;
+};
+
+/*
+* Framing of the Source RCON protocol (https://developer.valvesoftware.com/wiki/Source_RCON_Protocol).
+* int32 size | int32 id | int32 type | body | 0x00 | 0x00, all little endian.
+* Packets inside one read are handed out straight from the received data. Only a packet split across reads is copied
+* into the fixed staging buffer, so parsing never allocates. One instance per connection.
+*/
+class SOCKETSERVER_API FSocketServerRCONParser {
+
+public:
+
+	static const int32 minPacketSize = 10;
+	static const int32 maxPacketSize = 4096;
+
+	//calls onPacket for every complete packet. false if the stream is corrupt, the connection should be closed then
+	bool receive(const uint8* data, int32 dataSize, TFunctionRef<void(const FSocketServerRCONPacket&)> onPacket);
+
+	//appends one packet to a batch of responses
+	static void appendPacket(TArray<uint8>& out, int32 id, int32 type, const uint8* body, int32 bodySize);
+
+	//set by the endpoint once this connection has sent the right password
+	bool isAuthenticated() const {
+		return authenticated;
+	}
+	void setAuthenticated() {
+		authenticated = true;
+	}
+
+private:
+
+	static void readPacket(const uint8* data, int32 size, FSocketServerRCONPacket& packet);
+
+	uint8 pending[4 + maxPacketSize];
+	int32 pendingSize = 0;
+	//size field of the staged packet, -1 while it is incomplete
+	int32 pendingPacketSize = -1;
+	bool authenticated = false;
+};
+
+
+/*
+* RCON side of a TCP server that was registered with registerRCONServer. The message parser of every connection of that
+* server hands its raw stream to receive() on the receive thread. Authentication is answered right there.
+* Commands of one read are handed to the game thread together. A command before a successful login closes the connection.
+*/
+class SOCKETSERVER_API FSocketServerRCONEndpoint {
+
+public:
+
+	FSocketServerRCONEndpoint(FString serverIDP, ERCONPasswordType passwordTypeP, FString passwordOrFileP, URCONServer* rconServerP);
+
+	//false if the connection has to be closed. responses of the whole read go to writer in one piece
+	bool receive(const FString& sessionID, FSocketServerRCONParser& parser, const uint8* data, int32 dataSize, const FSocketServerTCPRawWriter& writer);
+	//gets every authenticated command on the receive thread instead of the game thread. set before add()
+	void setCommandHandler(TFunction<void(const FString& sessionID, int32 requestID, const FString& request)> handler);
+
+	//registry, looked up by the message parsers
+	static void add(TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe> endpoint);
+	static void remove(const FString& serverID);
+	static TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe> find(const FString& serverID);
+	//changes with every add or remove. a parser only looks up its endpoint again when this differs
+	static uint64 getGeneration() {
+		return generation.load(std::memory_order_acquire);
+	}
+
+private:
+
+	bool checkPassword(const FString& password) const;
+
+	FString serverID;
+	ERCONPasswordType passwordType;
+	FString passwordOrFile;
+	TWeakObjectPtr<URCONServer> rconServer;
+	TFunction<void(const FString& sessionID, int32 requestID, const FString& request)> commandHandler;
+
+	static FCriticalSection registryLock;
+	static TMap<FString, TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe>> registry;
+	static std::atomic<uint64> generation;
+};
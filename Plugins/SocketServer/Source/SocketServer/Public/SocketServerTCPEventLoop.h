@@ -0,0 +1,88 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+#include "SocketServerTCPMessageParser.h"
+#include "SocketServerTCPSendQueue.h"
+#include "HAL/CriticalSection.h"
+#include <atomic>
+
+class USocketServerPluginTCPServer;
+class FSocketServerTCPIOThread;
+
+/*one accepted client of the event loop*/
+struct FSocketServerTCPConnection {
+
+	FSocketServerTCPConnection(FClientSocketSession sessionP, EReceiveFilterServer receiveFilter, int32 ioThreadIndexP);
+	~FSocketServerTCPConnection();
+
+	uint64 id = 0;
+	int32 ioThreadIndex = 0;
+	FClientSocketSession session;
+	//only used by the io thread that owns the connection
+	FSocketServerTCPMessageParser parser;
+
+	FCriticalSection sendLock;
+	FSocketServerTCPSendQueue sendQueue;
+	bool writeArmed = false;
+
+	std::atomic<bool> closed{ false };
+};
+
+typedef TSharedPtr<FSocketServerTCPConnection, ESPMode::ThreadSafe> FSocketServerTCPConnectionPtr;
+
+
+/*
+* Readiness based TCP backend. A fixed number of io threads, each with its own epoll instance, serve all
+* connections of a server. Thread 0 also accepts new clients and hands them out round robin.
+* Replaces the send and receive thread per connection. Linux only, isSupported() is false everywhere else.
+*/
+class SOCKETSERVER_API FSocketServerTCPEventLoop {
+
+public:
+
+	//a client that reads slower than the server sends is disconnected once this much is queued for it
+	static const int64 maxQueuedBytesPerConnection = 64 * 1024 * 1024;
+
+	FSocketServerTCPEventLoop(USocketServerPluginTCPServer* tcpServerP, EReceiveFilterServer receiveFilterP, int32 threadCount);
+	~FSocketServerTCPEventLoop();
+
+	static bool isSupported();
+
+	//the listener stays owned by the caller but must outlive the loop
+	bool start(FSocket* listenerSocket);
+	void stop();
+
+	//wraps the data like the send thread (byte header) and queues it on the connection
+	void send(FString sessionID, FString message, TArray<uint8> byteArray);
+	//closes the socket and fires "Client disconnected". does not remove the session from the server
+	void closeConnection(FString sessionID);
+	int32 num();
+
+private:
+
+	friend class FSocketServerTCPIOThread;
+
+	void accept();
+	//io thread 0 watches the listener again after accept ran out of file descriptors
+	void resumeAccept();
+	void onReadable(FSocketServerTCPConnectionPtr connection, TArray<uint8>& readBuffer);
+	void onWritable(FSocketServerTCPConnectionPtr connection);
+	void enqueue(FSocketServerTCPConnectionPtr connection, FSocketServerTCPSendItem&& item);
+	void disconnect(FSocketServerTCPConnectionPtr connection, bool removeSession);
+	void watch(FSocketServerTCPConnection& connection, bool writable);
+
+	USocketServerPluginTCPServer* tcpServer = nullptr;
+	EReceiveFilterServer receiveFilter;
+	ESocketServerTCPMessageWrapping messageWrapping = ESocketServerTCPMessageWrapping::E_None;
+	FSocket* listener = nullptr;
+	//only used by io thread 0. 0 = the listener is watched
+	double acceptPausedUntil = 0;
+
+	TArray<FSocketServerTCPIOThread*> ioThreads;
+	int32 nextIOThread = 0;
+	std::atomic<uint64> nextConnectionID{ 1 };
+
+	FCriticalSection connectionsLock;
+	TMap<FString, FSocketServerTCPConnectionPtr> connectionsBySession;
+};
@@ -0,0 +1,38 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+
+/*
+* Streams a file to a client socket. On Linux the kernel copies straight from the page cache with sendfile().
+* If the file system does not support that, blocks are read with pread() and sent from one reused buffer.
+* Other platforms read through FArchive into one reused buffer. A short send continues at the returned position.
+*/
+class SOCKETSERVER_API FSocketServerTCPFileSender {
+
+public:
+
+	FSocketServerTCPFileSender(FSocket* socketP, FString filePathP);
+	~FSocketServerTCPFileSender();
+
+	//false if the file can't be opened or is empty
+	bool open(int64& fileSize);
+	//sends at most maxBytes starting at position. returns the sent bytes, 0 if the socket is busy and -1 on errors,
+	//including a file that got shorter since open()
+	int64 send(int64 position, int64 maxBytes);
+
+private:
+
+	void close();
+
+	FSocket* socket = nullptr;
+	FString filePath;
+	int64 size = 0;
+
+	int fileHandle = -1;
+	bool useSendfile = true;
+
+	FArchive* reader = nullptr;
+	int64 readerPosition = 0;
+	TArray<uint8> buffer;
+};
@@ -0,0 +1,83 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+#include "SocketServerRCONParser.h"
+
+/*
+* Turns the raw bytes of one TCP connection into message events (string/byte wrapping or none).
+* One instance per connection, not thread safe. Used by the receive thread and by the event loop.
+*/
+class SOCKETSERVER_API FSocketServerTCPMessageParser {
+
+public:
+
+	//wrapping and size limit as set on USocketServerBPLibrary
+	FSocketServerTCPMessageParser(FString sessionIDP, FString serverIDP, EReceiveFilterServer receiveFilterP);
+	FSocketServerTCPMessageParser(FString sessionIDP, FString serverIDP, EReceiveFilterServer receiveFilterP,
+		ESocketServerTCPMessageWrapping messageWrappingP, FString tcpMessageHeaderP, FString tcpMessageFooterP, int32 maxMessageSizeP);
+
+	//false if the stream is corrupt (invalid byte header) or a message is larger than the limit. the connection should be closed then
+	bool receive(const uint8* data, int32 dataSize);
+	//sends bytes back on this connection without a game thread hop. used for RCON responses
+	void setRawWriter(FSocketServerTCPRawWriter writer);
+	//gets every complete message instead of the game thread events
+	void setMessageHandler(TFunction<void(const uint8* data, int32 dataSize)> handler);
+
+	static const int32 byteHeaderSize = 5;
+	static const int32 defaultMaxMessageSize = 64 * 1024 * 1024;
+
+private:
+
+	bool receiveString(const uint8* data, int32 dataSize);
+	bool receiveBytes(const uint8* data, int32 dataSize);
+	void triggerMessageEvent(const uint8* data, int32 dataSize);
+	void triggerStringEvent(const uint8* data, int32 dataSize);
+	//uint8 endian (0x00 little, 0x01 big) | int32 length. false if the header is invalid
+	bool readDataLength(const uint8* header, int32& byteLenght) const;
+
+	FString sessionID;
+	FString serverID;
+	EReceiveFilterServer receiveFilter;
+
+	//message wrapping
+	FString tcpMessageHeader = FString();
+	FString tcpMessageFooter = FString();
+	ESocketServerTCPMessageWrapping messageWrapping = ESocketServerTCPMessageWrapping::E_None;
+	//a declared byte length or an unfinished string message above this closes the connection
+	int32 maxMessageSize = defaultMaxMessageSize;
+	TFunction<void(const uint8* data, int32 dataSize)> messageHandler;
+
+	/*utf-8 header or footer, searched with Boyer-Moore-Horspool*/
+	struct FToken {
+		TArray<uint8> bytes;
+		int32 skip[256];
+
+		void init(const FString& text);
+		//index of the first match in data[from, to) or INDEX_NONE
+		int32 find(const uint8* data, int32 from, int32 to) const;
+	};
+
+	//string wrapping. received bytes are appended to stringBuffer, every byte is searched only once.
+	//stringHead is the start of the current message (or of the not yet matched text outside of a message)
+	FToken headerToken;
+	FToken footerToken;
+	TArray<uint8> stringBuffer;
+	int32 stringHead = 0;
+	int32 stringScan = 0;
+	bool inStringMessage = false;
+
+	//byte wrapping. a header split across reads is staged here, complete messages inside a read are
+	//emitted straight from the received data. only a message split across reads is copied into pendingMessage
+	uint8 pendingHeader[byteHeaderSize];
+	int32 pendingHeaderSize = 0;
+	bool hasPendingMessage = false;
+	int32 pendingMessageSize = 0;
+	TArray<uint8> pendingMessage;
+
+	//the raw stream of a registered RCON server bypasses wrapping and message events
+	FSocketServerTCPRawWriter rawWriter;
+	uint64 rconGeneration = MAX_uint64;
+	TSharedPtr<FSocketServerRCONEndpoint, ESPMode::ThreadSafe> rconEndpoint;
+	TUniquePtr<FSocketServerRCONParser> rconParser;
+};
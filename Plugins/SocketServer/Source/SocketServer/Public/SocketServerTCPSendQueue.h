@@ -0,0 +1,62 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "SocketServer.h"
+
+/*one queued TCP message. the byte wrapping header stays next to the payload instead of being copied in front of it*/
+struct SOCKETSERVER_API FSocketServerTCPSendItem {
+
+	TArray<uint8> payload;
+	uint8 header[5];
+	int32 headerSize = 0;
+
+	FSocketServerTCPSendItem() {}
+	FSocketServerTCPSendItem(TArray<uint8>&& payloadP, bool byteWrapping);
+
+	int32 size() const {
+		return headerSize + payload.Num();
+	}
+};
+
+
+/*
+* Outgoing messages of one connection. write() hands as many queued messages as possible to the OS in one
+* gathered call (sendmsg with an iovec per header and payload on Linux) and remembers how far a short write got.
+* Not thread safe.
+*/
+class SOCKETSERVER_API FSocketServerTCPSendQueue {
+
+public:
+
+	void add(FSocketServerTCPSendItem&& item);
+	bool isEmpty() const {
+		return head >= items.Num();
+	}
+	int32 num() const {
+		return items.Num() - head;
+	}
+	//header and payload bytes of all messages that are not completely sent
+	int64 bytes() const {
+		return queuedBytes;
+	}
+
+	//one non blocking write. returns the written bytes, 0 if the socket would block and -1 on errors.
+	//every finished message is counted as sent and leaves the queue depth
+	int64 write(FSocket* socket, FSocketServerSessionCounters* counters);
+	//drops everything that is not sent yet
+	void empty(FSocketServerSessionCounters* counters);
+
+private:
+
+	//checks head, offset and the compaction across partial writes
+	friend class FSocketServerTCPSendQueuePartialWriteTest;
+
+	void advance(int64 bytes, FSocketServerSessionCounters* counters);
+
+	TArray<FSocketServerTCPSendItem> items;
+	int32 head = 0;
+	//bytes of items[head] (header + payload) that are already written
+	int32 offset = 0;
+	int64 queuedBytes = 0;
+	TArray<uint8> coalesceBuffer;
+};
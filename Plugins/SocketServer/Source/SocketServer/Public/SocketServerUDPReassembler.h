@@ -0,0 +1,87 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/List.h"
+#include "SocketServerUDPSessionTable.h"
+
+/*
+* Header in front of every fragment of a message that is larger than maxPacketSize. Little endian:
+* uint16 magic | uint8 version | uint8 reserved | uint32 messageID | uint16 index | uint16 count
+*/
+struct SOCKETSERVER_API FSocketServerUDPFragmentHeader {
+
+	static const int32 size = 12;
+	static const uint16 magic = 0xF7A5;
+	static const uint8 version = 1;
+
+	uint32 messageID = 0;
+	uint16 index = 0;
+	uint16 count = 0;
+
+	void write(uint8* out) const;
+	//false if the datagram does not start with a valid fragment header
+	bool read(const uint8* data, int32 dataSize);
+};
+
+
+/*
+* Puts fragmented messages back together. One instance per receive thread, not thread safe.
+* Fragments may arrive in any order. Incomplete messages are dropped after a timeout or, oldest first,
+* when the buffered bytes exceed the memory limit. The bookkeeping of a message counts against the limit
+* as well, so many tiny fragments with fresh message ids can not grow the buffers past it.
+*/
+class SOCKETSERVER_API FSocketServerUDPReassembler {
+
+public:
+
+	FSocketServerUDPReassembler() {}
+	//order holds raw list nodes
+	UE_NONCOPYABLE(FSocketServerUDPReassembler);
+
+	//returns true and fills message when this fragment completed a message
+	bool add(const FSocketServerUDPAddressKey& sender, const FSocketServerUDPFragmentHeader& header, const uint8* payload, int32 payloadSize,
+		double timeoutSeconds, int64 memoryLimit, TArray<uint8>& message);
+	int32 getDroppedMessages() const { return droppedMessages; }
+
+private:
+
+	struct FMessageKey {
+		FSocketServerUDPAddressKey sender;
+		uint32 messageID = 0;
+
+		bool operator==(const FMessageKey& other) const {
+			return messageID == other.messageID && sender == other.sender;
+		}
+
+		friend uint32 GetTypeHash(const FMessageKey& key) {
+			return HashCombine(GetTypeHash(key.sender), key.messageID);
+		}
+	};
+
+	typedef TDoubleLinkedList<FMessageKey> FMessageOrder;
+
+	struct FPendingMessage {
+		TArray<TArray<uint8>> fragments;
+		int32 received = 0;
+		//payload plus bookkeeping, this is what counts against the memory limit
+		int64 bytes = 0;
+		double firstSeen = 0;
+		FMessageOrder::TDoubleLinkedListNode* orderNode = nullptr;
+	};
+
+	static int64 overheadBytes(int32 fragmentCount) {
+		return (int64)sizeof(FPendingMessage) + (int64)sizeof(FMessageKey) * 2 + (int64)fragmentCount * (int64)sizeof(TArray<uint8>);
+	}
+
+	void remove(const FMessageKey& key, bool dropped);
+	void purge(double now, double timeoutSeconds);
+	bool evictOldest();
+
+	TMap<FMessageKey, FPendingMessage> pending;
+	//oldest first, so eviction and timeouts never scan all pending messages
+	FMessageOrder order;
+	int64 bufferedBytes = 0;
+	double lastPurge = 0;
+	int32 droppedMessages = 0;
+};
@@ -0,0 +1,78 @@
+// Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IPAddress.h"
+#include "HAL/CriticalSection.h"
+#include <atomic>
+
+struct FClientSocketSession;
+
+typedef TSharedPtr<FClientSocketSession, ESPMode::ThreadSafe> FClientSocketSessionPtr;
+
+/*binary remote address (ip + port). replaces the "ip:port" string as lookup key for incoming datagrams*/
+struct SOCKETSERVER_API FSocketServerUDPAddressKey {
+
+	uint64 high = 0;
+	uint64 low = 0;
+	//port in the lower 16 bits, ip version above
+	uint32 portAndFamily = 0;
+
+	FSocketServerUDPAddressKey() {}
+	explicit FSocketServerUDPAddressKey(const FInternetAddr& addr);
+	FSocketServerUDPAddressKey(const uint8* ipBytes, int32 ipSize, uint16 port);
+
+	bool operator==(const FSocketServerUDPAddressKey& other) const {
+		return high == other.high && low == other.low && portAndFamily == other.portAndFamily;
+	}
+
+	friend uint32 GetTypeHash(const FSocketServerUDPAddressKey& key) {
+		return HashCombine(HashCombine(GetTypeHash(key.high), GetTypeHash(key.low)), key.portAndFamily);
+	}
+};
+
+
+/*
+* Session table of a UDP server. Writes (new or removed sessions) copy the affected shard and publish it
+* under a lock. Every receive thread keeps a FReader with its own references to the shards, lookups through
+* a reader only lock when the table changed since the last lookup. Old shards stay alive as long as a reader
+* still references them.
+*/
+class SOCKETSERVER_API FSocketServerUDPSessionTable {
+
+public:
+
+	static const int32 shardCount = 64;
+	typedef TMap<FSocketServerUDPAddressKey, FClientSocketSessionPtr> FShardMap;
+	typedef TSharedPtr<const FShardMap, ESPMode::ThreadSafe> FShardMapPtr;
+
+	struct FReader {
+		uint64 generation = MAX_uint64;
+		FShardMapPtr shards[shardCount];
+	};
+
+	FSocketServerUDPSessionTable();
+
+	//the returned pointer stays valid until the next lookup through the same reader
+	FClientSocketSession* find(const FSocketServerUDPAddressKey& key, FReader& reader) const;
+	FClientSocketSessionPtr findByID(const FString& sessionID) const;
+
+	//returns the session that is stored afterwards. if another thread added the address first that session wins.
+	//an existing session with the same ID under another address is replaced
+	FClientSocketSessionPtr add(const FSocketServerUDPAddressKey& key, FClientSocketSessionPtr session);
+	FClientSocketSessionPtr remove(const FString& sessionID);
+	TArray<FClientSocketSessionPtr> getAll() const;
+	int32 num() const;
+
+private:
+
+	static int32 shardIndex(const FSocketServerUDPAddressKey& key) {
+		return (int32)(GetTypeHash(key) & (shardCount - 1));
+	}
+
+	mutable FCriticalSection writeLock;
+	FShardMapPtr shards[shardCount];
+	TMap<FString, FSocketServerUDPAddressKey> keysByID;
+	TMap<FString, FClientSocketSessionPtr> sessionsByID;
+	std::atomic<uint64> generation{ 0 };
+};
@@ -1,5 +1,6 @@
 // Copyright 2017-2020 David Romanski (Socke). All Rights Reserved.
 
+using System.IO;
 using UnrealBuildTool;
 
 public class SocketServer : ModuleRules
@@ -47,6 +48,28 @@ public class SocketServer : ModuleRules
 			);
 		
 		
+		// Native socket access (recvmmsg and friends) needs the BSD socket classes of the engine
+		if (Target.Platform == UnrealTargetPlatform.Linux)
+		{
+			PrivateIncludePaths.Add(Path.Combine(EngineDirectory, "Source/Runtime/Sockets/Private"));
+			PrivateDefinitions.Add("SOCKETSERVER_WITH_NATIVE_SOCKETS=1");
+		}
+		else
+		{
+			PrivateDefinitions.Add("SOCKETSERVER_WITH_NATIVE_SOCKETS=0");
+		}
+
+		// posix_fadvise, fallocate, sendfile and friends for the file server. Independent of the socket subsystem
+		if (Target.Platform == UnrealTargetPlatform.Linux)
+		{
+			PrivateDefinitions.Add("SOCKETSERVER_WITH_NATIVE_FILES=1");
+		}
+		else
+		{
+			PrivateDefinitions.Add("SOCKETSERVER_WITH_NATIVE_FILES=0");
+		}
+
+
 		DynamicallyLoadedModuleNames.AddRange(
 			new string[]
 			{
@@ -0,0 +1,301 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Classes/LumafuseGridAutoTiler.h"
+
+#include "SocketServerBPLibrary.h"
+#include "LowEntryExtendedStandardLibrary/Public/Classes/LowEntryExtendedStandardLibrary.h"
+
+
+ULumafuseGridAutoTiler::ULumafuseGridAutoTiler()
+{
+	CandidateLayouts.Add(FIntPoint(1, 1));
+	CandidateLayouts.Add(FIntPoint(2, 2));
+	CandidateLayouts.Add(FIntPoint(3, 2));
+	CandidateLayouts.Add(FIntPoint(4, 2));
+	CandidateLayouts.Add(FIntPoint(4, 4));
+
+	ChangeHeat.Init(1.0f, HeatGridSize * HeatGridSize);
+	ChangedThisFrame.Init(false, HeatGridSize * HeatGridSize);
+}
+
+void ULumafuseGridAutoTiler::Initialize(FIntPoint InFrameSize, FIntPoint InitialLayout)
+{
+	FScopeLock ScopeLock(&Lock);
+	FrameSize = FIntPoint(FMath::Max(InFrameSize.X, 1), FMath::Max(InFrameSize.Y, 1));
+	CurrentLayout = FIntPoint(FMath::Max(InitialLayout.X, 1), FMath::Max(InitialLayout.Y, 1));
+	LayoutSequence = 0;
+
+	SumWeight = SumPixels = SumMilliseconds = SumPixelsSquared = SumPixelsMilliseconds = 0.0;
+	BytesPerPixel = DefaultBytesPerPixel;
+	PacketLossRate = 0.0f;
+
+	//Until we know better, assume every region of the frame changes every frame
+	ChangeHeat.Init(1.0f, HeatGridSize * HeatGridSize);
+	ChangedThisFrame.Init(false, HeatGridSize * HeatGridSize);
+
+	PendingLayout = FIntPoint::ZeroValue;
+	PendingWins = 0;
+	LastChangeSeconds = FPlatformTime::Seconds();
+}
+
+void ULumafuseGridAutoTiler::RecordTileEncode(FIntPoint TileSize, float EncodeMilliseconds, int32 CompressedBytes)
+{
+	FScopeLock ScopeLock(&Lock);
+	const double Pixels = FMath::Max(TileSize.X * TileSize.Y, 1);
+	const double Alpha = FMath::Clamp(SmoothingFactor, 0.001f, 1.0f);
+
+	//Decay the old samples so the fit follows thermal throttling, background load, content changes...
+	const double Decay = 1.0 - Alpha;
+	SumWeight = SumWeight * Decay + 1.0;
+	SumPixels = SumPixels * Decay + Pixels;
+	SumMilliseconds = SumMilliseconds * Decay + EncodeMilliseconds;
+	SumPixelsSquared = SumPixelsSquared * Decay + Pixels * Pixels;
+	SumPixelsMilliseconds = SumPixelsMilliseconds * Decay + Pixels * EncodeMilliseconds;
+
+	BytesPerPixel = FMath::Lerp(BytesPerPixel, (float)(CompressedBytes / Pixels), (float)Alpha);
+}
+
+void ULumafuseGridAutoTiler::RecordPacketLoss(int32 PacketsSent, int32 PacketsLost)
+{
+	if (PacketsSent <= 0)
+	{
+		return;
+	}
+
+	FScopeLock ScopeLock(&Lock);
+	const float Loss = FMath::Clamp((float)PacketsLost / PacketsSent, 0.0f, 1.0f);
+	PacketLossRate = FMath::Lerp(PacketLossRate, Loss, FMath::Clamp(SmoothingFactor, 0.001f, 1.0f));
+}
+
+void ULumafuseGridAutoTiler::RecordChangedBlock(FIntPoint BlockCoordinate, FIntPoint BlockLayout)
+{
+	if (BlockLayout.X <= 0 || BlockLayout.Y <= 0 || BlockCoordinate.X < 0 || BlockCoordinate.Y < 0
+		|| BlockCoordinate.X >= BlockLayout.X || BlockCoordinate.Y >= BlockLayout.Y)
+	{
+		return;
+	}
+
+	//Map the block of whatever layout was in use onto the fixed resolution change grid.
+	//Layouts finer than the grid (more than HeatGridSize blocks per axis) mark the cell the block falls into
+	const int32 MinX = BlockCoordinate.X * HeatGridSize / BlockLayout.X;
+	const int32 MaxX = FMath::Max((BlockCoordinate.X + 1) * HeatGridSize / BlockLayout.X, MinX + 1);
+	const int32 MinY = BlockCoordinate.Y * HeatGridSize / BlockLayout.Y;
+	const int32 MaxY = FMath::Max((BlockCoordinate.Y + 1) * HeatGridSize / BlockLayout.Y, MinY + 1);
+
+	FScopeLock ScopeLock(&Lock);
+	for (int32 Y = MinY; Y < FMath::Min(MaxY, HeatGridSize); Y++)
+	{
+		for (int32 X = MinX; X < FMath::Min(MaxX, HeatGridSize); X++)
+		{
+			ChangedThisFrame[Y * HeatGridSize + X] = true;
+		}
+	}
+}
+
+void ULumafuseGridAutoTiler::EndFrame()
+{
+	FScopeLock ScopeLock(&Lock);
+	const float Alpha = FMath::Clamp(SmoothingFactor, 0.001f, 1.0f);
+	for (int32 i = 0; i < ChangeHeat.Num(); i++)
+	{
+		ChangeHeat[i] = FMath::Lerp(ChangeHeat[i], ChangedThisFrame[i] ? 1.0f : 0.0f, Alpha);
+		ChangedThisFrame[i] = false;
+	}
+}
+
+int32 ULumafuseGridAutoTiler::GetEncoderCores() const
+{
+	return FMath::Max(EncoderCores > 0 ? EncoderCores : FPlatformMisc::NumberOfCores(), 1);
+}
+
+float ULumafuseGridAutoTiler::GetTileEncodeMilliseconds(float TilePixels) const
+{
+	//Fit EncodeMs = Overhead + PerPixel * Pixels, the fixed overhead is what punishes tiny tiles
+	double Overhead = 0.5;
+	double PerPixel = 20.0 / (1920.0 * 1080.0);
+
+	if (SumWeight > 1.5)
+	{
+		const double MeanPixels = SumPixels / SumWeight;
+		const double MeanMilliseconds = SumMilliseconds / SumWeight;
+		const double Variance = SumPixelsSquared / SumWeight - MeanPixels * MeanPixels;
+
+		if (Variance > 1.0)
+		{
+			PerPixel = FMath::Max((SumPixelsMilliseconds / SumWeight - MeanPixels * MeanMilliseconds) / Variance, 0.0);
+			Overhead = FMath::Max(MeanMilliseconds - PerPixel * MeanPixels, 0.0);
+		}
+		else
+		{
+			//All samples were taken at the same tile size, so we can only scale the measured time
+			PerPixel = MeanMilliseconds / FMath::Max(MeanPixels, 1.0);
+			Overhead = 0.0;
+		}
+	}
+
+	return (float)(Overhead + PerPixel * TilePixels);
+}
+
+float ULumafuseGridAutoTiler::GetDirtyProbability(FIntPoint Layout, int32 TileX, int32 TileY) const
+{
+	const int32 MinX = TileX * HeatGridSize / Layout.X;
+	const int32 MaxX = FMath::Max((TileX + 1) * HeatGridSize / Layout.X, MinX + 1);
+	const int32 MinY = TileY * HeatGridSize / Layout.Y;
+	const int32 MaxY = FMath::Max((TileY + 1) * HeatGridSize / Layout.Y, MinY + 1);
+
+	//A tile has to be re-sent as soon as any of the cells it covers changes
+	float CleanProbability = 1.0f;
+	for (int32 Y = MinY; Y < FMath::Min(MaxY, HeatGridSize); Y++)
+	{
+		for (int32 X = MinX; X < FMath::Min(MaxX, HeatGridSize); X++)
+		{
+			CleanProbability *= 1.0f - ChangeHeat[Y * HeatGridSize + X];
+		}
+	}
+
+	return 1.0f - CleanProbability;
+}
+
+FIntPoint ULumafuseGridAutoTiler::GetCurrentLayout() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return CurrentLayout;
+}
+
+int32 ULumafuseGridAutoTiler::GetLayoutSequence() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return LayoutSequence;
+}
+
+float ULumafuseGridAutoTiler::EstimateLayoutCost(FIntPoint Layout) const
+{
+	if (Layout.X <= 0 || Layout.Y <= 0)
+	{
+		return MAX_flt;
+	}
+
+	FScopeLock ScopeLock(&Lock);
+	const float TilePixels = (float)FrameSize.X * FrameSize.Y / (Layout.X * Layout.Y);
+	const float TileMilliseconds = GetTileEncodeMilliseconds(TilePixels);
+	const float TileBytes = TilePixels * BytesPerPixel;
+	const float TilePackets = FMath::Max(FMath::CeilToFloat(TileBytes / FMath::Max(PayloadBytesPerPacket, 1)), 1.0f);
+
+	//Losing any one packet invalidates the whole tile, so bigger tiles have a bigger blast radius
+	const float TileLossProbability = 1.0f - FMath::Pow(1.0f - PacketLossRate, TilePackets);
+
+	float ExpectedDirtyTiles = 0.0f;
+	for (int32 TileY = 0; TileY < Layout.Y; TileY++)
+	{
+		for (int32 TileX = 0; TileX < Layout.X; TileX++)
+		{
+			ExpectedDirtyTiles += GetDirtyProbability(Layout, TileX, TileY);
+		}
+	}
+
+	//Dirty tiles are encoded in parallel, but one dirty tile still takes a full tile encode
+	const float EncodeWaves = FMath::Max(ExpectedDirtyTiles / GetEncoderCores(), FMath::Min(ExpectedDirtyTiles, 1.0f));
+	const float EncodeCost = TileMilliseconds * EncodeWaves;
+
+	const float ResentKilobytes = ExpectedDirtyTiles * TileLossProbability * TileBytes / 1024.0f;
+	const float LossCost = ResentKilobytes * PacketLossCostPerKilobyte;
+
+	return EncodeCost + LossCost;
+}
+
+FIntPoint ULumafuseGridAutoTiler::EvaluateLayout(bool& bLayoutChanged)
+{
+	//FCriticalSection is recursive, EstimateLayoutCost takes it again
+	FScopeLock ScopeLock(&Lock);
+	bLayoutChanged = false;
+
+	FIntPoint BestLayout = CurrentLayout;
+	float BestCost = MAX_flt;
+	for (const FIntPoint& Candidate : CandidateLayouts)
+	{
+		const float Cost = EstimateLayoutCost(Candidate);
+		if (Cost < BestCost)
+		{
+			BestCost = Cost;
+			BestLayout = Candidate;
+		}
+	}
+
+	//Only a clear improvement counts as a win for the candidate, anything else resets the streak
+	const float CurrentCost = EstimateLayoutCost(CurrentLayout);
+	if (BestLayout == CurrentLayout || BestCost > CurrentCost * (1.0f - HysteresisMargin))
+	{
+		PendingLayout = FIntPoint::ZeroValue;
+		PendingWins = 0;
+		return CurrentLayout;
+	}
+
+	if (BestLayout != PendingLayout)
+	{
+		PendingLayout = BestLayout;
+		PendingWins = 0;
+	}
+	PendingWins++;
+
+	const double Now = FPlatformTime::Seconds();
+	if (PendingWins >= StableEvaluationsRequired && Now - LastChangeSeconds >= MinSecondsBetweenChanges)
+	{
+		CurrentLayout = BestLayout;
+		LayoutSequence++;
+		LastChangeSeconds = Now;
+		PendingLayout = FIntPoint::ZeroValue;
+		PendingWins = 0;
+		bLayoutChanged = true;
+	}
+
+	return CurrentLayout;
+}
+
+
+// Layout change packet structure:
+// As TArray<uint8>
+// {
+//   [0] ControlPacketMarker 0xFF (uint8, never a DisplayID of a block packet)
+//   [1-4] Magic "LFLC" (4 x uint8)
+//   [5] DisplayID (uint8)
+//   [6-9] LayoutSequence (int32->TArray<uint8> of size 4)
+//   [10-13] GridLayoutX (int32->TArray<uint8> of size 4)
+//   [14-17] GridLayoutY (int32->TArray<uint8> of size 4)
+// }
+// Receivers should drop block packets whose grid layout does not match the newest sequence they have seen
+
+TArray<uint8> ULumafuseGridAutoTiler::BuildLayoutChangePacket(uint8 DisplayID, int32 Sequence, FIntPoint Layout)
+{
+	TArray<uint8> Packet;
+	Packet.Add(ControlPacketMarker);
+	Packet.Add('L');
+	Packet.Add('F');
+	Packet.Add('L');
+	Packet.Add('C');
+	Packet.Add(DisplayID);
+	Packet.Append(ULowEntryExtendedStandardLibrary::IntegerToBytes(Sequence));
+	Packet.Append(ULowEntryExtendedStandardLibrary::IntegerToBytes(Layout.X));
+	Packet.Append(ULowEntryExtendedStandardLibrary::IntegerToBytes(Layout.Y));
+	return Packet;
+}
+
+void ULumafuseGridAutoTiler::SendLayoutChangeToClient(uint8 DisplayID, USocketServerBPLibrary* ServerTarget,
+	FString ClientSessionID, FString OptionalServerID)
+{
+	if (ServerTarget == nullptr)
+	{
+		return;
+	}
+
+	int32 Sequence;
+	FIntPoint Layout;
+	{
+		FScopeLock ScopeLock(&Lock);
+		Sequence = LayoutSequence;
+		Layout = CurrentLayout;
+	}
+	TArray<uint8> Packet = BuildLayoutChangePacket(DisplayID, Sequence, Layout);
+	//Layout changes must not wait behind queued frame data
+	ServerTarget->socketServerSendUDPMessageToClientWithPriority(ClientSessionID, "", Packet, false, ESocketServerUDPSendPriority::E_Control, ESocketServerUDPSocketType::E_SSS_CLIENT, OptionalServerID);
+}
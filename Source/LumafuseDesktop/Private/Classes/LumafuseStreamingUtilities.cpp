@@ -2,6 +2,7 @@
 
 
 #include "Classes/LumafuseStreamingUtilities.h"
+#include "Classes/LumafuseGridAutoTiler.h"
 
 #include "SocketServerBPLibrary.h"
 #include "LowEntryExtendedStandardLibrary/Public/Classes/LowEntryExtendedStandardLibrary.h"
@@ -37,6 +38,12 @@ void ULumafuseStreamingUtilities::DistillChunkPacketsAndSendToClient(uint8 Displ
 	int32 ChunkIndex, const TArray<uint8>& BufferChunk, USocketServerBPLibrary* ServerTarget,
 	FString ClientSessionID, FString OptionalServerID)
 {
+	if (DisplayID == ULumafuseGridAutoTiler::ControlPacketMarker)
+	{
+		UE_LOG(LogTemp, Error, TEXT("DisplayID %i is reserved for control packets"), DisplayID);
+		return;
+	}
+
 	//Initialize loop parameters to ensure that the frame data gets constructed properly
 	const int32 bufferChunkSize = BufferChunk.Num();
 	const int32 firstIndex = ChunkIndex * (bufferChunkSize / SplitSize);
@@ -81,7 +88,7 @@ void ULumafuseStreamingUtilities::DistillChunkPacketsAndSendToClient(uint8 Displ
 		TotalPacket.Append(CompressedPixelPacket);
 
 		//Send packet to client
-		ServerTarget->socketServerSendUDPMessageToClient(ClientSessionID, MessageToSend, TotalPacket,false, true, ESocketServerUDPSocketType::E_SSS_CLIENT, OptionalServerID);
+		ServerTarget->socketServerSendUDPMessageToClientWithPriority(ClientSessionID, MessageToSend, TotalPacket, false, ESocketServerUDPSendPriority::E_Bulk, ESocketServerUDPSocketType::E_SSS_CLIENT, OptionalServerID);
 		
 		//Increment the index that's used to determine the starting index for the new pixel buffer packet
 		ChunkSubArrayIndex += SplitSize;
@@ -122,7 +129,7 @@ void ULumafuseStreamingUtilities::OptimizeAndSendFrameChunkPackets(const TArray<
 		totalPacket.Append(compressedPixelPacket);
 		
 		//Send packet
-		serverTarget->socketServerSendUDPMessageToClient(clientSessionID, messageToSend, totalPacket, false, true, ESocketServerUDPSocketType::E_SSS_CLIENT, optionalServerID);
+		serverTarget->socketServerSendUDPMessageToClientWithPriority(clientSessionID, messageToSend, totalPacket, false, ESocketServerUDPSendPriority::E_Bulk, ESocketServerUDPSocketType::E_SSS_CLIENT, optionalServerID);
 	}
 
 }
@@ -0,0 +1,153 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Classes/LumafuseTileRateController.h"
+
+#include "Misc/ScopeLock.h"
+
+
+void ULumafuseTileRateController::SetGridLayout(FIntPoint InGridLayout)
+{
+	FScopeLock Lock(&StateSection);
+
+	InGridLayout = FIntPoint(FMath::Max(InGridLayout.X, 1), FMath::Max(InGridLayout.Y, 1));
+	if (InGridLayout == GridLayout)
+	{
+		return;
+	}
+
+	//The old tiles cover different pixels, their history does not apply to the new grid
+	GridLayout = InGridLayout;
+	Tiles.Empty();
+	TotalComplexity = 0.0f;
+}
+
+int32 ULumafuseTileRateController::GetTileBudget(FIntPoint BlockPosition) const
+{
+	FScopeLock Lock(&StateSection);
+	return GetTileBudgetLocked(BlockPosition);
+}
+
+int32 ULumafuseTileRateController::GetTileBudgetLocked(FIntPoint BlockPosition) const
+{
+	const int32 TileCount = GridLayout.X * GridLayout.Y;
+	const FTileRateState* State = Tiles.Find(BlockPosition);
+
+	//Without history for every tile an even split is the best guess
+	if (State == nullptr || Tiles.Num() < TileCount || TotalComplexity <= 0.0f)
+	{
+		return FMath::Max(FrameByteBudget / TileCount, 1);
+	}
+
+	return FMath::Max(FMath::RoundToInt(FrameByteBudget * (State->Complexity / TotalComplexity)), 1);
+}
+
+int32 ULumafuseTileRateController::QualityForBytes(const FTileRateState& State, float TargetBytes) const
+{
+	//ln(Target) - ln(Last) = Slope * (Quality - LastQuality)
+	const float Delta = FMath::Loge(FMath::Max(TargetBytes, 1.0f) / FMath::Max(State.LastBytes, 1)) / State.Slope;
+	return FMath::Clamp(FMath::FloorToInt(State.LastQuality + Delta), MinQuality, MaxQuality);
+}
+
+int32 ULumafuseTileRateController::PredictQuality(FIntPoint BlockPosition) const
+{
+	FScopeLock Lock(&StateSection);
+
+	const FTileRateState* State = Tiles.Find(BlockPosition);
+	if (State == nullptr || State->LastBytes <= 0)
+	{
+		return FMath::Clamp(InitialQuality, MinQuality, MaxQuality);
+	}
+
+	return QualityForBytes(*State, GetTileBudgetLocked(BlockPosition));
+}
+
+int32 ULumafuseTileRateController::CorrectQuality(FIntPoint BlockPosition, int32 Quality, int32 EncodedBytes) const
+{
+	FScopeLock Lock(&StateSection);
+
+	FTileRateState Observed;
+	if (const FTileRateState* State = Tiles.Find(BlockPosition))
+	{
+		Observed = *State;
+	}
+	Observed.LastQuality = Quality;
+	Observed.LastBytes = EncodedBytes;
+
+	//Always step down at least once, otherwise a retry would just produce the same bytes again
+	return FMath::Max(FMath::Min(QualityForBytes(Observed, GetTileBudgetLocked(BlockPosition)), Quality - 1), MinQuality);
+}
+
+bool ULumafuseTileRateController::ShouldRetry(FIntPoint BlockPosition, int32 EncodedBytes, int32 RetriesDone) const
+{
+	FScopeLock Lock(&StateSection);
+	return RetriesDone < MaxRetryEncodes && EncodedBytes > GetTileBudgetLocked(BlockPosition) * (1.0f + OvershootTolerance);
+}
+
+void ULumafuseTileRateController::RecordEncode(FIntPoint BlockPosition, int32 Quality, int32 EncodedBytes)
+{
+	FScopeLock Lock(&StateSection);
+
+	FTileRateState& State = Tiles.FindOrAdd(BlockPosition);
+	const bool bHadHistory = State.LastBytes > 0;
+
+	//Two encodes at different qualities give us the local slope of this tile's size curve
+	if (bHadHistory && State.LastQuality != Quality && EncodedBytes > 0)
+	{
+		const float MeasuredSlope = FMath::Loge((float)EncodedBytes / State.LastBytes) / (Quality - State.LastQuality);
+		if (MeasuredSlope > 0.005f && MeasuredSlope < 0.2f)
+		{
+			State.Slope = FMath::Lerp(State.Slope, MeasuredSlope, 0.3f);
+		}
+	}
+
+	State.LastQuality = Quality;
+	State.LastBytes = FMath::Max(EncodedBytes, 1);
+
+	const float NewComplexity = State.LastBytes * FMath::Exp(State.Slope * (ReferenceQuality - Quality));
+	if (bHadHistory)
+	{
+		TotalComplexity -= State.Complexity;
+	}
+	State.Complexity = NewComplexity;
+	TotalComplexity += NewComplexity;
+}
+
+void ULumafuseTileRateController::RecordTileFinished(int32 TileBudget, int32 FinalBytes, int32 Retries,
+	float EncodeMilliseconds, float RetryMilliseconds)
+{
+	FScopeLock Lock(&StateSection);
+
+	const int32 Budget = FMath::Max(TileBudget, 1);
+
+	Stats.TilesEncoded++;
+	Stats.RetryEncodes += Retries;
+	if (FinalBytes <= Budget * (1.0f + OvershootTolerance))
+	{
+		Stats.TilesWithinBudget++;
+	}
+
+	SumBudgetRatio += (double)FinalBytes / Budget;
+	SumEncodeMilliseconds += EncodeMilliseconds;
+	SumRetryMilliseconds += RetryMilliseconds;
+
+	Stats.AverageBudgetRatio = SumBudgetRatio / Stats.TilesEncoded;
+	Stats.AverageEncodeMilliseconds = SumEncodeMilliseconds / Stats.TilesEncoded;
+	Stats.AverageRetryMilliseconds = SumRetryMilliseconds / Stats.TilesEncoded;
+}
+
+FLumafuseRateControlStats ULumafuseTileRateController::GetStats() const
+{
+	FScopeLock Lock(&StateSection);
+	return Stats;
+}
+
+void ULumafuseTileRateController::ResetStats()
+{
+	FScopeLock Lock(&StateSection);
+
+	Stats = FLumafuseRateControlStats();
+	SumBudgetRatio = 0.0;
+	SumEncodeMilliseconds = 0.0;
+	SumRetryMilliseconds = 0.0;
+}
@@ -73,7 +73,18 @@ void ULumafuseBufferBlockWorker::CopyTextureBlock(const FTexture2DRHIRef& Source
 void ULumafuseBufferBlockWorker::GetPixelBufferBlockFromRenderTargetThreadSafe(UTextureRenderTarget2D* TextureRenderTarget, FIntPoint BlockPosition, FIntPoint GridLayout,
 																		TArray<uint8>& Buffer, int32 CompressionQuality)
 {
-	ENQUEUE_RENDER_COMMAND(ReadSurfaceCommand)([this, TextureRenderTarget, &Buffer, CompressionQuality, BlockPosition, GridLayout](FRHICommandListImmediate& RHICmdList)
+	ReadBlockAndEncode(TextureRenderTarget, BlockPosition, GridLayout, Buffer, [this, &Buffer, CompressionQuality](TArray<FColor>& Data, FIntPoint BlockSize)
+	{
+		// Compress the surface data and set the byte data to the buffer
+		CompressPixelsToBuffer(Data, Buffer, BlockSize.X, BlockSize.Y, CompressionQuality);
+	});
+}
+
+void ULumafuseBufferBlockWorker::ReadBlockAndEncode(UTextureRenderTarget2D* TextureRenderTarget, FIntPoint BlockPosition, FIntPoint GridLayout,
+																		TArray<uint8>& Buffer, TFunction<void(TArray<FColor>& SurfaceData, FIntPoint BlockSize)> Encode)
+{
+	ULumafuseGridAutoTiler* Tiler = AutoTiler;
+	ENQUEUE_RENDER_COMMAND(ReadSurfaceCommand)([this, TextureRenderTarget, &Buffer, BlockPosition, GridLayout, Tiler, Encode](FRHICommandListImmediate& RHICmdList)
 {
 	// A frame is supplied so immediately read its data and compress it with JPEG compression.
 	FTexture2DRHIRef Texture2DRHI = (TextureRenderTarget->Resource && TextureRenderTarget->Resource->TextureRHI) ? TextureRenderTarget->Resource->TextureRHI->GetTexture2D() : nullptr;
@@ -101,8 +112,13 @@ void ULumafuseBufferBlockWorker::GetPixelBufferBlockFromRenderTargetThreadSafe(U
 	FIntRect Rect(0, 0, BlockSize.X, BlockSize.Y);
 	RHICmdList.ReadSurfaceData(DestTexture, Rect, Data, FReadSurfaceDataFlags());
 
-	// Compress the surface data and set the byte data to the buffer
-	CompressPixelsToBuffer(Data, Buffer, BlockSize.X, BlockSize.Y, CompressionQuality);
+	const double EncodeStartSeconds = FPlatformTime::Seconds();
+	Encode(Data, BlockSize);
+	if (Tiler != nullptr)
+	{
+		// Retries of rate controlled blocks included, they are part of what a tile of this size costs
+		Tiler->RecordTileEncode(BlockSize, (FPlatformTime::Seconds() - EncodeStartSeconds) * 1000.0, Buffer.Num());
+	}
 });
 }
 
@@ -159,6 +175,68 @@ void ULumafuseBufferBlockWorker::CompressPixelsToBuffer(TArray<FColor>& SurfaceD
 	}
 }
 
+void ULumafuseBufferBlockWorker::GetPixelBufferBlockFromRenderTargetRateControlled(UTextureRenderTarget2D* TextureRenderTarget, FIntPoint BlockPosition, FIntPoint GridLayout,
+																		TArray<uint8>& Buffer, ULumafuseTileRateController* RateController)
+{
+	if (RateController == nullptr)
+	{
+		UE_LOG(LogTemp, Error, TEXT("No rate controller supplied for block %s"), *BlockPosition.ToString());
+		return;
+	}
+
+	RateController->SetGridLayout(GridLayout);
+
+	ReadBlockAndEncode(TextureRenderTarget, BlockPosition, GridLayout, Buffer, [this, &Buffer, BlockPosition, RateController](TArray<FColor>& Data, FIntPoint BlockSize)
+	{
+		// Compress the surface data with the quality the controller predicts for this block
+		CompressPixelsToBufferRateControlled(Data, Buffer, BlockSize.X, BlockSize.Y, BlockPosition, RateController);
+	});
+}
+
+void ULumafuseBufferBlockWorker::CompressPixelsToBufferRateControlled(TArray<FColor>& SurfaceData, TArray<uint8>& Buffer,
+	int32 SizeX, int32 SizeY, FIntPoint BlockPosition, ULumafuseTileRateController* RateController)
+{
+	IImageWrapperModule& ImageWrapperModule = FModuleManager::GetModuleChecked<IImageWrapperModule>(TEXT("ImageWrapper"));
+	TSharedPtr<IImageWrapper> ImageWrapper = ImageWrapperModule.CreateImageWrapper(EImageFormat::JPEG);
+
+	const int32 TileBudget = RateController->GetTileBudget(BlockPosition);
+	int32 Quality = RateController->PredictQuality(BlockPosition);
+	int32 Retries = 0;
+	double RetrySeconds = 0.0;
+	const double StartSeconds = FPlatformTime::Seconds();
+
+	while (true)
+	{
+		const double EncodeStartSeconds = FPlatformTime::Seconds();
+
+		// The wrapper keeps its compressed result, so the raw data is set again to force a fresh encode on retries
+		if (!ImageWrapper->SetRaw(SurfaceData.GetData(), SurfaceData.GetAllocatedSize(), SizeX, SizeY, ERGBFormat::BGRA, 8))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Failed to compress image"));
+			return;
+		}
+		Buffer = ImageWrapper->GetCompressed(Quality);
+		RateController->RecordEncode(BlockPosition, Quality, Buffer.Num());
+
+		if (Retries > 0)
+		{
+			RetrySeconds += FPlatformTime::Seconds() - EncodeStartSeconds;
+		}
+
+		// Only re-encode when the prediction missed badly and there is still quality left to give up
+		if (Quality <= RateController->MinQuality || !RateController->ShouldRetry(BlockPosition, Buffer.Num(), Retries))
+		{
+			break;
+		}
+
+		Quality = RateController->CorrectQuality(BlockPosition, Quality, Buffer.Num());
+		Retries++;
+	}
+
+	const float EncodeMilliseconds = (FPlatformTime::Seconds() - StartSeconds) * 1000.0;
+	RateController->RecordTileFinished(TileBudget, Buffer.Num(), Retries, EncodeMilliseconds, RetrySeconds * 1000.0);
+}
+
 // Separate and send buffer block
 
 // Looping through the buffer block to:
@@ -188,6 +266,17 @@ void ULumafuseBufferBlockWorker::SeparateAndSendBufferBlock(uint8 DisplayID, uin
 	const TArray<uint8>& BufferBlock, USocketServerBPLibrary* ServerTarget, FString ClientSessionID,
 	FString OptionalServerID)
 {
+	if (DisplayID == ULumafuseGridAutoTiler::ControlPacketMarker)
+	{
+		UE_LOG(LogTemp, Error, TEXT("DisplayID %i is reserved for control packets"), DisplayID);
+		return;
+	}
+
+	// Every block that goes out counts as changed in this frame
+	if (AutoTiler != nullptr)
+	{
+		AutoTiler->RecordChangedBlock(BlockCoordinate, BlockLayout);
+	}
 
 	constexpr int32 PacketSize = 4096;
 	int32 PayloadSize = PacketSize - 27; // 27 bytes is the size of the header
@@ -227,7 +316,7 @@ void ULumafuseBufferBlockWorker::SeparateAndSendBufferBlock(uint8 DisplayID, uin
 		}
 
 		// Sending the packet out to the client
-		ServerTarget->socketServerSendUDPMessageToClient(ClientSessionID, MessageToSend, TotalPacket,false, true, ESocketServerUDPSocketType::E_SSS_CLIENT, OptionalServerID);
+		ServerTarget->socketServerSendUDPMessageToClientWithPriority(ClientSessionID, MessageToSend, TotalPacket, false, ESocketServerUDPSendPriority::E_Bulk, ESocketServerUDPSocketType::E_SSS_CLIENT, OptionalServerID);
 	}
 
 
@@ -0,0 +1,113 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Classes/LumafuseGridAutoTiler.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	const FIntPoint TestFrameSize(1920, 1080);
+
+	//Feeds one frame: an encode sample for the tile size of every candidate, the changed blocks, then evaluates.
+	//Encode times follow 0.5 ms + 20 ms per full frame with 5% noise
+	FIntPoint SimulateFrame(ULumafuseGridAutoTiler* Tiler, FRandomStream& Random, TFunctionRef<void(ULumafuseGridAutoTiler*)> MarkChanges, int32& LayoutChanges)
+	{
+		for (const FIntPoint& Layout : Tiler->CandidateLayouts)
+		{
+			const FIntPoint TileSize(TestFrameSize.X / Layout.X, TestFrameSize.Y / Layout.Y);
+			const float Pixels = (float)TileSize.X * TileSize.Y;
+			const float Milliseconds = (0.5f + 20.0f * Pixels / (TestFrameSize.X * TestFrameSize.Y)) * Random.FRandRange(0.95f, 1.05f);
+			Tiler->RecordTileEncode(TileSize, Milliseconds, (int32)(Pixels * 0.3f));
+		}
+
+		MarkChanges(Tiler);
+		Tiler->EndFrame();
+
+		bool bLayoutChanged = false;
+		const FIntPoint Layout = Tiler->EvaluateLayout(bLayoutChanged);
+		if (bLayoutChanged)
+		{
+			LayoutChanges++;
+		}
+		return Layout;
+	}
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLumafuseGridAutoTilerConvergenceTest, "Lumafuse.GridAutoTiler.Convergence",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLumafuseGridAutoTilerConvergenceTest::RunTest(const FString& Parameters)
+{
+	ULumafuseGridAutoTiler* Tiler = NewObject<ULumafuseGridAutoTiler>();
+	Tiler->EncoderCores = 8;
+	Tiler->SmoothingFactor = 0.2f;
+	Tiler->MinSecondsBetweenChanges = 0.0f;
+	Tiler->Initialize(TestFrameSize, FIntPoint(1, 1));
+	FRandomStream Random(26);
+	int32 LayoutChanges = 0;
+
+	//Full screen motion: every tile is dirty, so eight tiles on eight cores beat both fewer and more tiles
+	auto MarkEverything = [](ULumafuseGridAutoTiler* InTiler)
+	{
+		const FIntPoint Layout = InTiler->GetCurrentLayout();
+		for (int32 Y = 0; Y < Layout.Y; Y++)
+		{
+			for (int32 X = 0; X < Layout.X; X++)
+			{
+				InTiler->RecordChangedBlock(FIntPoint(X, Y), Layout);
+			}
+		}
+	};
+	for (int32 Frame = 0; Frame < 30; Frame++)
+	{
+		SimulateFrame(Tiler, Random, MarkEverything, LayoutChanges);
+	}
+	TestEqual(TEXT("Full motion settles on 4x2"), Tiler->GetCurrentLayout(), FIntPoint(4, 2));
+	TestEqual(TEXT("Full motion switches once"), LayoutChanges, 1);
+
+	for (int32 Frame = 0; Frame < 200; Frame++)
+	{
+		SimulateFrame(Tiler, Random, MarkEverything, LayoutChanges);
+	}
+	TestEqual(TEXT("Full motion stays on 4x2"), Tiler->GetCurrentLayout(), FIntPoint(4, 2));
+	TestEqual(TEXT("Full motion doesn't flap"), LayoutChanges, 1);
+
+	//Only the top left sixteenth keeps changing: once the rest has cooled down, small tiles only re-encode that corner
+	auto MarkCorner = [](ULumafuseGridAutoTiler* InTiler)
+	{
+		InTiler->RecordChangedBlock(FIntPoint(0, 0), FIntPoint(4, 4));
+	};
+	for (int32 Frame = 0; Frame < 100; Frame++)
+	{
+		SimulateFrame(Tiler, Random, MarkCorner, LayoutChanges);
+	}
+	TestEqual(TEXT("Corner motion settles on 4x4"), Tiler->GetCurrentLayout(), FIntPoint(4, 4));
+	TestEqual(TEXT("Corner motion switches once"), LayoutChanges, 2);
+
+	for (int32 Frame = 0; Frame < 200; Frame++)
+	{
+		SimulateFrame(Tiler, Random, MarkCorner, LayoutChanges);
+	}
+	TestEqual(TEXT("Corner motion stays on 4x4"), Tiler->GetCurrentLayout(), FIntPoint(4, 4));
+	TestEqual(TEXT("Corner motion doesn't flap"), LayoutChanges, 2);
+	TestEqual(TEXT("Sequence follows the switches"), Tiler->GetLayoutSequence(), 2);
+
+	//A candidate has to win several evaluations in a row before it is adopted
+	Tiler->StableEvaluationsRequired = 5;
+	Tiler->Initialize(TestFrameSize, FIntPoint(1, 1));
+	LayoutChanges = 0;
+	int32 Frames = 0;
+	while (LayoutChanges == 0 && Frames < 30)
+	{
+		SimulateFrame(Tiler, Random, MarkEverything, LayoutChanges);
+		Frames++;
+	}
+	TestTrue(FString::Printf(TEXT("Switched after %i evaluations, not before 5"), Frames), LayoutChanges == 1 && Frames >= 5);
+	TestEqual(TEXT("Initialize resets the sequence"), Tiler->GetLayoutSequence(), 1);
+	return true;
+}
+
+#endif
@@ -0,0 +1,193 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Classes/LumafuseTileRateController.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	struct FReplayedTile
+	{
+		int32 FinalBytes = 0;
+		int32 FinalQuality = 0;
+		int32 Retries = 0;
+		int32 LowestQuality = MAX_int32;
+		int32 HighestQuality = MIN_int32;
+	};
+
+	//Same loop as ULumafuseBufferBlockWorker::CompressPixelsToBufferRateControlled, with the JPEG encoder replaced by a size curve
+	FReplayedTile ReplayTile(ULumafuseTileRateController* Controller, FIntPoint BlockPosition, TFunctionRef<int32(int32 Quality)> EncodedSize)
+	{
+		FReplayedTile Tile;
+		const int32 TileBudget = Controller->GetTileBudget(BlockPosition);
+		int32 Quality = Controller->PredictQuality(BlockPosition);
+
+		while (true)
+		{
+			Tile.LowestQuality = FMath::Min(Tile.LowestQuality, Quality);
+			Tile.HighestQuality = FMath::Max(Tile.HighestQuality, Quality);
+			Tile.FinalBytes = EncodedSize(Quality);
+			Tile.FinalQuality = Quality;
+			Controller->RecordEncode(BlockPosition, Quality, Tile.FinalBytes);
+
+			if (Quality <= Controller->MinQuality || !Controller->ShouldRetry(BlockPosition, Tile.FinalBytes, Tile.Retries))
+			{
+				break;
+			}
+
+			Quality = Controller->CorrectQuality(BlockPosition, Quality, Tile.FinalBytes);
+			Tile.Retries++;
+		}
+
+		Controller->RecordTileFinished(TileBudget, Tile.FinalBytes, Tile.Retries, 0.0f, 0.0f);
+		return Tile;
+	}
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLumafuseTileRateControllerBudgetReplayTest, "Lumafuse.TileRateController.BudgetReplay",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLumafuseTileRateControllerBudgetReplayTest::RunTest(const FString& Parameters)
+{
+	const FIntPoint GridLayout(4, 4);
+	const int32 FrameCount = 60;
+	const int32 SceneCutFrame = 30;
+
+	for (int32 MaxRetryEncodes = 0; MaxRetryEncodes <= 2; MaxRetryEncodes++)
+	{
+		ULumafuseTileRateController* Controller = NewObject<ULumafuseTileRateController>();
+		Controller->FrameByteBudget = 256 * 1024;
+		Controller->MaxRetryEncodes = MaxRetryEncodes;
+		Controller->SetGridLayout(GridLayout);
+		FRandomStream Random(27);
+
+		//Every tile follows Size = Base * exp(Slope * (Quality - 50)) with 3% noise. Flat and busy tiles differ
+		//by 10x in size and the slopes differ from the controller's starting guess in both directions
+		TMap<FIntPoint, TPair<float, float>> Content;
+		for (int32 Y = 0; Y < GridLayout.Y; Y++)
+		{
+			for (int32 X = 0; X < GridLayout.X; X++)
+			{
+				Content.Add(FIntPoint(X, Y), TPair<float, float>(Random.FRandRange(2000.0f, 20000.0f), Random.FRandRange(0.02f, 0.045f)));
+			}
+		}
+
+		float LowestFrameRatio = MAX_flt;
+		float HighestFrameRatio = 0.0f;
+		int32 MostRetries = 0;
+		int32 LowestQuality = MAX_int32;
+		int32 HighestQuality = MIN_int32;
+
+		for (int32 Frame = 0; Frame < FrameCount; Frame++)
+		{
+			//The first frame has no history to split the budget by, the stats only cover the frames after it
+			if (Frame == 1)
+			{
+				Controller->ResetStats();
+			}
+
+			//Scene cut: every tile gets twice as expensive at once
+			if (Frame == SceneCutFrame)
+			{
+				for (auto& Element : Content)
+				{
+					Element.Value.Key *= 2.0f;
+				}
+			}
+
+			int64 FrameBytes = 0;
+			for (const auto& Element : Content)
+			{
+				const float Base = Element.Value.Key;
+				const float Slope = Element.Value.Value;
+				const FReplayedTile Tile = ReplayTile(Controller, Element.Key, [&Random, Base, Slope](int32 Quality)
+				{
+					return FMath::RoundToInt(Base * FMath::Exp(Slope * (Quality - 50)) * Random.FRandRange(0.97f, 1.03f));
+				});
+
+				FrameBytes += Tile.FinalBytes;
+				MostRetries = FMath::Max(MostRetries, Tile.Retries);
+				LowestQuality = FMath::Min(LowestQuality, Tile.LowestQuality);
+				HighestQuality = FMath::Max(HighestQuality, Tile.HighestQuality);
+			}
+
+			//The frame of the cut is encoded with the history of the old content, one frame later it has to fit again
+			if (Frame != 0 && Frame != SceneCutFrame)
+			{
+				const float Ratio = (float)FrameBytes / Controller->FrameByteBudget;
+				LowestFrameRatio = FMath::Min(LowestFrameRatio, Ratio);
+				HighestFrameRatio = FMath::Max(HighestFrameRatio, Ratio);
+			}
+		}
+
+		const FLumafuseRateControlStats Stats = Controller->GetStats();
+		const int32 TileCount = GridLayout.X * GridLayout.Y;
+		AddInfo(FString::Printf(TEXT("%i retries: frames use %.2f - %.2f of the budget, %i of %i tiles within budget, %i retry encodes"),
+			MaxRetryEncodes, LowestFrameRatio, HighestFrameRatio, Stats.TilesWithinBudget, Stats.TilesEncoded, Stats.RetryEncodes));
+
+		TestTrue(FString::Printf(TEXT("%i retries: no frame over budget plus tolerance"), MaxRetryEncodes), HighestFrameRatio <= 1.0f + Controller->OvershootTolerance);
+		TestTrue(FString::Printf(TEXT("%i retries: no frame wastes the budget"), MaxRetryEncodes), LowestFrameRatio >= 0.85f);
+		TestEqual(FString::Printf(TEXT("%i retries: every tile counted"), MaxRetryEncodes), Stats.TilesEncoded, (FrameCount - 1) * TileCount);
+		TestTrue(FString::Printf(TEXT("%i retries: tiles within budget"), MaxRetryEncodes), Stats.TilesWithinBudget >= Stats.TilesEncoded * 0.9f);
+		TestTrue(FString::Printf(TEXT("%i retries: average budget ratio"), MaxRetryEncodes), Stats.AverageBudgetRatio >= 0.9f && Stats.AverageBudgetRatio <= 1.1f);
+		TestTrue(FString::Printf(TEXT("%i retries: retry limit per tile"), MaxRetryEncodes), MostRetries <= MaxRetryEncodes);
+		TestTrue(FString::Printf(TEXT("%i retries: retry limit in the stats"), MaxRetryEncodes), Stats.RetryEncodes <= Stats.TilesEncoded * MaxRetryEncodes);
+		TestTrue(FString::Printf(TEXT("%i retries: quality within range"), MaxRetryEncodes), LowestQuality >= Controller->MinQuality && HighestQuality <= Controller->MaxQuality);
+	}
+	return true;
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLumafuseTileRateControllerRetryLimitTest, "Lumafuse.TileRateController.RetryLimit",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLumafuseTileRateControllerRetryLimitTest::RunTest(const FString& Parameters)
+{
+	const FIntPoint BlockPosition(0, 0);
+
+	//A tile that reacts much less to quality than the controller expects, so every corrected encode is still over budget
+	auto EncodedSize = [](int32 Quality)
+	{
+		return FMath::RoundToInt(5000.0f * FMath::Exp(0.01f * (Quality - 50)));
+	};
+
+	for (int32 MaxRetryEncodes = 0; MaxRetryEncodes <= 3; MaxRetryEncodes++)
+	{
+		ULumafuseTileRateController* Controller = NewObject<ULumafuseTileRateController>();
+		Controller->FrameByteBudget = 3000;
+		Controller->MaxRetryEncodes = MaxRetryEncodes;
+		Controller->SetGridLayout(FIntPoint(1, 1));
+
+		for (int32 Frame = 0; Frame < 6; Frame++)
+		{
+			const FReplayedTile Tile = ReplayTile(Controller, BlockPosition, EncodedSize);
+			const FString Prefix = FString::Printf(TEXT("%i retries, frame %i"), MaxRetryEncodes, Frame);
+
+			TestTrue(Prefix + TEXT(": retry limit"), Tile.Retries <= MaxRetryEncodes);
+			TestTrue(Prefix + TEXT(": quality never rises on a retry"), Tile.Retries == 0 || Tile.FinalQuality < Tile.HighestQuality);
+			TestTrue(Prefix + TEXT(": quality within range"), Tile.LowestQuality >= Controller->MinQuality && Tile.HighestQuality <= Controller->MaxQuality);
+
+			//Retries only end early once the quality has nothing left to give
+			if (Tile.Retries < MaxRetryEncodes)
+			{
+				TestEqual(Prefix + TEXT(": stopped at the minimum quality"), Tile.FinalQuality, Controller->MinQuality);
+			}
+			if (Frame == 0 && MaxRetryEncodes <= 2)
+			{
+				TestEqual(Prefix + TEXT(": every retry used"), Tile.Retries, MaxRetryEncodes);
+			}
+		}
+
+		//The budget is out of reach even at the minimum quality, so no tile counts as within budget
+		const FLumafuseRateControlStats Stats = Controller->GetStats();
+		TestEqual(FString::Printf(TEXT("%i retries: tiles counted"), MaxRetryEncodes), Stats.TilesEncoded, 6);
+		TestEqual(FString::Printf(TEXT("%i retries: nothing within budget"), MaxRetryEncodes), Stats.TilesWithinBudget, 0);
+		TestTrue(FString::Printf(TEXT("%i retries: retry limit in the stats"), MaxRetryEncodes), Stats.RetryEncodes <= 6 * MaxRetryEncodes);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,133 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "HAL/CriticalSection.h"
+#include "SocketServerPluginUDPServer.h"
+#include "LumafuseGridAutoTiler.generated.h"
+
+/**
+ * Picks the capture grid layout (2x2, 3x2, 4x2, 4x4, ...) at runtime instead of relying on a fixed
+ * E_CaptureClusterDensity. Each candidate layout is scored by the expected time to encode the tiles
+ * that are likely to be dirty on the available cores, plus the expected bytes that have to be resent
+ * when a packet of a tile gets lost. A new layout is only adopted after it has won several
+ * evaluations in a row by a clear margin so that decisions settle instead of flapping.
+ * ULumafuseBufferBlockWorker feeds encode times and sent blocks in from the render thread, so every
+ * function takes the tiler's lock.
+ */
+UCLASS(BlueprintType)
+class LUMAFUSEDESKTOP_API ULumafuseGridAutoTiler : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	ULumafuseGridAutoTiler();
+
+	// Layouts the tiler is allowed to choose from (columns, rows)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Auto Tiler")
+	TArray<FIntPoint> CandidateLayouts;
+
+	// Cores available for encoding tiles, 0 uses the number of physical cores
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Auto Tiler")
+	int32 EncoderCores = 0;
+
+	// Payload bytes carried by a single block packet (see ULumafuseBufferBlockWorker::SeparateAndSendBufferBlock)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Auto Tiler")
+	int32 PayloadBytesPerPacket = 4096 - 27;
+
+	// Milliseconds of cost charged per kilobyte that is expected to be resent after packet loss
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Auto Tiler")
+	float PacketLossCostPerKilobyte = 0.05f;
+
+	// Relative improvement a candidate needs over the current layout before it is considered
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Auto Tiler")
+	float HysteresisMargin = 0.15f;
+
+	// Consecutive evaluations the same candidate has to win before the layout is switched
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Auto Tiler")
+	int32 StableEvaluationsRequired = 3;
+
+	// Minimum time between two layout switches
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Auto Tiler")
+	float MinSecondsBetweenChanges = 2.0f;
+
+	// Weight of the newest sample in the exponential moving averages (0-1)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Auto Tiler")
+	float SmoothingFactor = 0.1f;
+
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Auto Tiler")
+	void Initialize(FIntPoint InFrameSize, FIntPoint InitialLayout);
+
+	// Feed back how long a tile took to compress and how big it turned out to be
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Auto Tiler")
+	void RecordTileEncode(FIntPoint TileSize, float EncodeMilliseconds, int32 CompressedBytes);
+
+	// Feed back receiver loss reports (NACKs, missing packet counts, ...)
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Auto Tiler")
+	void RecordPacketLoss(int32 PacketsSent, int32 PacketsLost);
+
+	// Marks a block of the given layout as changed in the current frame
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Auto Tiler")
+	void RecordChangedBlock(FIntPoint BlockCoordinate, FIntPoint BlockLayout);
+
+	// Closes the current frame and folds its change mask into the change history
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Auto Tiler")
+	void EndFrame();
+
+	// Scores all candidates and returns the layout that should be used for the next frame
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Auto Tiler")
+	FIntPoint EvaluateLayout(bool& bLayoutChanged);
+
+	UFUNCTION(BlueprintPure, Category = "Lumafuse|Auto Tiler")
+	FIntPoint GetCurrentLayout() const;
+
+	UFUNCTION(BlueprintPure, Category = "Lumafuse|Auto Tiler")
+	int32 GetLayoutSequence() const;
+
+	// Expected per-frame cost in milliseconds for a layout under the current measurements
+	UFUNCTION(BlueprintPure, Category = "Lumafuse|Auto Tiler")
+	float EstimateLayoutCost(FIntPoint Layout) const;
+
+	// Tells a receiver that the following frames use the current layout
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Networking|Display")
+	void SendLayoutChangeToClient(uint8 DisplayID, USocketServerBPLibrary* ServerTarget, FString ClientSessionID, FString OptionalServerID);
+
+	static TArray<uint8> BuildLayoutChangePacket(uint8 DisplayID, int32 Sequence, FIntPoint Layout);
+
+	// First byte of control packets. Block packets start with their DisplayID, so this DisplayID is reserved
+	static constexpr uint8 ControlPacketMarker = 0xFF;
+
+private:
+	// Resolution of the change history, every candidate layout is mapped onto this grid
+	static constexpr int32 HeatGridSize = 16;
+
+	int32 GetEncoderCores() const;
+	float GetTileEncodeMilliseconds(float TilePixels) const;
+	float GetDirtyProbability(FIntPoint Layout, int32 TileX, int32 TileY) const;
+
+	mutable FCriticalSection Lock;
+
+	FIntPoint FrameSize = FIntPoint(1920, 1080);
+	FIntPoint CurrentLayout = FIntPoint(2, 2);
+	int32 LayoutSequence = 0;
+
+	// Exponentially weighted least squares of encode milliseconds over tile pixels
+	double SumWeight = 0.0;
+	double SumPixels = 0.0;
+	double SumMilliseconds = 0.0;
+	double SumPixelsSquared = 0.0;
+	double SumPixelsMilliseconds = 0.0;
+
+	static constexpr float DefaultBytesPerPixel = 0.3f;
+	float BytesPerPixel = DefaultBytesPerPixel;
+	float PacketLossRate = 0.0f;
+
+	TArray<float> ChangeHeat;
+	TArray<bool> ChangedThisFrame;
+
+	FIntPoint PendingLayout = FIntPoint::ZeroValue;
+	int32 PendingWins = 0;
+	double LastChangeSeconds = 0.0;
+};
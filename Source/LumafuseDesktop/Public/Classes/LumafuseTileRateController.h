@@ -0,0 +1,135 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "HAL/CriticalSection.h"
+#include "LumafuseTileRateController.generated.h"
+
+// Running numbers that describe how well the controller keeps tiles inside their budget
+USTRUCT(BlueprintType)
+struct FLumafuseRateControlStats
+{
+	GENERATED_BODY()
+
+	// Tiles encoded since the last reset
+	UPROPERTY(BlueprintReadOnly, Category = "Lumafuse|Rate Control")
+	int32 TilesEncoded = 0;
+
+	// Tiles whose final size stayed within budget plus tolerance
+	UPROPERTY(BlueprintReadOnly, Category = "Lumafuse|Rate Control")
+	int32 TilesWithinBudget = 0;
+
+	// Extra encodes that were needed because the prediction missed
+	UPROPERTY(BlueprintReadOnly, Category = "Lumafuse|Rate Control")
+	int32 RetryEncodes = 0;
+
+	// Average of final tile size / tile budget
+	UPROPERTY(BlueprintReadOnly, Category = "Lumafuse|Rate Control")
+	float AverageBudgetRatio = 0.0f;
+
+	// Average time spent encoding one tile, retries included
+	UPROPERTY(BlueprintReadOnly, Category = "Lumafuse|Rate Control")
+	float AverageEncodeMilliseconds = 0.0f;
+
+	// Average time spent on retry encodes per tile
+	UPROPERTY(BlueprintReadOnly, Category = "Lumafuse|Rate Control")
+	float AverageRetryMilliseconds = 0.0f;
+};
+
+/**
+ * Per-tile JPEG quality controller. Every tile keeps the size and quality of its previous encode
+ * plus an estimate of how strongly its size reacts to quality (compressed size is close to
+ * exponential in quality, so the model is ln(Size) = a + Slope * Quality). The frame byte budget is
+ * split between tiles by their complexity so text-heavy tiles get more bytes than flat ones, and the
+ * quality for each tile is predicted from its last encode. The controller is safe to use from the
+ * render thread while the game thread changes the budget.
+ */
+UCLASS(BlueprintType)
+class LUMAFUSEDESKTOP_API ULumafuseTileRateController : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	// Bytes that all tiles of one frame may use together
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Rate Control")
+	int32 FrameByteBudget = 256 * 1024;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Rate Control")
+	int32 MinQuality = 20;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Rate Control")
+	int32 MaxQuality = 95;
+
+	// Quality used for tiles that have never been encoded
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Rate Control")
+	int32 InitialQuality = 75;
+
+	// How far above budget a tile may end up before a retry encode is done (0.1 = 10%)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Rate Control")
+	float OvershootTolerance = 0.15f;
+
+	// Upper limit of extra encodes per tile, 0 disables retries
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Lumafuse|Rate Control")
+	int32 MaxRetryEncodes = 1;
+
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Rate Control")
+	void SetGridLayout(FIntPoint InGridLayout);
+
+	// Byte budget of a tile, derived from the frame budget and the complexity of all tiles
+	UFUNCTION(BlueprintPure, Category = "Lumafuse|Rate Control")
+	int32 GetTileBudget(FIntPoint BlockPosition) const;
+
+	// Quality that is expected to land the tile on its budget
+	UFUNCTION(BlueprintPure, Category = "Lumafuse|Rate Control")
+	int32 PredictQuality(FIntPoint BlockPosition) const;
+
+	// Quality for a retry after an encode at Quality produced EncodedBytes
+	int32 CorrectQuality(FIntPoint BlockPosition, int32 Quality, int32 EncodedBytes) const;
+
+	// True if a tile of EncodedBytes is far enough over budget to justify another encode
+	bool ShouldRetry(FIntPoint BlockPosition, int32 EncodedBytes, int32 RetriesDone) const;
+
+	// Feed back every encode of a tile, the last call for a tile is taken as its final size
+	void RecordEncode(FIntPoint BlockPosition, int32 Quality, int32 EncodedBytes);
+
+	// Feed back the outcome once a tile is done, TileBudget is the budget the tile was encoded against
+	void RecordTileFinished(int32 TileBudget, int32 FinalBytes, int32 Retries, float EncodeMilliseconds, float RetryMilliseconds);
+
+	UFUNCTION(BlueprintPure, Category = "Lumafuse|Rate Control")
+	FLumafuseRateControlStats GetStats() const;
+
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse|Rate Control")
+	void ResetStats();
+
+private:
+	struct FTileRateState
+	{
+		int32 LastQuality = 0;
+		int32 LastBytes = 0;
+
+		// d ln(Size) / d Quality, a typical JPEG doubles in size every ~25 quality steps
+		float Slope = 0.028f;
+
+		// Tile size at the reference quality, used to split the frame budget
+		float Complexity = 1.0f;
+	};
+
+	// Quality that all complexity values are normalized to
+	static constexpr int32 ReferenceQuality = 50;
+
+	int32 GetTileBudgetLocked(FIntPoint BlockPosition) const;
+	int32 QualityForBytes(const FTileRateState& State, float TargetBytes) const;
+
+	FIntPoint GridLayout = FIntPoint(1, 1);
+	TMap<FIntPoint, FTileRateState> Tiles;
+	float TotalComplexity = 0.0f;
+
+	FLumafuseRateControlStats Stats;
+	double SumBudgetRatio = 0.0;
+	double SumEncodeMilliseconds = 0.0;
+	double SumRetryMilliseconds = 0.0;
+
+	mutable FCriticalSection StateSection;
+};
@@ -13,6 +13,8 @@
 #include "LowEntryExtendedStandardLibrary/Public/Classes/LowEntryExtendedStandardLibrary.h"
 #include "LowEntryCompression/Public/Classes/LowEntryCompressionLibrary.h"
 #include "Engine/TextureRenderTarget2D.h"
+#include "Classes/LumafuseTileRateController.h"
+#include "Classes/LumafuseGridAutoTiler.h"
 #include "LumafuseBufferBlockWorker.generated.h"
 
 /**
@@ -28,11 +30,20 @@ class LUMAFUSEDESKTOP_API ULumafuseBufferBlockWorker : public UMultiThreadTask
 	UFUNCTION(BlueprintCallable, Category = "Lumafuse | Multithreading | Rendering")
 	void GetPixelBufferBlockFromRenderTargetThreadSafe(UTextureRenderTarget2D* TextureRenderTarget, FIntPoint BlockPosition, FIntPoint GridLayout, UPARAM(ref)TArray<uint8>& Buffer, int32 CompressionQuality);
 
+	// Enqueues the render command that copies one block of the render target and reads it back. Encode runs on the render thread and fills Buffer
+	void ReadBlockAndEncode(UTextureRenderTarget2D* TextureRenderTarget, FIntPoint BlockPosition, FIntPoint GridLayout, TArray<uint8>& Buffer, TFunction<void(TArray<FColor>& SurfaceData, FIntPoint BlockSize)> Encode);
+
 	UFUNCTION(BlueprintCallable, Category = "Lumafuse | Multithreading | Rendering")
 	void GetPixelBufferFromRenderTargetThreadSafe(UTextureRenderTarget2D* TextureRenderTarget,UPARAM(ref)TArray<uint8>& Buffer, int32 CompressionQuality);
 	
 	void CompressPixelsToBuffer(TArray<FColor>& SurfaceData, TArray<uint8>& Buffer, int32 SizeX, int32 SizeY, int32 CompressionQuality);
 
+	// Same as GetPixelBufferBlockFromRenderTargetThreadSafe, but the JPEG quality of the block is picked by the rate controller
+	UFUNCTION(BlueprintCallable, Category = "Lumafuse | Multithreading | Rendering")
+	void GetPixelBufferBlockFromRenderTargetRateControlled(UTextureRenderTarget2D* TextureRenderTarget, FIntPoint BlockPosition, FIntPoint GridLayout, UPARAM(ref)TArray<uint8>& Buffer, ULumafuseTileRateController* RateController);
+
+	void CompressPixelsToBufferRateControlled(TArray<FColor>& SurfaceData, TArray<uint8>& Buffer, int32 SizeX, int32 SizeY, FIntPoint BlockPosition, ULumafuseTileRateController* RateController);
+
 	UFUNCTION(BlueprintCallable, Category = "Lumafuse | Networking | Display")
 	void SeparateAndSendBufferBlock(uint8 DisplayID, uint8 FrameID, FIntPoint BlockLayout, FIntPoint BlockCoordinate, const TArray<uint8>& BufferBlock, USocketServerBPLibrary* ServerTarget, FString ClientSessionID
 											, FString OptionalServerID);
@@ -42,4 +53,9 @@ class LUMAFUSEDESKTOP_API ULumafuseBufferBlockWorker : public UMultiThreadTask
 	{
 		FlushRenderingCommands(bFlushDeferredDeletes);
 	}
+
+public:
+	// Optional. Gets the encode time and size of every captured block and every block that is sent, so it can pick the next grid layout
+	UPROPERTY(BlueprintReadWrite, Category = "Lumafuse | Multithreading | Rendering")
+	ULumafuseGridAutoTiler* AutoTiler = nullptr;
 };